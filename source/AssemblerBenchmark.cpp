@@ -0,0 +1,215 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+
+#include "AssemblerBenchmark.h"
+#include "MachineCodeAssembler.h"
+
+namespace AssemblerBenchmark
+{
+
+// Encodings the string based front end made, one line for each opcode, data type, condition, address mode and LOAD.
+struct Golden
+{
+    const char* Line;
+    uint32_t Bytes;
+};
+
+static const Golden sGolden[] =
+{
+    {"CMP U8,R0,R0,0x000",0x00000002},
+    {"RET U16,&R1,R7,0x053",0x05327884},
+    {"SWAP U32,$R2,R14,0x0a6",0x0a64e906},
+    {"PAUSE U64,R3,&R5,0x0f9",0x0f975188},
+    {"SETINT S8,&R4,&R12,0x14c",0x14c9ca0a},
+    {"CLRINT S16,$R5,&R3,0x19f",0x19fb3a8c},
+    {"MOVE S32,R6,R10,0x1f2",0x1f2ca30e},
+    {"MEMSET S64,&R7,R1,0x245",0x245e1b90},
+    {"MEMCPY U8,$R8,R8,0x298",0x29808c12},
+    {"POP U16,R9,&R15,0x2eb",0x2eb3f494},
+    {"PUSH U32,&R10,&R6,0x33e",0x33e56d16},
+    {"SPSET U64,$R11,&R13,0x391",0x3917dd98},
+    {"SPGET S8,R12,R4,0x3e4",0x3e48461a},
+    {"SSET S16,&R13,R11,0x437",0x437abe9c},
+    {"SGET S32,$R14,R2,0x48a",0x48ac2f1e},
+    {"OR S64,R15,&R9,0x4dd",0x4ddf97a0},
+    {"XOR U8,&R0,&R0,0x530",0x53010822},
+    {"AND U16,$R1,&R7,0x583",0x583378a4},
+    {"NOT U32,R2,R14,0x5d6",0x5d64e126},
+    {"SETBIT U64,&R3,R5,0x629",0x629659a8},
+    {"CLRBIT S8,$R4,R12,0x67c",0x67c8ca2a},
+    {"LSL S16,R5,&R3,0x6cf",0x6cfb32ac},
+    {"LSR S32,&R6,&R10,0x722",0x722dab2e},
+    {"ASR S64,$R7,&R1,0x775",0x775f1bb0},
+    {"ADD U8,R8,R8,0x7c8",0x7c808432},
+    {"SUB U16,&R9,R15,0x81b",0x81b2fcb4},
+    {"MUL U32,$R10,R6,0x86e",0x86e46d36},
+    {"DIV U64,R11,&R13,0x8c1",0x8c17d5b8},
+    {"DIVR S8,&R12,&R4,0x914",0x91494e3a},
+    {"RAND S16,$R13,&R11,0x967",0x967bbebc},
+    {"LERP S32,R14,R2,0x9ba",0x9bac273e},
+    {"MAX S64,&R15,R9,0xa0d",0xa0de9fc0},
+    {"MIN U8,$R0,R0,0xa60",0xa6000842},
+    {"FADD DOUBLE,R1,&R7,0xab3",0xab3370c4},
+    {"FSUB FLOAT,&R2,&R14,0xb06",0xb061e946},
+    {"FMUL DOUBLE,$R3,&R5,0xb59",0xb59359c8},
+    {"FDIV FLOAT,R4,R12,0xbac",0xbac0c24a},
+    {"FRAC DOUBLE,&R5,R3,0xbff",0xbff23acc},
+    {"FRAND FLOAT,$R6,R10,0xc52",0xc520ab4e},
+    {"FLERP DOUBLE,R7,&R1,0xca5",0xca5313d0},
+    {"FMAX FLOAT,&R8,&R8,0xcf8",0xcf818c52},
+    {"FMIN DOUBLE,$R9,&R15,0xd4b",0xd4b3fcd4},
+    {"FSQRT FLOAT,R10,R6,0xd9e",0xd9e06556},
+    {"FSIN DOUBLE,&R11,R13,0xdf1",0xdf12ddd8},
+    {"FCOS FLOAT,$R12,R4,0xe44",0xe4404e5a},
+    {"FTAN DOUBLE,R13,&R11,0xe97",0xe973b6dc},
+    {"FATAN FLOAT,&R14,&R2,0xeea",0xeea12f5e},
+    {"JUMP FALSE,0,R0,0xfffc",0xfffc0000},
+    {"JUMP TRUE,1,R15,0xeeeb",0xeeebf880},
+    {"JUMP NEQ,0,R15,0xddda",0xdddaf100},
+    {"JUMP POS,1,R3,0xccc9",0xccc93980},
+    {"JUMP NZ,0,R15,0xbbb8",0xbbb8f200},
+    {"JUMP EQ,1,R15,0xaaa7",0xaaa7fa80},
+    {"JUMP NE,0,R6,0x9996",0x99966300},
+    {"JUMP LT,1,R15,0x8885",0x8885fb80},
+    {"JUMP GT,0,R15,0x7774",0x7774f400},
+    {"JUMP LE,1,R9,0x6663",0x66639c80},
+    {"JUMP GE,0,R15,0x5552",0x5552f500},
+    {"LOAD 0,0,R1,0x000010",0x00001011},
+    {"LOAD 1,1,R7,0xabcdef",0xabcdef77},
+    {"LOAD 1,2,R14,0xffffff",0xffffffeb},
+};
+
+std::string MakeSource(size_t a_Lines,uint32_t a_Seed)
+{
+    static const char* const opCodes[] = {"MOVE","ADD","SUB","CMP","AND","OR","XOR","NOT","LSL","LSR","ASR","MUL","DIV","MEMSET","MEMCPY","FADD","FSIN","SWAP"};
+    static const char* const types[] = {"U8","U16","U32","U64","S8","S16","S32","S64","FLOAT","DOUBLE"};
+    static const char* const conditions[] = {"FALSE","TRUE","NEQ","POS","NZ","EQ","NE","LT","GT","LE","GE"};
+    static const char* const prefixes[] = {"","&","$"};
+
+    std::mt19937 random(a_Seed);
+    std::stringstream source;
+    source << std::hex << std::setfill('0');
+    for( size_t n = 0 ; n < a_Lines ; n++ )
+    {
+        const uint32_t kind = random() % 8;
+        if( kind == 0 )
+        {
+            source << "LOAD " << (random() % 2) << "," << (random() % 3) << ",R" << std::dec << (random() % 15) << std::hex << ",0x" << std::setw(6) << (random() & 0xffffff);
+        }
+        else if( kind == 1 )
+        {
+            source << "JUMP " << conditions[random() % 11] << "," << (random() % 2) << ",R15,0x" << std::setw(4) << (random() & 0xffff);
+        }
+        else
+        {
+            source << opCodes[random() % 18] << " " << types[random() % 10] << ","
+                   << prefixes[random() % 3] << "R" << std::dec << (random() % 16) << ","
+                   << prefixes[random() % 2] << "R" << (random() % 16) << std::hex << ",0x" << std::setw(4) << (random() & 0xfff);
+        }
+
+        if( random() % 4 == 0 )
+        {
+            source << "        // A comment about what this does.";
+        }
+        source << "\n";
+    }
+    return source.str();
+}
+
+template <typename ASSEMBLE> static Result Time(const std::string& a_Source,uint32_t a_Runs,ASSEMBLE a_Assemble)
+{
+    Result result;
+    result.Lines = std::count(a_Source.begin(),a_Source.end(),'\n');
+    for( uint32_t run = 0 ; run < a_Runs ; run++ )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        a_Assemble();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if( run == 0 || seconds < result.Seconds )
+        {
+            result.Seconds = seconds;
+        }
+    }
+    result.LinesPerSecond = result.Seconds > 0.0 ? result.Lines / result.Seconds : 0.0;
+    return result;
+}
+
+Result Measure(const std::string& a_Source,uint32_t a_Threads,uint32_t a_Runs)
+{
+    MachineCodeAssembler assembler;
+    return Time(a_Source,a_Runs,[&](){assembler.Compile(a_Source,nullptr,a_Threads);});
+}
+
+bool CheckEncodings(std::ostream& a_Report)
+{
+    MachineCodeAssembler assembler;
+    bool same = true;
+    for( const auto& golden : sGolden )
+    {
+        Instruction ins;
+        ins.Bytes = 0;
+        try
+        {
+            ins = assembler.MakeInstruction(golden.Line);
+        }
+        catch(const std::exception& e)
+        {
+            a_Report << golden.Line << " : " << e.what() << std::endl;
+            same = false;
+            continue;
+        }
+
+        if( ins.Bytes != golden.Bytes )
+        {
+            a_Report << std::hex << std::setfill('0') << golden.Line << " made 0x" << std::setw(8) << ins.Bytes << " expected 0x" << std::setw(8) << golden.Bytes << std::dec << std::setfill(' ') << std::endl;
+            same = false;
+        }
+    }
+
+    // FNV-1a of the bytes, the same on one thread and on all of them.
+    const std::string source = MakeSource(GOLDEN_LINES);
+    for( const uint32_t threads : {1u,std::max(1u,std::thread::hardware_concurrency())} )
+    {
+        const std::vector<Instruction> code = assembler.Compile(source,nullptr,threads);
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(code.data());
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for( size_t n = 0 ; n < code.size() * sizeof(Instruction) ; n++ )
+        {
+            hash = (hash ^ bytes[n]) * 0x100000001b3ull;
+        }
+
+        if( code.size() != GOLDEN_LINES || hash != GOLDEN_HASH )
+        {
+            a_Report << "The code of " << GOLDEN_LINES << " generated lines on " << threads << " threads is not the recorded code" << std::endl;
+            same = false;
+        }
+    }
+    return same;
+}
+
+bool Report(size_t a_Lines,std::ostream& a_Report)
+{
+    const std::string source = MakeSource(a_Lines);
+    const uint32_t threads = std::max(1u,std::thread::hardware_concurrency());
+    const bool same = CheckEncodings(a_Report);
+
+    const Result current = Measure(source);
+    const Result all = Measure(source,threads);
+
+    a_Report << "Assembler benchmark, " << a_Lines << " lines" << std::endl;
+    a_Report << std::setfill(' ') << std::fixed << std::setprecision(0);
+    a_Report << std::setw(12) << "Baseline" << std::setw(16) << BASELINE_LINES_PER_SECOND << " lines/s, the string based front end on " << BASELINE_MACHINE << std::endl;
+    a_Report << std::setw(12) << "Current" << std::setw(16) << current.LinesPerSecond << " lines/s" << std::endl;
+    a_Report << std::setprecision(2) << "Speed up " << current.LinesPerSecond / BASELINE_LINES_PER_SECOND << "x, only meaningful on the same machine" << std::endl;
+    a_Report << std::setprecision(0) << std::setw(12) << (std::to_string(threads) + " threads") << std::setw(16) << all.LinesPerSecond << " lines/s" << std::endl;
+    a_Report << std::setprecision(2) << "Speed up " << (current.LinesPerSecond > 0.0 ? all.LinesPerSecond / current.LinesPerSecond : 0.0) << "x over one thread" << std::endl;
+    a_Report << (same ? "The code matches the recorded encodings" : "The code is different!") << std::endl;
+    return same;
+}
+
+}// namespace AssemblerBenchmark
@@ -0,0 +1,53 @@
+#ifndef __ASSEMBLER_BENCHMARK_H__
+#define __ASSEMBLER_BENCHMARK_H__
+
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+/**
+ * @brief Measures how many lines a second the assembler gets through, against what the string based front end it
+ * replaced managed, and checks it still makes the code that front end made from encodings recorded from it.
+ */
+namespace AssemblerBenchmark
+{
+    // The string based front end on MakeSource(200000), best of five runs of one thread. The speed up against it only
+    // means something on the same kind of machine.
+    const double BASELINE_LINES_PER_SECOND = 446000.0;
+    const char* const BASELINE_MACHINE = "a 1 vCPU Xeon VM, g++ -O2";
+
+    // FNV-1a of the code the string based front end made from MakeSource(GOLDEN_LINES).
+    const size_t GOLDEN_LINES = 20000;
+    const uint64_t GOLDEN_HASH = 0x1ffbf893eaba1d4dull;
+
+    struct Result
+    {
+        uint64_t Lines = 0;
+        double Seconds = 0.0;
+        double LinesPerSecond = 0.0;
+    };
+
+    /**
+     * @brief Makes a_Lines lines of source using every instruction format, data type, condition and address mode.
+     */
+    std::string MakeSource(size_t a_Lines,uint32_t a_Seed = 1);
+
+    /**
+     * @brief Assembles the source with the assembler on a_Threads threads, without a listing. Takes the best of a_Runs.
+     */
+    Result Measure(const std::string& a_Source,uint32_t a_Threads = 1,uint32_t a_Runs = 3);
+
+    /**
+     * @brief Checks the recorded encodings, a line for each opcode, data type, condition and address mode, then the
+     * code of MakeSource(GOLDEN_LINES) on one thread and on all of them. What does not match is written to a_Report.
+     */
+    bool CheckEncodings(std::ostream& a_Report);
+
+    /**
+     * @brief Checks the encodings then measures a_Lines of generated source against the baseline, on one thread and
+     * then every core. Returns false if the code was not the recorded code.
+     */
+    bool Report(size_t a_Lines,std::ostream& a_Report);
+}
+
+#endif //__ASSEMBLER_BENCHMARK_H__
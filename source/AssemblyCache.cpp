@@ -0,0 +1,403 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+#include "AssemblyCache.h"
+
+static const uint64_t FNV_BASIS = 0xcbf29ce484222325ull;
+static const uint64_t FNV_PRIME = 0x100000001b3ull;
+
+// Eight bytes at a time, used for the whole source and for each line of it so it has to be quick.
+static uint64_t HashBytes(std::string_view a_Bytes)
+{
+    uint64_t hash = FNV_BASIS;
+    size_t n = 0;
+    for( ; n + 8 <= a_Bytes.size() ; n += 8 )
+    {
+        uint64_t word;
+        memcpy(&word,a_Bytes.data() + n,sizeof(word));
+        hash = (hash ^ word) * FNV_PRIME;
+        hash ^= hash >> 32;
+    }
+    for( ; n < a_Bytes.size() ; n++ )
+    {
+        hash = (hash ^ static_cast<uint8_t>(a_Bytes[n])) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// The statement upper cased, runs of white space as one space and none next to a comma. Keywords, registers and hex
+// do not care about case so lines that only differ in those ways make the same instruction.
+static uint64_t HashStatement(std::string_view a_Statement)
+{
+    uint64_t hash = FNV_BASIS;
+    bool space = false;
+    bool comma = false;
+    for( const char c : a_Statement )
+    {
+        if( c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' )
+        {
+            space = true;
+            continue;
+        }
+
+        if( space && !comma && c != ',' )
+        {
+            hash = (hash ^ ' ') * FNV_PRIME;
+        }
+        space = false;
+        comma = c == ',';
+        hash = (hash ^ static_cast<uint8_t>(c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c)) * FNV_PRIME;
+    }
+    return hash;
+}
+
+AssemblyCache::AssemblyCache():
+    mHeader{}
+{
+
+}
+
+AssemblyCache::~AssemblyCache()
+{
+
+}
+
+bool AssemblyCache::Load(const std::string& a_Filename)
+{
+    mHeader = CacheHeader{};
+    mCode.clear();
+    mRegions.clear();
+    mLines.clear();
+    mLabels.clear();
+    mNames.clear();
+    mTablesFile.clear();
+
+    std::ifstream in(a_Filename,std::ios::binary|std::ios::ate);
+    const uint64_t fileSize = in ? static_cast<uint64_t>(in.tellg()) : 0;
+    CacheHeader header = {};
+    if( !in || !in.seekg(0) || !in.read(reinterpret_cast<char*>(&header),sizeof(header)) ||
+        header.Magic != MAGIC || header.Version != VERSION || header.HeaderSize != sizeof(CacheHeader) )
+    {
+        return false;
+    }
+
+    // Each count on its own first so the sum can not overflow.
+    if( header.CodeCount > fileSize / sizeof(Instruction) || header.RegionCount > fileSize / sizeof(CacheRegion) ||
+        header.LineCount > fileSize / sizeof(CacheLine) || header.LabelCount > fileSize / sizeof(CacheLabel) ||
+        header.NameSize > fileSize ||
+        sizeof(CacheHeader) + (header.CodeCount * sizeof(Instruction)) + (header.RegionCount * sizeof(CacheRegion)) +
+            (header.LineCount * sizeof(CacheLine)) + (header.LabelCount * sizeof(CacheLabel)) + header.NameSize != fileSize )
+    {
+        return false;
+    }
+
+    std::vector<Instruction> code(header.CodeCount);
+    if( !in.read(reinterpret_cast<char*>(code.data()),code.size() * sizeof(Instruction)) )
+    {
+        return false;
+    }
+
+    mHeader = header;
+    mCode = std::move(code);
+    mTablesFile = a_Filename;
+    mTablesOffset = sizeof(CacheHeader) + (header.CodeCount * sizeof(Instruction));
+    return true;
+}
+
+void AssemblyCache::LoadTables()
+{
+    const std::string filename = mTablesFile;
+    mTablesFile.clear();
+
+    std::ifstream in(filename,std::ios::binary);
+    std::vector<CacheRegion> regions(mHeader.RegionCount);
+    std::vector<CacheLine> lines(mHeader.LineCount);
+    std::vector<CacheLabel> labels(mHeader.LabelCount);
+    std::string names(mHeader.NameSize,'\0');
+    if( !in.seekg(mTablesOffset) ||
+        !in.read(reinterpret_cast<char*>(regions.data()),regions.size() * sizeof(CacheRegion)) ||
+        !in.read(reinterpret_cast<char*>(lines.data()),lines.size() * sizeof(CacheLine)) ||
+        !in.read(reinterpret_cast<char*>(labels.data()),labels.size() * sizeof(CacheLabel)) ||
+        !in.read(&names[0],names.size()) )
+    {
+        // Changed under us, nothing can be trusted but it can all be assembled again.
+        mCode.clear();
+        mHeader = CacheHeader{};
+        return;
+    }
+
+    // Labels with names outside the names are dropped with their region, as are regions outside the code.
+    for( auto& label : labels )
+    {
+        if( label.Name > names.size() || label.NameSize > names.size() - label.Name )
+        {
+            label.NameSize = ~0u;
+        }
+    }
+
+    mRegions.reserve(regions.size());
+    for( const auto& region : regions )
+    {
+        if( region.Offset <= mCode.size() && region.Count <= mCode.size() - region.Offset &&
+            region.FirstLabel <= labels.size() && region.Labels <= labels.size() - region.FirstLabel &&
+            std::none_of(labels.begin() + region.FirstLabel,labels.begin() + region.FirstLabel + region.Labels,[](const CacheLabel& a_Label){return a_Label.NameSize == ~0u;}) )
+        {
+            mRegions[region.Hash] = {region.Offset,region.Count,region.FirstLabel,region.Labels,region.Scratch};
+        }
+    }
+    mLabels.swap(labels);
+    mNames.swap(names);
+
+    mLines.reserve(lines.size());
+    for( const auto& line : lines )
+    {
+        mLines[line.Hash] = line.Code;
+    }
+}
+
+void AssemblyCache::Save(const std::string& a_Filename)
+{
+    // Saving over the file the tables have not been read from yet.
+    if( mTablesFile.size() )
+    {
+        LoadTables();
+    }
+
+    CacheHeader header = mHeader;
+    header.Magic = MAGIC;
+    header.Version = VERSION;
+    header.HeaderSize = sizeof(CacheHeader);
+    header.CodeCount = mCode.size();
+    header.RegionCount = mRegions.size();
+    header.LineCount = mLines.size();
+    header.LabelCount = mLabels.size();
+    header.NameSize = mNames.size();
+
+    std::vector<CacheRegion> regions;
+    regions.reserve(mRegions.size());
+    for( const auto& region : mRegions )
+    {
+        regions.push_back({region.first,region.second.Offset,region.second.Count,region.second.FirstLabel,region.second.Labels,region.second.Scratch});
+    }
+
+    std::vector<CacheLine> lines;
+    lines.reserve(mLines.size());
+    for( const auto& line : mLines )
+    {
+        lines.push_back({line.first,line.second,0});
+    }
+
+    std::ofstream out(a_Filename,std::ios::binary|std::ios::trunc);
+    if( !out )
+    {
+        throw std::runtime_error("Failed to create assembly cache " + a_Filename);
+    }
+
+    out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    out.write(reinterpret_cast<const char*>(mCode.data()),mCode.size() * sizeof(Instruction));
+    out.write(reinterpret_cast<const char*>(regions.data()),regions.size() * sizeof(CacheRegion));
+    out.write(reinterpret_cast<const char*>(lines.data()),lines.size() * sizeof(CacheLine));
+    out.write(reinterpret_cast<const char*>(mLabels.data()),mLabels.size() * sizeof(CacheLabel));
+    out.write(mNames.data(),mNames.size());
+    if( !out )
+    {
+        throw std::runtime_error("Failed to write assembly cache " + a_Filename);
+    }
+}
+
+uint64_t AssemblyCache::KeepLabels(const MachineCodeAssembler::LabelTable& a_Labels,std::vector<CacheLabel>& r_Labels,std::string& r_Names)
+{
+    const uint64_t first = r_Labels.size();
+    for( const auto& definition : a_Labels.Definitions )
+    {
+        r_Labels.push_back({definition.Code,definition.Line,r_Names.size(),static_cast<uint32_t>(definition.Name.size()),0,Instruction{0},0});
+        r_Names += definition.Name;
+    }
+    for( const auto& branch : a_Labels.Branches )
+    {
+        r_Labels.push_back({branch.Code,branch.Line,r_Names.size(),static_cast<uint32_t>(branch.Label.size()),1,branch.Jump,branch.Scratch});
+        r_Names += branch.Label;
+    }
+    return first;
+}
+
+std::vector<Instruction> AssemblyCache::Compile(const MachineCodeAssembler& a_Assembler,std::string_view a_Source,std::vector<ProgramImage::Symbol>* r_Symbols)
+{
+    mStats = Stats();
+    if( r_Symbols )
+    {
+        r_Symbols->clear();
+    }
+
+    const uint64_t sourceHash = HashBytes(a_Source);
+    if( mHeader.Magic == MAGIC && mHeader.Errors == 0 && mHeader.LabelCount == 0 && mHeader.SourceHash == sourceHash && mHeader.SourceSize == a_Source.size() )
+    {
+        mStats.SourceReused = true;
+        return mCode;
+    }
+
+    if( mTablesFile.size() )
+    {
+        LoadTables();
+    }
+
+    std::vector<Instruction> code;
+    code.reserve(mCode.size());
+    std::unordered_map<uint64_t,Span> regions;
+    std::unordered_map<uint64_t,Instruction> lines;
+    std::vector<CacheLabel> labels;
+    std::string names;
+    MachineCodeAssembler::LabelTable sourceLabels;
+    std::vector<MachineCodeAssembler::LineError> errors;
+
+    std::string_view source = a_Source;
+    uint64_t rolling = 0;
+    while( source.size() )
+    {
+        // Find where the region ends, hashing it as it goes. The cut is on the top bits of a hash that each line shifts
+        // up by one, so it depends on the last 64 lines and not only the last one, sources have a lot of lines the same.
+        uint64_t regionHash = FNV_BASIS;
+        uint32_t regionLines = 0;
+        size_t regionSize = 0;
+        while( regionSize < source.size() )
+        {
+            const size_t end = source.find('\n',regionSize);
+            const size_t next = end == std::string_view::npos ? source.size() : end + 1;
+            const uint64_t lineHash = HashBytes(source.substr(regionSize,next - regionSize));
+            regionHash = (regionHash ^ lineHash) * FNV_PRIME;
+            rolling = (rolling << 1) + lineHash;
+            regionLines++;
+            regionSize = next;
+            if( (rolling >> (64 - REGION_BITS)) == 0 || regionLines == REGION_MAX_LINES )
+            {
+                break;
+            }
+        }
+
+        const std::string_view region = source.substr(0,regionSize);
+        source.remove_prefix(regionSize);
+        const uint64_t firstLine = mStats.Lines;
+
+        const auto found = mRegions.find(regionHash);
+        if( found != mRegions.end() )
+        {
+            const Span& span = found->second;
+            uint64_t firstLabel = labels.size();
+            if( span.Labels || span.Scratch != MachineCodeAssembler::LabelTable::SCRATCH_BEFORE )
+            {
+                MachineCodeAssembler::LabelTable regionLabels;
+                regionLabels.Scratch = span.Scratch;
+                for( uint64_t n = span.FirstLabel ; n < span.FirstLabel + span.Labels ; n++ )
+                {
+                    const CacheLabel& label = mLabels[n];
+                    std::string name = mNames.substr(label.Name,label.NameSize);
+                    if( label.IsBranch )
+                    {
+                        regionLabels.Branches.push_back({std::move(name),label.Code,label.Line,label.Jump,label.Scratch});
+                    }
+                    else
+                    {
+                        regionLabels.Definitions.push_back({std::move(name),label.Code,label.Line});
+                    }
+                }
+                sourceLabels.Append(regionLabels,code.size(),firstLine);
+                firstLabel = KeepLabels(regionLabels,labels,names);
+            }
+
+            regions.emplace(regionHash,Span{code.size(),span.Count,firstLabel,span.Labels,span.Scratch});
+            code.insert(code.end(),mCode.begin() + span.Offset,mCode.begin() + span.Offset + span.Count);
+            mStats.Lines += regionLines;
+            mStats.RegionsReused++;
+            continue;
+        }
+
+        // New, line by line. Lines with a label or a JUMP to one are always parsed, they add to the labels.
+        const uint64_t offset = code.size();
+        MachineCodeAssembler::LabelTable regionLabels;
+        bool clean = true;
+        std::string_view rest = region;
+        while( rest.size() )
+        {
+            const size_t end = rest.find('\n');
+            const std::string_view line = rest.substr(0,end);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+            mStats.Lines++;
+
+            const std::string_view statement = MachineCodeAssembler::GetStatement(line);
+            if( statement.size() == 0 )
+            {
+                continue;
+            }
+
+            const uint64_t statementHash = HashStatement(statement);
+            const auto seen = lines.find(statementHash);
+            if( seen != lines.end() )
+            {
+                code.push_back(seen->second);
+                continue;
+            }
+
+            const auto kept = mLines.find(statementHash);
+            if( kept != mLines.end() )
+            {
+                code.push_back(kept->second);
+                lines.emplace(statementHash,kept->second);
+                continue;
+            }
+
+            try
+            {
+                const size_t labelsBefore = regionLabels.Definitions.size() + regionLabels.Branches.size();
+                Instruction ins;
+                const bool made = a_Assembler.AssembleStatement(statement,code.size() - offset,mStats.Lines - firstLine,regionLabels,ins);
+                mStats.LinesParsed++;
+                if( made )
+                {
+                    code.push_back(ins);
+                    if( regionLabels.Definitions.size() + regionLabels.Branches.size() == labelsBefore )
+                    {
+                        lines.emplace(statementHash,ins);
+                    }
+                }
+            }
+            catch(const std::exception& e)
+            {
+                errors.push_back({mStats.Lines,std::string(e.what()) + " : " + std::string(line)});
+                clean = false;
+            }
+        }
+
+        sourceLabels.Append(regionLabels,offset,firstLine);
+        if( clean )
+        {
+            const uint64_t firstLabel = KeepLabels(regionLabels,labels,names);
+            regions.emplace(regionHash,Span{offset,code.size() - offset,firstLabel,static_cast<uint32_t>(labels.size() - firstLabel),regionLabels.Scratch});
+        }
+        mStats.RegionsAssembled++;
+    }
+
+    mHeader.Magic = MAGIC;
+    mHeader.SourceHash = sourceHash;
+    mHeader.SourceSize = a_Source.size();
+    mHeader.LabelCount = labels.size();
+    mCode = code;
+    mRegions.swap(regions);
+    mLines.swap(lines);
+    mLabels.swap(labels);
+    mNames.swap(names);
+
+    // The JUMPs to labels go in now all the regions are known, their errors with the rest in line order.
+    const size_t lineErrors = errors.size();
+    a_Assembler.Link(code,sourceLabels,errors,r_Symbols);
+    mHeader.Errors = errors.size();
+    mStats.Errors = errors.size();
+    std::inplace_merge(errors.begin(),errors.begin() + lineErrors,errors.end(),[](const MachineCodeAssembler::LineError& a_Left,const MachineCodeAssembler::LineError& a_Right){return a_Left.Line < a_Right.Line;});
+    for( const auto& error : errors )
+    {
+        std::cerr << error.Line << ": " << error.Message << std::endl;
+    }
+    return code;
+}
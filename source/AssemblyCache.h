@@ -0,0 +1,159 @@
+#ifndef __ASSEMBLY_CACHE_H__
+#define __ASSEMBLY_CACHE_H__
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+#include "MachineCodeAssembler.h"
+
+/**
+ * @brief Keeps what the last assembly of a source made, on disk, so the next one only assembles the lines that were edited.
+ *
+ * Three levels, each tried before the next:-
+ *   The whole source. If its hash and size are the same as last time and it had no errors the code is handed back as it was.
+ *   Regions. The source is cut into runs of lines where a rolling hash of the lines before has its top REGION_BITS bits
+ *   zero, or after REGION_MAX_LINES. Where the cuts fall only depends on the 64 lines before them so an edit only changes
+ *   the regions it is in, after that the cuts are in the same places as before. A region seen last time is copied from
+ *   last time's code.
+ *   Lines. In a region that is new each line is looked up by the hash of its statement, the line without the comment and
+ *   with the case and white space made the same, and only lines not seen before are parsed.
+ * Lines with errors are never kept, regions with them are assembled each time so the errors are reported again.
+ *
+ * The code kept is from before the JUMPs to labels are put in. Each region also keeps the labels and the JUMPs to them
+ * it has, which are put together for the whole source and linked after, as where a JUMP goes depends on the regions
+ * before. A region with none of either is only copied. Lines with a label or a JUMP to one are not kept on their own
+ * and are parsed each time their region is new. A source with labels is never handed back whole.
+ *
+ * Only the regions and lines of the last source are saved so the cache does not grow as the source is edited. The
+ * tables are read from the file when the whole source has changed, an unchanged source only reads the code.
+ *
+ * The hashes are 64bit FNV-1a, a collision would give the wrong code. For a million different lines the odds of one
+ * are about one in thirty million.
+ *
+ * File layout, all little endian, only for loading into the same build:-
+ *   CacheHeader
+ *   Instruction[CodeCount], the code of the last source.
+ *   CacheRegion[RegionCount]
+ *   CacheLine[LineCount]
+ *   CacheLabel[LabelCount]
+ *   char[NameSize], the names of the labels.
+ */
+class AssemblyCache
+{
+public:
+    static const uint32_t MAGIC = 0x4341434d; // "MCAC"
+    static const uint16_t VERSION = 3;
+    static const uint32_t REGION_BITS = 6;          // Regions of about 64 lines.
+    static const uint32_t REGION_MAX_LINES = 1024;
+
+    struct CacheHeader
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t HeaderSize;
+        uint64_t SourceHash;
+        uint64_t SourceSize;
+        uint64_t Errors;            // Lines of the source that did not assemble.
+        uint64_t CodeCount;
+        uint64_t RegionCount;
+        uint64_t LineCount;
+        uint64_t LabelCount;
+        uint64_t NameSize;
+    };
+
+    struct CacheRegion
+    {
+        uint64_t Hash;
+        uint64_t Offset;            // Where its code starts in the code of the last source.
+        uint64_t Count;
+        uint64_t FirstLabel;        // Its labels and JUMPs to them in the CacheLabels, the labels first.
+        uint32_t Labels;
+        uint32_t Scratch;           // Of its last .scratch, LabelTable::SCRATCH_BEFORE for none.
+    };
+
+    struct CacheLine
+    {
+        uint64_t Hash;
+        Instruction Code;
+        uint32_t Unused;
+    };
+
+    // A label, or a JUMP to one, of a region. Code and line are from the start of the region.
+    struct CacheLabel
+    {
+        uint64_t Code;
+        uint64_t Line;
+        uint64_t Name;              // Offset of the name in the names.
+        uint32_t NameSize;
+        uint32_t IsBranch;
+        Instruction Jump;           // For a JUMP, its placeholder and scratch register.
+        uint32_t Scratch;
+    };
+
+    struct Stats
+    {
+        uint64_t Lines = 0;
+        uint64_t LinesParsed = 0;
+        uint64_t RegionsReused = 0;
+        uint64_t RegionsAssembled = 0;
+        uint64_t Errors = 0;        // Lines reported to std::cerr.
+        bool SourceReused = false;
+    };
+
+    AssemblyCache();
+    ~AssemblyCache();
+
+    /**
+     * @brief Loads a cache written by Save. If there is no file, or it is not a cache of this version, the cache is left
+     * empty and false returned, the next Compile assembles everything.
+     */
+    bool Load(const std::string& a_Filename);
+
+    /**
+     * @brief Throws if the file can not be written.
+     */
+    void Save(const std::string& a_Filename);
+
+    /**
+     * @brief The same code as a_Assembler.Compile(a_Source) would make, errors reported to std::cerr the same way.
+     * What is kept is replaced by what this source made. r_Symbols, if not null, gets the labels as Compile does.
+     */
+    std::vector<Instruction> Compile(const MachineCodeAssembler& a_Assembler,std::string_view a_Source,std::vector<ProgramImage::Symbol>* r_Symbols = nullptr);
+
+    const Stats& GetStats()const{return mStats;}
+
+private:
+    struct Span
+    {
+        uint64_t Offset;
+        uint64_t Count;
+        uint64_t FirstLabel;
+        uint32_t Labels;
+        uint32_t Scratch;
+    };
+
+    CacheHeader mHeader;
+    std::vector<Instruction> mCode;
+    std::unordered_map<uint64_t,Span> mRegions;
+    std::unordered_map<uint64_t,Instruction> mLines;
+    std::vector<CacheLabel> mLabels;
+    std::string mNames;
+
+    // Where the tables are in the file Load read, they are only read if they are needed.
+    std::string mTablesFile;
+    uint64_t mTablesOffset = 0;
+
+    Stats mStats;
+
+    void LoadTables();
+
+    /**
+     * @brief Keeps the labels of a region in r_Labels and r_Names, returns where they start.
+     */
+    static uint64_t KeepLabels(const MachineCodeAssembler::LabelTable& a_Labels,std::vector<CacheLabel>& r_Labels,std::string& r_Names);
+};
+
+#endif //__ASSEMBLY_CACHE_H__
@@ -0,0 +1,414 @@
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <iomanip>
+#include <thread>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "BenchmarkSuite.h"
+#include "MachineCodeAssembler.h"
+#include "ProgramImage.h"
+#include "AssemblerBenchmark.h"
+#include "Encoder.h"
+#include "MathKernels.h"
+#include "WideCPU.h"
+
+namespace BenchmarkSuite
+{
+
+struct Program
+{
+    const char* Name;
+    const char* Source;
+};
+
+// Every loop counts R0 down from 2^48 so none of them end inside any sensible number of cycles.
+static const Program sPrograms[] =
+{
+    {"integer",
+        "LOAD 0,0,R0,0x000000         // Loop counter, 2^48\n"
+        "LOAD 1,2,R0,0x000001\n"
+        "LOAD 0,0,R1,0x012345\n"
+        "LOAD 0,0,R2,0x6789AB\n"
+        "ADD  U64,R1,R2,0x0000        // Loop starts here.\n"
+        "XOR  U64,R2,R3,0x0000\n"
+        "MUL  U64,R15,R3,0x0005\n"
+        "ADD  U32,R15,R1,0x0003\n"
+        "OR   U64,R3,R4,0x0000\n"
+        "AND  U64,R2,R4,0x0000\n"
+        "SUB  S64,R15,R0,0x0001\n"
+        "JUMP NZ,1,R15,0xfff9         // Back 7 to the first ADD.\n"
+    },
+    {"memcpy",
+        "LOAD 0,0,R0,0x000000         // Loop counter, 2^48\n"
+        "LOAD 1,2,R0,0x000001\n"
+        "LOAD 0,0,R5,0x010000         // Source buffer\n"
+        "LOAD 0,0,R6,0x020000         // Dest buffer\n"
+        "MEMSET U64,R0,&R5,0x0200     // Fill the source, one 4KiB page.\n"
+        "MEMCPY U64,&R5,&R6,0x0200    // Loop starts here, copy the page.\n"
+        "MOVE S64,&R6,R1,0x0100       // Read some of it back.\n"
+        "ADD  S64,R15,R1,0x0001\n"
+        "MOVE S64,R1,&R5,0x0100       // And change the source.\n"
+        "MEMCPY U32,&R6,&R5,0x0040    // Copy part of it back.\n"
+        "SUB  S64,R15,R0,0x0001\n"
+        "JUMP NZ,1,R15,0xfffa         // Back 6 to the first MEMCPY.\n"
+    },
+    {"float",
+        "LOAD 0,0,R0,0x000000         // Loop counter, 2^48\n"
+        "LOAD 1,2,R0,0x000001\n"
+        "LOAD 0,2,R1,0x003FF0         // R1 = 1.0\n"
+        "FSIN DOUBLE,R1,R2,0x0000     // Loop starts here.\n"
+        "FCOS DOUBLE,R2,R3,0x0000\n"
+        "FSQRT DOUBLE,R3,R4,0x0000\n"
+        "FMUL DOUBLE,R3,R4,0x0000\n"
+        "FADD DOUBLE,R4,R5,0x0000     // Sum of the results.\n"
+        "MOVE U64,R4,R1,0x0000        // Next input, keeps it between 0 and 1.\n"
+        "SUB  S64,R15,R0,0x0001\n"
+        "JUMP NZ,1,R15,0xfff9         // Back 7 to FSIN.\n"
+    },
+    {"branchy",
+        "LOAD 0,0,R0,0x000000         // Loop counter, 2^48\n"
+        "LOAD 1,2,R0,0x000001\n"
+        "LOAD 0,0,R1,0x9E3779         // xorshift64 state, never zero.\n"
+        "LSL  U64,R1,R2,0x000d        // Loop starts here. R1 ^= R1 << 13\n"
+        "XOR  U64,R2,R1,0x0000\n"
+        "LSR  U64,R1,R2,0x0007        // R1 ^= R1 >> 7\n"
+        "XOR  U64,R2,R1,0x0000\n"
+        "LSL  U64,R1,R2,0x0011        // R1 ^= R1 << 17\n"
+        "XOR  U64,R2,R1,0x0000\n"
+        "LSR  U64,R1,R2,0x003f        // Top bit, zero or one.\n"
+        "JUMP EQ,1,R15,0x0002\n"
+        "ADD  U64,R15,R3,0x0001\n"
+        "LSR  U64,R1,R2,0x0020        // Bit 32.\n"
+        "AND  U64,R15,R2,0x0001\n"
+        "JUMP NE,1,R15,0x0002\n"
+        "ADD  U64,R15,R4,0x0001\n"
+        "CMP  U32,R3,R4,0x0000        // Which count is ahead.\n"
+        "JUMP LT,1,R15,0x0002\n"
+        "ADD  U64,R15,R5,0x0001\n"
+        "SUB  S64,R15,R0,0x0001\n"
+        "JUMP NZ,1,R15,0xffef         // Back 17 to the first LSL.\n"
+    }
+};
+
+// The integer program again, built by the compiler with nothing to parse at startup. Checked against what the assembler
+// makes from the source so the two can not drift apart.
+static constexpr std::array<Instruction,12> sIntegerCode = Join(
+    std::array<Instruction,4>{
+        EncodeLoad(REG_0,0x000000),
+        EncodeLoad(REG_0,0x000001,2,true),
+        EncodeLoad(REG_1,0x012345),
+        EncodeLoad(REG_2,0x6789AB)},
+    std::array<Instruction,8>{
+        Encode<OP_ADD>(DataType_UNSIGNED_INT_64,REG_1,REG_2),
+        Encode<OP_XOR>(DataType_UNSIGNED_INT_64,REG_2,REG_3),
+        Encode<OP_MUL>(DataType_UNSIGNED_INT_64,REG_15,REG_3,0x0005),
+        Encode<OP_ADD>(DataType_UNSIGNED_INT_32,REG_15,REG_1,0x0003),
+        Encode<OP_OR>(DataType_UNSIGNED_INT_64,REG_3,REG_4),
+        Encode<OP_AND>(DataType_UNSIGNED_INT_64,REG_2,REG_4),
+        Encode<OP_SUB>(DataType_SIGNED_INT_64,REG_15,REG_0,0x0001),
+        EncodeJump(ConCode_NZ,true,REG_15,-7)});
+
+// The float functions FLOAT_PRECISION_FAST changes, each in a loop of its own. The input goes round [0,1) by x = frac(x * 7)
+// from 0.1, which is not a fraction of a power of two so it never settles.
+struct FloatFunction
+{
+    const char* OpCode;
+    MathKernels::Function Function;
+};
+
+static const FloatFunction sFloatFunctions[] =
+{
+    {"FSIN",MathKernels::FUNCTION_SIN},
+    {"FCOS",MathKernels::FUNCTION_COS},
+    {"FTAN",MathKernels::FUNCTION_TAN},
+    {"FATAN",MathKernels::FUNCTION_ATAN}
+};
+
+static std::string MakeFloatFunctionSource(const char* a_OpCode,bool a_Double)
+{
+    const std::string type = a_Double ? "DOUBLE" : "FLOAT";
+    std::string source =
+        "LOAD 0,0,R0,0x000000         // Loop counter, 2^48\n"
+        "LOAD 1,2,R0,0x000001\n";
+    source += a_Double ?
+        "LOAD 0,0,R1,0x99999A         // R1 = 0.1\n"
+        "LOAD 1,1,R1,0x999999\n"
+        "LOAD 1,2,R1,0x003FB9\n" :
+        "LOAD 0,0,R1,0xCCCCCD         // R1 = 0.1f\n"
+        "LOAD 1,1,R1,0x00003D\n";
+    source += std::string(a_OpCode) + " " + type + ",R1,R2,0x0000   // Loop starts here.\n";
+    source += "FADD " + type + ",R2,R3,0x0000     // Sum of the results.\n";
+    source += "FMUL " + type + ",R15,R1,0x0007\n";
+    source += "FRAC " + type + ",R1,R1,0x0000\n";
+    source +=
+        "SUB  S64,R15,R0,0x0001\n"
+        "JUMP NZ,1,R15,0xfffb         // Back 5 to the function.\n";
+    return source;
+}
+
+static std::string JSONString(const std::string& a_String)
+{
+    std::string quoted = "\"";
+    for( const char c : a_String )
+    {
+        if( c == '"' || c == '\\' )
+        {
+            quoted += '\\';
+        }
+        quoted += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+    }
+    return quoted + "\"";
+}
+
+static const char* GetBuildName()
+{
+#if defined(BENCHMARK_BUILD)
+    return "benchmark";
+#elif defined(RELEASE_BUILD)
+    return "release";
+#elif defined(DEBUG_BUILD)
+    return "debug";
+#else
+    return "unknown";
+#endif
+}
+
+template <typename FUNCTION> static double BestOf(uint32_t a_Runs,FUNCTION a_Function)
+{
+    double best = 0.0;
+    for( uint32_t run = 0 ; run < a_Runs ; run++ )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        a_Function();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if( run == 0 || seconds < best )
+        {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+static void SetRates(Timing& r_Timing)
+{
+    if( r_Timing.Instructions > 0 && r_Timing.Seconds > 0.0 )
+    {
+        r_Timing.Valid = true;
+        r_Timing.MIPS = r_Timing.Instructions / r_Timing.Seconds / 1000000.0;
+        r_Timing.NanosecondsPerInstruction = r_Timing.Seconds * 1000000000.0 / r_Timing.Instructions;
+    }
+}
+
+// Does the runs and hands back the CPU from the last one so the final state can be checked.
+static std::unique_ptr<MiniCPU> Execute(const GuestMemory& a_Memory,uint64_t a_Entry,uint64_t a_Cycles,bool a_UseJIT,uint32_t a_Runs,Timing& r_Timing,FloatPrecision a_Precision = FLOAT_PRECISION_EXACT)
+{
+    r_Timing = Timing();
+    std::unique_ptr<MiniCPU> cpu;
+    for( uint32_t run = 0 ; run < a_Runs ; run++ )
+    {
+        cpu.reset(new MiniCPU());
+        cpu->SetFloatPrecision(a_Precision);
+        cpu->LoadImage(a_Memory,a_Entry);
+        if( a_UseJIT )
+        {
+            try
+            {
+                cpu->EnableJIT(true);
+            }
+            catch(const std::exception&)
+            {
+                return nullptr;
+            }
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t instructions = cpu->Run(a_Cycles);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if( run == 0 || seconds < r_Timing.Seconds )
+        {
+            r_Timing.Instructions = instructions;
+            r_Timing.Seconds = seconds;
+        }
+    }
+
+    SetRates(r_Timing);
+    return cpu;
+}
+
+// The same on a WideCPU, the instructions counted are those of all the lanes.
+static void ExecuteWide(const GuestMemory& a_Memory,uint64_t a_Entry,uint64_t a_Cycles,uint32_t a_Runs,Timing& r_Timing,FloatPrecision a_Precision)
+{
+    r_Timing = Timing();
+    for( uint32_t run = 0 ; run < a_Runs ; run++ )
+    {
+        WideCPU wide(FLOAT_PRECISION_LANES);
+        wide.SetFloatPrecision(a_Precision);
+        wide.LoadImage(a_Memory,a_Entry);
+
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t instructions = wide.Run(a_Cycles);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if( run == 0 || seconds < r_Timing.Seconds )
+        {
+            r_Timing.Instructions = instructions;
+            r_Timing.Seconds = seconds;
+        }
+    }
+    SetRates(r_Timing);
+}
+
+Timing Measure(const std::string& a_Source,uint64_t a_Cycles,bool a_UseJIT,uint32_t a_Runs)
+{
+    const ProgramImage image = MachineCodeAssembler().CompileImage(a_Source);
+    GuestMemory memory;
+    image.LoadInto(memory);
+
+    Timing timing;
+    Execute(memory,image.GetEntry(),a_Cycles,a_UseJIT,a_Runs,timing);
+    return timing;
+}
+
+static void WriteTiming(std::ostream& a_JSON,const Timing& a_Timing)
+{
+    if( !a_Timing.Valid )
+    {
+        a_JSON << "null";
+        return;
+    }
+
+    a_JSON  << "{\"instructions\": " << a_Timing.Instructions
+            << ", \"seconds\": " << a_Timing.Seconds
+            << ", \"mips\": " << a_Timing.MIPS
+            << ", \"ns_per_instruction\": " << a_Timing.NanosecondsPerInstruction << "}";
+}
+
+bool Run(uint64_t a_Cycles,std::ostream& a_JSON)
+{
+    bool allMatch = true;
+    const std::ios::fmtflags oldFlags = a_JSON.flags();
+    const std::streamsize oldPrecision = a_JSON.precision();
+    a_JSON << std::fixed << std::setprecision(6);
+
+    a_JSON << "{" << std::endl;
+    a_JSON << "  \"build\": " << JSONString(GetBuildName()) << "," << std::endl;
+    a_JSON << "  \"compiler\": " << JSONString(__VERSION__) << "," << std::endl;
+    a_JSON << "  \"unix_time\": " << static_cast<uint64_t>(std::time(nullptr)) << "," << std::endl;
+    a_JSON << "  \"host_threads\": " << std::thread::hardware_concurrency() << "," << std::endl;
+    a_JSON << "  \"cycles\": " << a_Cycles << "," << std::endl;
+
+    a_JSON << "  \"programs\": [" << std::endl;
+    for( size_t n = 0 ; n < sizeof(sPrograms) / sizeof(sPrograms[0]) ; n++ )
+    {
+        const ProgramImage image = MachineCodeAssembler().CompileImage(sPrograms[n].Source);
+        GuestMemory memory;
+        image.LoadInto(memory);
+
+        Timing interpreter,jit;
+        const std::unique_ptr<MiniCPU> interpreted = Execute(memory,image.GetEntry(),a_Cycles,false,3,interpreter);
+        const std::unique_ptr<MiniCPU> compiled = Execute(memory,image.GetEntry(),a_Cycles,true,3,jit);
+
+        // The JIT has to get the same answer as the interpreter for its numbers to mean anything.
+        const bool match = !compiled || interpreted->CompareState(*compiled).empty();
+        allMatch = allMatch && match;
+
+        a_JSON << "    {\"name\": " << JSONString(sPrograms[n].Name) << "," << std::endl;
+        a_JSON << "     \"interpreter\": ";
+        WriteTiming(a_JSON,interpreter);
+        a_JSON << "," << std::endl << "     \"jit\": ";
+        WriteTiming(a_JSON,jit);
+        a_JSON << "," << std::endl << "     \"jit_matches_interpreter\": " << (match ? "true" : "false") << "}";
+        a_JSON << (n + 1 < sizeof(sPrograms) / sizeof(sPrograms[0]) ? "," : "") << std::endl;
+    }
+    a_JSON << "  ]," << std::endl;
+
+    // Exact libm against the fast kernels, on the interpreter as the JIT calls the same handlers for them, and on a
+    // WideCPU where only the fast ones are done for all the lanes at once.
+    a_JSON << "  \"float_precision\": [" << std::endl;
+    const size_t numberOfFunctions = sizeof(sFloatFunctions) / sizeof(sFloatFunctions[0]);
+    for( size_t n = 0 ; n < numberOfFunctions * 2 ; n++ )
+    {
+        const FloatFunction& function = sFloatFunctions[n / 2];
+        const bool isDouble = (n & 1) != 0;
+        const ProgramImage image = MachineCodeAssembler().CompileImage(MakeFloatFunctionSource(function.OpCode,isDouble));
+        GuestMemory memory;
+        image.LoadInto(memory);
+
+        const uint64_t cycles = a_Cycles / FLOAT_PRECISION_CYCLES_DIVISOR;
+        Timing exact,fast,wideExact,wideFast;
+        Execute(memory,image.GetEntry(),cycles,false,3,exact,FLOAT_PRECISION_EXACT);
+        Execute(memory,image.GetEntry(),cycles,false,3,fast,FLOAT_PRECISION_FAST);
+        ExecuteWide(memory,image.GetEntry(),cycles / FLOAT_PRECISION_LANES,3,wideExact,FLOAT_PRECISION_EXACT);
+        ExecuteWide(memory,image.GetEntry(),cycles / FLOAT_PRECISION_LANES,3,wideFast,FLOAT_PRECISION_FAST);
+        const double error = MathKernels::MeasureError(function.Function,isDouble,MathKernels::TRIG_LIMIT,FLOAT_PRECISION_SAMPLES);
+
+        a_JSON << "    {\"function\": " << JSONString(MathKernels::GetName(function.Function))
+               << ", \"type\": " << JSONString(isDouble ? "double" : "float") << "," << std::endl;
+        a_JSON << "     \"exact\": ";
+        WriteTiming(a_JSON,exact);
+        a_JSON << "," << std::endl << "     \"fast\": ";
+        WriteTiming(a_JSON,fast);
+        a_JSON << "," << std::endl << "     \"wide_exact\": ";
+        WriteTiming(a_JSON,wideExact);
+        a_JSON << "," << std::endl << "     \"wide_fast\": ";
+        WriteTiming(a_JSON,wideFast);
+        a_JSON << "," << std::endl << "     \"fast_speedup\": " << (fast.Valid && exact.Valid ? exact.Seconds / fast.Seconds : 0.0)
+               << ", \"wide_fast_speedup\": " << (wideFast.Valid && wideExact.Valid ? wideExact.Seconds / wideFast.Seconds : 0.0)
+               << ", \"fast_max_ulp\": " << error << "}";
+        a_JSON << (n + 1 < numberOfFunctions * 2 ? "," : "") << std::endl;
+    }
+    a_JSON << "  ]," << std::endl;
+
+    const std::string source = AssemblerBenchmark::MakeSource(STARTUP_LINES);
+    const uint32_t threads = std::max(1u,std::thread::hardware_concurrency());
+    const AssemblerBenchmark::Result single = AssemblerBenchmark::Measure(source,1);
+    const AssemblerBenchmark::Result parallel = AssemblerBenchmark::Measure(source,threads);
+    a_JSON << "  \"assembler\": {\"lines\": " << single.Lines
+           << ", \"lines_per_second\": " << single.LinesPerSecond
+           << ", \"threads\": " << threads
+           << ", \"parallel_lines_per_second\": " << parallel.LinesPerSecond << "}," << std::endl;
+
+    // Startup is from having the program, as source or an image file, to a CPU ready to run it.
+    const double fromSource = BestOf(3,[&]()
+    {
+        const ProgramImage image = MachineCodeAssembler().CompileImage(source);
+        GuestMemory memory;
+        image.LoadInto(memory);
+        std::unique_ptr<MiniCPU> cpu(new MiniCPU());
+        cpu->LoadImage(memory,image.GetEntry());
+    });
+
+    const std::string imageFilename = (std::filesystem::temp_directory_path() / ("MiniCPU_benchmark_" + std::to_string(getpid()) + ".img")).string();
+    MachineCodeAssembler().CompileImage(source).Save(imageFilename);
+    const double fromImage = BestOf(3,[&]()
+    {
+        ProgramImage image;
+        image.Load(imageFilename);
+        GuestMemory memory;
+        image.LoadInto(memory);
+        std::unique_ptr<MiniCPU> cpu(new MiniCPU());
+        cpu->LoadImage(memory,image.GetEntry());
+    });
+    std::filesystem::remove(imageFilename);
+
+    const std::vector<Instruction> assembled = MachineCodeAssembler().Compile(sPrograms[0].Source);
+    const bool embeddedMatch = assembled.size() == sIntegerCode.size() &&
+            memcmp(assembled.data(),sIntegerCode.data(),sizeof(sIntegerCode)) == 0;
+
+    a_JSON << "  \"startup\": {\"lines\": " << STARTUP_LINES
+           << ", \"source_us\": " << (fromSource * 1000000.0)
+           << ", \"image_us\": " << (fromImage * 1000000.0) << "}," << std::endl;
+    a_JSON << "  \"embedded_matches_assembler\": " << (embeddedMatch ? "true" : "false") << "," << std::endl;
+    a_JSON << "  \"jit_matches_interpreter\": " << (allMatch ? "true" : "false") << std::endl;
+    a_JSON << "}" << std::endl;
+
+    a_JSON.flags(oldFlags);
+    a_JSON.precision(oldPrecision);
+    return allMatch && embeddedMatch;
+}
+
+}// namespace BenchmarkSuite
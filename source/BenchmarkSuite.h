@@ -0,0 +1,54 @@
+#ifndef __BENCHMARK_SUITE_H__
+#define __BENCHMARK_SUITE_H__
+
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+/**
+ * @brief A fixed set of guest programs, each a loop that never ends, run for the same number of cycles on the
+ * interpreter and the JIT. Along with the assembler speed and how long a large program takes to be ready to run.
+ * The results are written as JSON so builds can be compared and regressions caught.
+ *
+ * Programs:-
+ *   integer    Integer math, like hello_world.asm but in a loop.
+ *   memcpy     Page sized MEMCPY between two buffers and scalar loads and stores.
+ *   float      FSIN, FCOS, FSQRT and FADD on doubles.
+ *   branchy    A xorshift random number generator with branches on its bits, half of them go each way.
+ *
+ * Then FSIN, FCOS, FTAN and FATAN on FLOAT and DOUBLE, each timed in a loop of its own with FLOAT_PRECISION_EXACT and
+ * FLOAT_PRECISION_FAST, on the interpreter and on a WideCPU of FLOAT_PRECISION_LANES lanes, with the worst error of the
+ * fast kernel in ULP from MathKernels::MeasureError.
+ */
+namespace BenchmarkSuite
+{
+    static const uint64_t DEFAULT_CYCLES = 50000000;
+    static const size_t STARTUP_LINES = 100000;
+    static const uint64_t FLOAT_PRECISION_CYCLES_DIVISOR = 10;   // There are eight of them, each run both ways.
+    static const uint64_t FLOAT_PRECISION_SAMPLES = 1000000;    // The MathKernels table used 30 million, a minute of its own.
+    static const uint32_t FLOAT_PRECISION_LANES = 8;
+
+    struct Timing
+    {
+        bool Valid = false;
+        uint64_t Instructions = 0;
+        double Seconds = 0.0;
+        double MIPS = 0.0;
+        double NanosecondsPerInstruction = 0.0;
+    };
+
+    /**
+     * @brief Runs a_Source for a_Cycles, best of a_Runs, on a fresh CPU each time. Timing is not valid if the JIT is
+     * asked for and this host does not have one.
+     */
+    Timing Measure(const std::string& a_Source,uint64_t a_Cycles,bool a_UseJIT,uint32_t a_Runs = 3);
+
+    /**
+     * @brief Runs the whole suite and writes the results to a_JSON.
+     * Returns false if the JIT and the interpreter did not finish any program in the same state, or the built in copy
+     * of the integer program is not what the assembler makes.
+     */
+    bool Run(uint64_t a_Cycles,std::ostream& a_JSON);
+}
+
+#endif //__BENCHMARK_SUITE_H__
@@ -0,0 +1,282 @@
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <cstring>
+
+#include "CpuPool.h"
+
+CpuPool::CpuPool(uint32_t a_Threads):
+    mThreads(a_Threads ? a_Threads : std::max(1u,std::thread::hardware_concurrency())),
+    mUnfinished(0),
+    mSteals(0),
+    mSleepingCount(0),
+    mPauses(0),
+    mStart(std::chrono::steady_clock::now())
+{
+    for( uint32_t n = 0 ; n < mThreads ; n++ )
+    {
+        mQueues.emplace_back(new WorkQueue());
+    }
+}
+
+CpuPool::~CpuPool()
+{
+
+}
+
+size_t CpuPool::Add(const std::vector<Instruction>& a_Program,uint64_t a_Cycles)
+{
+    Instance instance;
+    instance.CPU.reset(new MiniCPU());
+    instance.CPU->SetRandomSeed(Random::DEFAULT_SEED,mInstances.size());
+    instance.CPU->SetParkOnPause(true);
+    instance.CPU->LoadImage(GetImage(a_Program));
+    instance.Remaining = a_Cycles;
+    mInstances.push_back(std::move(instance));
+    return mInstances.size() - 1;
+}
+
+CpuPool::Result CpuPool::Run(uint64_t a_SliceCycles)
+{
+    if( a_SliceCycles == 0 )
+    {
+        throw std::runtime_error("CpuPool time slice must be at least one cycle");
+    }
+
+    // Deal the instances out to the threads, after that it's up to the stealing to balance things.
+    size_t unfinished = 0;
+    for( size_t n = 0 ; n < mInstances.size() ; n++ )
+    {
+        if( mInstances[n].Remaining > 0 && mInstances[n].Error.empty() )
+        {
+            mQueues[unfinished % mThreads]->Instances.push_back(n);
+            unfinished++;
+        }
+    }
+    mUnfinished = unfinished;
+    mSteals = 0;
+    mPauses = 0;
+
+    std::vector<uint64_t> instructions(mThreads,0);
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for( uint32_t n = 1 ; n < mThreads ; n++ )
+    {
+        threads.emplace_back(&CpuPool::Worker,this,n,a_SliceCycles,std::ref(instructions[n]));
+    }
+    Worker(0,a_SliceCycles,instructions[0]);
+
+    for( auto& t : threads )
+    {
+        t.join();
+    }
+
+    Result result;
+    result.Threads = mThreads;
+    result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for( auto i : instructions )
+    {
+        result.Instructions += i;
+    }
+    result.InstructionsPerSecond = result.Seconds > 0.0 ? result.Instructions / result.Seconds : 0.0;
+    result.Steals = mSteals;
+    result.Pauses = mPauses;
+
+    if( mInstances.size() )
+    {
+        size_t pages = 0;
+        size_t code = 0;
+        for( const auto& instance : mInstances )
+        {
+            pages += instance.CPU->GetMemory().GetPrivatePageCount();
+            code += instance.CPU->GetCodeCacheSize();
+        }
+        result.PrivateKiBPerInstance = (pages * MiniCPU::PAGE_SIZE) / (1024.0 * mInstances.size());
+        result.CodeKiBPerInstance = code / (1024.0 * mInstances.size());
+    }
+    return result;
+}
+
+void CpuPool::Worker(uint32_t a_Index,uint64_t a_SliceCycles,uint64_t& r_Instructions)
+{
+    uint64_t instructions = 0;
+    while( mUnfinished > 0 )
+    {
+        Wake(a_Index);
+
+        size_t index;
+        if( !Pop(a_Index,index) && !Steal(a_Index,index) )
+        {// Nothing to do, the last few instances are still running on other threads or are all paused.
+            if( mSleepingCount > 0 )
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(mSleeping.GetTickMicroseconds()));
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+            continue;
+        }
+
+        Instance& instance = mInstances[index];
+        const uint64_t before = instance.CPU->GetCycleCount();
+        try
+        {
+            instance.CPU->Run(std::min(a_SliceCycles,instance.Remaining));
+        }
+        catch(const std::exception& e)
+        {
+            instance.Error = e.what();
+        }
+
+        const uint64_t executed = instance.CPU->GetCycleCount() - before;
+        instance.Remaining -= std::min(executed,instance.Remaining);
+        instructions += executed;
+
+        if( instance.Remaining > 0 && instance.Error.empty() )
+        {
+            if( instance.CPU->IsParked() )
+            {
+                Park(index,instance.CPU->GetParkedMicroseconds());
+            }
+            else
+            {
+                Push(a_Index,index);
+            }
+        }
+        else
+        {
+            mUnfinished--;
+        }
+    }
+    r_Instructions = instructions;
+}
+
+// The owner works from the back, thieves take from the front.
+bool CpuPool::Pop(uint32_t a_Queue,size_t& r_Instance)
+{
+    WorkQueue& queue = *mQueues[a_Queue];
+    std::lock_guard<std::mutex> lock(queue.Lock);
+    if( queue.Instances.empty() )
+    {
+        return false;
+    }
+    r_Instance = queue.Instances.back();
+    queue.Instances.pop_back();
+    return true;
+}
+
+bool CpuPool::Steal(uint32_t a_Thief,size_t& r_Instance)
+{
+    for( uint32_t n = 1 ; n < mThreads ; n++ )
+    {
+        WorkQueue& queue = *mQueues[(a_Thief + n) % mThreads];
+        std::lock_guard<std::mutex> lock(queue.Lock);
+        if( queue.Instances.size() )
+        {
+            r_Instance = queue.Instances.front();
+            queue.Instances.pop_front();
+            mSteals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void CpuPool::Push(uint32_t a_Queue,size_t a_Instance)
+{
+    WorkQueue& queue = *mQueues[a_Queue];
+    std::lock_guard<std::mutex> lock(queue.Lock);
+    queue.Instances.push_front(a_Instance);
+}
+
+void CpuPool::Park(size_t a_Instance,uint64_t a_Microseconds)
+{
+    std::lock_guard<std::mutex> lock(mSleepingLock);
+    mSleeping.Add(a_Instance,GetMicroseconds() + a_Microseconds);
+    mSleepingCount++;
+    mPauses++;
+}
+
+void CpuPool::Wake(uint32_t a_Queue)
+{
+    if( mSleepingCount == 0 )
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mSleepingLock,std::try_to_lock);
+    if( !lock.owns_lock() )
+    {
+        return;
+    }
+
+    std::vector<size_t> awake;
+    mSleeping.Expire(GetMicroseconds(),awake);
+    mSleepingCount -= awake.size();
+    lock.unlock();
+
+    // The other threads steal them from here if this one has too many.
+    for( size_t index : awake )
+    {
+        Push(a_Queue,index);
+    }
+}
+
+uint64_t CpuPool::GetMicroseconds()const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mStart).count();
+}
+
+// Builds the memory for each different program once, the instances then share its pages.
+const GuestMemory& CpuPool::GetImage(const std::vector<Instruction>& a_Program)
+{
+    for( const auto& image : mImages )
+    {
+        if( image.Program.size() == a_Program.size() && memcmp(image.Program.data(),a_Program.data(),a_Program.size() * sizeof(Instruction)) == 0 )
+        {
+            return *image.Memory;
+        }
+    }
+
+    Image image;
+    image.Program = a_Program;
+    image.Memory.reset(new GuestMemory());
+    image.Memory->Write(0,a_Program.data(),a_Program.size() * sizeof(Instruction));
+    mImages.push_back(std::move(image));
+    return *mImages.back().Memory;
+}
+
+void CpuPool::ScalingReport(const std::vector<Instruction>& a_Program,size_t a_Instances,uint64_t a_Cycles,uint64_t a_SliceCycles,uint32_t a_MaxThreads,std::ostream& a_Report)
+{
+    a_Report << "CpuPool scaling, " << a_Instances << " instances of " << a_Cycles << " cycles, " << a_SliceCycles << " cycles per slice, "
+             << std::thread::hardware_concurrency() << " host threads" << std::endl;
+    a_Report << std::setfill(' ') << std::setw(8) << "Threads" << std::setw(16) << "MIPS" << std::setw(10) << "Speedup" << std::setw(10) << "Steals" << std::setw(10) << "Pauses" << std::setw(14) << "Private KiB" << std::setw(12) << "Code KiB" << std::endl;
+
+    double single = 0.0;
+    for( uint32_t threads = 1 ; threads <= a_MaxThreads ; threads *= 2 )
+    {
+        CpuPool pool(threads);
+        for( size_t n = 0 ; n < a_Instances ; n++ )
+        {
+            pool.Add(a_Program,a_Cycles);
+        }
+
+        const Result result = pool.Run(a_SliceCycles);
+        if( threads == 1 )
+        {
+            single = result.InstructionsPerSecond;
+        }
+
+        a_Report << std::setw(8) << threads
+                 << std::setw(16) << std::fixed << std::setprecision(1) << result.InstructionsPerSecond / 1000000.0
+                 << std::setw(10) << std::setprecision(2) << (single > 0.0 ? result.InstructionsPerSecond / single : 0.0)
+                 << std::setw(10) << result.Steals
+                 << std::setw(10) << result.Pauses
+                 << std::setw(14) << std::setprecision(1) << result.PrivateKiBPerInstance
+                 << std::setw(12) << result.CodeKiBPerInstance << std::endl;
+    }
+}
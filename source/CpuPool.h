@@ -0,0 +1,120 @@
+#ifndef __CPU_POOL_H__
+#define __CPU_POOL_H__
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <ostream>
+#include <chrono>
+
+#include "MiniCPU.h"
+#include "TimerWheel.h"
+
+/**
+ * @brief Runs lots of independent MiniCPU instances on a pool of threads, one per core by default.
+ * Each instance runs for a time slice of cycles and is then put back on the queue of the thread that ran it.
+ * Every thread has its own queue, when that is empty it steals from the others so all the cores stay busy
+ * even when some programs finish early or throw.
+ * PAUSE parks an instance rather than sleeping the thread, it goes into a timer wheel and whichever thread looks
+ * after its deadline puts it back on a queue. A thread with nothing to run and instances asleep sleeps for a tick,
+ * so thousands of mostly paused instances cost little more than the ones that are running.
+ */
+class CpuPool
+{
+public:
+    struct Result
+    {
+        uint32_t Threads = 0;
+        uint64_t Instructions = 0;
+        double Seconds = 0.0;
+        double InstructionsPerSecond = 0.0;
+        uint64_t Steals = 0;
+        uint64_t Pauses = 0;                 // Times an instance was parked by PAUSE.
+        double PrivateKiBPerInstance = 0.0;  // Guest memory pages each instance has written to, on average.
+        double CodeKiBPerInstance = 0.0;     // Decoded micro ops, on average.
+    };
+
+    /**
+     * @brief a_Threads of zero uses one per core.
+     */
+    CpuPool(uint32_t a_Threads = 0);
+    ~CpuPool();
+
+    /**
+     * @brief Adds an instance that will run the program for a_Cycles instructions. Returns its index.
+     * Instances of the same program share one copy of it, copy on write.
+     */
+    size_t Add(const std::vector<Instruction>& a_Program,uint64_t a_Cycles);
+
+    /**
+     * @brief Runs all the instances until they have used their cycles or stopped with an exception.
+     * Instances are run for a_SliceCycles at a time.
+     */
+    Result Run(uint64_t a_SliceCycles);
+
+    size_t GetSize()const{return mInstances.size();}
+    uint32_t GetThreads()const{return mThreads;}
+    const MiniCPU& GetCPU(size_t a_Index)const{return *mInstances[a_Index].CPU;}
+
+    /**
+     * @brief The exception that stopped the instance, empty if it ran all its cycles.
+     */
+    const std::string& GetError(size_t a_Index)const{return mInstances[a_Index].Error;}
+
+    /**
+     * @brief Runs a_Instances copies of the program with 1, 2, 4 ... a_MaxThreads threads and writes the throughput of each.
+     */
+    static void ScalingReport(const std::vector<Instruction>& a_Program,size_t a_Instances,uint64_t a_Cycles,uint64_t a_SliceCycles,uint32_t a_MaxThreads,std::ostream& a_Report);
+
+private:
+    struct Instance
+    {
+        std::unique_ptr<MiniCPU> CPU;
+        uint64_t Remaining;
+        std::string Error;
+    };
+
+    struct Image
+    {
+        std::vector<Instruction> Program;
+        std::unique_ptr<GuestMemory> Memory;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex Lock;
+        std::deque<size_t> Instances;
+    };
+
+    const uint32_t mThreads;
+    std::vector<Instance> mInstances;
+    std::vector<Image> mImages;
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+    std::atomic<size_t> mUnfinished;
+    std::atomic<uint64_t> mSteals;
+
+    TimerWheel mSleeping;                       // Parked instances, microseconds since mStart.
+    std::mutex mSleepingLock;
+    std::atomic<size_t> mSleepingCount;
+    std::atomic<uint64_t> mPauses;
+    std::chrono::steady_clock::time_point mStart;
+
+    void Worker(uint32_t a_Index,uint64_t a_SliceCycles,uint64_t& r_Instructions);
+    bool Pop(uint32_t a_Queue,size_t& r_Instance);
+    bool Steal(uint32_t a_Thief,size_t& r_Instance);
+    void Push(uint32_t a_Queue,size_t a_Instance);
+    void Park(size_t a_Instance,uint64_t a_Microseconds);
+
+    /**
+     * @brief Puts the instances whose PAUSE is over on the queue, unless another thread is already doing it.
+     */
+    void Wake(uint32_t a_Queue);
+    uint64_t GetMicroseconds()const;
+    const GuestMemory& GetImage(const std::vector<Instruction>& a_Program);
+};
+
+#endif //__CPU_POOL_H__
@@ -0,0 +1,145 @@
+#ifndef __ENCODER_H__
+#define __ENCODER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <stdexcept>
+
+#include "MiniCPU.h"
+
+/**
+ * @brief Builds instructions in C++, at compile time, without the assembler. The same encodings as
+ * MachineCodeAssembler::MakeInstruction so a program can be baked into the binary and loaded with no parsing.
+ *
+ *   static constexpr std::array<Instruction,3> sCode = Join(
+ *       std::array<Instruction,1>{EncodeLoad(REG_1,0x10)},
+ *       std::array<Instruction,2>{Encode<OP_ADD>(DataType_SIGNED_INT_32,REG_15,REG_1,1),
+ *                                 EncodeJump(ConCode_TRUE,1,REG_15,-1)});
+ *
+ * Registers take REG_IS_ADDRESS, AddressIn(REG_1), for the & of the assembler. Anything out of range throws, which in
+ * a constant expression is a compile error saying where.
+ * The fields are put together with shifts, the bitfields can not be used in a constant expression, so the layout here
+ * has to follow the structs in MiniCPU.h.
+ */
+
+constexpr uint32_t AddressIn(uint32_t a_Register)
+{
+    return a_Register | REG_IS_ADDRESS;
+}
+
+constexpr uint32_t EncodeRegister(uint32_t a_Register)
+{
+    if( (a_Register & ~static_cast<uint32_t>(REG_IS_ADDRESS)) >= NUMBER_REGISTERS )
+    {
+        throw std::runtime_error("Encode, register out of range");
+    }
+    return a_Register & 0x0f;
+}
+
+/**
+ * @brief LOAD, a_Constant shifted up by 24 bits a_Shift times and written or or'd into a_Dest.
+ */
+constexpr Instruction EncodeLoad(uint32_t a_Dest,uint32_t a_Constant,uint32_t a_Shift = 0,bool a_OrWithDest = false)
+{
+    if( a_Dest & REG_IS_ADDRESS )
+    {
+        throw std::runtime_error("Encode, the LOAD instruction can not use registers as an indirect address");
+    }
+    if( a_Constant > 0x00ffffff )
+    {
+        throw std::runtime_error("Encode, the constant data for LOAD is too large, only 24bit values allowed");
+    }
+    if( a_Shift > 2 )
+    {
+        throw std::runtime_error("Encode, the LOAD shift is 0 to 2");
+    }
+
+    return Instruction{1u
+        | (static_cast<uint32_t>(a_OrWithDest) << 1)
+        | (a_Shift << 2)
+        | (EncodeRegister(a_Dest) << 4)
+        | (a_Constant << 8)};
+}
+
+/**
+ * @brief JUMP, a_Offset is in instructions and for PC relative is from the JUMP itself.
+ */
+constexpr Instruction EncodeJump(uint32_t a_Condition,bool a_PCRelative,uint32_t a_OffsetRegister,int16_t a_Offset)
+{
+    if( a_OffsetRegister & REG_IS_ADDRESS )
+    {
+        throw std::runtime_error("Encode, the JUMP instruction can not use registers as an indirect address");
+    }
+    if( a_Condition > 0x0f )
+    {
+        throw std::runtime_error("Encode, JUMP condition out of range");
+    }
+
+    return Instruction{(static_cast<uint32_t>(OP_JUMP) << 1)
+        | (a_Condition << 7)
+        | (static_cast<uint32_t>(a_PCRelative) << 11)
+        | (EncodeRegister(a_OffsetRegister) << 12)
+        | (static_cast<uint32_t>(static_cast<uint16_t>(a_Offset)) << 16)};
+}
+
+/**
+ * @brief Every other instruction. The same four params as the assembler, registers that are not used can be left as
+ * REG_0 and a data type that is not used as DataType_IGNORE.
+ */
+template <uint32_t OPCODE> constexpr Instruction Encode(uint32_t a_DataType,uint32_t a_Source,uint32_t a_Dest,uint32_t a_Constant = 0)
+{
+    static_assert(OPCODE != OP_JUMP,"Use EncodeJump for JUMP");
+    static_assert(OPCODE < NUMBER_OPERATIONS,"Not an opcode");
+
+    if( a_DataType > 7 )
+    {
+        throw std::runtime_error("Encode, data type out of range");
+    }
+    if( a_Constant > 0x0fff )
+    {
+        throw std::runtime_error("Encode, constant data out of range, only 12bit values allowed");
+    }
+
+    return Instruction{(OPCODE << 1)
+        | (EncodeRegister(a_Source) << 7)
+        | ((a_Source & REG_IS_ADDRESS) ? (1u << 11) : 0u)
+        | (EncodeRegister(a_Dest) << 12)
+        | ((a_Dest & REG_IS_ADDRESS) ? (1u << 16) : 0u)
+        | (a_DataType << 17)
+        | (a_Constant << 20)};
+}
+
+/**
+ * @brief Any 64bit value into a register, the three LOADs the decoder fuses into one. The top sixteen bits are in the
+ * last LOAD.
+ */
+constexpr std::array<Instruction,3> EncodeLoad64(uint32_t a_Dest,uint64_t a_Value)
+{
+    return {EncodeLoad(a_Dest,static_cast<uint32_t>(a_Value & 0x00ffffff),0,false),
+            EncodeLoad(a_Dest,static_cast<uint32_t>((a_Value >> 24) & 0x00ffffff),1,true),
+            EncodeLoad(a_Dest,static_cast<uint32_t>(a_Value >> 48),2,true)};
+}
+
+/**
+ * @brief Puts arrays of instructions one after the other, so a program can be built from parts.
+ */
+template <size_t... SIZES> constexpr std::array<Instruction,(SIZES + ...)> Join(const std::array<Instruction,SIZES>&... a_Parts)
+{
+    std::array<Instruction,(SIZES + ...)> joined{};
+    size_t at = 0;
+    auto append = [&joined,&at](const auto& a_Part)
+    {
+        for( size_t n = 0 ; n < a_Part.size() ; n++ )
+        {
+            joined[at++] = a_Part[n];
+        }
+    };
+    (append(a_Parts),...);
+    return joined;
+}
+
+// All zeros has to be the NOP.
+static_assert(EncodeJump(ConCode_FALSE,false,REG_0,0).Bytes == 0,"The NOP must encode as zero");
+
+#endif //__ENCODER_H__
@@ -0,0 +1,1506 @@
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdlib>
+#include <cassert>
+
+#include "MiniCPU.h"
+#include "JIT.h"
+#include "Profiler.h"
+#include "MemoryKernels.h"
+#include "MathKernels.h"
+#include "Recording.h"
+#include "Multicore.h"
+
+/**
+ * @brief Reads a register as the type. Integers are just truncated, floats use the bits in the register.
+ */
+template <typename T> inline T GetRegisterValue(const Register& a_Reg)
+{
+    return static_cast<T>(a_Reg.u64);
+}
+
+template <> inline float GetRegisterValue<float>(const Register& a_Reg)
+{
+    return a_Reg.f32;
+}
+
+template <> inline double GetRegisterValue<double>(const Register& a_Reg)
+{
+    return a_Reg.f64;
+}
+
+/**
+ * @brief When writing to a register the value is sign / zero extended to the full 64 bits.
+ * A float clears the top 32 bits.
+ */
+template <typename T> inline void SetRegisterValue(Register& a_Reg,T a_Value)
+{
+    a_Reg.u64 = static_cast<uint64_t>(a_Value);
+}
+
+template <> inline void SetRegisterValue<float>(Register& a_Reg,float a_Value)
+{
+    a_Reg.u64 = 0;
+    a_Reg.f32 = a_Value;
+}
+
+template <> inline void SetRegisterValue<double>(Register& a_Reg,double a_Value)
+{
+    a_Reg.f64 = a_Value;
+}
+
+/**
+ * @brief All the instruction handlers and the decoder that picks them.
+ * Each handler is a template on the data type and on whether the source and dest are addresses,
+ * so all of that is resolved once when the instruction is decoded and not every time it is executed.
+ */
+struct ExecutionUnit
+{
+    static const uint32_t NUMBER_DATA_TYPES = 8;
+    static const uint32_t NUMBER_OPCODES = 64;
+    static const uint32_t NUMBER_CONDITIONS = 16;
+    static const uint32_t NUMBER_HANDLERS = NUMBER_OPCODES * NUMBER_DATA_TYPES * 4;
+
+    // Constant data is a 12 bit value, for LERP and FLERP 0xfff is 1.0
+    static constexpr double LERP_ONE = 4095.0;
+    static constexpr uint64_t RANDOM_BATCH = 256;   // Values made at a time by RAND and FRAND writing to memory.
+
+    // How an opcode uses the constant data and registers. Needed by the decoder.
+    enum OpCodeFlags
+    {
+        OPCODE_USES_OFFSET = 0,             // Constant is added to the operand addresses.
+        OPCODE_CONSTANT_IS_OPERAND = 1,     // Constant is a shift, count etc. &R15 is still the constant as an address.
+        OPCODE_REGISTERS_ARE_ADDRESSES = 2, // MEMSET and MEMCPY, the registers hold addresses even without the &.
+        OPCODE_FLOAT = 4                    // R15 reads as the constant converted to FLOAT or DOUBLE.
+    };
+
+    static MicroOpHandler sHandlers[NUMBER_HANDLERS];
+    static MicroOpHandler sFastHandlers[NUMBER_HANDLERS];   // Used over sHandlers for FLOAT_PRECISION_FAST where set.
+    static uint32_t sOpCodeFlags[NUMBER_OPCODES];
+    static MicroOpHandler sJumpTo[NUMBER_CONDITIONS];
+    static MicroOpHandler sJumpRelative[NUMBER_CONDITIONS];
+    static MicroOpHandler sJumpAbsolute[NUMBER_CONDITIONS];
+    static MicroOpHandler sMathJump[3][NUMBER_DATA_TYPES][NUMBER_CONDITIONS];   // ADD, SUB or CMP then JUMP.
+
+    // The base register for &R15 when the constant is an offset, so the address is just the constant.
+    static Register sZeroRegister;
+
+/******************************************************************************
+ * Operand helpers.
+ ******************************************************************************/
+    template <typename T,bool ADDRESS> static T ReadOperand(const MiniCPU& a_CPU,const Register* a_Reg,uint64_t a_Offset)
+    {
+        if( ADDRESS )
+        {
+            return a_CPU.ReadMemory<T>(a_Reg->u64 + a_Offset);
+        }
+        return GetRegisterValue<T>(*a_Reg);
+    }
+
+    template <typename T,bool ADDRESS> static void WriteOperand(MiniCPU& a_CPU,Register* a_Reg,uint64_t a_Offset,T a_Value)
+    {
+        if( ADDRESS )
+        {
+            a_CPU.WriteMemory<T>(a_Reg->u64 + a_Offset,a_Value);
+        }
+        else
+        {
+            SetRegisterValue<T>(*a_Reg,a_Value);
+        }
+    }
+
+    template <typename T,bool SA> static T ReadSource(const MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        return ReadOperand<T,SA>(a_CPU,a_Op.Source,a_Op.Offset);
+    }
+
+    template <typename T,bool DA> static T ReadDest(const MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        return ReadOperand<T,DA>(a_CPU,a_Op.Dest,a_Op.Offset);
+    }
+
+    template <typename T,bool SA> static void WriteSource(MiniCPU& a_CPU,const MicroOp& a_Op,T a_Value)
+    {
+        WriteOperand<T,SA>(a_CPU,a_Op.Source,a_Op.Offset,a_Value);
+    }
+
+    template <typename T,bool DA> static void WriteDest(MiniCPU& a_CPU,const MicroOp& a_Op,T a_Value)
+    {
+        WriteOperand<T,DA>(a_CPU,a_Op.Dest,a_Op.Offset,a_Value);
+    }
+
+/******************************************************************************
+ * Flags
+ ******************************************************************************/
+    template <typename T> static bool SignBit(T a_Value)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        return ((static_cast<U>(a_Value) >> (sizeof(T)*8-1)) & 1) != 0;
+    }
+
+    template <typename T> static constexpr uint32_t DataTypeOf()
+    {
+        return (sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3) | (std::is_signed<T>::value ? DataType_SIGNED_INT_8 : 0);
+    }
+
+    // Operations that set the flags only record what they did, see LazyFlags.
+    template <typename T> static void RecordFlags(MiniCPU& a_CPU,uint32_t a_Operation,T a_Result,T a_A = 0,T a_B = 0)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        a_CPU.mFlags.Result = static_cast<U>(a_Result);
+        a_CPU.mFlags.A = static_cast<U>(a_A);
+        a_CPU.mFlags.B = static_cast<U>(a_B);
+        a_CPU.mFlags.Operation = a_Operation;
+        a_CPU.mFlags.DataType = DataTypeOf<T>();
+    }
+
+    template <typename T> static T Add(MiniCPU& a_CPU,T a_A,T a_B)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const T result = static_cast<T>(static_cast<U>(a_A) + static_cast<U>(a_B));
+        RecordFlags<T>(a_CPU,FLAGS_ADD,result,a_A,a_B);
+        return result;
+    }
+
+    template <typename T> static T Subtract(MiniCPU& a_CPU,T a_A,T a_B)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const T result = static_cast<T>(static_cast<U>(a_A) - static_cast<U>(a_B));
+        RecordFlags<T>(a_CPU,FLAGS_SUB,result,a_A,a_B);
+        return result;
+    }
+
+    template <typename T> static T SetResultFlags(MiniCPU& a_CPU,T a_Result)
+    {
+        RecordFlags<T>(a_CPU,FLAGS_RESULT,a_Result);
+        return a_Result;
+    }
+
+    // When the operation is known, as it is for fused instructions, only what COND needs is worked out.
+    template <typename T,uint32_t OPERATION,uint32_t COND> static bool TestOperation(T a_A,T a_B,T a_Result)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const bool zero = a_Result == 0;
+        bool lessThan;
+        if( OPERATION == FLAGS_SUB )
+        {
+            lessThan = a_A < a_B;
+        }
+        else if( std::is_signed<T>::value )
+        {// Negative != overflow, so the sum without wrapping is negative.
+            lessThan = SignBit<U>(static_cast<U>((static_cast<U>(a_Result) ^ ((static_cast<U>(a_A) ^ static_cast<U>(a_Result)) & (static_cast<U>(a_B) ^ static_cast<U>(a_Result))))));
+        }
+        else
+        {
+            lessThan = static_cast<U>(a_Result) < static_cast<U>(a_A);
+        }
+
+        switch( COND )
+        {
+        case ConCode_FALSE: return false;
+        case ConCode_TRUE:  return true;
+        case ConCode_NEQ:   return SignBit(a_Result);
+        case ConCode_POS:   return !SignBit(a_Result);
+        case ConCode_NZ:    return !zero;
+        case ConCode_EQ:    return zero;
+        case ConCode_NE:    return !zero;
+        case ConCode_LT:    return lessThan;
+        case ConCode_GT:    return !zero && !lessThan;
+        case ConCode_LE:    return zero || lessThan;
+        case ConCode_GE:    return !lessThan;
+        }
+        return false;
+    }
+
+    // Zero, and not zero, are the result being zero for every operation, which is most of the conditions loops use.
+    template <uint32_t COND> static bool TestFlags(const MiniCPU& a_CPU)
+    {
+        if( (COND == ConCode_EQ || COND == ConCode_NE || COND == ConCode_NZ) && a_CPU.mFlags.Operation != FLAGS_VALUE )
+        {
+            return (a_CPU.mFlags.Result == 0) == (COND == ConCode_EQ);
+        }
+        return TestCondition(a_CPU.mFlags.Get(),COND);
+    }
+
+/******************************************************************************
+ * Stack
+ ******************************************************************************/
+    static void Push(MiniCPU& a_CPU,uint64_t a_Value)
+    {
+        a_CPU.WriteMemory<uint64_t>(a_CPU.mSP,a_Value);
+        a_CPU.mSP += sizeof(uint64_t);
+    }
+
+    static uint64_t Pop(MiniCPU& a_CPU)
+    {
+        a_CPU.mSP -= sizeof(uint64_t);
+        return a_CPU.ReadMemory<uint64_t>(a_CPU.mSP);
+    }
+
+/******************************************************************************
+ * Program control
+ ******************************************************************************/
+    static void OpIllegal(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_CPU.mPC -= sizeof(Instruction);
+        throw std::runtime_error("Illegal instruction " + std::to_string(a_Op.Bytes) + " at PC " + std::to_string(a_CPU.mPC));
+    }
+
+    static void OpLoadSet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_Op.Dest->u64 = a_Op.Constant.u64;
+    }
+
+    static void OpLoadOr(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_Op.Dest->u64 |= a_Op.Constant.u64;
+    }
+
+    // Jump using R15, the target was worked out when decoded.
+    template <uint32_t COND> static void OpJumpTo(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        if( TestFlags<COND>(a_CPU) )
+        {
+            a_CPU.mPC = a_Op.Constant.u64;
+        }
+    }
+
+    // Relative jumps are from the jump instruction, its address is in the offset.
+    template <uint32_t COND> static void OpJumpRelative(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        if( TestFlags<COND>(a_CPU) )
+        {
+            a_CPU.mPC = a_Op.Offset + ((a_Op.Constant.s64 + a_Op.Source->s64) * sizeof(Instruction));
+        }
+    }
+
+    template <uint32_t COND> static void OpJumpAbsolute(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        if( TestFlags<COND>(a_CPU) )
+        {
+            a_CPU.mPC = (a_Op.Constant.s64 + a_Op.Source->s64) * sizeof(Instruction);
+        }
+    }
+
+    template <typename T,bool SA,bool DA> static void OpCmp(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        Subtract<T>(a_CPU,ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpRet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const uint64_t pc = Pop(a_CPU);
+        if( pc & (sizeof(Instruction)-1) )
+        {
+            throw std::runtime_error("RET to a miss aligned address " + std::to_string(pc));
+        }
+        a_CPU.mPC = pc;
+    }
+
+    // When the source is R15 there is nothing to write the dest back to.
+    // A register with an aligned value in memory is one host atomic exchange, so it is a lock the cores of a Multicore
+    // can share. Sequentially consistent for every width, the same SWAP takes a lock and releases it.
+    // Anything else in memory, unaligned or memory to memory, is done under a lock only other SWAPs like it take.
+    template <typename T,bool SA,bool DA> static void OpSwap(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        if( SA != DA )
+        {
+            const uint64_t address = (DA ? a_Op.Dest : a_Op.Source)->u64 + a_Op.Offset;
+            if( (address & (sizeof(T)-1)) == 0 )
+            {
+                Register* reg = DA ? a_Op.Source : a_Op.Dest;
+                T* memory = reinterpret_cast<T*>(a_CPU.GetWritePointer(address));
+                const T value = __atomic_exchange_n(memory,GetRegisterValue<T>(*reg),__ATOMIC_SEQ_CST);
+                a_CPU.Written(address,sizeof(T));
+                if( reg != &a_Op.Immediate )
+                {
+                    SetRegisterValue<T>(*reg,value);
+                }
+                return;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock;
+        if( (SA || DA) && a_CPU.mMulticore )
+        {
+            lock = std::unique_lock<std::mutex>(a_CPU.mMulticore->mSwapLock);
+        }
+
+        const T source = ReadSource<T,SA>(a_CPU,a_Op);
+        if( a_Op.Source != &a_Op.Immediate )
+        {
+            WriteSource<T,SA>(a_CPU,a_Op,ReadDest<T,DA>(a_CPU,a_Op));
+        }
+        WriteDest<T,DA>(a_CPU,a_Op,source);
+    }
+
+    template <typename T,bool SA,bool DA> static void OpPause(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const T microseconds = ReadSource<T,SA>(a_CPU,a_Op);
+        if( a_CPU.mRecording )
+        {// Logs how long it really slept, or when replaying sleeps for that long.
+            a_CPU.mRecording->Pause(a_CPU.mCycleCount,microseconds > 0 ? static_cast<uint64_t>(microseconds) : 0);
+        }
+        else if( microseconds > 0 && a_CPU.mParkOnPause )
+        {// Run stops here and the thread goes on to something else.
+            a_CPU.mParked = true;
+            a_CPU.mParkedMicroseconds = static_cast<uint64_t>(microseconds);
+            a_CPU.mSliceEnd = a_CPU.mCycleCount;
+        }
+        else if( microseconds > 0 )
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(microseconds)));
+        }
+    }
+
+    template <typename T,bool SA,bool DA> static void OpSetInt(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_CPU.mInterruptMask |= static_cast<uint32_t>(ReadSource<T,SA>(a_CPU,a_Op));
+        a_CPU.CheckInterrupts();
+    }
+
+    template <typename T,bool SA,bool DA> static void OpClrInt(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_CPU.mInterruptMask &= ~static_cast<uint32_t>(ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+/******************************************************************************
+ * Data
+ ******************************************************************************/
+    template <typename T,bool SA,bool DA> static void OpMove(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+    // True if the range does not wrap the top of the address space, so it can be worked on a page at a time.
+    static bool InAddressSpace(uint64_t a_Address,uint64_t a_Bytes)
+    {
+        return a_Bytes <= ~a_Address;
+    }
+
+    // For MEMSET and MEMCPY the registers always hold addresses and the constant is the count.
+    // The SIMD kernels do the work a page at a time on the host memory of the page, elements that
+    // straddle two pages (or a range that wraps the address space) are done an element at a time.
+    template <typename T,bool SA,bool DA> static void OpMemSet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const T value = ReadSource<T,SA>(a_CPU,a_Op);
+        uint64_t dest = a_Op.Dest->u64;
+        uint64_t count = a_Op.Constant.u64;
+        if( count > 0 && count <= ~0ull / sizeof(T) && InAddressSpace(dest,count*sizeof(T)) )
+        {
+            uint64_t bits = 0;
+            memcpy(&bits,&value,sizeof(T));
+            while( count > 0 )
+            {
+                const uint64_t whole = std::min(count,(MiniCPU::PAGE_SIZE - (dest & (MiniCPU::PAGE_SIZE-1))) / sizeof(T));
+                if( whole == 0 )
+                {
+                    a_CPU.WriteMemory<T>(dest,value);
+                    dest += sizeof(T);
+                    count--;
+                    continue;
+                }
+
+                MemoryKernels::Fill(a_CPU.GetWritePointer(dest),bits,sizeof(T),whole);
+                a_CPU.Written(dest,whole*sizeof(T));
+                dest += whole*sizeof(T);
+                count -= whole;
+            }
+            return;
+        }
+
+        for( uint64_t n = 0 ; n < count ; n++ )
+        {
+            a_CPU.WriteMemory<T>(dest + (n*sizeof(T)),value);
+        }
+    }
+
+    template <typename T,bool SA,bool DA> static void OpMemCpy(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const uint64_t source = a_Op.Source->u64;
+        const uint64_t dest = a_Op.Dest->u64;
+        const uint64_t count = a_Op.Constant.u64;
+        const uint64_t bytes = count*sizeof(T);
+        if( count > 0 && count <= ~0ull / sizeof(T) && InAddressSpace(source,bytes) && InAddressSpace(dest,bytes) )
+        {
+            // Chunks never cross a page of either side. The write pointer is got first as getting it can
+            // make a private copy of a shared page, the read pointer then sees the page we will write to.
+            const bool backwards = dest > source && dest < source + bytes;
+            uint64_t done = 0;
+            while( done < bytes )
+            {
+                const uint64_t left = bytes - done;
+                uint64_t chunk;
+                uint64_t offset;
+                if( backwards )
+                {
+                    const uint64_t sourceEnd = source + left;
+                    const uint64_t destEnd = dest + left;
+                    chunk = std::min(left,std::min(((sourceEnd-1) & (MiniCPU::PAGE_SIZE-1)) + 1,((destEnd-1) & (MiniCPU::PAGE_SIZE-1)) + 1));
+                    offset = left - chunk;
+                }
+                else
+                {
+                    offset = done;
+                    chunk = std::min(left,std::min(MiniCPU::PAGE_SIZE - ((source+offset) & (MiniCPU::PAGE_SIZE-1)),MiniCPU::PAGE_SIZE - ((dest+offset) & (MiniCPU::PAGE_SIZE-1))));
+                }
+
+                uint8_t* to = a_CPU.GetWritePointer(dest + offset);
+                MemoryKernels::Move(to,a_CPU.GetReadPointer(source + offset),chunk);
+                a_CPU.Written(dest + offset,chunk);
+                done += chunk;
+            }
+            return;
+        }
+
+        if( dest > source && dest < source + (count*sizeof(T)) )
+        {// Overlapping, copy backwards like memmove does.
+            for( uint64_t n = count ; n > 0 ; n-- )
+            {
+                a_CPU.WriteMemory<T>(dest + ((n-1)*sizeof(T)),a_CPU.ReadMemory<T>(source + ((n-1)*sizeof(T))));
+            }
+        }
+        else
+        {
+            for( uint64_t n = 0 ; n < count ; n++ )
+            {
+                a_CPU.WriteMemory<T>(dest + (n*sizeof(T)),a_CPU.ReadMemory<T>(source + (n*sizeof(T))));
+            }
+        }
+    }
+
+    template <typename T,bool SA,bool DA> static void OpPop(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<uint64_t,DA>(a_CPU,a_Op,Pop(a_CPU));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpPush(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        Push(a_CPU,ReadSource<uint64_t,SA>(a_CPU,a_Op));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpSPSet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_CPU.mSP = ReadSource<uint64_t,SA>(a_CPU,a_Op);
+    }
+
+    template <typename T,bool SA,bool DA> static void OpSPGet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<uint64_t,DA>(a_CPU,a_Op,a_CPU.mSP);
+    }
+
+    // Saves R0 to R14, the flags and the interrupt mask. SGET pops them back in the reverse order.
+    template <typename T,bool SA,bool DA> static void OpSSet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        for( int r = REG_0 ; r < REG_15 ; r++ )
+        {
+            Push(a_CPU,a_CPU.mRegisters[r].u64);
+        }
+        Push(a_CPU,a_CPU.mFlags.Get());
+        Push(a_CPU,a_CPU.mInterruptMask);
+    }
+
+    template <typename T,bool SA,bool DA> static void OpSGet(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_CPU.mInterruptMask = static_cast<uint32_t>(Pop(a_CPU));
+        a_CPU.mFlags.Set(static_cast<uint32_t>(Pop(a_CPU)));
+        for( int r = REG_14 ; r >= REG_0 ; r-- )
+        {
+            a_CPU.mRegisters[r].u64 = Pop(a_CPU);
+        }
+
+        // Either can enable an interrupt that is waiting, so it is taken now and not at the end of the slice.
+        a_CPU.CheckInterrupts();
+    }
+
+/******************************************************************************
+ * Bit wise
+ ******************************************************************************/
+    template <typename T,bool SA,bool DA> static void OpOr(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(ReadDest<T,DA>(a_CPU,a_Op) | ReadSource<T,SA>(a_CPU,a_Op))));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpXor(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(ReadDest<T,DA>(a_CPU,a_Op) ^ ReadSource<T,SA>(a_CPU,a_Op))));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpAnd(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(ReadDest<T,DA>(a_CPU,a_Op) & ReadSource<T,SA>(a_CPU,a_Op))));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpNot(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(~ReadSource<T,SA>(a_CPU,a_Op))));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpSetBit(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t bit = a_Op.Constant.u64;
+        const U mask = bit < sizeof(T)*8 ? static_cast<U>(static_cast<U>(1) << bit) : 0;
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(static_cast<U>(ReadSource<T,SA>(a_CPU,a_Op)) | mask)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpClrBit(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t bit = a_Op.Constant.u64;
+        const U mask = bit < sizeof(T)*8 ? static_cast<U>(static_cast<U>(1) << bit) : 0;
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(static_cast<U>(ReadSource<T,SA>(a_CPU,a_Op)) & static_cast<U>(~mask))));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpLSL(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t shift = a_Op.Constant.u64;
+        const U value = static_cast<U>(ReadSource<T,SA>(a_CPU,a_Op));
+        const U result = shift < sizeof(T)*8 ? static_cast<U>(value << shift) : 0;
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(result)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpLSR(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t shift = a_Op.Constant.u64;
+        const U value = static_cast<U>(ReadSource<T,SA>(a_CPU,a_Op));
+        const U result = shift < sizeof(T)*8 ? static_cast<U>(value >> shift) : 0;
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(result)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpASR(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        typedef typename std::make_signed<T>::type S;
+        const uint64_t shift = a_Op.Constant.u64;
+        const S value = static_cast<S>(ReadSource<T,SA>(a_CPU,a_Op));
+        const S result = static_cast<S>(value >> (shift < sizeof(T)*8 ? shift : (sizeof(T)*8)-1));
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(result)));
+    }
+
+/******************************************************************************
+ * Integer math, dest = dest op source
+ ******************************************************************************/
+    template <typename T,bool SA,bool DA> static void OpAdd(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,Add<T>(a_CPU,ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpSub(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,Subtract<T>(a_CPU,ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpMul(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const U result = static_cast<U>(static_cast<U>(ReadDest<T,DA>(a_CPU,a_Op)) * static_cast<U>(ReadSource<T,SA>(a_CPU,a_Op)));
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(result)));
+    }
+
+    // Any integer division by zero returns zero. The one signed overflow case, MIN / -1, wraps.
+    template <typename T> static T Divide(T a_A,T a_B)
+    {
+        if( a_B == 0 )
+        {
+            return 0;
+        }
+
+        if( std::is_signed<T>::value && a_A == std::numeric_limits<T>::min() && a_B == static_cast<T>(-1) )
+        {
+            return a_A;
+        }
+        return static_cast<T>(a_A / a_B);
+    }
+
+    template <typename T> static T Remainder(T a_A,T a_B)
+    {
+        if( a_B == 0 || (std::is_signed<T>::value && a_B == static_cast<T>(-1)) )
+        {
+            return 0;
+        }
+        return static_cast<T>(a_A % a_B);
+    }
+
+    template <typename T,bool SA,bool DA> static void OpDiv(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,Divide<T>(ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op))));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpDivR(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,Remainder<T>(ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op))));
+    }
+
+    // Integers are the low bits of a value, FRAND is 0.0 to 1.0.
+    template <typename T> static T RandomValue(uint64_t a_Value)
+    {
+        if constexpr( std::is_same<T,float>::value )
+        {
+            return Random::ToFloat(a_Value);
+        }
+        else if constexpr( std::is_same<T,double>::value )
+        {
+            return Random::ToDouble(a_Value);
+        }
+        else
+        {
+            return static_cast<T>(a_Value);
+        }
+    }
+
+    // Writes a_Count random values to a_Dest. Done in batches, that never cross a page, made in one go by Random::Fill
+    // into a buffer on the stack. Elements that straddle two pages, or a range that wraps the address space, are done
+    // one at a time. Either way the values are the ones a_Count calls to Random::Next would give.
+    template <typename T> static void WriteRandom(MiniCPU& a_CPU,uint64_t a_Dest,uint64_t a_Count)
+    {
+        if( a_Count > 0 && a_Count <= ~0ull / sizeof(T) && InAddressSpace(a_Dest,a_Count*sizeof(T)) )
+        {
+            uint64_t values[RANDOM_BATCH];
+            while( a_Count > 0 )
+            {
+                const uint64_t batch = std::min(std::min(a_Count,RANDOM_BATCH),(MiniCPU::PAGE_SIZE - (a_Dest & (MiniCPU::PAGE_SIZE-1))) / sizeof(T));
+                if( batch == 0 )
+                {
+                    a_CPU.WriteMemory<T>(a_Dest,RandomValue<T>(a_CPU.mRandom.Next()));
+                    a_Dest += sizeof(T);
+                    a_Count--;
+                    continue;
+                }
+
+                a_CPU.mRandom.Fill(values,batch);
+                uint8_t* to = a_CPU.GetWritePointer(a_Dest);
+                for( uint64_t n = 0 ; n < batch ; n++ )
+                {
+                    const T value = RandomValue<T>(values[n]);
+                    memcpy(to + (n*sizeof(T)),&value,sizeof(T));
+                }
+                a_CPU.Written(a_Dest,batch*sizeof(T));
+                a_Dest += batch*sizeof(T);
+                a_Count -= batch;
+            }
+            return;
+        }
+
+        for( uint64_t n = 0 ; n < a_Count ; n++ )
+        {
+            a_CPU.WriteMemory<T>(a_Dest + (n*sizeof(T)),RandomValue<T>(a_CPU.mRandom.Next()));
+        }
+    }
+
+    // Writes count random values to the address in dest, if dest is not an address just the one value goes into the register.
+    template <typename T,bool SA,bool DA> static void OpRand(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        if( DA )
+        {
+            WriteRandom<T>(a_CPU,a_Op.Dest->u64,a_Op.Constant.u64);
+        }
+        else
+        {
+            SetRegisterValue<T>(*a_Op.Dest,RandomValue<T>(a_CPU.mRandom.Next()));
+        }
+    }
+
+    template <typename T,bool SA,bool DA> static void OpLerp(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const __int128 source = ReadSource<T,SA>(a_CPU,a_Op);
+        const __int128 dest = ReadDest<T,DA>(a_CPU,a_Op);
+        const __int128 result = source + (((dest - source) * static_cast<__int128>(a_Op.Constant.u64)) / static_cast<__int128>(LERP_ONE));
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,static_cast<T>(result)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpMax(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const T source = ReadSource<T,SA>(a_CPU,a_Op);
+        const T dest = ReadDest<T,DA>(a_CPU,a_Op);
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,dest > source ? dest : source));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpMin(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const T source = ReadSource<T,SA>(a_CPU,a_Op);
+        const T dest = ReadDest<T,DA>(a_CPU,a_Op);
+        WriteDest<T,DA>(a_CPU,a_Op,SetResultFlags<T>(a_CPU,dest < source ? dest : source));
+    }
+
+/******************************************************************************
+ * Float math, the data type is FLOAT or DOUBLE. These do not change the flags.
+ ******************************************************************************/
+    template <typename T,bool SA,bool DA> static void OpFAdd(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,ReadDest<T,DA>(a_CPU,a_Op) + ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFSub(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,ReadDest<T,DA>(a_CPU,a_Op) - ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFMul(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,ReadDest<T,DA>(a_CPU,a_Op) * ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFDiv(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,ReadDest<T,DA>(a_CPU,a_Op) / ReadSource<T,SA>(a_CPU,a_Op));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFrac(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        T whole;
+        WriteDest<T,DA>(a_CPU,a_Op,std::modf(ReadSource<T,SA>(a_CPU,a_Op),&whole));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFRand(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        OpRand<T,SA,DA>(a_CPU,a_Op);
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFLerp(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const T source = ReadSource<T,SA>(a_CPU,a_Op);
+        const T dest = ReadDest<T,DA>(a_CPU,a_Op);
+        const T t = static_cast<T>(a_Op.Constant.u64 / LERP_ONE);
+        WriteDest<T,DA>(a_CPU,a_Op,source + ((dest - source) * t));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFMax(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::fmax(ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFMin(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::fmin(ReadDest<T,DA>(a_CPU,a_Op),ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFSqrt(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::sqrt(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFSin(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::sin(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFCos(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::cos(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFTan(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::tan(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFATan(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,std::atan(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    // FLOAT_PRECISION_FAST
+    template <typename T,bool SA,bool DA> static void OpFSinFast(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,MathKernels::Sin(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFCosFast(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,MathKernels::Cos(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFTanFast(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,MathKernels::Tan(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+    template <typename T,bool SA,bool DA> static void OpFATanFast(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        WriteDest<T,DA>(a_CPU,a_Op,MathKernels::ATan(ReadSource<T,SA>(a_CPU,a_Op)));
+    }
+
+/******************************************************************************
+ * Fused instructions, the handler runs more than one instruction.
+ ******************************************************************************/
+    template <uint32_t LENGTH,FusionType TYPE> static void Fused(MiniCPU& a_CPU,const MicroOp& a_Op,uint64_t a_JumpTo)
+    {
+#ifdef MINICPU_PROFILER
+        // The other instructions are the micro ops after this one in the page, fusing never crosses a page.
+        for( uint32_t n = 1 ; n < LENGTH ; n++ )
+        {
+            (&a_Op)[n].Count++;
+        }
+#endif
+        a_CPU.mPC = a_JumpTo;
+        a_CPU.mCycleCount += LENGTH - 1;
+        a_CPU.mFusionStats.Executed[TYPE]++;
+        a_CPU.mFusionStats.DispatchesSaved += LENGTH - 1;
+    }
+
+    // The full value of the LOAD instructions is in the immediate.
+    template <uint32_t LENGTH,FusionType TYPE> static void OpLoadFused(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        a_Op.Dest->u64 = a_Op.Immediate.u64;
+        Fused<LENGTH,TYPE>(a_CPU,a_Op,a_CPU.mPC + ((LENGTH-1) * sizeof(Instruction)));
+    }
+
+    // Only fused when both operands are registers, the jump target is in the constant.
+    template <typename T,uint32_t OPCODE,uint32_t COND> static void OpMathJump(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const T dest = GetRegisterValue<T>(*a_Op.Dest);
+        const T source = GetRegisterValue<T>(*a_Op.Source);
+        T result;
+        if( OPCODE == OP_ADD )
+        {
+            result = Add<T>(a_CPU,dest,source);
+            SetRegisterValue<T>(*a_Op.Dest,result);
+        }
+        else if( OPCODE == OP_SUB )
+        {
+            result = Subtract<T>(a_CPU,dest,source);
+            SetRegisterValue<T>(*a_Op.Dest,result);
+        }
+        else
+        {
+            result = Subtract<T>(a_CPU,dest,source);
+        }
+
+        const FusionType type = OPCODE == OP_ADD ? FUSE_ADD_JUMP : OPCODE == OP_SUB ? FUSE_SUB_JUMP : FUSE_CMP_JUMP;
+        if( TestOperation<T,OPCODE == OP_ADD ? FLAGS_ADD : FLAGS_SUB,COND>(dest,source,result) )
+        {
+            Fused<2,type>(a_CPU,a_Op,a_Op.Constant.u64);
+        }
+        else
+        {
+            Fused<2,type>(a_CPU,a_Op,a_CPU.mPC + sizeof(Instruction));
+        }
+    }
+
+/******************************************************************************
+ * Decoding
+ ******************************************************************************/
+    static uint32_t HandlerIndex(uint32_t a_OpCode,uint32_t a_DataType,bool a_SourceIsAddress,bool a_DestIsAddress)
+    {
+        return a_OpCode | (a_DataType << 6) | (a_SourceIsAddress?(1<<9):0) | (a_DestIsAddress?(1<<10):0);
+    }
+
+    // Works out what register, or value in the micro op, an operand reads from.
+    static Register* ResolveOperand(MiniCPU& a_CPU,MicroOp& a_Op,uint32_t a_Register,bool a_IsAddress,bool a_IsSource,uint32_t a_OpCodeFlags)
+    {
+        if( a_Register != REG_15 )
+        {
+            return &a_CPU.mRegisters[a_Register];
+        }
+
+        if( a_IsAddress || (a_OpCodeFlags&OPCODE_REGISTERS_ARE_ADDRESSES) )
+        {
+            return (a_OpCodeFlags&OPCODE_CONSTANT_IS_OPERAND) ? &a_Op.Constant : &sZeroRegister;
+        }
+        return a_IsSource ? &a_Op.Immediate : &a_CPU.mRegisters[REG_15];
+    }
+
+    static uint64_t LoadValue(const LoadInstruction& a_Load)
+    {
+        const uint32_t shift = a_Load.Shift * 24;
+        return shift < 64 ? (static_cast<uint64_t>(a_Load.ConstantData) << shift) : 0;
+    }
+
+    static uint64_t JumpTarget(const JumpInstruction& a_Jump,uint64_t a_PC)
+    {
+        const int64_t offset = a_Jump.ConstantData;
+        return (a_Jump.PCRelative ? a_PC : 0) + (offset * sizeof(Instruction));
+    }
+
+    static void Decode(MiniCPU& a_CPU,uint64_t a_PC,MicroOp& a_Op)
+    {
+        Instruction ins;
+        ins.Bytes = a_CPU.ReadMemory<uint32_t>(a_PC);
+
+        a_Op.Bytes = ins.Bytes;
+        a_Op.Source = &sZeroRegister;
+        a_Op.Dest = &sZeroRegister;
+        a_Op.Immediate.u64 = 0;
+        a_Op.Constant.u64 = 0;
+        a_Op.Offset = 0;
+
+        if( ins.Load.IsLoad )
+        {
+            a_Op.Constant.u64 = LoadValue(ins.Load);
+            a_Op.Dest = &a_CPU.mRegisters[ins.Load.Dest];
+            a_Op.Handler = ins.Load.OrWithDest ? OpLoadOr : OpLoadSet;
+            return;
+        }
+
+        if( ins.Standard.OpCode == OP_JUMP )
+        {
+            if( ins.Jump.OffsetRegister == REG_15 )
+            {
+                a_Op.Constant.u64 = JumpTarget(ins.Jump,a_PC);
+                a_Op.Handler = sJumpTo[ins.Jump.Condition];
+            }
+            else
+            {
+                a_Op.Source = &a_CPU.mRegisters[ins.Jump.OffsetRegister];
+                a_Op.Constant.s64 = ins.Jump.ConstantData;
+                a_Op.Offset = a_PC;
+                a_Op.Handler = ins.Jump.PCRelative ? sJumpRelative[ins.Jump.Condition] : sJumpAbsolute[ins.Jump.Condition];
+            }
+            return;
+        }
+
+        const uint32_t opCode = ins.Standard.OpCode;
+        const uint32_t flags = sOpCodeFlags[opCode];
+        const uint64_t constant = ins.Standard.ConstantData;
+
+        a_Op.Constant.u64 = constant;
+        if( flags&OPCODE_FLOAT )
+        {
+            if( ins.Standard.DataType == DataType_DOUBLE )
+            {
+                SetRegisterValue<double>(a_Op.Immediate,static_cast<double>(constant));
+            }
+            else
+            {
+                SetRegisterValue<float>(a_Op.Immediate,static_cast<float>(constant));
+            }
+        }
+        else
+        {
+            a_Op.Immediate.u64 = constant;
+        }
+
+        if( (flags&OPCODE_CONSTANT_IS_OPERAND) == 0 )
+        {
+            a_Op.Offset = constant;
+        }
+
+        a_Op.Source = ResolveOperand(a_CPU,a_Op,ins.Standard.Source,ins.Standard.SourceIsAddress,true,flags);
+        a_Op.Dest = ResolveOperand(a_CPU,a_Op,ins.Standard.Dest,ins.Standard.DestIsAddress,false,flags);
+        const uint32_t index = HandlerIndex(opCode,ins.Standard.DataType,ins.Standard.SourceIsAddress,ins.Standard.DestIsAddress);
+        a_Op.Handler = (a_CPU.mFloatPrecision == FLOAT_PRECISION_FAST && sFastHandlers[index]) ? sFastHandlers[index] : sHandlers[index];
+    }
+
+    static bool IsLoadOr(const Instruction& a_Ins,uint32_t a_Dest)
+    {
+        return a_Ins.Load.IsLoad && a_Ins.Load.OrWithDest && a_Ins.Load.Dest == a_Dest;
+    }
+
+    // Peephole pass, looks at the instructions after the one just decoded for a sequence that can be one micro op.
+    // Never looks past the end of the code page, so invalidating a page never has to look at the one before.
+    static void Fuse(MiniCPU& a_CPU,uint64_t a_PC,MicroOp& a_Op)
+    {
+        const uint64_t left = (MiniCPU::CODE_PAGE_SIZE - (a_PC & (MiniCPU::CODE_PAGE_SIZE-1))) / sizeof(Instruction);
+        if( left < 2 )
+        {
+            return;
+        }
+
+        Instruction first,second;
+        first.Bytes = a_Op.Bytes;
+        second.Bytes = a_CPU.ReadMemory<uint32_t>(a_PC + sizeof(Instruction));
+
+        if( first.Load.IsLoad )
+        {
+            if( first.Load.OrWithDest || !IsLoadOr(second,first.Load.Dest) )
+            {
+                return;
+            }
+
+            a_Op.Immediate.u64 = a_Op.Constant.u64 | LoadValue(second.Load);
+            a_Op.Handler = OpLoadFused<2,FUSE_LOAD_48>;
+            FusionType type = FUSE_LOAD_48;
+            if( left >= 3 )
+            {
+                Instruction third;
+                third.Bytes = a_CPU.ReadMemory<uint32_t>(a_PC + (2*sizeof(Instruction)));
+                if( IsLoadOr(third,first.Load.Dest) )
+                {
+                    a_Op.Immediate.u64 |= LoadValue(third.Load);
+                    a_Op.Handler = OpLoadFused<3,FUSE_LOAD_64>;
+                    type = FUSE_LOAD_64;
+                }
+            }
+            a_CPU.mFusionStats.Decoded[type]++;
+            return;
+        }
+
+        const uint32_t opCode = first.Standard.OpCode;
+        const bool isMath = opCode == OP_ADD || opCode == OP_SUB || opCode == OP_CMP;
+        if( !isMath || first.Standard.SourceIsAddress || first.Standard.DestIsAddress )
+        {
+            return;
+        }
+
+        if( second.Standard.IsLoad || second.Standard.OpCode != OP_JUMP || second.Jump.OffsetRegister != REG_15 )
+        {
+            return;
+        }
+
+        const uint32_t math = opCode == OP_ADD ? 0 : opCode == OP_SUB ? 1 : 2;
+        a_Op.Constant.u64 = JumpTarget(second.Jump,a_PC + sizeof(Instruction));
+        a_Op.Handler = sMathJump[math][first.Standard.DataType][second.Jump.Condition];
+        a_CPU.mFusionStats.Decoded[FUSE_ADD_JUMP + math]++;
+    }
+
+    static MicroOp& DecodeAndFuse(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        // The micro op lives in the code cache of the CPU, it's only const to the handlers that execute it.
+        MicroOp& op = const_cast<MicroOp&>(a_Op);
+        const uint64_t pc = a_CPU.mPC - sizeof(Instruction);
+        Decode(a_CPU,pc,op);
+        op.Single = op.Handler;
+        Fuse(a_CPU,pc,op);
+        return op;
+    }
+
+    // Every micro op starts with these handlers, they decode the instruction then run it.
+    static void OpDecode(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const MicroOp& op = DecodeAndFuse(a_CPU,a_Op);
+        op.Handler(a_CPU,op);
+    }
+
+    static void OpDecodeSingle(MiniCPU& a_CPU,const MicroOp& a_Op)
+    {
+        const MicroOp& op = DecodeAndFuse(a_CPU,a_Op);
+        op.Single(a_CPU,op);
+    }
+
+/******************************************************************************
+ * Building the handler tables.
+ ******************************************************************************/
+    template <template <typename,bool,bool> class OP,typename T> static void SetAddressModes(uint32_t a_OpCode,uint32_t a_DataType,MicroOpHandler* r_Table = sHandlers)
+    {
+        r_Table[HandlerIndex(a_OpCode,a_DataType,false,false)] = OP<T,false,false>::Execute;
+        r_Table[HandlerIndex(a_OpCode,a_DataType,true,false)] = OP<T,true,false>::Execute;
+        r_Table[HandlerIndex(a_OpCode,a_DataType,false,true)] = OP<T,false,true>::Execute;
+        r_Table[HandlerIndex(a_OpCode,a_DataType,true,true)] = OP<T,true,true>::Execute;
+    }
+
+    // Same handler for all data types.
+    template <template <typename,bool,bool> class OP> static void SetHandlers(uint32_t a_OpCode,uint32_t a_Flags = OPCODE_USES_OFFSET)
+    {
+        for( uint32_t type = 0 ; type < NUMBER_DATA_TYPES ; type++ )
+        {
+            SetAddressModes<OP,uint64_t>(a_OpCode,type);
+        }
+        sOpCodeFlags[a_OpCode] = a_Flags;
+    }
+
+    template <template <typename,bool,bool> class OP> static void SetIntegerHandlers(uint32_t a_OpCode,uint32_t a_Flags = OPCODE_USES_OFFSET)
+    {
+        SetAddressModes<OP,uint8_t>(a_OpCode,DataType_UNSIGNED_INT_8);
+        SetAddressModes<OP,uint16_t>(a_OpCode,DataType_UNSIGNED_INT_16);
+        SetAddressModes<OP,uint32_t>(a_OpCode,DataType_UNSIGNED_INT_32);
+        SetAddressModes<OP,uint64_t>(a_OpCode,DataType_UNSIGNED_INT_64);
+        SetAddressModes<OP,int8_t>(a_OpCode,DataType_SIGNED_INT_8);
+        SetAddressModes<OP,int16_t>(a_OpCode,DataType_SIGNED_INT_16);
+        SetAddressModes<OP,int32_t>(a_OpCode,DataType_SIGNED_INT_32);
+        SetAddressModes<OP,int64_t>(a_OpCode,DataType_SIGNED_INT_64);
+        sOpCodeFlags[a_OpCode] = a_Flags;
+    }
+
+    // Float ops only have two valid data types, the rest are illegal.
+    template <template <typename,bool,bool> class OP> static void SetFloatHandlers(uint32_t a_OpCode,uint32_t a_Flags = OPCODE_USES_OFFSET)
+    {
+        SetAddressModes<OP,float>(a_OpCode,DataType_FLOAT);
+        SetAddressModes<OP,double>(a_OpCode,DataType_DOUBLE);
+        sOpCodeFlags[a_OpCode] = a_Flags | OPCODE_FLOAT;
+    }
+
+    // The FLOAT_PRECISION_FAST version of an opcode already set with SetFloatHandlers.
+    template <template <typename,bool,bool> class OP> static void SetFastFloatHandlers(uint32_t a_OpCode)
+    {
+        SetAddressModes<OP,float>(a_OpCode,DataType_FLOAT,sFastHandlers);
+        SetAddressModes<OP,double>(a_OpCode,DataType_DOUBLE,sFastHandlers);
+    }
+
+    template <uint32_t OPCODE> static void SetMathJumpHandlers();
+
+    static bool BuildHandlerTables();
+};
+
+MicroOpHandler ExecutionUnit::sHandlers[NUMBER_HANDLERS];
+MicroOpHandler ExecutionUnit::sFastHandlers[NUMBER_HANDLERS];
+uint32_t ExecutionUnit::sOpCodeFlags[NUMBER_OPCODES];
+MicroOpHandler ExecutionUnit::sJumpTo[NUMBER_CONDITIONS];
+MicroOpHandler ExecutionUnit::sJumpRelative[NUMBER_CONDITIONS];
+MicroOpHandler ExecutionUnit::sJumpAbsolute[NUMBER_CONDITIONS];
+MicroOpHandler ExecutionUnit::sMathJump[3][NUMBER_DATA_TYPES][NUMBER_CONDITIONS];
+Register ExecutionUnit::sZeroRegister;
+
+// Wraps a templated handler so it can be passed as a template template argument.
+namespace TypedHandler
+{
+#define DEF_TYPED_HANDLER(__name__,__function__)    template <typename T,bool SA,bool DA> struct __name__ {static void Execute(MiniCPU& a_CPU,const MicroOp& a_Op){ExecutionUnit::__function__<T,SA,DA>(a_CPU,a_Op);}};
+    DEF_TYPED_HANDLER(Cmp,OpCmp)
+    DEF_TYPED_HANDLER(Ret,OpRet)
+    DEF_TYPED_HANDLER(Swap,OpSwap)
+    DEF_TYPED_HANDLER(Pause,OpPause)
+    DEF_TYPED_HANDLER(SetInt,OpSetInt)
+    DEF_TYPED_HANDLER(ClrInt,OpClrInt)
+    DEF_TYPED_HANDLER(Move,OpMove)
+    DEF_TYPED_HANDLER(MemSet,OpMemSet)
+    DEF_TYPED_HANDLER(MemCpy,OpMemCpy)
+    DEF_TYPED_HANDLER(Pop,OpPop)
+    DEF_TYPED_HANDLER(Push,OpPush)
+    DEF_TYPED_HANDLER(SPSet,OpSPSet)
+    DEF_TYPED_HANDLER(SPGet,OpSPGet)
+    DEF_TYPED_HANDLER(SSet,OpSSet)
+    DEF_TYPED_HANDLER(SGet,OpSGet)
+    DEF_TYPED_HANDLER(Or,OpOr)
+    DEF_TYPED_HANDLER(Xor,OpXor)
+    DEF_TYPED_HANDLER(And,OpAnd)
+    DEF_TYPED_HANDLER(Not,OpNot)
+    DEF_TYPED_HANDLER(SetBit,OpSetBit)
+    DEF_TYPED_HANDLER(ClrBit,OpClrBit)
+    DEF_TYPED_HANDLER(LSL,OpLSL)
+    DEF_TYPED_HANDLER(LSR,OpLSR)
+    DEF_TYPED_HANDLER(ASR,OpASR)
+    DEF_TYPED_HANDLER(Add,OpAdd)
+    DEF_TYPED_HANDLER(Sub,OpSub)
+    DEF_TYPED_HANDLER(Mul,OpMul)
+    DEF_TYPED_HANDLER(Div,OpDiv)
+    DEF_TYPED_HANDLER(DivR,OpDivR)
+    DEF_TYPED_HANDLER(Rand,OpRand)
+    DEF_TYPED_HANDLER(Lerp,OpLerp)
+    DEF_TYPED_HANDLER(Max,OpMax)
+    DEF_TYPED_HANDLER(Min,OpMin)
+    DEF_TYPED_HANDLER(FAdd,OpFAdd)
+    DEF_TYPED_HANDLER(FSub,OpFSub)
+    DEF_TYPED_HANDLER(FMul,OpFMul)
+    DEF_TYPED_HANDLER(FDiv,OpFDiv)
+    DEF_TYPED_HANDLER(Frac,OpFrac)
+    DEF_TYPED_HANDLER(FRand,OpFRand)
+    DEF_TYPED_HANDLER(FLerp,OpFLerp)
+    DEF_TYPED_HANDLER(FMax,OpFMax)
+    DEF_TYPED_HANDLER(FMin,OpFMin)
+    DEF_TYPED_HANDLER(FSqrt,OpFSqrt)
+    DEF_TYPED_HANDLER(FSin,OpFSin)
+    DEF_TYPED_HANDLER(FCos,OpFCos)
+    DEF_TYPED_HANDLER(FTan,OpFTan)
+    DEF_TYPED_HANDLER(FATan,OpFATan)
+    DEF_TYPED_HANDLER(FSinFast,OpFSinFast)
+    DEF_TYPED_HANDLER(FCosFast,OpFCosFast)
+    DEF_TYPED_HANDLER(FTanFast,OpFTanFast)
+    DEF_TYPED_HANDLER(FATanFast,OpFATanFast)
+#undef DEF_TYPED_HANDLER
+
+    // Fills in the jump handlers for each condition code.
+    template <uint32_t COND> struct Jump
+    {
+        static void Set()
+        {
+            ExecutionUnit::sJumpTo[COND] = ExecutionUnit::OpJumpTo<COND>;
+            ExecutionUnit::sJumpRelative[COND] = ExecutionUnit::OpJumpRelative<COND>;
+            ExecutionUnit::sJumpAbsolute[COND] = ExecutionUnit::OpJumpAbsolute<COND>;
+            Jump<COND+1>::Set();
+        }
+    };
+
+    template <> struct Jump<ExecutionUnit::NUMBER_CONDITIONS>
+    {
+        static void Set(){}
+    };
+
+    // Fills in the fused math and jump handlers for each condition code.
+    template <typename T,uint32_t OPCODE,uint32_t MATH,uint32_t COND> struct MathJump
+    {
+        static void Set(uint32_t a_DataType)
+        {
+            ExecutionUnit::sMathJump[MATH][a_DataType][COND] = ExecutionUnit::OpMathJump<T,OPCODE,COND>;
+            MathJump<T,OPCODE,MATH,COND+1>::Set(a_DataType);
+        }
+    };
+
+    template <typename T,uint32_t OPCODE,uint32_t MATH> struct MathJump<T,OPCODE,MATH,ExecutionUnit::NUMBER_CONDITIONS>
+    {
+        static void Set(uint32_t a_DataType){}
+    };
+};
+
+template <uint32_t OPCODE> void ExecutionUnit::SetMathJumpHandlers()
+{
+    const uint32_t MATH = OPCODE == OP_ADD ? 0 : OPCODE == OP_SUB ? 1 : 2;
+    TypedHandler::MathJump<uint8_t,OPCODE,MATH,0>::Set(DataType_UNSIGNED_INT_8);
+    TypedHandler::MathJump<uint16_t,OPCODE,MATH,0>::Set(DataType_UNSIGNED_INT_16);
+    TypedHandler::MathJump<uint32_t,OPCODE,MATH,0>::Set(DataType_UNSIGNED_INT_32);
+    TypedHandler::MathJump<uint64_t,OPCODE,MATH,0>::Set(DataType_UNSIGNED_INT_64);
+    TypedHandler::MathJump<int8_t,OPCODE,MATH,0>::Set(DataType_SIGNED_INT_8);
+    TypedHandler::MathJump<int16_t,OPCODE,MATH,0>::Set(DataType_SIGNED_INT_16);
+    TypedHandler::MathJump<int32_t,OPCODE,MATH,0>::Set(DataType_SIGNED_INT_32);
+    TypedHandler::MathJump<int64_t,OPCODE,MATH,0>::Set(DataType_SIGNED_INT_64);
+}
+
+bool ExecutionUnit::BuildHandlerTables()
+{
+    // Everything starts off illegal.
+    for( auto& h : sHandlers )
+    {
+        h = OpIllegal;
+    }
+
+    TypedHandler::Jump<0>::Set();
+    SetMathJumpHandlers<OP_ADD>();
+    SetMathJumpHandlers<OP_SUB>();
+    SetMathJumpHandlers<OP_CMP>();
+
+    SetIntegerHandlers<TypedHandler::Cmp>(OP_CMP);
+    SetHandlers<TypedHandler::Ret>(OP_RET);
+    SetIntegerHandlers<TypedHandler::Swap>(OP_SWAP);
+    SetIntegerHandlers<TypedHandler::Pause>(OP_PAUSE);
+    SetHandlers<TypedHandler::SetInt>(OP_SETINT);
+    SetHandlers<TypedHandler::ClrInt>(OP_CLRINT);
+
+    SetIntegerHandlers<TypedHandler::Move>(OP_MOVE);
+    SetIntegerHandlers<TypedHandler::MemSet>(OP_MEMSET,OPCODE_CONSTANT_IS_OPERAND|OPCODE_REGISTERS_ARE_ADDRESSES);
+    SetIntegerHandlers<TypedHandler::MemCpy>(OP_MEMCPY,OPCODE_CONSTANT_IS_OPERAND|OPCODE_REGISTERS_ARE_ADDRESSES);
+
+    SetHandlers<TypedHandler::Pop>(OP_POP);
+    SetHandlers<TypedHandler::Push>(OP_PUSH);
+    SetHandlers<TypedHandler::SPSet>(OP_SPSET);
+    SetHandlers<TypedHandler::SPGet>(OP_SPGET);
+    SetHandlers<TypedHandler::SSet>(OP_SSET);
+    SetHandlers<TypedHandler::SGet>(OP_SGET);
+
+    SetIntegerHandlers<TypedHandler::Or>(OP_OR);
+    SetIntegerHandlers<TypedHandler::Xor>(OP_XOR);
+    SetIntegerHandlers<TypedHandler::And>(OP_AND);
+    SetIntegerHandlers<TypedHandler::Not>(OP_NOT);
+    SetIntegerHandlers<TypedHandler::SetBit>(OP_SETBIT,OPCODE_CONSTANT_IS_OPERAND);
+    SetIntegerHandlers<TypedHandler::ClrBit>(OP_CLRBIT,OPCODE_CONSTANT_IS_OPERAND);
+    SetIntegerHandlers<TypedHandler::LSL>(OP_LSL,OPCODE_CONSTANT_IS_OPERAND);
+    SetIntegerHandlers<TypedHandler::LSR>(OP_LSR,OPCODE_CONSTANT_IS_OPERAND);
+    SetIntegerHandlers<TypedHandler::ASR>(OP_ASR,OPCODE_CONSTANT_IS_OPERAND);
+
+    SetIntegerHandlers<TypedHandler::Add>(OP_ADD);
+    SetIntegerHandlers<TypedHandler::Sub>(OP_SUB);
+    SetIntegerHandlers<TypedHandler::Mul>(OP_MUL);
+    SetIntegerHandlers<TypedHandler::Div>(OP_DIV);
+    SetIntegerHandlers<TypedHandler::DivR>(OP_DIVR);
+    SetIntegerHandlers<TypedHandler::Rand>(OP_RAND,OPCODE_CONSTANT_IS_OPERAND);
+    SetIntegerHandlers<TypedHandler::Lerp>(OP_LERP,OPCODE_CONSTANT_IS_OPERAND);
+    SetIntegerHandlers<TypedHandler::Max>(OP_MAX);
+    SetIntegerHandlers<TypedHandler::Min>(OP_MIN);
+
+    SetFloatHandlers<TypedHandler::FAdd>(OP_FADD);
+    SetFloatHandlers<TypedHandler::FSub>(OP_FSUB);
+    SetFloatHandlers<TypedHandler::FMul>(OP_FMUL);
+    SetFloatHandlers<TypedHandler::FDiv>(OP_FDIV);
+    SetFloatHandlers<TypedHandler::Frac>(OP_FRAC);
+    SetFloatHandlers<TypedHandler::FRand>(OP_FRAND,OPCODE_CONSTANT_IS_OPERAND);
+    SetFloatHandlers<TypedHandler::FLerp>(OP_FLERP,OPCODE_CONSTANT_IS_OPERAND);
+    SetFloatHandlers<TypedHandler::FMax>(OP_FMAX);
+    SetFloatHandlers<TypedHandler::FMin>(OP_FMIN);
+    SetFloatHandlers<TypedHandler::FSqrt>(OP_FSQRT);
+    SetFloatHandlers<TypedHandler::FSin>(OP_FSIN);
+    SetFloatHandlers<TypedHandler::FCos>(OP_FCOS);
+    SetFloatHandlers<TypedHandler::FTan>(OP_FTAN);
+    SetFloatHandlers<TypedHandler::FATan>(OP_FATAN);
+
+    SetFastFloatHandlers<TypedHandler::FSinFast>(OP_FSIN);
+    SetFastFloatHandlers<TypedHandler::FCosFast>(OP_FCOS);
+    SetFastFloatHandlers<TypedHandler::FTanFast>(OP_FTAN);
+    SetFastFloatHandlers<TypedHandler::FATanFast>(OP_FATAN);
+
+    return true;
+}
+
+static const bool sHandlerTablesBuilt = ExecutionUnit::BuildHandlerTables();
+
+MicroOp* MiniCPU::FindCodePage(uint64_t a_CodePage)
+{
+    MicroOp* ops;
+    auto found = mCodePages.find(a_CodePage);
+    if( found != mCodePages.end() )
+    {
+        ops = found->second.get();
+    }
+    else
+    {
+        // Code that runs through a lot of memory would grow the cache forever, start again when it's full.
+        if( mCodePages.size() >= MAX_CODE_PAGES )
+        {
+            ClearCodePages();
+        }
+        ops = AllocateCodePage(a_CodePage);
+    }
+
+    CodeTLBEntry& entry = mCodeTLB[a_CodePage & (TLB_SIZE-1)];
+    entry.Page = a_CodePage;
+    entry.Ops = ops;
+    return ops;
+}
+
+MicroOp* MiniCPU::AllocateCodePage(uint64_t a_CodePage)
+{
+    assert(sHandlerTablesBuilt);
+    MicroOp* page = static_cast<MicroOp*>(aligned_alloc(alignof(MicroOp),sizeof(MicroOp) * MICRO_OPS_PER_PAGE));
+    if( page == nullptr )
+    {
+        throw std::bad_alloc();
+    }
+
+    for( uint64_t n = 0 ; n < MICRO_OPS_PER_PAGE ; n++ )
+    {
+        page[n].Handler = ExecutionUnit::OpDecode;
+        page[n].Single = ExecutionUnit::OpDecodeSingle;
+        page[n].Count = 0;
+    }
+    mCodePages[a_CodePage].reset(page);
+    MarkCode((a_CodePage << CODE_PAGE_SHIFT) >> PAGE_SHIFT);
+    return page;
+}
+
+void MiniCPU::InvalidateCode(uint64_t a_Address,uint64_t a_Size)
+{
+    // Any micro op that overlaps the bytes written has to be decoded again, as do any fused with it that come before it in the page.
+    const uint64_t first = a_Address & ~static_cast<uint64_t>(sizeof(Instruction)-1);
+    const uint64_t end = a_Address + a_Size;
+    for( uint64_t address = first ; address - first < end - first ; )
+    {
+        auto found = mCodePages.find(address >> CODE_PAGE_SHIFT);
+        if( found == mCodePages.end() )
+        {// Nothing decoded here, skip to the next code page.
+            address = (address | (CODE_PAGE_SIZE-1)) + 1;
+            continue;
+        }
+
+        MicroOp* page = found->second.get();
+        const uint64_t index = (address & (CODE_PAGE_SIZE-1)) / sizeof(Instruction);
+        for( uint64_t n = index >= MAX_FUSED_LENGTH-1 ? index - (MAX_FUSED_LENGTH-1) : 0 ; n <= index ; n++ )
+        {
+            page[n].Handler = ExecutionUnit::OpDecode;
+            page[n].Single = ExecutionUnit::OpDecodeSingle;
+        }
+        address += sizeof(Instruction);
+    }
+
+    if( mJIT )
+    {
+        mJIT->Invalidate(a_Address,a_Size);
+    }
+}
+
+void MiniCPU::ClearCodePages()
+{
+    CollectProfile();
+    mCodePages.clear();
+    mPagesWithCode.clear();
+    for( auto& entry : mCodeTLB )
+    {
+        entry.Page = TLB_EMPTY;
+        entry.Ops = nullptr;
+    }
+
+    if( mJIT )
+    {
+        mJIT->Flush();
+    }
+}
+
+void MiniCPU::CollectProfile()
+{
+#ifdef MINICPU_PROFILER
+    for( auto& page : mCodePages )
+    {
+        for( uint64_t n = 0 ; n < MICRO_OPS_PER_PAGE ; n++ )
+        {
+            if( page.second[n].Count )
+            {
+                if( mProfiler )
+                {
+                    mProfiler->Add((page.first << CODE_PAGE_SHIFT) + (n * sizeof(Instruction)),page.second[n].Count);
+                }
+                page.second[n].Count = 0;
+            }
+        }
+    }
+    mProfiledCycles = 0;
+#endif
+}
+
+uint64_t MiniCPU::Run(uint64_t a_MaxCycles)
+{
+    // Each slice ends at the next timer deadline, or after INTERRUPT_POLL_CYCLES so the mailbox is not left too long.
+    const uint64_t start = mCycleCount;
+    const uint64_t end = mCycleCount + a_MaxCycles;
+    mParked = false;
+    while( mCycleCount != end && !mParked )
+    {
+        CheckInterrupts();
+        uint64_t cycles = end - mCycleCount > INTERRUPT_POLL_CYCLES ? INTERRUPT_POLL_CYCLES : end - mCycleCount;
+        const uint64_t deadline = GetInterruptDeadline();
+        if( deadline - mCycleCount < cycles )
+        {
+            cycles = deadline - mCycleCount;
+        }
+        RunSlice(cycles);
+    }
+
+#ifdef MINICPU_PROFILER
+    if( mProfiler )
+    {
+        CollectProfile();
+    }
+#endif
+    return mCycleCount - start;
+}
+
+void MiniCPU::RunSlice(uint64_t a_Cycles)
+{
+    // Fused micro ops can run up to MAX_FUSED_LENGTH instructions, so stop using them when there is not enough left.
+    mSliceEnd = mCycleCount + a_Cycles;
+#ifdef MINICPU_PROFILER
+    if( mProfiler )
+    {// The same loops with each micro op counting itself. The counts are 32 bit, a slice is far shorter than
+     // PROFILE_COLLECT_CYCLES so collecting between slices is soon enough.
+        const uint64_t start = mCycleCount;
+        while( mSliceEnd - mCycleCount >= MAX_FUSED_LENGTH )
+        {
+            const MicroOp& op = GetMicroOp(mPC);
+            op.Count++;
+            mPC += sizeof(Instruction);
+            mCycleCount++;
+            op.Handler(*this,op);
+        }
+
+        while( mCycleCount != mSliceEnd )
+        {
+            GetMicroOp(mPC).Count++;
+            Step();
+        }
+
+        mProfiledCycles += mCycleCount - start;
+        if( mProfiledCycles >= PROFILE_COLLECT_CYCLES - INTERRUPT_POLL_CYCLES )
+        {
+            CollectProfile();
+        }
+        return;
+    }
+#endif
+
+    if( mJIT )
+    {
+        mJIT->Run(a_Cycles);
+        return;
+    }
+
+    while( mSliceEnd - mCycleCount >= MAX_FUSED_LENGTH )
+    {
+        Dispatch();
+    }
+
+    while( mCycleCount != mSliceEnd )
+    {
+        Step();
+    }
+}
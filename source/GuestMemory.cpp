@@ -0,0 +1,243 @@
+#include <cstring>
+#include <algorithm>
+
+#include "GuestMemory.h"
+
+// What every page that has never been written reads as.
+alignas(64) static const uint8_t sZeroPage[GuestMemory::PAGE_SIZE] = {};
+
+GuestMemory::GuestMemory()
+{
+
+}
+
+GuestMemory::~GuestMemory()
+{
+    Clear();
+}
+
+void GuestMemory::Clear()
+{
+    for( auto& page : mPages )
+    {
+        Release(page.second);
+    }
+    mPages.clear();
+}
+
+void GuestMemory::Share(const GuestMemory& a_Source)
+{
+    if( &a_Source == this )
+    {
+        return;
+    }
+
+    Clear();
+    mPages.reserve(a_Source.mPages.size());
+    for( const auto& page : a_Source.mPages )
+    {
+        page.second->References++;
+        mPages.emplace(page.first,page.second);
+    }
+}
+
+void GuestMemory::SharePage(uint64_t a_Page,const GuestMemory& a_Source)
+{
+    auto source = a_Source.mPages.find(a_Page);
+    auto found = mPages.find(a_Page);
+    if( found != mPages.end() )
+    {
+        if( source != a_Source.mPages.end() && source->second == found->second )
+        {
+            return;
+        }
+        Release(found->second);
+        if( source == a_Source.mPages.end() )
+        {
+            mPages.erase(found);
+            return;
+        }
+        found->second = source->second;
+    }
+    else if( source != a_Source.mPages.end() )
+    {
+        mPages.emplace(a_Page,source->second);
+    }
+    else
+    {
+        return;
+    }
+    source->second->References++;
+}
+
+bool GuestMemory::IsSharedWith(uint64_t a_Page,const GuestMemory& a_Other)const
+{
+    auto found = mPages.find(a_Page);
+    auto other = a_Other.mPages.find(a_Page);
+    if( found == mPages.end() || other == a_Other.mPages.end() )
+    {
+        return found == mPages.end() && other == a_Other.mPages.end();
+    }
+    return found->second == other->second;
+}
+
+std::vector<uint64_t> GuestMemory::GetPages()const
+{
+    std::vector<uint64_t> pages;
+    pages.reserve(mPages.size());
+    for( const auto& page : mPages )
+    {
+        pages.push_back(page.first);
+    }
+    return pages;
+}
+
+const uint8_t* GuestMemory::GetReadable(uint64_t a_Page)const
+{
+    auto found = mPages.find(a_Page);
+    return found == mPages.end() ? sZeroPage : found->second->Bytes;
+}
+
+uint8_t* GuestMemory::GetWritable(uint64_t a_Page)
+{
+    PageData*& page = mPages[a_Page];
+    if( page == nullptr )
+    {
+        page = Allocate();
+        memset(page->Bytes,0,PAGE_SIZE);
+    }
+    else if( page->References.load() > 1 || page->Mapping )
+    {// Shared or from a file, take a copy for ourselves.
+        PageData* copy = Allocate();
+        memcpy(copy->Bytes,page->Bytes,PAGE_SIZE);
+        Release(page);
+        page = copy;
+    }
+    return page->Bytes;
+}
+
+bool GuestMemory::Map(uint64_t a_Page,const uint8_t* a_Bytes,const std::shared_ptr<const void>& a_Mapping)
+{
+    PageData*& page = mPages[a_Page];
+    if( page != nullptr )
+    {
+        return false;
+    }
+
+    page = new PageData();
+    page->References = 1;
+    page->Bytes = const_cast<uint8_t*>(a_Bytes);
+    page->Mapping = a_Mapping;
+    return true;
+}
+
+void GuestMemory::Read(uint64_t a_Address,void* r_Data,uint64_t a_Size)const
+{
+    uint8_t* dst = static_cast<uint8_t*>(r_Data);
+    while( a_Size > 0 )
+    {
+        const uint64_t offset = a_Address & (PAGE_SIZE-1);
+        const uint64_t bytes = std::min(a_Size,PAGE_SIZE - offset);
+        memcpy(dst,GetReadable(a_Address >> PAGE_SHIFT) + offset,bytes);
+        dst += bytes;
+        a_Address += bytes;
+        a_Size -= bytes;
+    }
+}
+
+void GuestMemory::Write(uint64_t a_Address,const void* a_Data,uint64_t a_Size)
+{
+    const uint8_t* src = static_cast<const uint8_t*>(a_Data);
+    while( a_Size > 0 )
+    {
+        const uint64_t offset = a_Address & (PAGE_SIZE-1);
+        const uint64_t bytes = std::min(a_Size,PAGE_SIZE - offset);
+        memcpy(GetWritable(a_Address >> PAGE_SHIFT) + offset,src,bytes);
+        src += bytes;
+        a_Address += bytes;
+        a_Size -= bytes;
+    }
+}
+
+size_t GuestMemory::GetPrivatePageCount()const
+{
+    size_t count = 0;
+    for( const auto& page : mPages )
+    {
+        if( page.second->References.load() == 1 && !page.second->Mapping )
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t GuestMemory::GetMappedPageCount()const
+{
+    size_t count = 0;
+    for( const auto& page : mPages )
+    {
+        if( page.second->Mapping )
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool GuestMemory::FindDifference(const GuestMemory& a_Other,uint64_t& r_Address)const
+{
+    // A page only one side has is compared with the zero page on the other.
+    auto compare = [&r_Address](uint64_t a_Page,const uint8_t* a_A,const uint8_t* a_B)
+    {
+        if( a_A == a_B || memcmp(a_A,a_B,PAGE_SIZE) == 0 )
+        {
+            return false;
+        }
+
+        uint64_t offset = 0;
+        while( a_A[offset] == a_B[offset] )
+        {
+            offset++;
+        }
+        r_Address = (a_Page << PAGE_SHIFT) + offset;
+        return true;
+    };
+
+    for( const auto& page : mPages )
+    {
+        if( compare(page.first,page.second->Bytes,a_Other.GetReadable(page.first)) )
+        {
+            return true;
+        }
+    }
+
+    for( const auto& page : a_Other.mPages )
+    {
+        if( mPages.count(page.first) == 0 && compare(page.first,sZeroPage,page.second->Bytes) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+GuestMemory::PageData* GuestMemory::Allocate()
+{
+    PageData* page = new PageData();
+    page->References = 1;
+    page->Bytes = new uint8_t[PAGE_SIZE];
+    return page;
+}
+
+void GuestMemory::Release(PageData* a_Page)
+{
+    if( a_Page->References.fetch_sub(1) == 1 )
+    {
+        if( !a_Page->Mapping )
+        {
+            delete[] a_Page->Bytes;
+        }
+        delete a_Page;
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef __GUEST_MEMORY_H__
+#define __GUEST_MEMORY_H__
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Sparse 64bit guest memory. Pages are only allocated when they are written to, reading a page
+ * that has never been written reads zeros.
+ * Pages can be shared between instances, Share() makes every page of another memory a page of this one.
+ * A shared page is copied the first time either side writes to it (copy on write), so thousands of instances
+ * loaded from the same image only pay for the pages they change.
+ * The reference counts are atomic so instances sharing pages can run on different threads.
+ * Pages can also be mapped straight from a file, see Map(). They are never written, the first write takes a copy.
+ */
+class GuestMemory
+{
+public:
+    static const uint64_t PAGE_SHIFT = 12;
+    static const uint64_t PAGE_SIZE = 1<<PAGE_SHIFT;
+
+    GuestMemory();
+    ~GuestMemory();
+
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    /**
+     * @brief Releases all the pages, everything reads as zero again.
+     */
+    void Clear();
+
+    /**
+     * @brief Throws away what this has and shares all the pages of a_Source.
+     */
+    void Share(const GuestMemory& a_Source);
+
+    /**
+     * @brief Makes the page what it is in a_Source, sharing it, or never written if a_Source does not have it.
+     */
+    void SharePage(uint64_t a_Page,const GuestMemory& a_Source);
+
+    /**
+     * @brief True if both have the same page, shared and not written by either since, or neither has it.
+     */
+    bool IsSharedWith(uint64_t a_Page,const GuestMemory& a_Other)const;
+
+    bool HasPage(uint64_t a_Page)const{return mPages.count(a_Page) != 0;}
+
+    /**
+     * @brief The numbers of all the pages that have been written, or shared or mapped in, in no order.
+     */
+    std::vector<uint64_t> GetPages()const;
+
+    /**
+     * @brief Returns the page for reading, the zero page if it has never been written.
+     */
+    const uint8_t* GetReadable(uint64_t a_Page)const;
+
+    /**
+     * @brief Returns the page for writing, allocating it or taking a private copy if it is shared.
+     */
+    uint8_t* GetWritable(uint64_t a_Page);
+
+    /**
+     * @brief Makes the page use a_Bytes, PAGE_SIZE bytes of read only memory owned by a_Mapping, without copying them.
+     * Returns false, doing nothing, if the page already has something in it.
+     */
+    bool Map(uint64_t a_Page,const uint8_t* a_Bytes,const std::shared_ptr<const void>& a_Mapping);
+
+    /**
+     * @brief For slow paths and loading, handles any alignment and crossing pages.
+     */
+    void Read(uint64_t a_Address,void* r_Data,uint64_t a_Size)const;
+    void Write(uint64_t a_Address,const void* a_Data,uint64_t a_Size);
+
+    size_t GetPageCount()const{return mPages.size();}
+    size_t GetPrivatePageCount()const;
+    size_t GetMappedPageCount()const;
+
+    /**
+     * @brief Returns true if the contents are different and the address of the first different byte found.
+     */
+    bool FindDifference(const GuestMemory& a_Other,uint64_t& r_Address)const;
+
+private:
+    struct PageData
+    {
+        std::atomic<uint64_t> References;
+        uint8_t* Bytes;
+        std::shared_ptr<const void> Mapping;   // Set when Bytes is in a mapped file, the page is then read only.
+    };
+
+    std::unordered_map<uint64_t,PageData*> mPages;
+
+    static PageData* Allocate();
+    static void Release(PageData* a_Page);
+};
+
+#endif //__GUEST_MEMORY_H__
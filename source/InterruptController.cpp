@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+#include "InterruptController.h"
+#include "MiniCPU.h"
+#include "Recording.h"
+
+static int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void CheckLine(uint32_t a_Line)
+{
+    if( a_Line >= InterruptController::NUMBER_LINES )
+    {
+        throw std::runtime_error("There is no interrupt line " + std::to_string(a_Line));
+    }
+}
+
+InterruptController::InterruptController():mMailbox(0)
+{
+    for( auto& raisedAt : mMailboxRaisedAt )
+    {
+        raisedAt = 0;
+    }
+    Reset();
+}
+
+InterruptController::~InterruptController()
+{
+
+}
+
+void InterruptController::Reset()
+{
+    mTimers.clear();
+    mWaiting = 0;
+    memset(mWaitingSince,0,sizeof(mWaitingSince));
+    memset(mRaisedAt,0,sizeof(mRaisedAt));
+    memset(&mStats,0,sizeof(mStats));
+    mMailbox = 0;
+    for( auto& raisedAt : mMailboxRaisedAt )
+    {
+        raisedAt = 0;
+    }
+}
+
+void InterruptController::AddTimer(uint32_t a_Line,uint64_t a_Cycle,uint64_t a_Period)
+{
+    CheckLine(a_Line);
+    mTimers.push_back({a_Cycle,a_Period,a_Line});
+    std::push_heap(mTimers.begin(),mTimers.end(),Later);
+}
+
+void InterruptController::ClearTimers()
+{
+    mTimers.clear();
+}
+
+void InterruptController::Raise(uint32_t a_Line)
+{
+    CheckLine(a_Line);
+
+    // Only the first is kept, the latency is from the oldest Raise not picked up yet.
+    int64_t expected = 0;
+    mMailboxRaisedAt[a_Line].compare_exchange_strong(expected,Now(),std::memory_order_relaxed);
+    mMailbox.fetch_or(1u << a_Line,std::memory_order_release);
+}
+
+void InterruptController::Update(uint64_t a_Cycle)
+{
+    if( mMailbox.load(std::memory_order_relaxed) )
+    {
+        const uint32_t mail = mMailbox.exchange(0,std::memory_order_acquire);
+        for( uint32_t line = 0 ; line < NUMBER_LINES ; line++ )
+        {
+            if( mail & (1u << line) )
+            {
+                // A Raise between the exchanges leaves zero here, that one then has no time.
+                const int64_t raisedAt = mMailboxRaisedAt[line].exchange(0,std::memory_order_relaxed);
+                mStats.Raised[line]++;
+                if( (mWaiting & (1u << line)) == 0 )
+                {
+                    mWaiting |= (1u << line);
+                    mWaitingSince[line] = a_Cycle;
+                    mRaisedAt[line] = raisedAt;
+                }
+            }
+        }
+    }
+
+    while( mTimers.size() && mTimers.front().Deadline <= a_Cycle )
+    {
+        std::pop_heap(mTimers.begin(),mTimers.end(),Later);
+        Timer& timer = mTimers.back();
+        mStats.Fired[timer.Line]++;
+        if( (mWaiting & (1u << timer.Line)) == 0 )
+        {
+            mWaiting |= (1u << timer.Line);
+            mWaitingSince[timer.Line] = timer.Deadline;
+            mRaisedAt[timer.Line] = 0;
+        }
+
+        if( timer.Period )
+        {// Deadlines missed while it was not looked at are skipped, not fired late one after another.
+            timer.Deadline += (((a_Cycle - timer.Deadline) / timer.Period) + 1) * timer.Period;
+            std::push_heap(mTimers.begin(),mTimers.end(),Later);
+        }
+        else
+        {
+            mTimers.pop_back();
+        }
+    }
+}
+
+void InterruptController::Take(uint32_t a_Line,uint64_t a_Cycle)
+{
+    mWaiting &= ~(1u << a_Line);
+    mStats.Taken[a_Line]++;
+
+    const uint64_t cycles = a_Cycle - mWaitingSince[a_Line];
+    mStats.LatencyCycles += cycles;
+    mStats.MaxLatencyCycles = std::max(mStats.MaxLatencyCycles,cycles);
+
+    if( mRaisedAt[a_Line] )
+    {
+        const uint64_t nanoseconds = static_cast<uint64_t>(Now() - mRaisedAt[a_Line]);
+        mStats.HostTaken++;
+        mStats.LatencyNanoseconds += nanoseconds;
+        mStats.MaxLatencyNanoseconds = std::max(mStats.MaxLatencyNanoseconds,nanoseconds);
+        mRaisedAt[a_Line] = 0;
+    }
+}
+
+/******************************************************************************
+ * MiniCPU
+ ******************************************************************************/
+void MiniCPU::CheckInterrupts()
+{
+    if( mRecording && mRecording->GetMode() == Recording::MODE_REPLAYING )
+    {// They come from the recording, the timers and mailbox are left alone.
+        uint32_t line;
+        while( mRecording->NextInterrupt(mCycleCount,line) )
+        {
+            TakeInterrupt(line);
+        }
+        return;
+    }
+
+    mInterrupts.Update(mCycleCount);
+    const uint32_t ready = mInterrupts.mWaiting & mInterruptMask;
+    if( ready == 0 )
+    {
+        return;
+    }
+
+    for( uint32_t line = InterruptController::NUMBER_LINES ; line-- > 0 ; )
+    {
+        if( ready & (1u << line) )
+        {
+            mInterrupts.Take(line,mCycleCount);
+            if( mRecording )
+            {
+                mRecording->Interrupt(mCycleCount,line);
+            }
+            TakeInterrupt(line);
+        }
+    }
+}
+
+uint64_t MiniCPU::GetInterruptDeadline()const
+{
+    if( mRecording && mRecording->GetMode() == Recording::MODE_REPLAYING )
+    {
+        return mRecording->GetNextInterruptCycle();
+    }
+    return mInterrupts.GetNextDeadline();
+}
+
+void MiniCPU::TakeInterrupt(uint32_t a_Line)
+{
+    const uint64_t first = offsetof(AddressSpace,InteruptCode.Interupt1);
+    const uint64_t size = offsetof(AddressSpace,InteruptCode.Interupt2) - first;
+
+    WriteMemory<uint64_t>(mSP,mPC);
+    mSP += sizeof(uint64_t);
+    mInterruptMask &= ~(1u << a_Line);
+    mPC = first + (a_Line * size);
+}
@@ -0,0 +1,100 @@
+#ifndef __INTERRUPT_CONTROLLER_H__
+#define __INTERRUPT_CONTROLLER_H__
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+
+/**
+ * @brief The interrupts of a MiniCPU, Interupt1 to Interupt3 in AddressSpace. Line n is enabled by bit n of the
+ * interrupt mask, SETINT and CLRINT.
+ * They come from timers, which fire on an exact cycle and can repeat, and from Raise, which any host thread can call
+ * at any time. Raise only sets a bit in a mailbox, no locks, the CPU picks it up the next time it looks.
+ *
+ * The CPU does not look per instruction. Run works in slices that end at the next timer deadline, or after
+ * MiniCPU::INTERRUPT_POLL_CYCLES for the mailbox, and only checks between them, and after SETINT and SGET as they can
+ * enable a line that is waiting. So a timer is taken on its cycle if its line is enabled.
+ *
+ * Taking an interrupt pushes the PC, the same as a CALL would, jumps to the vector and clears the bit of the line in
+ * the mask, so it can not interrupt itself. The handler saves what it uses with SSET, puts it back with SGET, SETINT
+ * to enable the line again then RET. When more than one is waiting they are all taken at once, the highest numbered
+ * first so Interupt1 runs first and returns into the next one.
+ */
+class InterruptController
+{
+public:
+    static const uint32_t NUMBER_LINES = 3;
+    static const uint64_t NO_DEADLINE = ~0ull;
+
+    struct Stats
+    {
+        uint64_t Raised[NUMBER_LINES];      // Picked up from the mailbox, Raise more than once before that counts once.
+        uint64_t Fired[NUMBER_LINES];       // By timers.
+        uint64_t Taken[NUMBER_LINES];       // Ones raised or fired while still waiting are only taken once.
+        uint64_t LatencyCycles;             // Total from fired or picked up to taken, so time masked is counted.
+        uint64_t MaxLatencyCycles;
+        uint64_t HostTaken;                 // Taken that came from Raise.
+        uint64_t LatencyNanoseconds;        // Total from Raise to taken.
+        uint64_t MaxLatencyNanoseconds;
+    };
+
+    InterruptController();
+    ~InterruptController();
+
+    InterruptController(const InterruptController&) = delete;
+    InterruptController& operator=(const InterruptController&) = delete;
+
+    /**
+     * @brief Drops the timers, anything waiting and the stats.
+     */
+    void Reset();
+
+    /**
+     * @brief Fires a_Line when the cycle count reaches a_Cycle, then every a_Period cycles if that is not zero.
+     * Only from the thread running the CPU, or when it is not running.
+     */
+    void AddTimer(uint32_t a_Line,uint64_t a_Cycle,uint64_t a_Period = 0);
+    void ClearTimers();
+
+    /**
+     * @brief Can be called from any thread at any time.
+     */
+    void Raise(uint32_t a_Line);
+
+    uint64_t GetNextDeadline()const{return mTimers.empty() ? NO_DEADLINE : mTimers.front().Deadline;}
+    uint32_t GetWaiting()const{return mWaiting;}
+    const Stats& GetStats()const{return mStats;}
+
+private:
+    friend class MiniCPU;
+
+    struct Timer
+    {
+        uint64_t Deadline;
+        uint64_t Period;
+        uint32_t Line;
+    };
+
+    std::vector<Timer> mTimers;     // Min heap on Deadline.
+    uint32_t mWaiting;              // Lines fired or raised and not taken yet.
+    uint64_t mWaitingSince[NUMBER_LINES];
+    int64_t mRaisedAt[NUMBER_LINES];
+    Stats mStats;
+
+    std::atomic<uint32_t> mMailbox;
+    std::atomic<int64_t> mMailboxRaisedAt[NUMBER_LINES];    // steady_clock nanoseconds of the first Raise not picked up.
+
+    static bool Later(const Timer& a_A,const Timer& a_B){return a_A.Deadline > a_B.Deadline;}
+
+    /**
+     * @brief Picks up the mailbox and fires the timers due by a_Cycle.
+     */
+    void Update(uint64_t a_Cycle);
+
+    /**
+     * @brief Removes a_Line from the waiting, which must have it, and adds it to the stats.
+     */
+    void Take(uint32_t a_Line,uint64_t a_Cycle);
+};
+
+#endif //__INTERRUPT_CONTROLLER_H__
@@ -0,0 +1,1288 @@
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+#include <algorithm>
+#include <memory>
+#include <exception>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+#include "JIT.h"
+
+#if defined(__x86_64__)
+
+namespace
+{
+
+enum HostRegister
+{
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+    NO_REGISTER = -1
+};
+
+// RBX holds the CPU and RBP the JIT context. RAX, RCX, RDX, R10 and R11 are scratch. The rest can hold guest registers.
+const int MAPPABLE_REGISTERS[] = {R12,R13,R14,R15,RSI,RDI,R8,R9};
+const int NUMBER_MAPPABLE_REGISTERS = sizeof(MAPPABLE_REGISTERS) / sizeof(MAPPABLE_REGISTERS[0]);
+
+// The 8 bit form of the op, the 16 / 32 / 64 bit form is this plus one.
+enum AluOp
+{
+    ALU_ADD = 0x00,
+    ALU_OR = 0x08,
+    ALU_AND = 0x20,
+    ALU_SUB = 0x28,
+    ALU_XOR = 0x30,
+    ALU_CMP = 0x38
+};
+
+enum ConditionCode
+{
+    JCC_C = 0x2,
+    JCC_NC = 0x3,
+    JCC_NE = 0x5,
+    JCC_A = 0x7,
+    JCC_L = 0xc
+};
+
+/**
+ * @brief Just enough of an x86-64 assembler for the JIT. All memory operands use a 32bit displacement.
+ * Opcodes greater than 0xff are two byte opcodes, 0x0f then the low byte.
+ */
+class X64Emitter
+{
+public:
+    X64Emitter(uint8_t* a_Code):mPos(a_Code){}
+
+    uint8_t* GetPos()const{return mPos;}
+
+    void Byte(uint8_t a_Byte){*mPos++ = a_Byte;}
+    void Dword(uint32_t a_Value){memcpy(mPos,&a_Value,4);mPos += 4;}
+    void Qword(uint64_t a_Value){memcpy(mPos,&a_Value,8);mPos += 8;}
+
+    // op reg,rm where both are registers.
+    void RR(uint32_t a_Opcode,int a_Size,int a_Reg,int a_RM)
+    {
+        Prefix(a_Size,a_Reg,0,a_RM);
+        Opcode(a_Opcode);
+        Byte(0xc0 | ((a_Reg&7)<<3) | (a_RM&7));
+    }
+
+    // op reg,[base + index*scale + disp32]
+    void RM(uint32_t a_Opcode,int a_Size,int a_Reg,int a_Base,int a_Index,int a_Scale,int32_t a_Disp)
+    {
+        Prefix(a_Size,a_Reg,a_Index == NO_REGISTER ? 0 : a_Index,a_Base);
+        Opcode(a_Opcode);
+        if( a_Index == NO_REGISTER && (a_Base&7) != RSP )
+        {
+            Byte(0x80 | ((a_Reg&7)<<3) | (a_Base&7));
+        }
+        else
+        {
+            const int scale = a_Scale == 8 ? 3 : a_Scale == 4 ? 2 : a_Scale == 2 ? 1 : 0;
+            const int index = a_Index == NO_REGISTER ? RSP : a_Index;
+            Byte(0x80 | ((a_Reg&7)<<3) | RSP);
+            Byte((scale<<6) | ((index&7)<<3) | (a_Base&7));
+        }
+        Dword(static_cast<uint32_t>(a_Disp));
+    }
+
+    void MovRR(int a_Dest,int a_Source)
+    {
+        if( a_Dest != a_Source )
+        {
+            RR(0x89,64,a_Source,a_Dest);
+        }
+    }
+
+    void Load64(int a_Dest,int a_Base,int32_t a_Disp){RM(0x8b,64,a_Dest,a_Base,NO_REGISTER,1,a_Disp);}
+    void Store64(int a_Base,int32_t a_Disp,int a_Source){RM(0x89,64,a_Source,a_Base,NO_REGISTER,1,a_Disp);}
+    void Load32(int a_Dest,int a_Base,int32_t a_Disp){RM(0x8b,32,a_Dest,a_Base,NO_REGISTER,1,a_Disp);}
+    void Store32(int a_Base,int32_t a_Disp,int a_Source){RM(0x89,32,a_Source,a_Base,NO_REGISTER,1,a_Disp);}
+
+    // Zero extends to 64 bits.
+    void MovImm32(int a_Dest,uint32_t a_Value)
+    {
+        if( a_Dest >= R8 )
+        {
+            Byte(0x41);
+        }
+        Byte(0xb8 + (a_Dest&7));
+        Dword(a_Value);
+    }
+
+    void MovImm64(int a_Dest,uint64_t a_Value)
+    {
+        if( a_Value <= 0xffffffff )
+        {
+            MovImm32(a_Dest,static_cast<uint32_t>(a_Value));
+            return;
+        }
+        Byte(0x48 | (a_Dest >= R8 ? 1 : 0));
+        Byte(0xb8 + (a_Dest&7));
+        Qword(a_Value);
+    }
+
+    void Alu(AluOp a_Op,int a_Size,int a_Dest,int a_Source){RR(a_Size == 8 ? a_Op : a_Op + 1,a_Size,a_Source,a_Dest);}
+
+    // op reg,imm32 in the 0x81 group, 0 = add, 1 = or, 4 = and, 5 = sub, 7 = cmp.
+    void AluImm(int a_Extension,int a_Size,int a_Dest,uint32_t a_Value)
+    {
+        RR(0x81,a_Size,a_Extension,a_Dest);
+        Dword(a_Value);
+    }
+
+    // op qword [base + disp32],imm32
+    void AluMemImm(int a_Extension,int a_Base,int32_t a_Disp,uint32_t a_Value)
+    {
+        RM(0x81,64,a_Extension,a_Base,NO_REGISTER,1,a_Disp);
+        Dword(a_Value);
+    }
+
+    // 4 = shl, 5 = shr, 7 = sar
+    void Shift(int a_Extension,int a_Size,int a_Dest,uint8_t a_Amount)
+    {
+        RR(a_Size == 8 ? 0xc0 : 0xc1,a_Size,a_Extension,a_Dest);
+        Byte(a_Amount);
+    }
+
+    void Not(int a_Size,int a_Dest){RR(a_Size == 8 ? 0xf6 : 0xf7,a_Size,2,a_Dest);}
+    void Test(int a_Size,int a_Reg){RR(a_Size == 8 ? 0x84 : 0x85,a_Size,a_Reg,a_Reg);}
+
+    // Returns where the rel32 is so it can be patched.
+    uint8_t* Jcc(ConditionCode a_Condition)
+    {
+        Byte(0x0f);
+        Byte(0x80 | a_Condition);
+        uint8_t* site = mPos;
+        Dword(0);
+        return site;
+    }
+
+    uint8_t* Jmp()
+    {
+        Byte(0xe9);
+        uint8_t* site = mPos;
+        Dword(0);
+        return site;
+    }
+
+    static void Patch(uint8_t* a_Site,const uint8_t* a_Target)
+    {
+        const int32_t rel = static_cast<int32_t>(a_Target - (a_Site + 4));
+        memcpy(a_Site,&rel,4);
+    }
+
+private:
+    uint8_t* mPos;
+
+    void Prefix(int a_Size,int a_Reg,int a_Index,int a_Base)
+    {
+        if( a_Size == 16 )
+        {
+            Byte(0x66);
+        }
+
+        const uint8_t rex = 0x40 | (a_Size == 64 ? 8 : 0) | ((a_Reg>>3)<<2) | ((a_Index>>3)<<1) | (a_Base>>3);
+        if( rex != 0x40 )
+        {
+            Byte(rex);
+        }
+    }
+
+    void Opcode(uint32_t a_Opcode)
+    {
+        if( a_Opcode > 0xff )
+        {
+            Byte(0x0f);
+        }
+        Byte(a_Opcode&0xff);
+    }
+};
+
+struct GuestInstruction
+{
+    uint64_t PC;
+    Instruction Ins;
+    bool Call;          // Run by calling the handler the interpreter uses, see JIT::CallHandler.
+    const MicroOp* Op;  // When set the call goes straight to its handler, see JIT::Compile.
+};
+
+// Where things are, relative to RBX (the CPU) and RBP (the JIT context).
+struct Offsets
+{
+    int32_t Registers;
+    int32_t PC;
+    int32_t Flags;
+    int32_t ReadTLB;
+    int32_t WriteTLB;
+    int32_t Remaining;
+    int32_t Owner;
+    int32_t SideExit;
+};
+
+struct PendingExit
+{
+    uint8_t* Site;
+    uint64_t Target;
+    bool Linkable;
+};
+
+bool IsShift(uint32_t a_OpCode)
+{
+    return a_OpCode == OP_LSL || a_OpCode == OP_LSR || a_OpCode == OP_ASR;
+}
+
+bool SetsFlags(const Instruction& a_Ins)
+{
+    if( a_Ins.Standard.IsLoad || a_Ins.Standard.OpCode == OP_JUMP || a_Ins.Standard.OpCode == OP_MOVE )
+    {
+        return false;
+    }
+    return true;
+}
+
+bool UsesMemory(const Instruction& a_Ins)
+{
+    return !a_Ins.Standard.IsLoad && a_Ins.Standard.OpCode != OP_JUMP && (a_Ins.Standard.SourceIsAddress || a_Ins.Standard.DestIsAddress);
+}
+
+bool IsCompiled(const Instruction& a_Ins)
+{
+    if( a_Ins.Standard.IsLoad )
+    {
+        return true;
+    }
+
+    switch( a_Ins.Standard.OpCode )
+    {
+    case OP_MOVE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_CMP:
+    case OP_MUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    case OP_LSL:
+    case OP_LSR:
+    case OP_ASR:
+        return true;
+    }
+    return false;
+}
+
+// What can be run in a block by calling its handler. Not what moves the PC, takes interrupts or needs the cycle count,
+// nor the reserved op codes that are always illegal.
+bool IsCalled(const Instruction& a_Ins)
+{
+    if( a_Ins.Standard.IsLoad || a_Ins.Standard.OpCode >= OP_RESERVED_00 )
+    {
+        return false;
+    }
+
+    switch( a_Ins.Standard.OpCode )
+    {
+    case OP_JUMP:
+    case OP_RET:
+    case OP_PAUSE:
+    case OP_SETINT:
+    case OP_SGET:
+        return false;
+    }
+    return true;
+}
+
+bool IsRegisterFloat(const Instruction& a_Ins)
+{
+    const StandardInstruction& ins = a_Ins.Standard;
+    return !ins.IsLoad && ins.OpCode >= OP_FADD && ins.OpCode <= OP_FATAN && ins.DataType <= DataType_DOUBLE && !ins.SourceIsAddress && !ins.DestIsAddress;
+}
+
+/**
+ * @brief Emits the code for one block.
+ */
+class BlockCompiler
+{
+public:
+    BlockCompiler(uint8_t* a_Code,const Offsets& a_Offsets,const uint32_t* a_ConditionMasks,uint64_t a_CallHandler):
+        mEmit(a_Code),
+        mOffsets(a_Offsets),
+        mConditionMasks(a_ConditionMasks),
+        mCallHandler(a_CallHandler)
+    {
+        for( auto& m : mMap )
+        {
+            m = NO_REGISTER;
+        }
+    }
+
+    uint8_t* GetPos()const{return mEmit.GetPos();}
+    const std::vector<PendingExit>& GetExits()const{return mExits;}
+
+    void Compile(const std::vector<GuestInstruction>& a_Code,bool a_EndsWithJump)
+    {
+        MapRegisters(a_Code);
+        FindFlagWrites(a_Code);
+
+        const uint64_t start = a_Code.front().PC;
+        const uint32_t length = static_cast<uint32_t>(a_Code.size());
+
+        // Entry, load the mapped registers, then each time round check the cycle budget.
+        for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+        {
+            if( mMap[r] != NO_REGISTER )
+            {
+                mEmit.Load64(mMap[r],RBX,GuestRegister(r));
+            }
+        }
+
+        uint8_t* head = mEmit.GetPos();
+        mEmit.AluMemImm(7,RBP,mOffsets.Remaining,length);
+        uint8_t* bail = mEmit.Jcc(JCC_L);
+        mEmit.AluMemImm(5,RBP,mOffsets.Remaining,length);
+
+        const size_t body = a_EndsWithJump ? a_Code.size() - 1 : a_Code.size();
+        for( size_t n = 0 ; n < body ; n++ )
+        {
+            mCurrent = static_cast<uint32_t>(n);
+            if( a_Code[n].Op )
+            {
+                EmitDirectCall(a_Code[n]);
+            }
+            else if( a_Code[n].Call )
+            {
+                EmitCall(a_Code[n]);
+            }
+            else
+            {
+                EmitInstruction(a_Code[n].Ins,n);
+            }
+        }
+
+        const uint64_t next = a_Code.back().PC + sizeof(Instruction);
+        if( a_EndsWithJump )
+        {
+            const JumpInstruction& jump = a_Code.back().Ins.Jump;
+            const uint64_t target = (jump.PCRelative ? a_Code.back().PC : 0) + (static_cast<int64_t>(jump.ConstantData) * sizeof(Instruction));
+            if( jump.Condition == ConCode_TRUE )
+            {
+                JumpTo(target,start,head);
+            }
+            else
+            {
+                mEmit.Load32(RAX,RBX,mOffsets.Flags);
+                mEmit.MovImm32(RCX,mConditionMasks[jump.Condition]);
+                mEmit.RR(0xfa3,32,RAX,RCX);    // bt ecx,eax
+                if( target == start )
+                {
+                    X64Emitter::Patch(mEmit.Jcc(JCC_C),head);
+                    Exit(next,true);
+                }
+                else
+                {
+                    uint8_t* notTaken = mEmit.Jcc(JCC_NC);
+                    Exit(target,true);
+                    X64Emitter::Patch(notTaken,mEmit.GetPos());
+                    Exit(next,true);
+                }
+            }
+        }
+        else
+        {
+            Exit(next,true);
+        }
+
+        // Not enough cycles left, nothing has been done yet.
+        X64Emitter::Patch(bail,mEmit.GetPos());
+        Exit(start,false);
+
+        // Leave before instruction N and let the interpreter do it. Give back the cycles not used and say where it was
+        // so JIT::Run can see an instruction that keeps doing this.
+        for( const auto& side : mSideExits )
+        {
+            X64Emitter::Patch(side.first,mEmit.GetPos());
+            mEmit.AluMemImm(0,RBP,mOffsets.Remaining,length - side.second);
+            mEmit.MovImm64(RAX,a_Code[side.second].PC);
+            mEmit.Store64(RBP,mOffsets.SideExit,RAX);
+            Exit(a_Code[side.second].PC,false);
+        }
+
+        // Leave after a called instruction N, the handler threw or the code was thrown away.
+        for( const auto& call : mCallExits )
+        {
+            X64Emitter::Patch(call.first,mEmit.GetPos());
+            mEmit.AluMemImm(0,RBP,mOffsets.Remaining,length - (call.second + 1));
+            Exit(a_Code[call.second].PC + sizeof(Instruction),false);
+        }
+    }
+
+private:
+    X64Emitter mEmit;
+    const Offsets& mOffsets;
+    const uint32_t* mConditionMasks;
+    const uint64_t mCallHandler;
+    int mMap[NUMBER_REGISTERS];
+    bool mWritten[NUMBER_REGISTERS] = {};
+    std::vector<bool> mStoreFlags;
+    std::vector<PendingExit> mExits;
+    std::vector<std::pair<uint8_t*,uint32_t>> mSideExits;
+    std::vector<std::pair<uint8_t*,uint32_t>> mCallExits;
+    uint32_t mCurrent = 0;
+
+    int32_t GuestRegister(uint32_t a_Register)const
+    {
+        return mOffsets.Registers + static_cast<int32_t>(a_Register * sizeof(Register));
+    }
+
+    // The most used registers get a host register.
+    void MapRegisters(const std::vector<GuestInstruction>& a_Code)
+    {
+        uint32_t uses[NUMBER_REGISTERS] = {};
+        auto use = [&](uint32_t a_Register,bool a_Write)
+        {
+            uses[a_Register]++;
+            if( a_Write )
+            {
+                mWritten[a_Register] = true;
+            }
+        };
+
+        for( const auto& c : a_Code )
+        {
+            const Instruction& ins = c.Ins;
+            if( c.Call )
+            {// The handler uses the registers in the CPU.
+                continue;
+            }
+
+            if( ins.Load.IsLoad )
+            {
+                use(ins.Load.Dest,true);
+            }
+            else if( ins.Standard.OpCode != OP_JUMP )
+            {
+                if( ins.Standard.Source != REG_15 )
+                {
+                    use(ins.Standard.Source,false);
+                }
+
+                if( ins.Standard.Dest != REG_15 || !ins.Standard.DestIsAddress )
+                {
+                    use(ins.Standard.Dest,!ins.Standard.DestIsAddress && ins.Standard.OpCode != OP_CMP);
+                }
+            }
+        }
+
+        uint32_t order[NUMBER_REGISTERS];
+        for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+        {
+            order[r] = r;
+        }
+        std::stable_sort(order,order + NUMBER_REGISTERS,[&](uint32_t a,uint32_t b){return uses[a] > uses[b];});
+
+        for( int n = 0 ; n < NUMBER_MAPPABLE_REGISTERS && uses[order[n]] > 0 ; n++ )
+        {
+            mMap[order[n]] = MAPPABLE_REGISTERS[n];
+        }
+    }
+
+    // Only the last flag write is stored, unless the block could leave before the next one.
+    void FindFlagWrites(const std::vector<GuestInstruction>& a_Code)
+    {
+        mStoreFlags.assign(a_Code.size(),false);
+        for( size_t n = 0 ; n < a_Code.size() ; n++ )
+        {
+            if( !SetsFlags(a_Code[n].Ins) )
+            {
+                continue;
+            }
+
+            bool store = true;
+            for( size_t k = n + 1 ; k < a_Code.size() ; k++ )
+            {
+                if( a_Code[k].Call || UsesMemory(a_Code[k].Ins) )
+                {
+                    break;
+                }
+
+                if( SetsFlags(a_Code[k].Ins) )
+                {
+                    store = false;
+                    break;
+                }
+            }
+            mStoreFlags[n] = store;
+        }
+    }
+
+    void LoadGuest(int a_Host,uint32_t a_Register)
+    {
+        if( mMap[a_Register] != NO_REGISTER )
+        {
+            mEmit.MovRR(a_Host,mMap[a_Register]);
+        }
+        else
+        {
+            mEmit.Load64(a_Host,RBX,GuestRegister(a_Register));
+        }
+    }
+
+    void StoreGuest(uint32_t a_Register,int a_Host)
+    {
+        if( mMap[a_Register] != NO_REGISTER )
+        {
+            mEmit.MovRR(mMap[a_Register],a_Host);
+        }
+        else
+        {
+            mEmit.Store64(RBX,GuestRegister(a_Register),a_Host);
+        }
+    }
+
+    void SideExit(ConditionCode a_Condition)
+    {
+        mSideExits.push_back(std::make_pair(mEmit.Jcc(a_Condition),mCurrent));
+    }
+
+    void Exit(uint64_t a_Target,bool a_Linkable)
+    {
+        for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+        {
+            if( mMap[r] != NO_REGISTER && mWritten[r] )
+            {
+                mEmit.Store64(RBX,GuestRegister(r),mMap[r]);
+            }
+        }
+        mEmit.MovImm64(RAX,a_Target);
+        mEmit.Store64(RBX,mOffsets.PC,RAX);
+        mExits.push_back({mEmit.Jmp(),a_Target,a_Linkable});
+    }
+
+    // The handler works on the registers in the CPU, so the mapped ones are put back before and loaded again after.
+    // RBX and RBP are kept by the call. The stack is 8 off 16 in a block, Enter pushed six registers after its return.
+    void EmitCall(const GuestInstruction& a_Code)
+    {
+        for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+        {
+            if( mMap[r] != NO_REGISTER && mWritten[r] )
+            {
+                mEmit.Store64(RBX,GuestRegister(r),mMap[r]);
+            }
+        }
+
+        mEmit.Load64(RDI,RBP,mOffsets.Owner);
+        mEmit.MovImm64(RSI,a_Code.PC);
+        mEmit.MovImm64(RAX,mCallHandler);
+        mEmit.AluImm(5,64,RSP,8);
+        mEmit.Byte(0xff);mEmit.Byte(0xd0);     // call rax
+        mEmit.AluImm(0,64,RSP,8);
+        Reload(a_Code.Ins);
+
+        mEmit.Test(32,RAX);
+        mCallExits.push_back(std::make_pair(mEmit.Jcc(JCC_NE),mCurrent));
+    }
+
+    // Float math on registers, it can not leave. Only its operands and the registers the call does not have to keep
+    // are put back. The PC is set for when the micro op has not been decoded yet, decoding finds the instruction from it.
+    void EmitDirectCall(const GuestInstruction& a_Code)
+    {
+        const StandardInstruction& ins = a_Code.Ins.Standard;
+        for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+        {
+            const int host = mMap[r];
+            if( host != NO_REGISTER && mWritten[r] && (r == ins.Source || r == ins.Dest || host < R12) )
+            {
+                mEmit.Store64(RBX,GuestRegister(r),host);
+            }
+        }
+
+        mEmit.MovImm64(RAX,a_Code.PC + sizeof(Instruction));
+        mEmit.Store64(RBX,mOffsets.PC,RAX);
+        mEmit.MovRR(RDI,RBX);
+        mEmit.MovImm64(RSI,reinterpret_cast<uint64_t>(a_Code.Op));
+        mEmit.AluImm(5,64,RSP,8);
+        mEmit.RM(0xff,32,2,RSI,NO_REGISTER,1,offsetof(MicroOp,Single));   // call [rsi + Single]
+        mEmit.AluImm(0,64,RSP,8);
+        Reload(a_Code.Ins);
+    }
+
+    // After a call, the operands it could have written and the registers the call did not have to keep, of those that
+    // can be mapped only R12 to R15 are kept.
+    void Reload(const Instruction& a_Ins)
+    {
+        for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+        {
+            const int host = mMap[r];
+            if( host != NO_REGISTER && (r == a_Ins.Standard.Source || r == a_Ins.Standard.Dest || host < R12) )
+            {
+                mEmit.Load64(host,RBX,GuestRegister(r));
+            }
+        }
+    }
+
+    void JumpTo(uint64_t a_Target,uint64_t a_Start,uint8_t* a_Head)
+    {
+        if( a_Target == a_Start )
+        {
+            X64Emitter::Patch(mEmit.Jmp(),a_Head);
+        }
+        else
+        {
+            Exit(a_Target,true);
+        }
+    }
+
+    // Works out the guest address and turns it into a host pointer with the TLB of the CPU, RAX and R10 are used.
+    // Leaves if the page is not in the TLB or the access crosses into the next page, the interpreter then fills the TLB.
+    // The write TLB only has pages that are private and have no code, so a write that gets through needs no other checks.
+    void Address(int a_Host,uint32_t a_Register,uint32_t a_Offset,uint32_t a_Size,bool a_Write)
+    {
+        if( a_Register == REG_15 )
+        {
+            mEmit.MovImm32(a_Host,a_Offset);
+        }
+        else
+        {
+            LoadGuest(a_Host,a_Register);
+            if( a_Offset )
+            {
+                mEmit.AluImm(0,64,a_Host,a_Offset);
+            }
+        }
+
+        const int32_t tlb = a_Write ? mOffsets.WriteTLB : mOffsets.ReadTLB;
+        mEmit.MovRR(R10,a_Host);
+        mEmit.Shift(5,64,R10,MiniCPU::PAGE_SHIFT);
+        mEmit.RR(0x89,32,R10,RAX);
+        mEmit.AluImm(4,32,RAX,MiniCPU::TLB_SIZE-1);
+        mEmit.Shift(4,32,RAX,4);
+        mEmit.RM(0x3b,64,R10,RBX,RAX,1,tlb);   // cmp r10,[rbx + rax + tlb]
+        SideExit(JCC_NE);
+
+        mEmit.RR(0x89,32,a_Host,R10);
+        mEmit.AluImm(4,32,R10,MiniCPU::PAGE_SIZE-1);
+        mEmit.AluImm(7,32,R10,MiniCPU::PAGE_SIZE-a_Size);
+        SideExit(JCC_A);
+
+        mEmit.RM(0x8b,64,a_Host,RBX,RAX,1,tlb + 8);
+        mEmit.Alu(ALU_ADD,64,a_Host,R10);
+    }
+
+    void LoadMemory(int a_Dest,int a_Address,uint32_t a_Size)
+    {
+        switch( a_Size )
+        {
+        case 1: mEmit.RM(0xfb6,32,a_Dest,a_Address,NO_REGISTER,1,0); break;
+        case 2: mEmit.RM(0xfb7,32,a_Dest,a_Address,NO_REGISTER,1,0); break;
+        case 4: mEmit.RM(0x8b,32,a_Dest,a_Address,NO_REGISTER,1,0); break;
+        default: mEmit.RM(0x8b,64,a_Dest,a_Address,NO_REGISTER,1,0); break;
+        }
+    }
+
+    void StoreMemory(int a_Address,uint32_t a_Size)
+    {
+        mEmit.RM(a_Size == 1 ? 0x88 : 0x89,a_Size*8,RAX,a_Address,NO_REGISTER,1,0);
+    }
+
+    // Sign or zero extend RAX to 64 bits, as the interpreter does when writing a register.
+    void Extend(uint32_t a_Size,bool a_Signed)
+    {
+        switch( a_Size )
+        {
+        case 1: mEmit.RR(a_Signed ? 0xfbe : 0xfb6,64,RAX,RAX); break;
+        case 2: mEmit.RR(a_Signed ? 0xfbf : 0xfb7,64,RAX,RAX); break;
+        case 4:
+            if( a_Signed )
+            {
+                mEmit.RR(0x63,64,RAX,RAX);
+            }
+            else
+            {
+                mEmit.RR(0x89,32,RAX,RAX);
+            }
+            break;
+        }
+    }
+
+    // Turns the host flags into the MiniCPU flags and stores them. RCX, R10 and R11 are free by now.
+    void StoreFlags(bool a_Signed)
+    {
+        mEmit.Byte(0x9c);               // pushfq
+        mEmit.Byte(0x41);mEmit.Byte(0x5a); // pop r10
+
+        mEmit.RR(0x89,32,R10,RCX);      // Negative, SF is bit 7
+        mEmit.Shift(5,32,RCX,7);
+        mEmit.AluImm(4,32,RCX,1 << ConFlag_Negative);
+
+        mEmit.RR(0x89,32,R10,R11);      // Zero, ZF is bit 6
+        mEmit.Shift(5,32,R11,6 - ConFlag_Zero);
+        mEmit.AluImm(4,32,R11,1 << ConFlag_Zero);
+        mEmit.Alu(ALU_OR,32,RCX,R11);
+
+        mEmit.RR(0x89,32,R10,R11);      // Carry, CF is bit 0
+        mEmit.AluImm(4,32,R11,1);
+        mEmit.Shift(4,32,R11,ConFlag_Carry);
+        mEmit.Alu(ALU_OR,32,RCX,R11);
+
+        mEmit.Shift(5,32,R10,11 - ConFlag_Overflow);  // Overflow, OF is bit 11
+        mEmit.AluImm(4,32,R10,1 << ConFlag_Overflow);
+        mEmit.Alu(ALU_OR,32,RCX,R10);
+
+        if( a_Signed )
+        {
+            mEmit.AluImm(1,32,RCX,1 << ConFlag_Signed);
+        }
+        mEmit.Store32(RBX,mOffsets.Flags,RCX);
+    }
+
+    void EmitInstruction(const Instruction& a_Ins,size_t a_Index)
+    {
+        if( a_Ins.Load.IsLoad )
+        {
+            const uint32_t shift = a_Ins.Load.Shift * 24;
+            const uint64_t value = shift < 64 ? (static_cast<uint64_t>(a_Ins.Load.ConstantData) << shift) : 0;
+            if( a_Ins.Load.OrWithDest )
+            {
+                LoadGuest(RAX,a_Ins.Load.Dest);
+                mEmit.MovImm64(RCX,value);
+                mEmit.Alu(ALU_OR,64,RAX,RCX);
+            }
+            else
+            {
+                mEmit.MovImm64(RAX,value);
+            }
+            StoreGuest(a_Ins.Load.Dest,RAX);
+            return;
+        }
+
+        if( a_Ins.Standard.OpCode == OP_JUMP )
+        {// Only never taken jumps end up in the body, they are NOPs.
+            return;
+        }
+
+        const StandardInstruction& ins = a_Ins.Standard;
+        const uint32_t opCode = ins.OpCode;
+        const uint32_t size = 1 << (ins.DataType&3);
+        const bool isSigned = ins.DataType >= DataType_SIGNED_INT_8;
+        const uint32_t offset = IsShift(opCode) ? 0 : ins.ConstantData;
+        const bool unary = opCode == OP_MOVE || opCode == OP_NOT || IsShift(opCode);
+        const bool writes = opCode != OP_CMP;
+
+        // All the leaving has to be done before anything changes.
+        if( ins.DestIsAddress )
+        {
+            Address(RDX,ins.Dest,ins.Dest == REG_15 ? ins.ConstantData : offset,size,writes);
+        }
+
+        if( ins.SourceIsAddress )
+        {
+            Address(R11,ins.Source,ins.Source == REG_15 ? ins.ConstantData : offset,size,false);
+            LoadMemory(RCX,R11,size);
+        }
+        else if( ins.Source == REG_15 )
+        {
+            mEmit.MovImm32(RCX,ins.ConstantData);
+        }
+        else
+        {
+            LoadGuest(RCX,ins.Source);
+        }
+
+        if( unary )
+        {
+            mEmit.MovRR(RAX,RCX);
+        }
+        else if( ins.DestIsAddress )
+        {
+            LoadMemory(RAX,RDX,size);
+        }
+        else
+        {
+            LoadGuest(RAX,ins.Dest);
+        }
+
+        const uint32_t bits = size * 8;
+        switch( opCode )
+        {
+        case OP_ADD: mEmit.Alu(ALU_ADD,size*8,RAX,RCX); break;
+        case OP_SUB: mEmit.Alu(ALU_SUB,size*8,RAX,RCX); break;
+        case OP_CMP: mEmit.Alu(ALU_CMP,size*8,RAX,RCX); break;
+        case OP_MUL:
+            // The low bits are the same signed or not, imul leaves SF and ZF undefined so they come from a test.
+            mEmit.RR(0xfaf,size == 1 ? 32 : size*8,RAX,RCX);
+            mEmit.Test(size*8,RAX);
+            break;
+        case OP_AND: mEmit.Alu(ALU_AND,size*8,RAX,RCX); break;
+        case OP_OR:  mEmit.Alu(ALU_OR,size*8,RAX,RCX); break;
+        case OP_XOR: mEmit.Alu(ALU_XOR,size*8,RAX,RCX); break;
+        case OP_NOT:
+            mEmit.Not(size*8,RAX);
+            mEmit.Test(size*8,RAX);
+            break;
+
+        case OP_LSL:
+        case OP_LSR:
+        case OP_ASR:
+            if( opCode == OP_ASR )
+            {
+                mEmit.Shift(7,size*8,RAX,static_cast<uint8_t>(std::min<uint32_t>(ins.ConstantData,bits-1)));
+            }
+            else if( ins.ConstantData >= bits )
+            {
+                mEmit.RR(0x31,32,RAX,RAX);
+            }
+            else
+            {
+                mEmit.Shift(opCode == OP_LSL ? 4 : 5,size*8,RAX,static_cast<uint8_t>(ins.ConstantData));
+            }
+            mEmit.Test(size*8,RAX);
+            break;
+        }
+
+        if( mStoreFlags[a_Index] )
+        {
+            StoreFlags(isSigned);
+        }
+
+        if( writes )
+        {
+            if( ins.DestIsAddress )
+            {
+                StoreMemory(RDX,size);
+            }
+            else
+            {
+                Extend(size,isSigned);
+                StoreGuest(ins.Dest,RAX);
+            }
+        }
+    }
+};
+
+}// namespace
+
+JIT::JIT(MiniCPU& a_CPU):
+    mCPU(a_CPU)
+{
+    static_assert(sizeof(MiniCPU::TLBEntry) == 16,"The JIT indexes the TLB with a shift of four");
+
+    mContext.Remaining = 0;
+    mContext.Owner = this;
+    mContext.SideExit = NO_SIDE_EXIT;
+
+    for( uint32_t condition = 0 ; condition < 16 ; condition++ )
+    {
+        mConditionMasks[condition] = 0;
+        for( uint32_t flags = 0 ; flags < 32 ; flags++ )
+        {
+            if( TestCondition(flags,condition) )
+            {
+                mConditionMasks[condition] |= (1<<flags);
+            }
+        }
+    }
+
+    // Read, write and execute so blocks can be patched when they are linked.
+    void* buffer = mmap(nullptr,CODE_BUFFER_SIZE,PROT_READ|PROT_WRITE|PROT_EXEC,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if( buffer == MAP_FAILED )
+    {
+        throw std::runtime_error("JIT failed to allocate executable memory");
+    }
+    mCodeBuffer = static_cast<uint8_t*>(buffer);
+    mCodeEnd = mCodeBuffer + CODE_BUFFER_SIZE;
+
+    BuildEnterExit();
+}
+
+JIT::~JIT()
+{
+    munmap(mCodeBuffer,CODE_BUFFER_SIZE);
+}
+
+void JIT::BuildEnterExit()
+{
+    X64Emitter emit(mCodeBuffer);
+
+    // void Enter(MiniCPU* rdi,Context* rsi,const uint8_t* rdx)
+    mEnter = reinterpret_cast<EnterFunction>(emit.GetPos());
+    emit.Byte(0x53);                    // push rbx
+    emit.Byte(0x55);                    // push rbp
+    emit.Byte(0x41);emit.Byte(0x54);    // push r12
+    emit.Byte(0x41);emit.Byte(0x55);    // push r13
+    emit.Byte(0x41);emit.Byte(0x56);    // push r14
+    emit.Byte(0x41);emit.Byte(0x57);    // push r15
+    emit.MovRR(RBX,RDI);
+    emit.MovRR(RBP,RSI);
+    emit.Byte(0xff);emit.Byte(0xe2);    // jmp rdx
+
+    mExit = emit.GetPos();
+    emit.Byte(0x41);emit.Byte(0x5f);    // pop r15
+    emit.Byte(0x41);emit.Byte(0x5e);    // pop r14
+    emit.Byte(0x41);emit.Byte(0x5d);    // pop r13
+    emit.Byte(0x41);emit.Byte(0x5c);    // pop r12
+    emit.Byte(0x5d);                    // pop rbp
+    emit.Byte(0x5b);                    // pop rbx
+    emit.Byte(0xc3);                    // ret
+
+    mCodeStart = emit.GetPos();
+    Flush();
+    mStats.Flushes = 0;
+}
+
+void JIT::Flush()
+{
+    mBlocks.clear();
+    mPendingLinks.clear();
+    mCompiledCode.clear();
+    mCodeFree = mCodeStart;
+    mStats.Flushes++;
+}
+
+void JIT::Invalidate(uint64_t a_Address,uint64_t a_Size)
+{
+    if( mCompiledCode.empty() || a_Size == 0 )
+    {
+        return;
+    }
+
+    // Only a write over an instruction that was compiled throws the code away, data next to it is left alone.
+    const uint64_t first = a_Address & ~static_cast<uint64_t>(sizeof(Instruction) - 1);
+    const uint64_t end = a_Address + a_Size;
+    for( uint64_t address = first ; address - first < end - first ; )
+    {
+        auto found = mCompiledCode.find(address >> MiniCPU::PAGE_SHIFT);
+        if( found == mCompiledCode.end() )
+        {
+            address = (address | (MiniCPU::PAGE_SIZE - 1)) + 1;
+            if( address == 0 )
+            {
+                return;
+            }
+            continue;
+        }
+
+        if( found->second[(address & (MiniCPU::PAGE_SIZE - 1)) / sizeof(Instruction)] )
+        {
+            Flush();
+            return;
+        }
+        address += sizeof(Instruction);
+    }
+}
+
+const JIT::Block& JIT::GetBlock(uint64_t a_PC)
+{
+    auto found = mBlocks.find(a_PC);
+    if( found != mBlocks.end() )
+    {
+        return found->second;
+    }
+
+    if( mCodeEnd - mCodeFree < MAX_BLOCK_CODE_SIZE )
+    {
+        Flush();
+    }
+
+    const Block block = Compile(a_PC);
+    return mBlocks.emplace(a_PC,block).first->second;
+}
+
+JIT::Block JIT::Compile(uint64_t a_PC)
+{
+    // Find the block, stops at a jump, something not compiled or the end of the memory page.
+    std::vector<GuestInstruction> code;
+    bool endsWithJump = false;
+    const uint64_t page = a_PC >> MiniCPU::PAGE_SHIFT;
+    for( uint64_t pc = a_PC ; code.size() < MAX_BLOCK_LENGTH ; pc += sizeof(Instruction) )
+    {
+        if( (pc >> MiniCPU::PAGE_SHIFT) != page )
+        {
+            break;
+        }
+
+        Instruction ins;
+        ins.Bytes = mCPU.ReadMemory<uint32_t>(pc);
+        if( !ins.Standard.IsLoad && ins.Standard.OpCode == OP_JUMP )
+        {
+            if( ins.Jump.Condition == ConCode_FALSE )
+            {// Never taken, a NOP.
+                code.push_back({pc,ins,false,nullptr});
+                continue;
+            }
+
+            if( ins.Jump.OffsetRegister == REG_15 )
+            {
+                code.push_back({pc,ins,false,nullptr});
+                endsWithJump = true;
+            }
+            break;
+        }
+
+        // Some instructions are always called, the others once they have left the block too often.
+        const bool call = !IsCompiled(ins) || mCalled.count(pc) > 0;
+        if( call && !IsCalled(ins) )
+        {
+            break;
+        }
+        code.push_back({pc,ins,call,nullptr});
+    }
+
+    if( code.empty() )
+    {
+        return {nullptr,0};
+    }
+
+    // Make sure writes to this page call back to us.
+    mCPU.MarkCode(page);
+    auto& compiled = mCompiledCode[page];
+    for( const auto& c : code )
+    {
+        compiled.set((c.PC & (MiniCPU::PAGE_SIZE - 1)) / sizeof(Instruction));
+    }
+
+    // Float math on registers can not throw, write memory or change the flags, so its micro op is called straight with
+    // nothing to check after. The micro ops of a code page stay where they are until ClearCodePages, which flushes this.
+    for( auto& c : code )
+    {
+        if( c.Call && IsRegisterFloat(c.Ins) )
+        {
+            const uint64_t codePage = c.PC >> MiniCPU::CODE_PAGE_SHIFT;
+            auto found = mCPU.mCodePages.find(codePage);
+            MicroOp* ops = found != mCPU.mCodePages.end() ? found->second.get() : nullptr;
+            if( ops == nullptr && mCPU.mCodePages.size() < MiniCPU::MAX_CODE_PAGES )
+            {
+                ops = mCPU.AllocateCodePage(codePage);
+            }
+
+            if( ops )
+            {
+                c.Op = &ops[(c.PC & (MiniCPU::CODE_PAGE_SIZE-1)) / sizeof(Instruction)];
+            }
+        }
+    }
+
+    Offsets offsets;
+    const uint8_t* cpu = reinterpret_cast<const uint8_t*>(&mCPU);
+    offsets.Registers = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mCPU.mRegisters[0]) - cpu);
+    offsets.PC = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mCPU.mPC) - cpu);
+    offsets.Flags = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mCPU.mFlags.Result) - cpu);
+    offsets.ReadTLB = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mCPU.mReadTLB[0]) - cpu);
+    offsets.WriteTLB = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mCPU.mWriteTLB[0]) - cpu);
+    offsets.Remaining = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mContext.Remaining) - reinterpret_cast<const uint8_t*>(&mContext));
+    offsets.Owner = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mContext.Owner) - reinterpret_cast<const uint8_t*>(&mContext));
+    offsets.SideExit = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&mContext.SideExit) - reinterpret_cast<const uint8_t*>(&mContext));
+
+    BlockCompiler compiler(mCodeFree,offsets,mConditionMasks,reinterpret_cast<uint64_t>(&CallHandler));
+    compiler.Compile(code,endsWithJump);
+
+    const Block block = {mCodeFree,static_cast<uint32_t>(code.size())};
+    mCodeFree = compiler.GetPos();
+
+    // Chain the exits straight to the blocks they go to, or wait until that block is compiled.
+    for( const auto& exit : compiler.GetExits() )
+    {
+        X64Emitter::Patch(exit.Site,mExit);
+        if( exit.Linkable )
+        {
+            auto target = mBlocks.find(exit.Target);
+            if( exit.Target == a_PC )
+            {
+                X64Emitter::Patch(exit.Site,block.Entry);
+            }
+            else if( target == mBlocks.end() )
+            {
+                mPendingLinks.emplace(exit.Target,exit.Site);
+            }
+            else if( target->second.Entry )
+            {
+                X64Emitter::Patch(exit.Site,target->second.Entry);
+            }
+        }
+    }
+
+    auto waiting = mPendingLinks.equal_range(a_PC);
+    for( auto link = waiting.first ; link != waiting.second ; ++link )
+    {
+        X64Emitter::Patch(link->second,block.Entry);
+    }
+    mPendingLinks.erase(a_PC);
+
+    mStats.BlocksCompiled++;
+    mStats.InstructionsCompiled += code.size();
+    return block;
+}
+
+uint32_t JIT::CallHandler(JIT* a_JIT,uint64_t a_PC)
+{
+    MiniCPU& cpu = a_JIT->mCPU;
+    const uint64_t flushes = a_JIT->mStats.Flushes;
+    try
+    {
+        const MicroOp& op = cpu.GetMicroOp(a_PC);
+        cpu.mPC = a_PC + sizeof(Instruction);
+        op.Single(cpu,op);
+    }
+    catch(...)
+    {// Can not go back through the compiled code, Run throws it once out.
+        a_JIT->mThrown = std::current_exception();
+        a_JIT->mThrownPC = cpu.mPC;
+        return 1;
+    }
+
+    a_JIT->mStats.HandlerCalls++;
+    cpu.mFlags.Resolve();
+    return a_JIT->mStats.Flushes != flushes ? 1 : 0;
+}
+
+uint64_t JIT::Run(uint64_t a_MaxCycles)
+{
+    mContext.Remaining = static_cast<int64_t>(a_MaxCycles);
+    while( mContext.Remaining > 0 )
+    {
+        const Block& block = GetBlock(mCPU.mPC);
+        if( block.Entry && block.Length <= mContext.Remaining )
+        {
+            // Compiled code reads and writes the flags as a value, the low 32 bits of the result.
+            mCPU.mFlags.Resolve();
+            const int64_t before = mContext.Remaining;
+            mEnter(&mCPU,&mContext,block.Entry);
+            const uint64_t executed = static_cast<uint64_t>(before - mContext.Remaining);
+            mCPU.mCycleCount += executed;
+            mStats.NativeInstructions += executed;
+
+            if( mThrown )
+            {
+                std::exception_ptr thrown;
+                std::swap(thrown,mThrown);
+                mCPU.mPC = mThrownPC;
+                std::rethrow_exception(thrown);
+            }
+
+            // An instruction that keeps leaving, a store to a page with code or an access that crosses pages, is called
+            // from now on instead. Getting in and out of the block each time costs more than the call.
+            if( mContext.SideExit != NO_SIDE_EXIT )
+            {
+                if( ++mSideExits[mContext.SideExit] == SIDE_EXIT_LIMIT )
+                {
+                    mCalled.insert(mContext.SideExit);
+                    mSideExits.erase(mContext.SideExit);
+                    Flush();
+                }
+                mContext.SideExit = NO_SIDE_EXIT;
+            }
+
+            if( executed > 0 )
+            {
+                continue;
+            }
+        }
+
+        // Not compiled, or the block left on its first instruction, so the interpreter does it.
+        mCPU.Step();
+        mContext.Remaining--;
+        mStats.InterpretedInstructions++;
+        if( mCPU.mParked )
+        {
+            break;
+        }
+    }
+    return a_MaxCycles - static_cast<uint64_t>(mContext.Remaining);
+}
+
+#else // Not x86-64
+
+JIT::JIT(MiniCPU& a_CPU):mCPU(a_CPU)
+{
+    throw std::runtime_error("The JIT is only supported on x86-64");
+}
+
+JIT::~JIT()
+{
+}
+
+void JIT::Flush()
+{
+}
+
+void JIT::Invalidate(uint64_t a_Address,uint64_t a_Size)
+{
+}
+
+uint64_t JIT::Run(uint64_t a_MaxCycles)
+{
+    return 0;
+}
+
+#endif
+
+bool JIT::DifferentialTest(const std::vector<Instruction>& a_Program,uint64_t a_Cycles,uint64_t a_Interval,std::ostream& a_Log)
+{
+    std::unique_ptr<MiniCPU> interpreted(new MiniCPU());
+    std::unique_ptr<MiniCPU> compiled(new MiniCPU());
+    interpreted->LoadProgram(a_Program);
+    compiled->LoadProgram(a_Program);
+    compiled->EnableJIT(true);
+
+    for( uint64_t done = 0 ; done < a_Cycles ; done += a_Interval )
+    {
+        const uint64_t cycles = std::min(a_Interval,a_Cycles - done);
+        std::string interpretedError,compiledError;
+        try
+        {
+            interpreted->Run(cycles);
+        }
+        catch(const std::exception& e)
+        {
+            interpretedError = e.what();
+        }
+
+        try
+        {
+            compiled->Run(cycles);
+        }
+        catch(const std::exception& e)
+        {
+            compiledError = e.what();
+        }
+
+        if( interpretedError != compiledError )
+        {
+            a_Log << "JIT differential test failed between cycles " << done << " and " << done + cycles << ", interpreter [" << interpretedError << "] JIT [" << compiledError << "]" << std::endl;
+            return false;
+        }
+
+        const std::string difference = interpreted->CompareState(*compiled);
+        if( difference.size() )
+        {
+            a_Log << "JIT differential test failed between cycles " << done << " and " << done + cycles << ", " << difference << std::endl;
+            return false;
+        }
+
+        if( interpretedError.size() )
+        {
+            a_Log << "Both stopped with [" << interpretedError << "]" << std::endl;
+            break;
+        }
+    }
+
+    a_Log << "JIT differential test passed" << std::endl;
+    return true;
+}
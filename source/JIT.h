@@ -0,0 +1,128 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <ostream>
+#include <exception>
+#include <bitset>
+
+#include "MiniCPU.h"
+
+/**
+ * @brief Translates basic blocks of MiniCPU code into x86-64 and runs them.
+ * A block starts at the PC and runs until a JUMP, a RET, an instruction the JIT does not handle or the end of the code page.
+ * Anything the JIT does not handle is run by the interpreter, so the results are always the same as the interpreter.
+ *
+ * Handled in native code:-
+ *   LOAD, and JUMP using R15 (the target is known). Jumps are chained directly to the target block once it is compiled.
+ *   MOVE, ADD, SUB, CMP, MUL, AND, OR, XOR, NOT, LSL, LSR, ASR for all the integer data types and address modes.
+ * Called from native code, the block goes on after them:-
+ *   The rest, the float math, MEMSET, MEMCPY, SWAP and so on, through the handler the interpreter would use.
+ * A block ends at JUMP using a register, RET, PAUSE, SETINT and SGET, these move the PC or take interrupts.
+ * The most used guest registers in a block are held in host registers for the life of the block.
+ *
+ * Memory is accessed through the TLB of the CPU. A miss, an access that crosses a page or a write to a page that has code
+ * leaves the block at that instruction and the interpreter runs it, filling the TLB. That write then flushes the JIT if code was compiled from the page, so self modifying code works.
+ * An instruction that leaves SIDE_EXIT_LIMIT times is compiled as a call from then on, a store to a page with code
+ * always leaves for one. A call that flushes the JIT leaves the block after it.
+ * The cycle budget is checked at the start of every block, if there is not enough left for the whole block the
+ * interpreter does the rest one instruction at a time. So Run(N) always executes exactly N instructions, unless a PAUSE
+ * parks the CPU first.
+ */
+class JIT
+{
+public:
+    struct Stats
+    {
+        uint64_t BlocksCompiled = 0;
+        uint64_t InstructionsCompiled = 0;
+        uint64_t Flushes = 0;
+        uint64_t NativeInstructions = 0;        // Guest instructions executed by compiled code.
+        uint64_t InterpretedInstructions = 0;   // Guest instructions the interpreter had to do.
+        uint64_t HandlerCalls = 0;              // Native instructions that were calls to a handler.
+    };
+
+    JIT(MiniCPU& a_CPU);
+    ~JIT();
+
+    /**
+     * @brief Executes a_MaxCycles instructions. Returns the number of instructions executed.
+     */
+    uint64_t Run(uint64_t a_MaxCycles);
+
+    /**
+     * @brief Called when memory that has been decoded is written, throws away all compiled code if any came from there.
+     */
+    void Invalidate(uint64_t a_Address,uint64_t a_Size);
+
+    /**
+     * @brief Throws away all compiled code.
+     */
+    void Flush();
+
+    const Stats& GetStats()const{return mStats;}
+
+    /**
+     * @brief Runs the program on two CPUs, one interpreted and one with the JIT, comparing the state every a_Interval cycles.
+     * Returns true if they were the same all the way through. Any difference is written to the log.
+     */
+    static bool DifferentialTest(const std::vector<Instruction>& a_Program,uint64_t a_Cycles,uint64_t a_Interval,std::ostream& a_Log);
+
+private:
+    static const uint64_t CODE_BUFFER_SIZE = 4*1024*1024;
+    static const uint32_t MAX_BLOCK_LENGTH = 64;
+    static const uint32_t MAX_BLOCK_CODE_SIZE = 32*1024;
+    static const uint32_t SIDE_EXIT_LIMIT = 16;
+    static const uint64_t NO_SIDE_EXIT = ~0ull;
+
+    struct Block
+    {
+        uint8_t* Entry;     // nullptr if the first instruction can not be compiled.
+        uint32_t Length;    // Number of guest instructions.
+    };
+
+    // What the compiled code uses that is not in the CPU.
+    struct Context
+    {
+        int64_t Remaining;  // Cycle budget left.
+        JIT* Owner;         // For CallHandler.
+        uint64_t SideExit;  // PC of the instruction the block left before to let the interpreter do it.
+    };
+
+    typedef void (*EnterFunction)(MiniCPU* a_CPU,Context* a_Context,const uint8_t* a_Entry);
+
+    MiniCPU& mCPU;
+    Context mContext;
+    Stats mStats;
+
+    uint8_t* mCodeBuffer;
+    uint8_t* mCodeStart;    // After the enter / exit code.
+    uint8_t* mCodeFree;
+    uint8_t* mCodeEnd;
+    EnterFunction mEnter;
+    uint8_t* mExit;
+
+    std::unordered_map<uint64_t,Block> mBlocks;
+    std::unordered_multimap<uint64_t,uint8_t*> mPendingLinks;  // Exits waiting for the block at a PC to be compiled.
+    std::unordered_map<uint64_t,std::bitset<MiniCPU::PAGE_SIZE/sizeof(Instruction)>> mCompiledCode;  // Compiled instructions per page.
+    uint32_t mConditionMasks[16];  // Bit N set if the condition is true for flags value N.
+    std::unordered_map<uint64_t,uint32_t> mSideExits;          // Times the block left before the instruction at a PC.
+    std::unordered_set<uint64_t> mCalled;                      // PCs that left too often, they are called from now on.
+    std::exception_ptr mThrown;                                // What a handler threw and the PC it left.
+    uint64_t mThrownPC = 0;
+
+    /**
+     * @brief Runs the instruction at a_PC with its handler, for compiled code. Returns non zero if the block has to
+     * leave after it, the handler threw or the JIT was flushed.
+     */
+    static uint32_t CallHandler(JIT* a_JIT,uint64_t a_PC);
+
+    const Block& GetBlock(uint64_t a_PC);
+    Block Compile(uint64_t a_PC);
+    void BuildEnterExit();
+};
+
+#endif //__JIT_H__
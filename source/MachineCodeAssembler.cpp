@@ -1,10 +1,270 @@
 #include <iostream>
-#include  <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <memory>
+#include <unordered_map>
+#include <climits>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "MachineCodeAssembler.h"
-#include "Util.h"
+#include "Encoder.h"
+
+/**
+ * @brief Keywords are at most eight characters so are packed, upper cased, into a 64bit key.
+ * Returns zero, which is never a keyword, for anything that can not be one.
+ */
+static constexpr uint64_t MakeKey(std::string_view a_Word)
+{
+    if( a_Word.size() == 0 || a_Word.size() > 8 )
+    {
+        return 0;
+    }
+
+    uint64_t key = 0;
+    for( size_t n = 0 ; n < a_Word.size() ; n++ )
+    {
+        const char c = a_Word[n];
+        key |= static_cast<uint64_t>(static_cast<uint8_t>(c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c)) << (n * 8);
+    }
+    return key;
+}
+
+struct Keyword
+{
+    const char* Name;
+    uint32_t Value;
+};
+
+/**
+ * @brief Open addressed hash table of keywords, built by the compiler. SIZE is a power of two at least twice the number of keywords.
+ */
+template <size_t SIZE> class KeywordTable
+{
+public:
+    template <size_t COUNT> constexpr KeywordTable(const Keyword (&a_Keywords)[COUNT]):mKeys{},mValues{}
+    {
+        static_assert(COUNT * 2 <= SIZE,"Keyword table is too small");
+        for( const auto& keyword : a_Keywords )
+        {
+            const uint64_t key = MakeKey(keyword.Name);
+            size_t slot = Hash(key);
+            while( mKeys[slot] != 0 )
+            {
+                slot = (slot + 1) & (SIZE-1);
+            }
+            mKeys[slot] = key;
+            mValues[slot] = keyword.Value;
+        }
+    }
+
+    bool Find(std::string_view a_Word,uint32_t& r_Value)const
+    {
+        const uint64_t key = MakeKey(a_Word);
+        if( key == 0 )
+        {
+            return false;
+        }
+
+        for( size_t slot = Hash(key) ; mKeys[slot] != 0 ; slot = (slot + 1) & (SIZE-1) )
+        {
+            if( mKeys[slot] == key )
+            {
+                r_Value = mValues[slot];
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    uint64_t mKeys[SIZE];
+    uint32_t mValues[SIZE];
+
+    static constexpr size_t Hash(uint64_t a_Key)
+    {
+        return static_cast<size_t>((a_Key * 0x9e3779b97f4a7c15ull) >> 40) & (SIZE-1);
+    }
+};
+
+static constexpr Keyword sOpCodeNames[] =
+{
+#define MAKE_OPCODE(__OP_NAME__,__OP_CODE__)  {__OP_NAME__,__OP_CODE__},
+    OPERATION_CODES
+#undef MAKE_OPCODE
+};
+
+static constexpr Keyword sDataTypeNames[] =
+{
+    {"u8",DataType_UNSIGNED_INT_8},
+    {"u16",DataType_UNSIGNED_INT_16},
+    {"u32",DataType_UNSIGNED_INT_32},
+    {"u64",DataType_UNSIGNED_INT_64},
+    {"s8",DataType_SIGNED_INT_8},
+    {"s16",DataType_SIGNED_INT_16},
+    {"s32",DataType_SIGNED_INT_32},
+    {"s64",DataType_SIGNED_INT_64},
+
+    // Types for float math
+    {"float",DataType_FLOAT},
+    {"double",DataType_DOUBLE}
+};
+
+static constexpr Keyword sConditionNames[] =
+{
+    {"FALSE",ConCode_FALSE},
+    {"TRUE",ConCode_TRUE},
+    {"NEQ",ConCode_NEQ},
+    {"POS",ConCode_POS},
+    {"NZ",ConCode_NZ},
+    {"EQ",ConCode_EQ},
+    {"NE",ConCode_NE},
+    {"LT",ConCode_LT},
+    {"GT",ConCode_GT},
+    {"LE",ConCode_LE},
+    {"GE",ConCode_GE}
+};
+
+static constexpr KeywordTable<256> sOpCodes(sOpCodeNames);
+static constexpr KeywordTable<32> sDataTypes(sDataTypeNames);
+static constexpr KeywordTable<32> sConditions(sConditionNames);
+static constexpr uint64_t LOAD_KEY = MakeKey("LOAD");
+
+static bool IsWhiteSpace(char a_Char)
+{
+    return a_Char == ' ' || a_Char == '\t' || a_Char == '\r' || a_Char == '\n' || a_Char == '\v' || a_Char == '\f';
+}
+
+static std::string_view Trim(std::string_view a_String)
+{
+    while( a_String.size() && IsWhiteSpace(a_String.front()) )
+    {
+        a_String.remove_prefix(1);
+    }
+
+    while( a_String.size() && IsWhiteSpace(a_String.back()) )
+    {
+        a_String.remove_suffix(1);
+    }
+    return a_String;
+}
+
+// Everything before any // comment, trimmed.
+static std::string_view StripComment(std::string_view a_Line)
+{
+    const size_t comment = a_Line.find("//");
+    return Trim(comment == std::string_view::npos ? a_Line : a_Line.substr(0,comment));
+}
+
+/**
+ * @brief Reads hex, with or without the 0x. False if there are no digits or anything that is not one.
+ */
+static bool ParseHex(std::string_view a_String,uint64_t& r_Value)
+{
+    if( a_String.size() > 2 && a_String[0] == '0' && (a_String[1] == 'x' || a_String[1] == 'X') )
+    {
+        a_String.remove_prefix(2);
+    }
+
+    if( a_String.size() == 0 || a_String.size() > 16 )
+    {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for( const char c : a_String )
+    {
+        uint32_t digit;
+        if( c >= '0' && c <= '9' )
+        {
+            digit = c - '0';
+        }
+        else if( c >= 'a' && c <= 'f' )
+        {
+            digit = c - 'a' + 10;
+        }
+        else if( c >= 'A' && c <= 'F' )
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    r_Value = value;
+    return true;
+}
 
-MachineCodeAssembler::MachineCodeAssembler()
+static bool IsLabelCharacter(char a_Char)
+{
+    return (a_Char >= 'a' && a_Char <= 'z') || (a_Char >= 'A' && a_Char <= 'Z') || (a_Char >= '0' && a_Char <= '9') || a_Char == '_' || a_Char == '.';
+}
+
+// A label is a name then a colon at the start of the statement, r_Rest is the instruction after it if there is one.
+static bool SplitLabel(std::string_view a_Statement,std::string_view& r_Name,std::string_view& r_Rest)
+{
+    size_t n = 0;
+    while( n < a_Statement.size() && IsLabelCharacter(a_Statement[n]) )
+    {
+        n++;
+    }
+
+    if( n == 0 || n == a_Statement.size() || a_Statement[n] != ':' )
+    {
+        return false;
+    }
+    r_Name = a_Statement.substr(0,n);
+    r_Rest = Trim(a_Statement.substr(n + 1));
+    return true;
+}
+
+// Anything that is hex is read as the constant, so it can not be a label.
+static bool IsLabelName(std::string_view a_Name)
+{
+    uint64_t value;
+    if( a_Name.size() == 0 || (a_Name[0] >= '0' && a_Name[0] <= '9') || ParseHex(a_Name,value) )
+    {
+        return false;
+    }
+    return std::all_of(a_Name.begin(),a_Name.end(),IsLabelCharacter);
+}
+
+// A directive, a_Name then what it is given, the name in any case.
+static bool SplitDirective(std::string_view a_Statement,std::string_view a_Name,std::string_view& r_Rest)
+{
+    if( a_Statement.size() < a_Name.size() || (a_Statement.size() > a_Name.size() && !IsWhiteSpace(a_Statement[a_Name.size()])) )
+    {
+        return false;
+    }
+
+    for( size_t n = 0 ; n < a_Name.size() ; n++ )
+    {
+        const char c = a_Statement[n];
+        if( (c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c) != a_Name[n] )
+        {
+            return false;
+        }
+    }
+    r_Rest = Trim(a_Statement.substr(a_Name.size()));
+    return true;
+}
+
+// How many LOADs it takes to put a_Value in a register. The first sets the low 24 bits, each after ors in the next.
+static uint32_t LoadsFor(uint64_t a_Value)
+{
+    return a_Value < (1ull << 24) ? 1 : a_Value < (1ull << 48) ? 2 : 3;
+}
+
+MachineCodeAssembler::MachineCodeAssembler():mErrorCount(0)
 {
     assert( sizeof(Instruction) == sizeof(uint32_t) );
     assert( OP_LAST < 128 );
@@ -15,280 +275,1004 @@ MachineCodeAssembler::~MachineCodeAssembler()
 
 }
 
-std::vector<Instruction> MachineCodeAssembler::Compile(const std::string& pAssembler)const
+std::vector<Instruction> MachineCodeAssembler::Compile(std::string_view a_Assembler,std::ostream* a_Listing,uint32_t a_Threads,std::vector<uint32_t>* r_LineNumbers,std::vector<ProgramImage::Symbol>* r_Symbols)const
 {
+    std::vector<Chunk> chunks = CompileChunks(a_Assembler,a_Threads,a_Listing != nullptr,r_LineNumbers != nullptr);
+
+    LabelTable labels;
+    uint64_t code = 0;
+    uint64_t line = 0;
+    for( const auto& chunk : chunks )
+    {
+        labels.Append(chunk.Labels,code,line);
+        code += chunk.Code.size();
+        line += chunk.Lines;
+    }
+
+    if( r_Symbols )
+    {
+        r_Symbols->clear();
+    }
+
+    if( !labels.Empty() )
+    {
+        Layout layout = MakeLayout(labels);
+        code = 0;
+        line = 0;
+        for( auto& chunk : chunks )
+        {
+            const size_t size = chunk.Code.size();
+            Place(chunk,labels,layout,code,line,a_Listing != nullptr,r_LineNumbers != nullptr);
+            code += size;
+            line += chunk.Lines;
+        }
+
+        if( r_Symbols )
+        {
+            r_Symbols->swap(layout.Symbols);
+        }
+    }
+
+    size_t total = 0;
+    for( const auto& chunk : chunks )
+    {
+        total += chunk.Code.size();
+    }
+
     std::vector<Instruction> machineCode;
+    machineCode.reserve(total);
+    if( r_LineNumbers )
+    {
+        r_LineNumbers->clear();
+        r_LineNumbers->reserve(total);
+    }
 
-    int LineNumber = 0;
-    const StringVec CodeLines = SplitString(pAssembler,"\n");
-    for(const auto &line : CodeLines )
+    size_t lines = 0;
+    Emit(chunks,[&machineCode](const Instruction* a_Code,size_t a_Count)
     {
-        try
+        machineCode.insert(machineCode.end(),a_Code,a_Code + a_Count);
+    },a_Listing,r_LineNumbers,lines);
+    return machineCode;
+}
+
+uint64_t MachineCodeAssembler::CompileStream(std::istream& a_Source,const InstructionSink& a_Sink,std::ostream* a_Listing,uint32_t a_Threads,std::vector<ProgramImage::Symbol>* r_Symbols)const
+{
+    // The bytes from blockAt on that have been read, what is after the last new line of a block is kept for the next.
+    std::string block;
+    uint64_t blockAt = 0;
+    auto read = [&a_Source,&block,&blockAt](uint64_t a_Offset)
+    {
+        if( a_Offset < blockAt || a_Offset > blockAt + block.size() )
         {
-            LineNumber++;
-            if( line.size() > 1 )
+            a_Source.clear();
+            if( !a_Source.seekg(static_cast<std::streamoff>(a_Offset)) )
             {
-                const Instruction ins = MakeInstruction(line);
-                machineCode.push_back(ins);
+                throw std::runtime_error("Labels need the source read twice and the stream can not go back");
+            }
+            block.clear();
+        }
+        else
+        {
+            block.erase(0,a_Offset - blockAt);
+        }
+        blockAt = a_Offset;
 
-                const std::string cleaned = TrimWhiteSpace(SplitString(line,"//")[0]);
-                std::cout << "[" << cleaned << "] ";
+        size_t end = std::string::npos;
+        while( end == std::string::npos && a_Source )
+        {
+            const size_t carried = block.size();
+            block.resize(carried + STREAM_BLOCK_SIZE);
+            a_Source.read(&block[carried],STREAM_BLOCK_SIZE);
+            block.resize(carried + static_cast<size_t>(a_Source.gcount()));
+            end = block.rfind('\n');
+        }
+        end = a_Source && end != std::string::npos ? end + 1 : block.size();
+        return std::string_view(block).substr(0,end);
+    };
 
-                if( ins.Standard.IsLoad )
-                {
-                    std::cout   << ins.Load.IsLoad << " "
-                                << ins.Load.OrWithDest << " "
-                                << ins.Load.Shift << " "
-                                << ins.Load.Dest << " "
-                                << ins.Load.ConstantData;
-                }
-                else if( ins.Standard.OpCode == OP_JUMP )
+    return CompileBlocks(read,a_Sink,a_Listing,a_Threads,r_Symbols);
+}
+
+uint64_t MachineCodeAssembler::CompileFile(const std::string& a_Filename,const InstructionSink& a_Sink,std::ostream* a_Listing,uint32_t a_Threads,std::vector<ProgramImage::Symbol>* r_Symbols)const
+{
+    if( r_Symbols )
+    {
+        r_Symbols->clear();
+    }
+
+    const int file = open(a_Filename.c_str(),O_RDONLY);
+    if( file < 0 )
+    {
+        throw std::runtime_error("Failed to open " + a_Filename);
+    }
+
+    struct stat info;
+    if( fstat(file,&info) != 0 || info.st_size == 0 )
+    {
+        close(file);
+        return 0;
+    }
+
+    const size_t fileSize = static_cast<size_t>(info.st_size);
+    void* base = mmap(nullptr,fileSize,PROT_READ,MAP_PRIVATE,file,0);
+    close(file);
+    if( base == MAP_FAILED )
+    {
+        throw std::runtime_error("Failed to map " + a_Filename);
+    }
+    const std::shared_ptr<void> mapping(base,[fileSize](void* a_Base){munmap(a_Base,fileSize);});
+    madvise(base,fileSize,MADV_SEQUENTIAL);
+
+    const std::string_view source(static_cast<const char*>(base),fileSize);
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t done = 0;
+    auto read = [source,base,pageSize,&done](uint64_t a_Offset)
+    {
+        // The pages that are done would otherwise stay in memory until the file is unmapped.
+        const size_t release = (a_Offset / pageSize) * pageSize;
+        const size_t from = (done / pageSize) * pageSize;
+        if( release > from )
+        {
+            madvise(static_cast<char*>(base) + from,release - from,MADV_DONTNEED);
+        }
+        done = a_Offset;
+
+        // Back to the last new line in the block, or on to the end of a line longer than a block.
+        size_t end = source.size();
+        if( a_Offset + STREAM_BLOCK_SIZE < source.size() )
+        {
+            end = source.rfind('\n',a_Offset + STREAM_BLOCK_SIZE - 1);
+            if( end == std::string_view::npos || end < a_Offset )
+            {
+                end = source.find('\n',a_Offset + STREAM_BLOCK_SIZE);
+            }
+            end = end == std::string_view::npos ? source.size() : end + 1;
+        }
+        return source.substr(a_Offset,end - a_Offset);
+    };
+
+    return CompileBlocks(read,a_Sink,a_Listing,a_Threads,r_Symbols);
+}
+
+uint64_t MachineCodeAssembler::CompileBlocks(const BlockReader& a_Read,const InstructionSink& a_Sink,std::ostream* a_Listing,uint32_t a_Threads,std::vector<ProgramImage::Symbol>* r_Symbols)const
+{
+    if( r_Symbols )
+    {
+        r_Symbols->clear();
+    }
+
+    uint64_t count = 0;
+    auto counted = [&a_Sink,&count](const Instruction* a_Code,size_t a_Count)
+    {
+        count += a_Count;
+        a_Sink(a_Code,a_Count);
+    };
+
+    // Up to the first block with a label or a JUMP to one the code is what it will be and goes straight out. A .scratch
+    // before then is kept in labels.
+    LabelTable labels;
+    size_t lines = 0;
+    uint64_t offset = 0;
+    for( std::string_view block = a_Read(offset) ; block.size() ; block = a_Read(offset) )
+    {
+        const std::vector<Chunk> chunks = CompileChunks(block,a_Threads,a_Listing != nullptr,false);
+        const bool hasLabels = std::any_of(chunks.begin(),chunks.end(),[](const Chunk& a_Chunk){return !a_Chunk.Labels.Empty();});
+        if( hasLabels )
+        {
+            break;
+        }
+
+        for( const auto& chunk : chunks )
+        {
+            labels.Append(chunk.Labels,0,0);
+        }
+        Emit(chunks,counted,a_Listing,nullptr,lines);
+        offset += block.size();
+    }
+
+    // From there on, find all the labels and the JUMPs to them without keeping the code, then read it all again for
+    // the code once the JUMPs are placed.
+    const uint64_t firstOffset = offset;
+    uint64_t code = count;
+    uint64_t line = lines;
+    for( std::string_view block = a_Read(offset) ; block.size() ; block = a_Read(offset) )
+    {
+        const std::vector<Chunk> chunks = CompileChunks(block,a_Threads,false,false);
+        for( const auto& chunk : chunks )
+        {
+            labels.Append(chunk.Labels,code,line);
+            code += chunk.Code.size();
+            line += chunk.Lines;
+        }
+        offset += block.size();
+    }
+
+    if( labels.Empty() )
+    {
+        return count;
+    }
+
+    Layout layout = MakeLayout(labels);
+    code = count;
+    line = lines;
+    offset = firstOffset;
+    for( std::string_view block = a_Read(offset) ; block.size() ; block = a_Read(offset) )
+    {
+        std::vector<Chunk> chunks = CompileChunks(block,a_Threads,a_Listing != nullptr,false);
+        for( auto& chunk : chunks )
+        {
+            const size_t size = chunk.Code.size();
+            Place(chunk,labels,layout,code,line,a_Listing != nullptr,false);
+            code += size;
+            line += chunk.Lines;
+        }
+        Emit(chunks,counted,a_Listing,nullptr,lines);
+        offset += block.size();
+    }
+
+    if( r_Symbols )
+    {
+        r_Symbols->swap(layout.Symbols);
+    }
+    return count;
+}
+
+std::string_view MachineCodeAssembler::GetStatement(std::string_view a_Line)
+{
+    return StripComment(a_Line);
+}
+
+InstructionSink MachineCodeAssembler::MemorySink(GuestMemory& r_Memory,uint64_t a_Address)
+{
+    return [&r_Memory,a_Address](const Instruction* a_Code,size_t a_Count) mutable
+    {
+        r_Memory.Write(a_Address,a_Code,a_Count * sizeof(Instruction));
+        a_Address += a_Count * sizeof(Instruction);
+    };
+}
+
+std::vector<MachineCodeAssembler::Chunk> MachineCodeAssembler::CompileChunks(std::string_view a_Assembler,uint32_t a_Threads,bool a_Listing,bool a_LineNumbers)const
+{
+    uint32_t threads = a_Threads ? a_Threads : std::max(1u,std::thread::hardware_concurrency());
+    if( a_Assembler.size() < PARALLEL_MIN_SIZE )
+    {
+        threads = 1;
+    }
+
+    // Split into chunks of about the same size that end at the end of a line.
+    std::vector<Chunk> chunks;
+    const size_t numChunks = threads > 1 ? threads * CHUNKS_PER_THREAD : 1;
+    const size_t chunkSize = (a_Assembler.size() / numChunks) + 1;
+    while( a_Assembler.size() )
+    {
+        size_t end = a_Assembler.find('\n',std::min(chunkSize,a_Assembler.size()) - 1);
+        end = end == std::string_view::npos ? a_Assembler.size() : end + 1;
+        chunks.emplace_back();
+        chunks.back().Source = a_Assembler.substr(0,end);
+        a_Assembler.remove_prefix(end);
+    }
+
+    if( threads > 1 && chunks.size() > 1 )
+    {
+        std::atomic<size_t> next(0);
+        auto worker = [&]()
+        {
+            for( size_t n = next++ ; n < chunks.size() ; n = next++ )
+            {
+                CompileChunk(chunks[n],a_Listing,a_LineNumbers);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for( uint32_t n = 1 ; n < threads ; n++ )
+        {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for( auto& w : workers )
+        {
+            w.join();
+        }
+    }
+    else
+    {
+        for( auto& chunk : chunks )
+        {
+            CompileChunk(chunk,a_Listing,a_LineNumbers);
+        }
+    }
+
+    return chunks;
+}
+
+void MachineCodeAssembler::Emit(const std::vector<Chunk>& a_Chunks,const InstructionSink& a_Sink,std::ostream* a_Listing,std::vector<uint32_t>* r_LineNumbers,size_t& r_Lines)const
+{
+    for( const auto& chunk : a_Chunks )
+    {
+        if( chunk.Code.size() )
+        {
+            a_Sink(chunk.Code.data(),chunk.Code.size());
+        }
+        if( r_LineNumbers )
+        {
+            for( const uint32_t line : chunk.LineNumbers )
+            {
+                r_LineNumbers->push_back(static_cast<uint32_t>(r_Lines + line));
+            }
+        }
+        for( const auto& error : chunk.Errors )
+        {
+            std::cerr << (r_Lines + error.Line) << ": " << error.Message << std::endl;
+        }
+        mErrorCount += chunk.Errors.size();
+
+        if( a_Listing )
+        {
+            a_Listing->write(chunk.Listing.data(),chunk.Listing.size());
+        }
+        r_Lines += chunk.Lines;
+    }
+}
+
+void MachineCodeAssembler::LabelTable::Append(const LabelTable& a_Piece,uint64_t a_Code,uint64_t a_Line)
+{
+    for( const auto& definition : a_Piece.Definitions )
+    {
+        Definitions.push_back({definition.Name,a_Code + definition.Code,a_Line + definition.Line});
+    }
+
+    for( const auto& branch : a_Piece.Branches )
+    {
+        Branches.push_back({branch.Label,a_Code + branch.Code,a_Line + branch.Line,branch.Jump,branch.Scratch == SCRATCH_BEFORE ? Scratch : branch.Scratch});
+    }
+
+    if( a_Piece.Scratch != SCRATCH_BEFORE )
+    {
+        Scratch = a_Piece.Scratch;
+    }
+}
+
+// Where an instruction ends up is its index plus what the branches before it have grown by. A label on a long JUMP is
+// on the first of its LOADs.
+int64_t MachineCodeAssembler::Layout::Placed(const LabelTable& a_Labels,uint64_t a_Code)const
+{
+    const auto& branches = a_Labels.Branches;
+    const size_t before = std::lower_bound(branches.begin(),branches.end(),a_Code,[](const LabelTable::Branch& a_Branch,uint64_t a_Value){return a_Branch.Code < a_Value;}) - branches.begin();
+    return static_cast<int64_t>(a_Code) + Grown[before];
+}
+
+// To the label from the JUMP, the last of the a_Size instructions, or from zero.
+int64_t MachineCodeAssembler::Layout::Distance(const LabelTable& a_Labels,size_t a_Branch,uint32_t a_Size)const
+{
+    const LabelTable::Branch& branch = a_Labels.Branches[a_Branch];
+    const int64_t target = Placed(a_Labels,Targets[a_Branch]);
+    return branch.Jump.Jump.PCRelative ? target - (Placed(a_Labels,branch.Code) + a_Size - 1) : target;
+}
+
+MachineCodeAssembler::Layout MachineCodeAssembler::MakeLayout(const LabelTable& a_Labels)const
+{
+    Layout layout;
+    const size_t count = a_Labels.Branches.size();
+    layout.Targets.resize(count,0);
+    layout.Sizes.resize(count,0);
+    layout.Grown.resize(count + 1,0);
+
+    std::unordered_map<std::string_view,uint64_t> labels;
+    std::vector<const LabelTable::Definition*> defined;
+    labels.reserve(a_Labels.Definitions.size());
+    for( const auto& definition : a_Labels.Definitions )
+    {
+        if( labels.emplace(definition.Name,definition.Code).second )
+        {
+            defined.push_back(&definition);
+        }
+        else
+        {
+            layout.Errors.push_back({definition.Line,"Label " + definition.Name + " is already defined"});
+        }
+    }
+
+    // Through R15 a JUMP starts as the one instruction, through any other register it always has its LOAD.
+    for( size_t n = 0 ; n < count ; n++ )
+    {
+        const LabelTable::Branch& branch = a_Labels.Branches[n];
+        const auto found = labels.find(branch.Label);
+        if( found == labels.end() )
+        {
+            layout.Errors.push_back({branch.Line,"Label " + branch.Label + " is not defined"});
+            continue;
+        }
+        layout.Targets[n] = found->second;
+        layout.Sizes[n] = branch.Jump.Jump.OffsetRegister == REG_15 ? 1 : 2;
+    }
+
+    // One made longer can push others out of reach, so go round until none change. Sizes only go up, or to zero once
+    // for an error, so it ends.
+    bool changed = true;
+    while( changed )
+    {
+        changed = false;
+        for( size_t n = 0 ; n < count ; n++ )
+        {
+            layout.Grown[n + 1] = layout.Grown[n] + static_cast<int64_t>(layout.Sizes[n]) - 1;
+        }
+
+        for( size_t n = 0 ; n < count ; n++ )
+        {
+            const uint32_t size = layout.Sizes[n];
+            if( size == 0 )
+            {
+                continue;
+            }
+
+            const LabelTable::Branch& branch = a_Labels.Branches[n];
+            const int64_t distance = layout.Distance(a_Labels,n,size);
+            if( size == 1 )
+            {
+                if( distance >= (branch.Jump.Jump.PCRelative ? INT16_MIN : 0) && distance <= INT16_MAX )
                 {
-                    std::cout   << ins.Jump.IsLoad << " "
-                                << ins.Jump.OpCode << " "
-                                << ins.Jump.Condition << " "
-                                << ins.Jump.PCRelative << " "
-                                << ins.Jump.OffsetRegister << " "
-                                << ins.Jump.ConstantData;
+                    continue;
                 }
-                else
+
+                if( branch.Scratch == LabelTable::SCRATCH_BEFORE || branch.Scratch == REG_15 )
                 {
-                    std::cout   << ins.Standard.IsLoad << " "
-                                << ins.Standard.OpCode << " "
-                                << ins.Standard.Source << " "
-                                << ins.Standard.SourceIsAddress << " "
-                                << ins.Standard.Dest << " "
-                                << ins.Standard.DestIsAddress << " "
-                                << ins.Standard.DataType << " "
-                                << ins.Standard.ConstantData;
+                    layout.Errors.push_back({branch.Line,"JUMP to " + branch.Label + " is too far for the constant, put a .scratch line before it naming a register it can use"});
+                    layout.Sizes[n] = 0;
+                    changed = true;
+                    continue;
                 }
+            }
 
-                std::cout << " Bytes: 0x" << std::setfill('0') << std::setw(8) << std::hex << ins.Bytes << std::dec;
-                std::cout << std::endl;
+            const uint32_t needed = 1 + LoadsFor(static_cast<uint64_t>(distance));
+            if( needed > size )
+            {
+                layout.Sizes[n] = needed;
+                changed = true;
             }
         }
-        catch(const std::exception& e)
+    }
+
+    std::stable_sort(layout.Errors.begin(),layout.Errors.end(),[](const LineError& a_Left,const LineError& a_Right){return a_Left.Line < a_Right.Line;});
+
+    // Now the JUMPs have their sizes the labels are where they will be, the first of a name is the one JUMPs go to.
+    layout.Symbols.reserve(defined.size());
+    for( const LabelTable::Definition* definition : defined )
+    {
+        layout.Symbols.push_back({definition->Name,static_cast<uint64_t>(layout.Placed(a_Labels,definition->Code)) * sizeof(Instruction)});
+    }
+    return layout;
+}
+
+void MachineCodeAssembler::Place(Chunk& r_Chunk,const LabelTable& a_Labels,const Layout& a_Layout,uint64_t a_Code,uint64_t a_Line,bool a_Listing,bool a_LineNumbers)const
+{
+    // The errors on the lines of the chunk.
+    auto byLine = [](const LineError& a_Error,uint64_t a_Value){return a_Error.Line < a_Value;};
+    const size_t errors = r_Chunk.Errors.size();
+    for( auto error = std::lower_bound(a_Layout.Errors.begin(),a_Layout.Errors.end(),a_Line + 1,byLine) ; error != a_Layout.Errors.end() && error->Line <= a_Line + r_Chunk.Lines ; ++error )
+    {
+        r_Chunk.Errors.push_back({error->Line - a_Line,error->Message});
+    }
+    if( r_Chunk.Errors.size() > errors )
+    {
+        std::stable_sort(r_Chunk.Errors.begin(),r_Chunk.Errors.end(),[](const LineError& a_Left,const LineError& a_Right){return a_Left.Line < a_Right.Line;});
+    }
+
+    const auto& branches = a_Labels.Branches;
+    size_t first = std::lower_bound(branches.begin(),branches.end(),a_Code,[](const LabelTable::Branch& a_Branch,uint64_t a_Value){return a_Branch.Code < a_Value;}) - branches.begin();
+    const uint64_t end = a_Code + r_Chunk.Code.size();
+    if( first == branches.size() || branches[first].Code >= end )
+    {
+        return;
+    }
+
+    std::vector<Instruction> code;
+    std::vector<uint32_t> lineNumbers;
+    std::string listing;
+    code.reserve(r_Chunk.Code.size() + ((r_Chunk.BranchListing.size() + 1) * 3));
+    size_t from = 0;
+    size_t listed = 0;
+    for( size_t b = 0 ; first + b < branches.size() && branches[first + b].Code < end ; b++ )
+    {
+        const size_t n = first + b;
+        const LabelTable::Branch& branch = branches[n];
+        const size_t at = static_cast<size_t>(branch.Code - a_Code);
+        code.insert(code.end(),r_Chunk.Code.begin() + from,r_Chunk.Code.begin() + at);
+        if( a_LineNumbers )
+        {
+            lineNumbers.insert(lineNumbers.end(),r_Chunk.LineNumbers.begin() + from,r_Chunk.LineNumbers.begin() + at);
+        }
+        if( a_Listing )
+        {
+            listing.append(r_Chunk.Listing,listed,r_Chunk.BranchListing[b].At - listed);
+            listed = r_Chunk.BranchListing[b].At;
+        }
+        from = at + 1;
+
+        const uint32_t size = a_Layout.Sizes[n];
+        if( size == 0 )
+        {
+            continue;
+        }
+
+        const JumpInstruction& jump = branch.Jump.Jump;
+        const int64_t distance = a_Layout.Distance(a_Labels,n,size);
+        Instruction made[4];
+        if( size == 1 )
+        {
+            made[0] = EncodeJump(jump.Condition,jump.PCRelative,REG_15,static_cast<int16_t>(distance));
+        }
+        else
         {
-            std::cerr << LineNumber << ": " << e.what() << " : " << line << std::endl;
-        }        
+            // It can have more LOADs than the distance now needs, the extra ones or in zeros.
+            const uint32_t reg = jump.OffsetRegister == REG_15 ? branch.Scratch : jump.OffsetRegister;
+            const uint64_t value = static_cast<uint64_t>(distance);
+            const uint32_t loads = size - 1;
+            made[0] = EncodeLoad(reg,static_cast<uint32_t>(value & 0x00ffffff));
+            if( loads > 1 )
+            {
+                made[1] = EncodeLoad(reg,static_cast<uint32_t>((value >> 24) & 0x00ffffff),1,true);
+            }
+            if( loads > 2 )
+            {
+                made[2] = EncodeLoad(reg,static_cast<uint32_t>(value >> 48),2,true);
+            }
+            made[loads] = EncodeJump(jump.Condition,jump.PCRelative,reg,0);
+        }
+
+        for( uint32_t i = 0 ; i < size ; i++ )
+        {
+            code.push_back(made[i]);
+            if( a_LineNumbers )
+            {
+                lineNumbers.push_back(static_cast<uint32_t>(branch.Line - a_Line));
+            }
+            if( a_Listing )
+            {
+                ListInstruction(listing,r_Chunk.BranchListing[b].Statement,made[i]);
+            }
+        }
     }
 
-    return machineCode;
+    code.insert(code.end(),r_Chunk.Code.begin() + from,r_Chunk.Code.end());
+    r_Chunk.Code.swap(code);
+    if( a_LineNumbers )
+    {
+        lineNumbers.insert(lineNumbers.end(),r_Chunk.LineNumbers.begin() + from,r_Chunk.LineNumbers.end());
+        r_Chunk.LineNumbers.swap(lineNumbers);
+    }
+    if( a_Listing )
+    {
+        listing.append(r_Chunk.Listing,listed,std::string::npos);
+        r_Chunk.Listing.swap(listing);
+    }
 }
 
-uint32_t MachineCodeAssembler::GetDataType(const std::string& a_Type)const
+void MachineCodeAssembler::Link(std::vector<Instruction>& r_Code,const LabelTable& a_Labels,std::vector<LineError>& r_Errors,std::vector<ProgramImage::Symbol>* r_Symbols)const
 {
-#define DEF_DATA_TYPE(__name__,__value__)   if( CompareNoCase(a_Type,(__name__)) ){return (__value__);}
+    if( r_Symbols )
+    {
+        r_Symbols->clear();
+    }
 
-    DEF_DATA_TYPE("u8",DataType_UNSIGNED_INT_8);
-    DEF_DATA_TYPE("u16",DataType_UNSIGNED_INT_16);
-    DEF_DATA_TYPE("u32",DataType_UNSIGNED_INT_32);
-    DEF_DATA_TYPE("u64",DataType_UNSIGNED_INT_64);
-    DEF_DATA_TYPE("s8",DataType_SIGNED_INT_8);
-    DEF_DATA_TYPE("s16",DataType_SIGNED_INT_16);
-    DEF_DATA_TYPE("s32",DataType_SIGNED_INT_32);
-    DEF_DATA_TYPE("s64",DataType_SIGNED_INT_64);
+    if( a_Labels.Empty() )
+    {
+        return;
+    }
 
-    // Types for float math
-    DEF_DATA_TYPE("float",DataType_FLOAT);
-    DEF_DATA_TYPE("double",DataType_DOUBLE);
+    Layout layout = MakeLayout(a_Labels);
+    Chunk whole;
+    whole.Code.swap(r_Code);
+    Place(whole,a_Labels,layout,0,0,false,false);
+    whole.Code.swap(r_Code);
+    r_Errors.insert(r_Errors.end(),layout.Errors.begin(),layout.Errors.end());
+    if( r_Symbols )
+    {
+        r_Symbols->swap(layout.Symbols);
+    }
+}
+
+void MachineCodeAssembler::CompileChunk(Chunk& r_Chunk,bool a_Listing,bool a_LineNumbers)const
+{
+    std::string_view source = r_Chunk.Source;
+    r_Chunk.Code.reserve(std::count(source.begin(),source.end(),'\n') + 1);
+    while( source.size() )
+    {
+        const size_t end = source.find('\n');
+        const std::string_view line = source.substr(0,end);
+        source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+        r_Chunk.Lines++;
+
+        const std::string_view cleaned = StripComment(line);
+        if( cleaned.size() == 0 )
+        {
+            continue;
+        }
+
+        try
+        {
+            const size_t branches = r_Chunk.Labels.Branches.size();
+            Instruction ins;
+            if( !AssembleStatement(cleaned,r_Chunk.Code.size(),r_Chunk.Lines,r_Chunk.Labels,ins) )
+            {
+                continue;
+            }
 
-#undef DEF_DATA_TYPE
+            if( r_Chunk.Labels.Branches.size() > branches )
+            {
+                r_Chunk.BranchListing.push_back({cleaned,r_Chunk.Listing.size()});
+            }
+            else if( a_Listing )
+            {
+                ListInstruction(r_Chunk.Listing,cleaned,ins);
+            }
 
-    return DataType_IGNORE;
+            r_Chunk.Code.push_back(ins);
+            if( a_LineNumbers )
+            {
+                r_Chunk.LineNumbers.push_back(static_cast<uint32_t>(r_Chunk.Lines));
+            }
+        }
+        catch(const std::exception& e)
+        {
+            r_Chunk.Errors.push_back({r_Chunk.Lines,std::string(e.what()) + " : " + std::string(line)});
+        }
+    }
 }
 
-uint32_t MachineCodeAssembler::GetRegister(const std::string& a_Type)const
+ProgramImage MachineCodeAssembler::CompileImage(std::string_view a_Assembler,std::ostream* a_Listing,uint32_t a_Threads,std::vector<uint32_t>* r_LineNumbers)const
 {
-#define DEF_REGISTER(__name__,__value__)   if( CompareNoCase(a_Type,(__name__)) ){return (__value__);}
+    std::vector<ProgramImage::Symbol> symbols;
+    const std::vector<Instruction> machineCode = Compile(a_Assembler,a_Listing,a_Threads,r_LineNumbers,&symbols);
 
-    DEF_REGISTER("r0",REG_0);
-    DEF_REGISTER("r1",REG_1);
-    DEF_REGISTER("r2",REG_2);
-    DEF_REGISTER("r3",REG_3);
-    DEF_REGISTER("r4",REG_4);
-    DEF_REGISTER("r5",REG_5);
-    DEF_REGISTER("r6",REG_6);
-    DEF_REGISTER("r7",REG_7);
-    DEF_REGISTER("r8",REG_8);
-    DEF_REGISTER("r9",REG_9);
-    DEF_REGISTER("r10",REG_10);
-    DEF_REGISTER("r11",REG_11);
-    DEF_REGISTER("r12",REG_12);
-    DEF_REGISTER("r13",REG_13);
-    DEF_REGISTER("r14",REG_14);
-    DEF_REGISTER("r15",REG_14);
+    ProgramImage image;
+    image.AddSection(ProgramImage::SECTION_CODE,0,machineCode.data(),machineCode.size() * sizeof(Instruction));
+    image.SetEntry(0);
+    for( const auto& symbol : symbols )
+    {
+        image.AddSymbol(symbol.Name,symbol.Address);
+    }
+    return image;
+}
+
+static void AppendNumber(std::string& r_String,uint64_t a_Value)
+{
+    char buffer[24];
+    const auto result = std::to_chars(buffer,buffer + sizeof(buffer),a_Value);
+    r_String.append(buffer,result.ptr);
+}
 
-    DEF_REGISTER("&r0",REG_0|REG_IS_ADDRESS);
-    DEF_REGISTER("&r1",REG_1|REG_IS_ADDRESS);
-    DEF_REGISTER("&r2",REG_2|REG_IS_ADDRESS);
-    DEF_REGISTER("&r3",REG_3|REG_IS_ADDRESS);
-    DEF_REGISTER("&r4",REG_4|REG_IS_ADDRESS);
-    DEF_REGISTER("&r5",REG_5|REG_IS_ADDRESS);
-    DEF_REGISTER("&r6",REG_6|REG_IS_ADDRESS);
-    DEF_REGISTER("&r7",REG_7|REG_IS_ADDRESS);
-    DEF_REGISTER("&r8",REG_8|REG_IS_ADDRESS);
-    DEF_REGISTER("&r9",REG_9|REG_IS_ADDRESS);
-    DEF_REGISTER("&r10",REG_10|REG_IS_ADDRESS);
-    DEF_REGISTER("&r11",REG_11|REG_IS_ADDRESS);
-    DEF_REGISTER("&r12",REG_12|REG_IS_ADDRESS);
-    DEF_REGISTER("&r13",REG_13|REG_IS_ADDRESS);
-    DEF_REGISTER("&r14",REG_14|REG_IS_ADDRESS);
-    DEF_REGISTER("&r15",REG_15|REG_IS_ADDRESS);
+// Fields of the instruction then the encoding, the same as the listing has always been.
+void MachineCodeAssembler::ListInstruction(std::string& r_Listing,std::string_view a_Line,const Instruction& ins)const
+{
+    r_Listing += '[';
+    r_Listing += a_Line;
+    r_Listing += "] ";
 
-#undef DEF_REGISTER
+    auto fields = [&r_Listing](std::initializer_list<uint64_t> a_Fields)
+    {
+        bool first = true;
+        for( const uint64_t field : a_Fields )
+        {
+            if( !first )
+            {
+                r_Listing += ' ';
+            }
+            AppendNumber(r_Listing,field);
+            first = false;
+        }
+    };
 
-    return DataType_IGNORE;
+    if( ins.Standard.IsLoad )
+    {
+        fields({ins.Load.IsLoad,ins.Load.OrWithDest,ins.Load.Shift,ins.Load.Dest,ins.Load.ConstantData});
+    }
+    else if( ins.Standard.OpCode == OP_JUMP )
+    {
+        fields({ins.Jump.IsLoad,ins.Jump.OpCode,ins.Jump.Condition,ins.Jump.PCRelative,ins.Jump.OffsetRegister});
+        r_Listing += ' ';
+        if( ins.Jump.ConstantData < 0 )
+        {
+            r_Listing += '-';
+        }
+        AppendNumber(r_Listing,static_cast<uint64_t>(std::abs(static_cast<int32_t>(ins.Jump.ConstantData))));
+    }
+    else
+    {
+        fields({ins.Standard.IsLoad,ins.Standard.OpCode,ins.Standard.Source,ins.Standard.SourceIsAddress,
+                ins.Standard.Dest,ins.Standard.DestIsAddress,ins.Standard.DataType,ins.Standard.ConstantData});
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    r_Listing += " Bytes: 0x";
+    for( int shift = 28 ; shift >= 0 ; shift -= 4 )
+    {
+        r_Listing += hex[(ins.Bytes >> shift) & 0xf];
+    }
+    r_Listing += '\n';
 }
 
-uint32_t MachineCodeAssembler::GetCondition(const std::string& a_Condition)const
+uint32_t MachineCodeAssembler::GetDataType(std::string_view a_Type)const
 {
-    if( TrimWhiteSpace(a_Condition).size() == 0 )
+    uint32_t type;
+    return sDataTypes.Find(a_Type,type) ? type : static_cast<uint32_t>(DataType_IGNORE);
+}
+
+// R0 to R15, & or $ in front says the register is an address. Anything else, like -, is R0.
+uint32_t MachineCodeAssembler::GetRegister(std::string_view a_Register)const
+{
+    uint32_t address = 0;
+    if( a_Register.size() > 1 && (a_Register[0] == '&' || a_Register[0] == '$') )
     {
-        throw std::runtime_error("Empty condition code not supported");
+        address = REG_IS_ADDRESS;
+        a_Register.remove_prefix(1);
     }
 
+    if( a_Register.size() < 2 || a_Register.size() > 3 || (a_Register[0] != 'r' && a_Register[0] != 'R') )
+    {
+        return DataType_IGNORE;
+    }
 
-#define DEF_CONDITION_CODE(__name__,__value__)   if( CompareNoCase(a_Condition,(__name__)) ){return (__value__);}
+    uint32_t number = 0;
+    for( size_t n = 1 ; n < a_Register.size() ; n++ )
+    {
+        if( a_Register[n] < '0' || a_Register[n] > '9' )
+        {
+            return DataType_IGNORE;
+        }
+        number = (number * 10) + (a_Register[n] - '0');
+    }
 
-    DEF_CONDITION_CODE("FALSE",ConCode_FALSE);
-    DEF_CONDITION_CODE("TRUE",ConCode_TRUE);
-    DEF_CONDITION_CODE("NEQ",ConCode_NEQ);
-    DEF_CONDITION_CODE("POS",ConCode_POS);
-    DEF_CONDITION_CODE("NZ",ConCode_NZ);
-    DEF_CONDITION_CODE("EQ",ConCode_EQ);
-    DEF_CONDITION_CODE("NE",ConCode_NE);
-    DEF_CONDITION_CODE("LT",ConCode_LT);
-    DEF_CONDITION_CODE("GT",ConCode_GT);
-    DEF_CONDITION_CODE("LE",ConCode_LE);
-    DEF_CONDITION_CODE("GE",ConCode_GE);
+    if( number >= NUMBER_REGISTERS || (a_Register.size() == 3 && a_Register[1] == '0') )
+    {
+        return DataType_IGNORE;
+    }
+    return number | address;
+}
 
-#undef DEF_CONDITION_CODE
+uint32_t MachineCodeAssembler::GetCondition(std::string_view a_Condition)const
+{
+    if( a_Condition.size() == 0 )
+    {
+        throw std::runtime_error("Empty condition code not supported");
+    }
 
-    throw std::runtime_error("Unknown condition code " + a_Condition);
+    uint32_t condition;
+    if( !sConditions.Find(a_Condition,condition) )
+    {
+        throw std::runtime_error("Unknown condition code " + std::string(a_Condition));
+    }
+    return condition;
 }
 
-uint16_t MachineCodeAssembler::GetConstantDataUNSIGNED(const std::string& a_Data)const
+// Constants that are not used can be given as -, they are zero. Standard instructions have 12 bits for it.
+uint16_t MachineCodeAssembler::GetConstantDataUNSIGNED(std::string_view a_Data)const
 {
-    uint16_t data;
-    sscanf(a_Data.c_str(),"0x%hx",&data);
+    uint64_t data = 0;
+    if( a_Data != "-" && !ParseHex(a_Data,data) )
+    {
+        throw std::runtime_error("Bad constant data " + std::string(a_Data) + ", expected hex");
+    }
 
-    return data;
+    if( data > 0x0fff )
+    {
+        throw std::runtime_error("Malformed instruction, the constant data is too large, only 12bit values allowed. Was given " + std::string(a_Data));
+    }
+    return static_cast<uint16_t>(data);
 }
 
-int16_t MachineCodeAssembler::GetConstantDataSIGNED(const std::string& a_Data)const
+// JUMP has 16 bits, negative offsets are given as their two's complement, 0xfffc is back four instructions.
+int16_t MachineCodeAssembler::GetConstantDataSIGNED(std::string_view a_Data)const
 {
-    int16_t data;
-    sscanf(a_Data.c_str(),"0x%hx",&data);
+    uint64_t data = 0;
+    if( a_Data != "-" && !ParseHex(a_Data,data) )
+    {
+        throw std::runtime_error("Bad constant data " + std::string(a_Data) + ", expected hex");
+    }
 
-    return data;
+    if( data > 0xffff )
+    {
+        throw std::runtime_error("Malformed instruction, the constant data for JUMP is too large, only 16bit values allowed. Was given " + std::string(a_Data));
+    }
+    return static_cast<int16_t>(static_cast<uint16_t>(data));
 }
 
-uint32_t MachineCodeAssembler::GetValue(const std::string& a_Data,uint32_t a_AllowedMax)const
+uint32_t MachineCodeAssembler::GetValue(std::string_view a_Data,uint32_t a_AllowedMax)const
 {
-    const uint32_t value = std::stoul(a_Data,nullptr,16);
+    uint64_t value;
+    if( !ParseHex(a_Data,value) )
+    {
+        throw std::runtime_error("Reading value from string failed, expected hex and was given " + std::string(a_Data));
+    }
+
     if( value > a_AllowedMax )
     {
         throw std::runtime_error("Reading value from string failed, allowed range is 0 to " + std::to_string(a_AllowedMax) + " value read was " + std::to_string(value) );
     }
 
-    return value;
+    return static_cast<uint32_t>(value);
 }
 
 
-Instruction MachineCodeAssembler::MakeInstruction(const std::string& a_InstructionDescription)const
+bool MachineCodeAssembler::AssembleStatement(std::string_view a_Statement,uint64_t a_Code,uint64_t a_Line,LabelTable& r_Labels,Instruction& r_Instruction)const
+{
+    std::string_view name;
+    if( SplitLabel(a_Statement,name,a_Statement) )
+    {
+        if( !IsLabelName(name) )
+        {
+            throw std::runtime_error("Bad label name " + std::string(name) + ", it can not be hex or start with a digit");
+        }
+        r_Labels.Definitions.push_back({std::string(name),a_Code,a_Line});
+        if( a_Statement.size() == 0 )
+        {
+            return false;
+        }
+    }
+
+    std::string_view scratch;
+    if( SplitDirective(a_Statement,".SCRATCH",scratch) )
+    {
+        const uint32_t reg = GetRegister(scratch);
+        if( scratch.size() < 2 || (scratch[0] != 'r' && scratch[0] != 'R') || (reg == DataType_IGNORE && scratch.substr(1) != "0") )
+        {
+            throw std::runtime_error("Bad .scratch register " + std::string(scratch) + ", expected R0 to R15");
+        }
+        r_Labels.Scratch = reg;
+        return false;
+    }
+
+    std::string_view label;
+    r_Instruction = Assemble(a_Statement,label);
+    if( label.size() )
+    {
+        r_Labels.Branches.push_back({std::string(label),a_Code,a_Line,r_Instruction,r_Labels.Scratch});
+    }
+    return true;
+}
+
+Instruction MachineCodeAssembler::MakeInstruction(std::string_view a_InstructionDescription)const
+{
+    std::string_view label;
+    const Instruction ins = Assemble(a_InstructionDescription,label);
+    if( label.size() )
+    {
+        throw std::runtime_error("Label " + std::string(label) + " is not defined");
+    }
+    return ins;
+}
+
+Instruction MachineCodeAssembler::Assemble(std::string_view a_InstructionDescription,std::string_view& r_Label)const
 {
     Instruction newInstruction;
     newInstruction.Bytes = 0;
 
-    const StringVec operation = SplitInstruction(a_InstructionDescription);
-    const std::string instruction = operation[0];
-    const StringVec params = SplitString(operation[1],",");
-    
-    if( params.size() != 4 )
+    // The mnemonic, then white space, then four params split by commas.
+    const std::string_view description = Trim(a_InstructionDescription);
+    size_t split = 0;
+    while( split < description.size() && !IsWhiteSpace(description[split]) )
+    {
+        split++;
+    }
+
+    const std::string_view instruction = description.substr(0,split);
+    std::string_view rest = description.substr(split);
+    if( instruction.size() == 0 )
+    {
+        throw std::runtime_error("No instruction found for instruction declaration [" + std::string(a_InstructionDescription) + "]");
+    }
+
+    std::string_view params[4];
+    size_t numParams = 0;
+    while( rest.size() && numParams < 5 )
     {
-        throw std::runtime_error("Malformed instruction, all instructions have four params, even if not used. num params found " + std::to_string(params.size()) + " " + a_InstructionDescription);
+        const size_t comma = rest.find(',');
+        if( numParams < 4 )
+        {
+            params[numParams] = Trim(rest.substr(0,comma));
+        }
+        numParams++;
+        rest.remove_prefix(comma == std::string_view::npos ? rest.size() : comma + 1);
+    }
+
+    if( numParams != 4 )
+    {
+        throw std::runtime_error("Malformed instruction, all instructions have four params, even if not used. num params found " + std::to_string(numParams) + " " + std::string(a_InstructionDescription));
     }
 
     // We have three command formats.
     // LOAD is denoted by the first bit, and so is not listed in the opcode enum.
     // JUMP is in the opcode but has a different definition of the four params.
     // The rest follow the same rules.
-    if( CompareNoCase(instruction,"LOAD") )
+    const uint64_t key = MakeKey(instruction);
+    if( key == LOAD_KEY )
     {
         const uint32_t dest = GetRegister(params[2]);
         if( IsRegisterAddress(dest) )
         {
             // Sorry, for jump register can't be a read address.
-            throw std::runtime_error("Malformed instruction, the LOAD instruction can not use registers as an indirect address " + a_InstructionDescription);
+            throw std::runtime_error("Malformed instruction, the LOAD instruction can not use registers as an indirect address " + std::string(a_InstructionDescription));
         }
 
         newInstruction.Load.IsLoad = 1;
         newInstruction.Load.OrWithDest = GetValue(params[0],1);
         newInstruction.Load.Shift = GetValue(params[1],2);
-        newInstruction.Load.Dest = (dest&0x15);
-
-        const uint32_t value = std::stoul(params[3],nullptr,16);
+        newInstruction.Load.Dest = (dest&0x0f);
 
-        if( value > 0x00ffffff )
+        uint64_t value;
+        if( !ParseHex(params[3],value) || value > 0x00ffffff )
         {
-            throw std::runtime_error("Malformed instruction, the constant data for LOAD is too large, only 24bit values allowed. Was given " + params[3]);
+            throw std::runtime_error("Malformed instruction, the constant data for LOAD is too large, only 24bit values allowed. Was given " + std::string(params[3]));
         }
 
-        newInstruction.Load.ConstantData = value;
+        newInstruction.Load.ConstantData = static_cast<uint32_t>(value);
 
     }
-    else if( CompareNoCase(instruction,"JUMP") )
+    else
     {
-        const uint32_t dest = GetRegister(params[2]);
-        if( IsRegisterAddress(dest) )
+        const uint32_t opCode = GetOpCode(instruction);
+        if( opCode == OP_JUMP )
         {
-            // Sorry, for jump register can't be a read address.
-            throw std::runtime_error("Malformed instruction, the JUMP instruction can not use registers as an indirect address " + a_InstructionDescription);
-        }
+            const uint32_t dest = GetRegister(params[2]);
+            if( IsRegisterAddress(dest) )
+            {
+                // Sorry, for jump register can't be a read address.
+                throw std::runtime_error("Malformed instruction, the JUMP instruction can not use registers as an indirect address " + std::string(a_InstructionDescription));
+            }
 
-        newInstruction.Jump.IsLoad = 0;
-        newInstruction.Jump.OpCode = OP_JUMP;
-        newInstruction.Jump.Condition = GetCondition(params[0]);
-        newInstruction.Jump.PCRelative = GetValue(params[1],1);
-        newInstruction.Jump.OffsetRegister = (dest&0x15);
-        newInstruction.Jump.ConstantData = GetConstantDataSIGNED(params[3]);
+            newInstruction.Jump.IsLoad = 0;
+            newInstruction.Jump.OpCode = OP_JUMP;
+            newInstruction.Jump.Condition = GetCondition(params[0]);
+            newInstruction.Jump.PCRelative = GetValue(params[1],1);
+            newInstruction.Jump.OffsetRegister = (dest&0x0f);
 
-    }
-    else
-    {
-        const uint32_t source = GetRegister(params[1]);
-        const uint32_t dest = GetRegister(params[2]);
+            // Not hex, a label. The constant is filled in by Link.
+            uint64_t constant;
+            if( params[3] != "-" && !ParseHex(params[3],constant) )
+            {
+                if( !IsLabelName(params[3]) )
+                {
+                    throw std::runtime_error("Bad constant data " + std::string(params[3]) + ", expected hex or a label");
+                }
+                r_Label = params[3];
+            }
+            else
+            {
+                newInstruction.Jump.ConstantData = GetConstantDataSIGNED(params[3]);
+            }
+        }
+        else
+        {
+            const uint32_t source = GetRegister(params[1]);
+            const uint32_t dest = GetRegister(params[2]);
 
-        newInstruction.Standard.OpCode = GetOpCode(instruction);
-        newInstruction.Standard.Source = (source&0x15);
-        newInstruction.Standard.Dest = (dest&0x15);
+            newInstruction.Standard.OpCode = opCode;
+            newInstruction.Standard.Source = (source&0x0f);
+            newInstruction.Standard.Dest = (dest&0x0f);
 
-        if( IsRegisterAddress(source) )
-        {
-            newInstruction.Standard.SourceIsAddress = 1;
-        }
+            if( IsRegisterAddress(source) )
+            {
+                newInstruction.Standard.SourceIsAddress = 1;
+            }
 
-        if( IsRegisterAddress(source) )
-        {
-            newInstruction.Standard.DestIsAddress = 1;
-        }
+            if( IsRegisterAddress(dest) )
+            {
+                newInstruction.Standard.DestIsAddress = 1;
+            }
 
-        newInstruction.Standard.DataType = GetDataType(params[0]);
-        newInstruction.Standard.ConstantData = GetConstantDataUNSIGNED(params[3]);
+            newInstruction.Standard.DataType = GetDataType(params[0]);
+            newInstruction.Standard.ConstantData = GetConstantDataUNSIGNED(params[3]);
+        }
     }
 
     return newInstruction;
 }
 
-uint32_t MachineCodeAssembler::GetOpCode(const std::string& a_Instuction)const
+uint32_t MachineCodeAssembler::GetOpCode(std::string_view a_Instuction)const
 {
-#define MAKE_OPCODE(__OP_NAME__,__OP_CODE__)  if( CompareNoCase(a_Instuction,(__OP_NAME__)) ){return __OP_CODE__;}
-    OPERATION_CODES
-#undef MAKE_OPCODE
-
-    throw std::runtime_error("Unknown instruction found " + a_Instuction);
-
-    return 0;
+    uint32_t opCode;
+    if( !sOpCodes.Find(a_Instuction,opCode) )
+    {
+        throw std::runtime_error("Unknown instruction found " + std::string(a_Instuction));
+    }
+    return opCode;
 }
-
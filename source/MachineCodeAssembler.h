@@ -2,38 +2,245 @@
 #define __MACINE_CODE_ASSEMBLER_H__
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <ostream>
+#include <istream>
+#include <functional>
+#include <atomic>
 #include <assert.h>
 
 #include "MiniCPU.h"
+#include "ProgramImage.h"
 
 /**
  * @brief This compiles an assember source file into machine code. This is NOT a macro assembler.
- * 
+ * Lines are tokenized in place with string_view, nothing is allocated per line unless there is an error.
+ * Mnemonics, data types and condition codes are found with hash tables built at compile time.
+ * Large sources are split into chunks of whole lines that are assembled on all the cores and then joined in order.
+ *
+ * Labels, a name then a colon at the start of a line, can be the target of a JUMP in place of its constant.
+ *   loop: SUB S64,R15,R0,0x0001
+ *         JUMP NZ,1,R15,loop
+ * Where they are is found once all the chunks are done, the JUMPs are then put in:-
+ *   JUMP cc,p,R15,label is the one instruction when the distance fits the sixteen bit constant. When it does not the
+ *   distance is put in the register of the last .scratch line before it with one to three LOADs, the fewest that hold
+ *   it, and the JUMP goes off that. With no .scratch, or .scratch R15, a JUMP that is too far is an error.
+ *   JUMP cc,p,Rn,label always puts the distance in Rn the same way, near or far, so what Rn holds after does not depend
+ *   on where the code ends up.
+ * Making one JUMP longer can push others out of reach so it is done again until nothing changes. Names that are also
+ * hex, like beef, can not be labels as the constant would be the number.
+ *
+ * CompileStream and CompileFile do not need the whole source or the whole program in memory. The source is read a block
+ * of STREAM_BLOCK_SIZE at a time, cut back to the last whole line, and the code of each block is handed to an
+ * InstructionSink before the next is read, so memory use is about the block size, a line that is longer is kept whole.
+ * From the first block with a label in it on the source is read twice, first for where the labels and the JUMPs to
+ * them are and then for the code, so memory then also grows with the number of labels. A stream that can not seek
+ * back throws when it gets to a label.
  */
+
+/**
+ * @brief Takes the code from CompileStream and CompileFile, a run of instructions at a time in order.
+ */
+typedef std::function<void(const Instruction* a_Code,size_t a_Count)> InstructionSink;
+
 class MachineCodeAssembler
 {
 public:
     MachineCodeAssembler();
     ~MachineCodeAssembler();
 
+    /**
+     * @brief Compiles the source using a_Threads threads, zero is one per core. Sources smaller than PARALLEL_MIN_SIZE are done on this thread.
+     * If a_Listing is not null each instruction is listed with its fields and encoding, the listing is written in one go at the end.
+     * Lines with errors are reported to std::cerr with their line number, in line order, and left out.
+     * If r_LineNumbers is not null it is filled with the source line, counted from one, of each instruction made.
+     * If r_Symbols is not null it is filled with the labels and the address each ended up at, the code being at zero.
+     */
+    std::vector<Instruction> Compile(std::string_view a_Assembler,std::ostream* a_Listing = nullptr,uint32_t a_Threads = 0,std::vector<uint32_t>* r_LineNumbers = nullptr,std::vector<ProgramImage::Symbol>* r_Symbols = nullptr)const;
+
+    /**
+     * @brief Compiles the source into an image with the code at address zero, the entry point, ready to be saved.
+     * The labels are its symbols.
+     */
+    ProgramImage CompileImage(std::string_view a_Assembler,std::ostream* a_Listing = nullptr,uint32_t a_Threads = 0,std::vector<uint32_t>* r_LineNumbers = nullptr)const;
+
+    /**
+     * @brief Compiles from a_Source to a_Sink a block at a time. Errors and the listing are written as each block is done.
+     * Returns the number of instructions made. r_Symbols, if not null, gets the labels as Compile does.
+     */
+    uint64_t CompileStream(std::istream& a_Source,const InstructionSink& a_Sink,std::ostream* a_Listing = nullptr,uint32_t a_Threads = 0,std::vector<ProgramImage::Symbol>* r_Symbols = nullptr)const;
+
+    /**
+     * @brief The same for a file, which is mapped rather than read and the pages let go once they are done.
+     * Throws if the file can not be opened.
+     */
+    uint64_t CompileFile(const std::string& a_Filename,const InstructionSink& a_Sink,std::ostream* a_Listing = nullptr,uint32_t a_Threads = 0,std::vector<ProgramImage::Symbol>* r_Symbols = nullptr)const;
+
+    /**
+     * @brief A sink that writes the code into guest memory from a_Address on.
+     */
+    static InstructionSink MemorySink(GuestMemory& r_Memory,uint64_t a_Address = 0);
+
+    /**
+     * @brief The number of lines reported to std::cerr as errors by everything this assembler has compiled.
+     */
+    uint64_t GetErrorCount()const{return mErrorCount;}
+
+    /**
+     * @brief The instruction on a line, without any comment and trimmed. Empty if the line has none.
+     */
+    static std::string_view GetStatement(std::string_view a_Line);
+
+    /**
+     * @brief Compiles one line, without any comment. Throws if it is not a valid instruction, or is a JUMP to a label
+     * as on its own there are none.
+     */
+    Instruction MakeInstruction(std::string_view a_InstructionDescription)const;
+
+    struct LineError
+    {
+        size_t Line;
+        std::string Message;
+    };
+
+    /**
+     * @brief The labels in a piece of source and the JUMPs to them, the code and lines counted from the start of the
+     * piece. The JUMPs are in the code as placeholders until Link puts them in.
+     */
+    struct LabelTable
+    {
+        static const uint32_t SCRATCH_BEFORE = 0xff;    // No .scratch yet in the piece, whatever the pieces before left.
+
+        struct Definition
+        {
+            std::string Name;
+            uint64_t Code;      // Index of the instruction it is on.
+            uint64_t Line;
+        };
+
+        struct Branch
+        {
+            std::string Label;
+            uint64_t Code;
+            uint64_t Line;
+            Instruction Jump;   // The placeholder, with the condition, the PC relative bit and the register.
+            uint32_t Scratch;   // Of the last .scratch before it.
+        };
+
+        std::vector<Definition> Definitions;
+        std::vector<Branch> Branches;
+        uint32_t Scratch = SCRATCH_BEFORE;  // Of the last .scratch in the piece.
 
-    std::vector<Instruction> Compile(const std::string& pAssembler)const;
+        bool Empty()const{return Definitions.empty() && Branches.empty();}
+
+        /**
+         * @brief Adds a_Piece as if its source followed this one, its code starting at a_Code and its lines after a_Line.
+         */
+        void Append(const LabelTable& a_Piece,uint64_t a_Code,uint64_t a_Line);
+    };
+
+    /**
+     * @brief Assembles one statement, from GetStatement, at instruction a_Code and line a_Line of a piece of source.
+     * A label at its start, and a JUMP to a label, are added to r_Labels, the JUMP made as a placeholder. A .scratch is
+     * kept in r_Labels for the JUMPs after it. Returns false if there is no instruction, only a label or a .scratch.
+     * Throws if it is not valid.
+     */
+    bool AssembleStatement(std::string_view a_Statement,uint64_t a_Code,uint64_t a_Line,LabelTable& r_Labels,Instruction& r_Instruction)const;
+
+    /**
+     * @brief Puts the JUMPs of a_Labels into r_Code, the code of the whole source made by AssembleStatement. What can
+     * not be linked is added to r_Errors and its JUMP left out. r_Symbols, if not null, gets the labels as Compile does.
+     */
+    void Link(std::vector<Instruction>& r_Code,const LabelTable& a_Labels,std::vector<LineError>& r_Errors,std::vector<ProgramImage::Symbol>* r_Symbols = nullptr)const;
+
+    static const size_t PARALLEL_MIN_SIZE = 64*1024;
+    static const size_t CHUNKS_PER_THREAD = 4;
+    static const size_t STREAM_BLOCK_SIZE = 4*1024*1024;
 
 private:
+    mutable std::atomic<uint64_t> mErrorCount;
 
-    uint32_t GetDataType(const std::string& a_Type)const;
-    uint32_t GetRegister(const std::string& a_Type)const;
-    uint32_t GetCondition(const std::string& a_Condition)const;
-    uint16_t GetConstantDataUNSIGNED(const std::string& a_Data)const;
-    int16_t GetConstantDataSIGNED(const std::string& a_Data)const;
-    uint32_t GetValue(const std::string& a_Data,uint32_t a_AllowedMax)const;
-    Instruction MakeInstruction(const std::string& a_InstructionDescription)const;
+    // Where the statement of a JUMP to a label is in the listing of its chunk, it is listed once it is linked.
+    struct Listed
+    {
+        std::string_view Statement;
+        size_t At;
+    };
 
-    bool IsRegisterAddress(uint32_t a_Register)const{return (a_Register&REG_IS_ADDRESS)?true:false;}
-    uint32_t GetOpCode(const std::string& a_Instuction)const;
+    struct Chunk
+    {
+        std::string_view Source;
+        size_t Lines = 0;
+        std::vector<Instruction> Code;
+        std::vector<uint32_t> LineNumbers;  // Within the chunk, like the errors.
+        std::string Listing;
+        std::vector<LineError> Errors;      // Lines within the chunk, fixed up when the chunks are joined.
+        LabelTable Labels;
+        std::vector<Listed> BranchListing;  // One for each of the branches in Labels.
+    };
+
+    // How long each JUMP to a label of the whole source is made.
+    struct Layout
+    {
+        std::vector<uint64_t> Targets;      // Index of the instruction the label of each branch is on.
+        std::vector<uint32_t> Sizes;        // Instructions each is made of, zero if it is an error and left out.
+        std::vector<int64_t> Grown;         // Grown[n] is how much longer the first n made the code.
+        std::vector<LineError> Errors;      // Lines from the start of the source, in line order.
+        std::vector<ProgramImage::Symbol> Symbols;  // Where each label ended up, in the order they are defined.
+
+        int64_t Placed(const LabelTable& a_Labels,uint64_t a_Code)const;
+        int64_t Distance(const LabelTable& a_Labels,size_t a_Branch,uint32_t a_Size)const;
+    };
+
+    // Hands back the block of whole lines that starts a_Offset bytes into the source, empty at the end. Only the last
+    // block handed back has to stay good.
+    typedef std::function<std::string_view(uint64_t a_Offset)> BlockReader;
 
+    /**
+     * @brief Compiles whole lines, split into chunks done over a_Threads threads.
+     */
+    std::vector<Chunk> CompileChunks(std::string_view a_Assembler,uint32_t a_Threads,bool a_Listing,bool a_LineNumbers)const;
+    void CompileChunk(Chunk& r_Chunk,bool a_Listing,bool a_LineNumbers)const;
+
+    /**
+     * @brief Gives the code of the chunks to a_Sink in order with the listing, line numbers and errors.
+     * r_Lines is the number of lines before the chunks, for the error messages and line numbers, and is moved on past them.
+     */
+    void Emit(const std::vector<Chunk>& a_Chunks,const InstructionSink& a_Sink,std::ostream* a_Listing,std::vector<uint32_t>* r_LineNumbers,size_t& r_Lines)const;
+
+    /**
+     * @brief CompileStream and CompileFile, a block at a time from a_Read.
+     */
+    uint64_t CompileBlocks(const BlockReader& a_Read,const InstructionSink& a_Sink,std::ostream* a_Listing,uint32_t a_Threads,std::vector<ProgramImage::Symbol>* r_Symbols)const;
+
+    /**
+     * @brief Finds where each label is and how long each JUMP to one has to be.
+     */
+    Layout MakeLayout(const LabelTable& a_Labels)const;
+
+    /**
+     * @brief Puts the JUMPs into the code of a chunk that starts at instruction a_Code and after line a_Line of the
+     * source, with their listing and line numbers, and takes the errors on its lines from a_Layout.
+     */
+    void Place(Chunk& r_Chunk,const LabelTable& a_Labels,const Layout& a_Layout,uint64_t a_Code,uint64_t a_Line,bool a_Listing,bool a_LineNumbers)const;
+
+    /**
+     * @brief MakeInstruction, but a JUMP to a label is made with a zero constant and the label handed back in r_Label.
+     */
+    Instruction Assemble(std::string_view a_Statement,std::string_view& r_Label)const;
+
+    uint32_t GetDataType(std::string_view a_Type)const;
+    uint32_t GetRegister(std::string_view a_Register)const;
+    uint32_t GetCondition(std::string_view a_Condition)const;
+    uint16_t GetConstantDataUNSIGNED(std::string_view a_Data)const;
+    int16_t GetConstantDataSIGNED(std::string_view a_Data)const;
+    uint32_t GetValue(std::string_view a_Data,uint32_t a_AllowedMax)const;
+
+    bool IsRegisterAddress(uint32_t a_Register)const{return (a_Register&REG_IS_ADDRESS)?true:false;}
+    uint32_t GetOpCode(std::string_view a_Instuction)const;
 
+    void ListInstruction(std::string& r_Listing,std::string_view a_Line,const Instruction& a_Instruction)const;
 };
 
-#endif //__MACINE_CODE_ASSEMBLER_H__
\ No newline at end of file
+#endif //__MACINE_CODE_ASSEMBLER_H__
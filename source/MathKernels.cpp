@@ -0,0 +1,115 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "MathKernels.h"
+#include "Random.h"
+
+namespace MathKernels
+{
+
+const char* GetName(Function a_Function)
+{
+    switch( a_Function )
+    {
+    case FUNCTION_SIN:  return "sin";
+    case FUNCTION_COS:  return "cos";
+    case FUNCTION_TAN:  return "tan";
+    case FUNCTION_ATAN: return "atan";
+    case NUMBER_FUNCTIONS: break;
+    }
+    return "unknown";
+}
+
+template <typename T> static T Fast(Function a_Function,T x)
+{
+    switch( a_Function )
+    {
+    case FUNCTION_SIN:  return Sin(x);
+    case FUNCTION_COS:  return Cos(x);
+    case FUNCTION_TAN:  return Tan(x);
+    case FUNCTION_ATAN: return ATan(x);
+    case NUMBER_FUNCTIONS: break;
+    }
+    return x;
+}
+
+static long double Reference(Function a_Function,long double x)
+{
+    switch( a_Function )
+    {
+    case FUNCTION_SIN:  return std::sin(x);
+    case FUNCTION_COS:  return std::cos(x);
+    case FUNCTION_TAN:  return std::tan(x);
+    case FUNCTION_ATAN: return std::atan(x);
+    case NUMBER_FUNCTIONS: break;
+    }
+    return x;
+}
+
+// In ULP of the exact result rounded to T, zero when that is not finite.
+template <typename T> static double Error(Function a_Function,T a_Value)
+{
+    const long double exact = Reference(a_Function,static_cast<long double>(a_Value));
+    const T rounded = static_cast<T>(exact);
+    if( !std::isfinite(rounded) )
+    {
+        return 0.0;
+    }
+
+    const T magnitude = std::fabs(rounded);
+    const long double ulp = static_cast<long double>(std::nextafter(magnitude,std::numeric_limits<T>::infinity())) - magnitude;
+    return static_cast<double>(std::fabs(static_cast<long double>(Fast<T>(a_Function,a_Value)) - exact) / ulp);
+}
+
+template <typename T> static double Measure(Function a_Function,double a_Range,uint64_t a_Samples)
+{
+    Random random(Random::DEFAULT_SEED);
+    double worst = 0.0;
+    for( uint64_t n = 0 ; n < a_Samples ; n++ )
+    {
+        // A third spread evenly over the range, a third spread over the exponents so small values are looked at too,
+        // and a third packed into [-MEASURE_NEAR,MEASURE_NEAR] where the atan folds meet. The worst atan values sit just
+        // past tan(pi/8), a few in a million of the whole range, so spread out the first two never find them.
+        const uint64_t bits = random.Next();
+        double x = (Random::ToDouble(bits) * 2.0 - 1.0) * a_Range;
+        if( n % 3 == 1 )
+        {
+            x = std::ldexp(a_Range * Random::ToDouble(random.Next()),-static_cast<int>(bits & 31));
+        }
+        else if( n % 3 == 2 )
+        {
+            x = (Random::ToDouble(bits) * 2.0 - 1.0) * std::min(a_Range,MEASURE_NEAR);
+        }
+        worst = std::max(worst,Error<T>(a_Function,static_cast<T>(x)));
+    }
+
+    // The hard ones for the reduction, the values either side of every multiple of pi/2 in the range. Random values
+    // almost never land close enough to one to show a reduction that is short of bits.
+    const long double halfPi = 1.570796326794896619231321691639751442L;
+    for( uint64_t k = 0 ; k * halfPi <= a_Range ; k++ )
+    {
+        T x = static_cast<T>(k * halfPi);
+        for( int n = 0 ; n < MEASURE_ULPS_AROUND ; n++ )
+        {
+            x = std::nextafter(x,static_cast<T>(0));
+        }
+        for( int n = -MEASURE_ULPS_AROUND ; n <= MEASURE_ULPS_AROUND ; n++ )
+        {
+            if( std::fabs(x) <= a_Range )
+            {
+                worst = std::max(worst,Error<T>(a_Function,x));
+                worst = std::max(worst,Error<T>(a_Function,-x));
+            }
+            x = std::nextafter(x,std::numeric_limits<T>::infinity());
+        }
+    }
+    return worst;
+}
+
+double MeasureError(Function a_Function,bool a_Double,double a_Range,uint64_t a_Samples)
+{
+    return a_Double ? Measure<double>(a_Function,a_Range,a_Samples) : Measure<float>(a_Function,a_Range,a_Samples);
+}
+
+}// namespace MathKernels
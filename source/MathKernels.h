@@ -0,0 +1,306 @@
+#ifndef __MATH_KERNELS_H__
+#define __MATH_KERNELS_H__
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+/**
+ * @brief The fast versions of FSIN, FCOS, FTAN and FATAN, used when a CPU is set to FLOAT_PRECISION_FAST.
+ * Inline so they go into the handler. There is no call into libm and, past the range check, no branch on the value,
+ * so the loops of a WideCPU can do them for all the lanes at once.
+ *
+ * sin, cos and tan take the argument down to [-pi/4,pi/4] with pi/2 in the parts of fdlibm's medium range
+ * __rem_pio2, good to about 150 bits, and then use the fdlibm polynomials. Past TRIG_LIMIT, and for inf and NaN, they call libm so big arguments are still right.
+ * atan folds the argument into [-tan(pi/8),tan(pi/8)] with (a-1)/(a+1) or -1/a and uses the fdlibm polynomial.
+ * FLOAT is worked out in double with the shorter musl polynomials for sin and cos, then rounded.
+ *
+ * Worst error seen against the exact result by MeasureError with 30 million values, |x| up to TRIG_LIMIT with a third of
+ * them in [-4,4] where the tan and atan worst cases are, and the two values either side of every multiple of pi/2:
+ *              DOUBLE      FLOAT
+ *   Sin        0.78 ULP    0.50 ULP
+ *   Cos        0.78 ULP    0.50 ULP
+ *   Tan        2.25 ULP    0.50 ULP
+ *   ATan       2.26 ULP    0.50 ULP
+ * These are what was seen, not a proof, and the DOUBLE tan and atan ones still creep up with more values: 100 million
+ * just past tan(pi/8), where (a-1)/(a+1) rounds worst, found 2.36 ULP for atan. libm is within 1 ULP for all of them.
+ * FSQRT is left to the host sqrt in both modes, it is one instruction and correctly rounded, nothing is faster.
+ *
+ * Where they pay is the WideCPU, two lanes to an SSE2 register. One at a time they are about as fast as a glibc that
+ * picked its FMA build, the double sin and cos a little slower for the longer reduction, see the float_precision part
+ * of BenchmarkSuite.
+ */
+namespace MathKernels
+{
+    static constexpr double TRIG_LIMIT = 65536.0;
+    static constexpr int MEASURE_ULPS_AROUND = 2;      // MeasureError also looks at this many values each side of k*pi/2.
+    static constexpr double MEASURE_NEAR = 4.0;        // And packs a third of its values in [-4,4], past both atan folds.
+
+    namespace Constants
+    {
+        static constexpr double INV_PIO2 = 6.36619772367581382433e-01;
+        static constexpr double PIO2_1 = 0x1.921fb544p+0;               // The first 33 bits of pi/2.
+        static constexpr double PIO2_1T = 6.07710050650619224932e-11;   // pi/2 - PIO2_1.
+        static constexpr double PIO2_2 = 0x1.0b4611a6p-34;              // The next 33 bits.
+        static constexpr double PIO2_3 = 0x1.3198a2ep-69;               // And the 33 after that.
+        static constexpr double PIO2_3T = 0x1.b839a252049c1p-104;       // pi/2 - PIO2_1 - PIO2_2 - PIO2_3.
+        static constexpr double ROUND = 0x1.8p52;                       // Adding and taking this away rounds to a whole number.
+
+        static constexpr double PIO4_HI = 7.85398163397448278999e-01;
+        static constexpr double PIO4_LO = 3.06161699786838301793e-17;
+        static constexpr double PIO2_HI = 1.57079632679489655800e+00;
+        static constexpr double PIO2_LO = 6.12323399573676603587e-17;
+        static constexpr double TAN_PI_8 = 4.14213562373095034620e-01;
+        static constexpr double TAN_3PI_8 = 2.41421356237309492343e+00;
+    }
+
+/******************************************************************************
+ * Polynomials on the reduced argument.
+ ******************************************************************************/
+    // fdlibm __kernel_sin and __kernel_cos, x + y is the argument with |x + y| <= pi/4 and y the tail of x.
+    inline double SinPoly(double x,double y)
+    {
+        const double z = x * x;
+        const double v = z * x;
+        const double r = 8.33333333332248946124e-03 + z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06 + z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)));
+        return x - ((z * (0.5 * y - v * r) - y) - v * -1.66666666666666324348e-01);
+    }
+
+    inline double CosPoly(double x,double y)
+    {
+        const double z = x * x;
+        const double r = z * (4.16666666666666019037e-02 + z * (-1.38888888888741095749e-03 + z * (2.48015872894767294178e-05 + z * (-2.75573143513906633035e-07 + z * (2.08757232129817482790e-09 + z * -1.13596475577881948265e-11)))));
+        const double hz = 0.5 * z;
+        const double w = 1.0 - hz;
+        return w + (((1.0 - w) - hz) + (z * r - x * y));
+    }
+
+    // musl __sindf and __cosdf, good to about 2^-37 which is plenty for FLOAT.
+    inline double SinPolyFloat(double x)
+    {
+        const double z = x * x;
+        const double w = z * z;
+        const double r = -0x1a00f9e2cae774.0p-65 + z * 0x16cd878c3b46a7.0p-71;
+        const double s = z * x;
+        return (x + s * (-0x15555554cbac77.0p-55 + z * 0x111110896efbb2.0p-59)) + s * w * r;
+    }
+
+    inline double CosPolyFloat(double x)
+    {
+        const double z = x * x;
+        const double w = z * z;
+        const double r = -0x16c087e80f1e27.0p-62 + z * 0x199342e0ee5069.0p-68;
+        return ((1.0 + z * -0x1ffffffd0c5e81.0p-54) + w * 0x155553e1053a42.0p-57) + (w * z) * r;
+    }
+
+    // fdlibm atan, |x| <= 7/16.
+    inline double ATanPoly(double x)
+    {
+        const double z = x * x;
+        const double w = z * z;
+        const double s1 = z * (3.33333333333329318027e-01 + w * (1.42857142725034663711e-01 + w * (9.09088713343650656196e-02 + w * (6.66107313738753120669e-02 + w * (4.97687799461593236017e-02 + w * 1.62858201153657823623e-02)))));
+        const double s2 = w * (-1.99999999998764832476e-01 + w * (-1.11111104054623557880e-01 + w * (-7.69187620504482999495e-02 + w * (-5.83357013379057348645e-02 + w * -3.65315727442169155270e-02))));
+        return x - x * (s1 + s2);
+    }
+
+/******************************************************************************
+ * Reduction, x = k*pi/2 + r.
+ * The choices are made with masks on the bits, not ?:, GCC will not vectorize a loop with a ?: on doubles in it.
+ ******************************************************************************/
+    inline uint64_t BitsOf(double x)
+    {
+        uint64_t bits;
+        memcpy(&bits,&x,sizeof(bits));
+        return bits;
+    }
+
+    inline double FromBits(uint64_t a_Bits)
+    {
+        double x;
+        memcpy(&x,&a_Bits,sizeof(x));
+        return x;
+    }
+
+    // a_Mask is all ones or all zeros.
+    inline double Select(uint64_t a_Mask,double a_True,double a_False)
+    {
+        return FromBits((BitsOf(a_True) & a_Mask) | (BitsOf(a_False) & ~a_Mask));
+    }
+
+    // All ones when a < b. From the sign of a - b as SSE2 has no compare of 64bit integers to make a mask with.
+    inline uint64_t LessMask(double a,double b)
+    {
+        return 0 - (BitsOf(a - b) >> 63);
+    }
+
+    // The low bits of k are in the low bits of the rounded value before ROUND is taken away, read from there so there
+    // is no conversion to an integer, which SSE2 does not have for a vector of doubles.
+    inline uint64_t QuadrantOf(double a_Rounded)
+    {
+        return BitsOf(a_Rounded);
+    }
+
+    // a + b as the rounded sum and what rounding lost, Knuth's TwoSum. Right whichever is bigger.
+    inline double TwoSum(double a,double b,double& r_Error)
+    {
+        const double sum = a + b;
+        const double bb = sum - a;
+        r_Error = (a - (sum - bb)) + (b - bb);
+        return sum;
+    }
+
+    // pi/2 in the three 33 bit parts of fdlibm's __rem_pio2 and a tail, k times each part is exact for |x| up to
+    // 2^20 * pi/2. A double close to a multiple of pi/2 cancels most of the first parts away, the closest below
+    // TRIG_LIMIT leaves about 2^-60 of x, so the later parts are needed for the bits that are left. fdlibm only does
+    // them when it sees the cancellation, here they are always done, with TwoSum so nothing is lost when they are not
+    // needed, as a branch would stop the loops vectorizing. r_Tail is what the result is short by.
+    inline double ReduceHalfPi(double x,uint64_t& r_Quadrant,double& r_Tail)
+    {
+        const double rounded = x * Constants::INV_PIO2 + Constants::ROUND;
+        const double k = rounded - Constants::ROUND;
+        r_Quadrant = QuadrantOf(rounded);
+        double e2;
+        double e3;
+        const double t1 = x - k * Constants::PIO2_1;
+        const double t2 = TwoSum(t1,-(k * Constants::PIO2_2),e2);
+        const double t3 = TwoSum(t2,-(k * Constants::PIO2_3),e3);
+        const double w = (e2 + e3) - k * Constants::PIO2_3T;
+        const double reduced = t3 + w;
+        r_Tail = w - (reduced - t3);
+        return reduced;
+    }
+
+    // The closest float below TRIG_LIMIT is about 2^-42 of itself from a multiple of pi/2, the 86 bits of pi/2 in the
+    // first round still leave more than 40 good bits of what is left, plenty for a float.
+    inline double ReduceHalfPiFloat(double x,uint64_t& r_Quadrant)
+    {
+        const double rounded = x * Constants::INV_PIO2 + Constants::ROUND;
+        const double k = rounded - Constants::ROUND;
+        r_Quadrant = QuadrantOf(rounded);
+        return (x - k * Constants::PIO2_1) - k * Constants::PIO2_1T;
+    }
+
+    // Sin of x in quadrant a_Quadrant, from the sin and cos of what is left. Cos is quadrant + 1.
+    inline double FromQuadrant(uint64_t a_Quadrant,double a_Sin,double a_Cos)
+    {
+        const uint64_t odd = 0 - (a_Quadrant & 1);
+        return FromBits(BitsOf(Select(odd,a_Cos,a_Sin)) ^ ((a_Quadrant & 2) << 62));
+    }
+
+    // Tan of x in quadrant a_Quadrant, s / c or in the odd ones -c / s. One divide either way.
+    inline double TanFromQuadrant(uint64_t a_Quadrant,double a_Sin,double a_Cos)
+    {
+        const uint64_t odd = 0 - (a_Quadrant & 1);
+        return Select(odd,-a_Cos,a_Sin) / Select(odd,a_Sin,a_Cos);
+    }
+
+/******************************************************************************
+ * The kernels. The InRange versions are only for |x| <= TRIG_LIMIT, so a loop over values known to be in range has
+ * no branches at all.
+ ******************************************************************************/
+    inline bool InRange(double x)
+    {
+        return std::fabs(x) <= TRIG_LIMIT;
+    }
+
+    inline double SinInRange(double x)
+    {
+        uint64_t k;
+        double y;
+        const double r = ReduceHalfPi(x,k,y);
+        return FromQuadrant(k,SinPoly(r,y),CosPoly(r,y));
+    }
+
+    inline double CosInRange(double x)
+    {
+        uint64_t k;
+        double y;
+        const double r = ReduceHalfPi(x,k,y);
+        return FromQuadrant(k + 1,SinPoly(r,y),CosPoly(r,y));
+    }
+
+    inline double TanInRange(double x)
+    {
+        uint64_t k;
+        double y;
+        const double r = ReduceHalfPi(x,k,y);
+        return TanFromQuadrant(k,SinPoly(r,y),CosPoly(r,y));
+    }
+
+    inline float SinInRange(float x)
+    {
+        uint64_t k;
+        const double r = ReduceHalfPiFloat(x,k);
+        return static_cast<float>(FromQuadrant(k,SinPolyFloat(r),CosPolyFloat(r)));
+    }
+
+    inline float CosInRange(float x)
+    {
+        uint64_t k;
+        const double r = ReduceHalfPiFloat(x,k);
+        return static_cast<float>(FromQuadrant(k + 1,SinPolyFloat(r),CosPolyFloat(r)));
+    }
+
+    inline float TanInRange(float x)
+    {
+        uint64_t k;
+        const double r = ReduceHalfPiFloat(x,k);
+        return static_cast<float>(TanFromQuadrant(k,SinPolyFloat(r),CosPolyFloat(r)));
+    }
+
+    // Past TRIG_LIMIT, and for inf and NaN, libm.
+    template <typename T> inline T Sin(T x)
+    {
+        return InRange(x) ? SinInRange(x) : std::sin(x);
+    }
+
+    template <typename T> inline T Cos(T x)
+    {
+        return InRange(x) ? CosInRange(x) : std::cos(x);
+    }
+
+    template <typename T> inline T Tan(T x)
+    {
+        return InRange(x) ? TanInRange(x) : std::tan(x);
+    }
+
+    inline double ATan(double x)
+    {
+        // Up to tan(pi/8) as it is, up to tan(3pi/8) as pi/4 + atan((a-1)/(a+1)), past that pi/2 + atan(-1/a).
+        // One divide for all three.
+        const double a = std::fabs(x);
+        const uint64_t small = LessMask(a,Constants::TAN_PI_8);
+        const uint64_t middle = LessMask(a,Constants::TAN_3PI_8);
+        const double numerator = Select(small,a,Select(middle,a - 1.0,-1.0));
+        const double denominator = Select(small,1.0,Select(middle,a + 1.0,a));
+        const double high = Select(small,0.0,Select(middle,Constants::PIO4_HI,Constants::PIO2_HI));
+        const double low = Select(small,0.0,Select(middle,Constants::PIO4_LO,Constants::PIO2_LO));
+        return std::copysign(high + (low + ATanPoly(numerator / denominator)),x);
+    }
+
+    inline float ATan(float x)
+    {
+        return static_cast<float>(ATan(static_cast<double>(x)));
+    }
+
+    enum Function
+    {
+        FUNCTION_SIN,
+        FUNCTION_COS,
+        FUNCTION_TAN,
+        FUNCTION_ATAN,
+
+        NUMBER_FUNCTIONS
+    };
+
+    const char* GetName(Function a_Function);
+
+    /**
+     * @brief The largest error in ULP of the fast a_Function over a_Samples values spread over [-a_Range,a_Range], a
+     * third of them in [-MEASURE_NEAR,MEASURE_NEAR], and the MEASURE_ULPS_AROUND values either side of each multiple of
+     * pi/2 in it, against the long double libm function. The table at the top of this file is this with 30 million samples.
+     */
+    double MeasureError(Function a_Function,bool a_Double,double a_Range,uint64_t a_Samples);
+}
+
+#endif //__MATH_KERNELS_H__
@@ -0,0 +1,238 @@
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMORY_KERNELS_X86
+#endif
+
+#include "MemoryKernels.h"
+
+namespace MemoryKernels
+{
+
+typedef void (*FillFunction)(uint8_t* a_Dest,uint64_t a_Value,uint32_t a_ElementSize,uint64_t a_Count);
+typedef void (*MoveFunction)(uint8_t* a_Dest,const uint8_t* a_Source,uint64_t a_Bytes);
+
+// Repeats the element to fill the pattern, the pattern size is a multiple of all the element sizes.
+static void MakePattern(uint8_t* a_Pattern,size_t a_PatternSize,uint64_t a_Value,uint32_t a_ElementSize)
+{
+    for( size_t n = 0 ; n < a_PatternSize ; n += a_ElementSize )
+    {
+        memcpy(a_Pattern + n,&a_Value,a_ElementSize);
+    }
+}
+
+/******************************************************************************
+ * Scalar, the reference.
+ ******************************************************************************/
+static void FillScalar(uint8_t* a_Dest,uint64_t a_Value,uint32_t a_ElementSize,uint64_t a_Count)
+{
+    for( uint64_t n = 0 ; n < a_Count ; n++ )
+    {
+        memcpy(a_Dest + (n*a_ElementSize),&a_Value,a_ElementSize);
+    }
+}
+
+static void MoveScalar(uint8_t* a_Dest,const uint8_t* a_Source,uint64_t a_Bytes)
+{
+    if( a_Dest > a_Source )
+    {
+        for( uint64_t n = a_Bytes ; n > 0 ; n-- )
+        {
+            a_Dest[n-1] = a_Source[n-1];
+        }
+    }
+    else
+    {
+        for( uint64_t n = 0 ; n < a_Bytes ; n++ )
+        {
+            a_Dest[n] = a_Source[n];
+        }
+    }
+}
+
+#ifdef MEMORY_KERNELS_X86
+/******************************************************************************
+ * SSE2, all x86-64 hosts have it.
+ ******************************************************************************/
+static void FillSSE2(uint8_t* a_Dest,uint64_t a_Value,uint32_t a_ElementSize,uint64_t a_Count)
+{
+    uint8_t pattern[16];
+    MakePattern(pattern,sizeof(pattern),a_Value,a_ElementSize);
+
+    const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+    const uint64_t bytes = a_Count * a_ElementSize;
+    uint64_t n = 0;
+    for( ; n + sizeof(pattern) <= bytes ; n += sizeof(pattern) )
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(a_Dest + n),value);
+    }
+    memcpy(a_Dest + n,pattern,bytes - n);
+}
+
+// When they overlap each chunk is loaded before any store can reach it, as long as the direction is right.
+static void MoveSSE2(uint8_t* a_Dest,const uint8_t* a_Source,uint64_t a_Bytes)
+{
+    const uint64_t CHUNK = sizeof(__m128i);
+    if( a_Dest > a_Source )
+    {
+        uint64_t n = a_Bytes;
+        for( ; n >= CHUNK ; n -= CHUNK )
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(a_Dest + n - CHUNK),_mm_loadu_si128(reinterpret_cast<const __m128i*>(a_Source + n - CHUNK)));
+        }
+        MoveScalar(a_Dest,a_Source,n);
+    }
+    else
+    {
+        uint64_t n = 0;
+        for( ; n + CHUNK <= a_Bytes ; n += CHUNK )
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(a_Dest + n),_mm_loadu_si128(reinterpret_cast<const __m128i*>(a_Source + n)));
+        }
+        MoveScalar(a_Dest + n,a_Source + n,a_Bytes - n);
+    }
+}
+
+/******************************************************************************
+ * AVX2, only used if CPUID says the host has it.
+ ******************************************************************************/
+__attribute__((target("avx2")))
+static void FillAVX2(uint8_t* a_Dest,uint64_t a_Value,uint32_t a_ElementSize,uint64_t a_Count)
+{
+    uint8_t pattern[32];
+    MakePattern(pattern,sizeof(pattern),a_Value,a_ElementSize);
+
+    const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pattern));
+    const uint64_t bytes = a_Count * a_ElementSize;
+    uint64_t n = 0;
+    for( ; n + 2*sizeof(pattern) <= bytes ; n += 2*sizeof(pattern) )
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a_Dest + n),value);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a_Dest + n + sizeof(pattern)),value);
+    }
+
+    if( n + sizeof(pattern) <= bytes )
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(a_Dest + n),value);
+        n += sizeof(pattern);
+    }
+    _mm256_zeroupper();     // What follows is SSE code, leaving the upper halves dirty makes it and libm after it pay for every transition.
+    memcpy(a_Dest + n,pattern,bytes - n);
+}
+
+__attribute__((target("avx2")))
+static void MoveAVX2(uint8_t* a_Dest,const uint8_t* a_Source,uint64_t a_Bytes)
+{
+    const uint64_t CHUNK = sizeof(__m256i);
+    if( a_Dest > a_Source )
+    {
+        uint64_t n = a_Bytes;
+        for( ; n >= CHUNK ; n -= CHUNK )
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(a_Dest + n - CHUNK),_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a_Source + n - CHUNK)));
+        }
+        _mm256_zeroupper();
+        MoveSSE2(a_Dest,a_Source,n);
+    }
+    else
+    {
+        uint64_t n = 0;
+        for( ; n + CHUNK <= a_Bytes ; n += CHUNK )
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(a_Dest + n),_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a_Source + n)));
+        }
+        _mm256_zeroupper();
+        MoveSSE2(a_Dest + n,a_Source + n,a_Bytes - n);
+    }
+}
+#endif //MEMORY_KERNELS_X86
+
+static InstructionSet FindBest()
+{
+#ifdef MEMORY_KERNELS_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports("avx2") )
+    {
+        return INSTRUCTION_SET_AVX2;
+    }
+
+    if( __builtin_cpu_supports("sse2") )
+    {
+        return INSTRUCTION_SET_SSE2;
+    }
+#endif
+    return INSTRUCTION_SET_SCALAR;
+}
+
+static const InstructionSet sBest = FindBest();
+static InstructionSet sCurrent = INSTRUCTION_SET_SCALAR;
+static FillFunction sFill = FillScalar;
+static MoveFunction sMove = MoveScalar;
+
+// Done at start up so the first MEMSET does not have to check.
+static const bool sSelected = (Select(sBest),true);
+
+void Fill(uint8_t* a_Dest,uint64_t a_Value,uint32_t a_ElementSize,uint64_t a_Count)
+{
+    sFill(a_Dest,a_Value,a_ElementSize,a_Count);
+}
+
+void Move(uint8_t* a_Dest,const uint8_t* a_Source,uint64_t a_Bytes)
+{
+    sMove(a_Dest,a_Source,a_Bytes);
+}
+
+InstructionSet GetBest()
+{
+    return sBest;
+}
+
+InstructionSet GetCurrent()
+{
+    return sCurrent;
+}
+
+void Select(InstructionSet a_InstructionSet)
+{
+    if( a_InstructionSet > sBest )
+    {
+        throw std::runtime_error(std::string("The host does not support ") + GetName(a_InstructionSet));
+    }
+
+    switch( a_InstructionSet )
+    {
+#ifdef MEMORY_KERNELS_X86
+    case INSTRUCTION_SET_AVX2:
+        sFill = FillAVX2;
+        sMove = MoveAVX2;
+        break;
+
+    case INSTRUCTION_SET_SSE2:
+        sFill = FillSSE2;
+        sMove = MoveSSE2;
+        break;
+#endif
+
+    default:
+        sFill = FillScalar;
+        sMove = MoveScalar;
+        break;
+    }
+    sCurrent = a_InstructionSet;
+}
+
+const char* GetName(InstructionSet a_InstructionSet)
+{
+    switch( a_InstructionSet )
+    {
+    case INSTRUCTION_SET_SCALAR:    return "Scalar";
+    case INSTRUCTION_SET_SSE2:      return "SSE2";
+    case INSTRUCTION_SET_AVX2:      return "AVX2";
+    case NUMBER_INSTRUCTION_SETS:   break;
+    }
+    return "Unknown";
+}
+
+}// namespace MemoryKernels
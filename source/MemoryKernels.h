@@ -0,0 +1,47 @@
+#ifndef __MEMORY_KERNELS_H__
+#define __MEMORY_KERNELS_H__
+
+#include <cstdint>
+
+/**
+ * @brief The bulk memory work behind MEMSET and MEMCPY.
+ * There is a scalar, SSE2 and AVX2 version of each, the best one the host supports is picked at start up using CPUID.
+ * All versions give byte for byte the same result, the scalar one is the reference.
+ */
+namespace MemoryKernels
+{
+    enum InstructionSet
+    {
+        INSTRUCTION_SET_SCALAR,
+        INSTRUCTION_SET_SSE2,
+        INSTRUCTION_SET_AVX2,
+
+        NUMBER_INSTRUCTION_SETS
+    };
+
+    /**
+     * @brief Writes a_Count elements of a_ElementSize bytes (1, 2, 4 or 8), each the low bytes of a_Value.
+     */
+    void Fill(uint8_t* a_Dest,uint64_t a_Value,uint32_t a_ElementSize,uint64_t a_Count);
+
+    /**
+     * @brief Copies a_Bytes bytes, the source and dest can overlap.
+     */
+    void Move(uint8_t* a_Dest,const uint8_t* a_Source,uint64_t a_Bytes);
+
+    /**
+     * @brief The best the host supports.
+     */
+    InstructionSet GetBest();
+
+    InstructionSet GetCurrent();
+
+    /**
+     * @brief Forces the kernels used, for testing and benchmarking. Throws if the host does not support it.
+     */
+    void Select(InstructionSet a_InstructionSet);
+
+    const char* GetName(InstructionSet a_InstructionSet);
+}
+
+#endif //__MEMORY_KERNELS_H__
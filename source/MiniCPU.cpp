@@ -4,18 +4,310 @@
 #include <map>
 #include <sstream>
 #include <array>
+#include <memory>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 #include "Util.h"
 #include "MiniCPU.h"
+#include "JIT.h"
+#include "Profiler.h"
+#include "Recording.h"
+#include "CpuPool.h"
+#include "Multicore.h"
+#include "WideCPU.h"
 #include "MachineCodeAssembler.h"
+#include "ProgramImage.h"
+#include "AssemblyCache.h"
+#include "AssemblerBenchmark.h"
+#include "BenchmarkSuite.h"
 
 
+MiniCPU::MiniCPU()
+{
+    Reset();
+}
+
+MiniCPU::~MiniCPU()
+{
+
+}
+
+void MiniCPU::Reset()
+{
+    mMemory.Clear();
+    mCorePages.clear();
+    mSnapshotID = 0;
+    mDirtyPages.clear();
+    FlushTLBs();
+    ClearCodePages();
+    for( auto& r : mRegisters )
+    {
+        r.u64 = 0;
+    }
+
+    // PC starts at the reset vector and the stack just after the boot code, it grows up.
+    mPC = 0;
+    mSP = (sizeof(AddressSpace) + 7) & ~7;
+    mFlags.Set(0);
+    mInterruptMask = 0;
+    mCycleCount = 0;
+    mRandom.Seed(mRandomSeed,mRandomStream);
+    mInterrupts.Reset();
+    mParked = false;
+    memset(&mFusionStats,0,sizeof(mFusionStats));
+}
+
+void MiniCPU::SetRandomSeed(uint64_t a_Seed,uint64_t a_Stream)
+{
+    mRandomSeed = a_Seed;
+    mRandomStream = a_Stream;
+    mRandom.Seed(mRandomSeed,mRandomStream);
+}
+
+const char* MiniCPU::GetFusionName(uint32_t a_Type)
+{
+    switch( a_Type )
+    {
+    case FUSE_ADD_JUMP: return "ADD + JUMP";
+    case FUSE_SUB_JUMP: return "SUB + JUMP";
+    case FUSE_CMP_JUMP: return "CMP + JUMP";
+    case FUSE_LOAD_48:  return "LOAD + LOAD";
+    case FUSE_LOAD_64:  return "LOAD + LOAD + LOAD";
+    }
+    return "Unknown";
+}
+
+void MiniCPU::LoadProgram(const std::vector<Instruction>& a_Program,uint64_t a_Address)
+{
+    if( a_Address & (sizeof(Instruction)-1) )
+    {
+        throw std::runtime_error("Programs must be loaded on a four byte boundary");
+    }
+
+    for( size_t n = 0 ; n < a_Program.size() ; n++ )
+    {
+        WriteMemory<uint32_t>(a_Address + (n*sizeof(Instruction)),a_Program[n].Bytes);
+    }
+    mPC = a_Address;
+}
+
+void MiniCPU::LoadImage(const GuestMemory& a_Image,uint64_t a_PC)
+{
+    CheckNotCore("LoadImage");
+    mMemory.Share(a_Image);
+    mSnapshotID = 0;
+    mDirtyPages.clear();
+    FlushTLBs();
+    ClearCodePages();
+    mPC = a_PC;
+}
+
+void MiniCPU::ReadMemorySlow(uint64_t a_Address,void* r_Data,uint64_t a_Size)const
+{
+    // Fills the TLB for each page it reads from.
+    uint8_t* dst = static_cast<uint8_t*>(r_Data);
+    for( uint64_t done = 0 ; done < a_Size ; )
+    {
+        const uint64_t address = a_Address + done;
+        const uint64_t bytes = std::min(a_Size - done,PAGE_SIZE - (address & (PAGE_SIZE-1)));
+        memcpy(dst + done,GetReadPointer(address),bytes);
+        done += bytes;
+    }
+}
+
+void MiniCPU::WriteMemorySlow(uint64_t a_Address,const void* a_Data,uint64_t a_Size)
+{
+    const uint8_t* src = static_cast<const uint8_t*>(a_Data);
+    for( uint64_t done = 0 ; done < a_Size ; )
+    {
+        const uint64_t address = a_Address + done;
+        const uint64_t bytes = std::min(a_Size - done,PAGE_SIZE - (address & (PAGE_SIZE-1)));
+        memcpy(GetWritePointer(address),src + done,bytes);
+        Written(address,bytes);
+        done += bytes;
+    }
+}
+
+const uint8_t* MiniCPU::GetReadPointer(uint64_t a_Address)const
+{
+    const uint64_t page = a_Address >> PAGE_SHIFT;
+    TLBEntry& entry = mReadTLB[page & (TLB_SIZE-1)];
+    if( entry.Page != page )
+    {
+        entry.Page = page;
+        entry.Data = const_cast<uint8_t*>(GetReadablePage(page));
+    }
+    return entry.Data + (a_Address & (PAGE_SIZE-1));
+}
+
+uint8_t* MiniCPU::GetWritePointer(uint64_t a_Address)
+{
+    const uint64_t page = a_Address >> PAGE_SHIFT;
+    TLBEntry& write = mWriteTLB[page & (TLB_SIZE-1)];
+    if( write.Page == page )
+    {
+        return write.Data + (a_Address & (PAGE_SIZE-1));
+    }
+
+    // Writing can allocate the page or copy it, so the read entry may be out of date too.
+    uint8_t* data = GetWritablePage(page);
+    if( mSnapshotID )
+    {
+        mDirtyPages.insert(page);
+    }
+    TLBEntry& read = mReadTLB[page & (TLB_SIZE-1)];
+    read.Page = page;
+    read.Data = data;
+    if( mPagesWithCode.count(page) == 0 )
+    {
+        write.Page = page;
+        write.Data = data;
+    }
+    return data + (a_Address & (PAGE_SIZE-1));
+}
+
+void MiniCPU::Written(uint64_t a_Address,uint64_t a_Size)
+{
+    if( mPagesWithCode.size() && mPagesWithCode.count(a_Address >> PAGE_SHIFT) )
+    {
+        InvalidateCode(a_Address,a_Size);
+    }
+}
+
+void MiniCPU::FlushTLBs()
+{
+    for( uint64_t n = 0 ; n < TLB_SIZE ; n++ )
+    {
+        mReadTLB[n].Page = TLB_EMPTY;
+        mReadTLB[n].Data = nullptr;
+    }
+    FlushWriteTLB();
+}
+
+// Once the pages are shared, or have to be tracked, writes have to go the slow way the first time again.
+void MiniCPU::FlushWriteTLB()
+{
+    for( uint64_t n = 0 ; n < TLB_SIZE ; n++ )
+    {
+        mWriteTLB[n].Page = TLB_EMPTY;
+        mWriteTLB[n].Data = nullptr;
+    }
+}
+
+// Writes to the page now have to go the slow way so they can throw away the code.
+void MiniCPU::MarkCode(uint64_t a_Page)
+{
+    if( mPagesWithCode.insert(a_Page).second )
+    {
+        TLBEntry& write = mWriteTLB[a_Page & (TLB_SIZE-1)];
+        if( write.Page == a_Page )
+        {
+            write.Page = TLB_EMPTY;
+            write.Data = nullptr;
+        }
+    }
+}
+
+void MiniCPU::SetFloatPrecision(FloatPrecision a_Precision)
+{
+    if( a_Precision != mFloatPrecision )
+    {
+        mFloatPrecision = a_Precision;
+        ClearCodePages();
+    }
+}
+
+void MiniCPU::EnableJIT(bool a_Enable)
+{
+    if( a_Enable && !mJIT )
+    {
+        mJIT.reset(new JIT(*this));
+    }
+    else if( !a_Enable )
+    {
+        mJIT.reset();
+    }
+}
+
+void MiniCPU::EnableProfiler(bool a_Enable)
+{
+#ifdef MINICPU_PROFILER
+    if( a_Enable && !mProfiler )
+    {// Anything counted by fused micro ops before now is thrown away.
+        CollectProfile();
+        mProfiler.reset(new Profiler());
+    }
+    else if( !a_Enable )
+    {
+        mProfiler.reset();
+    }
+#else
+    if( a_Enable )
+    {
+        throw std::runtime_error("The profiler is not built in, build with MINICPU_PROFILER defined");
+    }
+#endif
+}
+
+std::string MiniCPU::CompareState(const MiniCPU& a_Other)const
+{
+    std::stringstream diff;
+    for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+    {
+        if( mRegisters[r].u64 != a_Other.mRegisters[r].u64 )
+        {
+            diff << "R" << r << " 0x" << std::hex << mRegisters[r].u64 << " != 0x" << a_Other.mRegisters[r].u64;
+            return diff.str();
+        }
+    }
+
+    if( mPC != a_Other.mPC )
+    {
+        diff << "PC 0x" << std::hex << mPC << " != 0x" << a_Other.mPC;
+    }
+    else if( mSP != a_Other.mSP )
+    {
+        diff << "SP 0x" << std::hex << mSP << " != 0x" << a_Other.mSP;
+    }
+    else if( GetFlags() != a_Other.GetFlags() )
+    {
+        diff << "Flags 0x" << std::hex << GetFlags() << " != 0x" << a_Other.GetFlags();
+    }
+    else if( mInterruptMask != a_Other.mInterruptMask )
+    {
+        diff << "Interrupt mask 0x" << std::hex << mInterruptMask << " != 0x" << a_Other.mInterruptMask;
+    }
+    else if( mCycleCount != a_Other.mCycleCount )
+    {
+        diff << "Cycles " << mCycleCount << " != " << a_Other.mCycleCount;
+    }
+    else
+    {
+        uint64_t address;
+        if( GetMemory().FindDifference(a_Other.GetMemory(),address) )
+        {
+            diff << "Memory at 0x" << std::hex << address << " 0x" << (int)ReadMemory<uint8_t>(address) << " != 0x" << (int)a_Other.ReadMemory<uint8_t>(address);
+        }
+    }
+    return diff.str();
+}
+
+// In one read, large sources are mostly what the assembly cache has to look at.
 static std::string ReadTextFile(const std::string& a_Filename)
 {
-    std::ifstream in(a_Filename);
-    std::stringstream buf;
-    buf << in.rdbuf();
-    return buf.str();
+    std::ifstream in(a_Filename,std::ios::binary|std::ios::ate);
+    std::string text;
+    if( in )
+    {
+        text.resize(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(&text[0],text.size());
+    }
+    return text;
 }
 
 int main(int argc, char *argv[])
@@ -34,11 +326,466 @@ int main(int argc, char *argv[])
     std::cout << "NUMBER_REGISTERS = " << NUMBER_REGISTERS << std::endl;
     
 
-    const std::string code = ReadTextFile("./hello_world.asm");
+    std::string filename = "./hello_world.asm";
+    std::string imageFilename;
+    std::string assemblyCacheFilename;
+    bool useJIT = false;
+    FloatPrecision floatPrecision = FLOAT_PRECISION_EXACT;
+    bool jitDiff = false;
+    uint64_t cycles = 10000;
+    size_t poolInstances = 0;
+    uint32_t poolThreads = 64;
+    uint32_t cores = 0;
+    uint32_t lanes = 0;
+    uint64_t timerCycles = 0;
+    uint64_t raiseMicroseconds = 0;
+    size_t assemblerBenchmarkLines = 0;
+    uint32_t assemblerThreads = 0;
+    bool listing = false;
+    bool profile = false;
+    uint64_t randomSeed = Random::DEFAULT_SEED;
+    std::string recordFilename;
+    std::string replayFilename;
+    uint64_t benchmarkCycles = 0;
+#ifdef BENCHMARK_BUILD
+    std::string benchmarkFilename = "benchmark.json";    // The benchmark build runs the suite unless told to write it somewhere else.
+#else
+    std::string benchmarkFilename;
+#endif
+    for( int n = 1 ; n < argc ; n++ )
+    {
+        const std::string arg = argv[n];
+        if( arg == "-jit" )
+        {
+            useJIT = true;
+        }
+        else if( arg == "-fastfloat" )
+        {
+            floatPrecision = FLOAT_PRECISION_FAST;
+        }
+        else if( arg == "-jitdiff" )
+        {
+            jitDiff = true;
+        }
+        else if( arg == "-cycles" && n + 1 < argc )
+        {
+            cycles = std::stoull(argv[++n]);
+            benchmarkCycles = cycles;
+        }
+        else if( arg == "-bench" && n + 1 < argc )
+        {
+            benchmarkFilename = argv[++n];
+        }
+        else if( arg == "-pool" && n + 1 < argc )
+        {
+            poolInstances = std::stoull(argv[++n]);
+        }
+        else if( arg == "-threads" && n + 1 < argc )
+        {
+            poolThreads = std::stoul(argv[++n]);
+        }
+        else if( arg == "-cores" && n + 1 < argc )
+        {
+            cores = std::stoul(argv[++n]);
+        }
+        else if( arg == "-lanes" && n + 1 < argc )
+        {
+            lanes = std::stoul(argv[++n]);
+        }
+        else if( arg == "-timer" && n + 1 < argc )
+        {
+            timerCycles = std::stoull(argv[++n]);
+        }
+        else if( arg == "-raise" && n + 1 < argc )
+        {
+            raiseMicroseconds = std::stoull(argv[++n]);
+        }
+        else if( arg == "-asmbench" && n + 1 < argc )
+        {
+            assemblerBenchmarkLines = std::stoull(argv[++n]);
+        }
+        else if( arg == "-asmthreads" && n + 1 < argc )
+        {
+            assemblerThreads = std::stoul(argv[++n]);
+        }
+        else if( arg == "-seed" && n + 1 < argc )
+        {
+            randomSeed = std::stoull(argv[++n],nullptr,0);
+        }
+        else if( arg == "-record" && n + 1 < argc )
+        {
+            recordFilename = argv[++n];
+        }
+        else if( arg == "-replay" && n + 1 < argc )
+        {
+            replayFilename = argv[++n];
+        }
+        else if( arg == "-profile" )
+        {
+            profile = true;
+        }
+        else if( arg == "-list" )
+        {
+            listing = true;
+        }
+        else if( arg == "-o" && n + 1 < argc )
+        {
+            imageFilename = argv[++n];
+        }
+        else if( arg == "-asmcache" && n + 1 < argc )
+        {
+            assemblyCacheFilename = argv[++n];
+        }
+        else
+        {
+            filename = arg;
+        }
+    }
+
+    if( assemblerBenchmarkLines > 0 )
+    {
+        return AssemblerBenchmark::Report(assemblerBenchmarkLines,std::cout) ? 0 : 1;
+    }
+
+    if( benchmarkFilename.size() )
+    {
+        std::ofstream json(benchmarkFilename);
+        if( !json )
+        {
+            std::cerr << "Failed to create " << benchmarkFilename << std::endl;
+            return 1;
+        }
+
+        const bool passed = BenchmarkSuite::Run(benchmarkCycles ? benchmarkCycles : BenchmarkSuite::DEFAULT_CYCLES,json);
+        std::cout << "Benchmark results written to " << benchmarkFilename << std::endl;
+        if( !passed )
+        {
+            std::cerr << "The JIT and the interpreter did not agree, see " << benchmarkFilename << std::endl;
+        }
+        return passed ? 0 : 1;
+    }
+
+    // A replay has everything it needs in the recording, the program is in the memory of its snapshot.
+    std::unique_ptr<MiniCPU> cpu(new MiniCPU());
+    cpu->SetFloatPrecision(floatPrecision);
+    Recording recording;
+    Profiler::SourceMap sourceMap;     // Only for source, images do not have line numbers.
+    std::vector<ProgramImage::Symbol> symbols;
+    std::string source;
+    if( replayFilename.size() )
+    {
+        recording.Load(replayFilename);
+        cpu->StartReplay(recording);
+        cycles = recording.GetEndCycle() - recording.GetStartCycle();
+        std::cout << "Replaying " << replayFilename << ", " << recording.GetEventCount() << " events over " << cycles << " cycles" << std::endl;
+    }
+    else
+    {
+        // Images are mapped and used as they are, source has to be assembled first.
+        const auto loadStart = std::chrono::steady_clock::now();
+        ProgramImage image;
+        if( ProgramImage::IsImage(filename) )
+        {
+            image.Load(filename);
+        }
+        else if( assemblyCacheFilename.size() && !profile && !listing )
+        {
+            // Only what was edited since the last run is assembled, the profiler and the listing want every line done.
+            AssemblyCache cache;
+            cache.Load(assemblyCacheFilename);
+            source = ReadTextFile(filename);
+            const std::vector<Instruction> machineCode = cache.Compile(MachineCodeAssembler(),source,&symbols);
+            const AssemblyCache::Stats& stats = cache.GetStats();
+            if( stats.SourceReused )
+            {
+                std::cout << "Assembly cache " << assemblyCacheFilename << " has all of " << filename << std::endl;
+            }
+            else
+            {
+                cache.Save(assemblyCacheFilename);
+                std::cout << "Assembly cache " << assemblyCacheFilename << " " << stats.RegionsReused << " regions reused, "
+                          << stats.RegionsAssembled << " assembled, " << stats.LinesParsed << " of " << stats.Lines << " lines parsed" << std::endl;
+            }
+            if( stats.Errors )
+            {
+                std::cerr << stats.Errors << " lines of " << filename << " did not assemble, nothing written or run" << std::endl;
+                return 1;
+            }
+            image.AddSection(ProgramImage::SECTION_CODE,0,machineCode.data(),machineCode.size() * sizeof(Instruction));
+            image.SetEntry(0);
+            for( const auto& symbol : symbols )
+            {
+                image.AddSymbol(symbol.Name,symbol.Address);
+            }
+        }
+        else if( imageFilename.size() && !profile )
+        {
+            // Saving an image, so the code can go straight to the file as it is made and the image mapped after.
+            // Neither the source nor the code is ever all in memory, the profiler wants both so does not do this.
+            // If it throws the writer removes what it had written.
+            try
+            {
+                MachineCodeAssembler assembler;
+                ImageStreamWriter writer(imageFilename);
+                const uint64_t instructions = assembler.CompileFile(filename,[&writer](const Instruction* a_Code,size_t a_Count)
+                {
+                    writer.Write(a_Code,a_Count);
+                },listing ? &std::cout : nullptr,assemblerThreads,&symbols);
+                if( assembler.GetErrorCount() )
+                {// Not finished, so the writer removes it.
+                    std::cerr << assembler.GetErrorCount() << " lines of " << filename << " did not assemble, no image written" << std::endl;
+                    return 1;
+                }
+                for( const auto& symbol : symbols )
+                {
+                    writer.AddSymbol(symbol.Name,symbol.Address);
+                }
+                writer.Finish();
+                std::cout << "Streamed " << instructions << " instructions to image " << imageFilename << std::endl;
+            }
+            catch(const std::exception& e)
+            {
+                std::cerr << "Failed to make image " << imageFilename << ": " << e.what() << std::endl;
+                return 1;
+            }
+            image.Load(imageFilename);
+            imageFilename.clear();
+        }
+        else
+        {
+            MachineCodeAssembler assembler;
+            source = ReadTextFile(filename);
+            image = assembler.CompileImage(source,listing ? &std::cout : nullptr,assemblerThreads,profile ? &sourceMap.Lines : nullptr);
+            sourceMap.Source = source;
+            if( assembler.GetErrorCount() )
+            {
+                std::cerr << assembler.GetErrorCount() << " lines of " << filename << " did not assemble, nothing written or run" << std::endl;
+                return 1;
+            }
+        }
+        std::cout << "Loaded " << filename << " in " << std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - loadStart).count() << "us" << std::endl;
+
+        symbols = image.GetSymbols();
+        if( listing )
+        {
+            std::cout << "Symbols, " << symbols.size() << std::endl;
+            for( const auto& symbol : symbols )
+            {
+                std::cout << "  0x" << std::hex << std::setfill('0') << std::setw(16) << symbol.Address << std::dec << std::setfill(' ') << "  " << symbol.Name << std::endl;
+            }
+        }
+
+        if( imageFilename.size() )
+        {
+            image.Save(imageFilename);
+            std::cout << "Saved image " << imageFilename << std::endl;
+        }
+
+        const std::vector<Instruction> machineCode = image.GetCode();
+
+        if( poolInstances > 0 )
+        {
+            CpuPool::ScalingReport(machineCode,poolInstances,cycles,10000,poolThreads,std::cout);
+            return 0;
+        }
+
+        if( jitDiff )
+        {
+            return JIT::DifferentialTest(machineCode,cycles,cycles < 1000 ? cycles : cycles / 1000,std::cout) ? 0 : 1;
+        }
+
+        if( cores > 0 )
+        {
+            GuestMemory memory;
+            image.LoadInto(memory);
+            Multicore multicore(cores);
+            multicore.LoadImage(memory,image.GetEntry());
+            multicore.SetRandomSeed(randomSeed);
+            multicore.EnableJIT(useJIT);
+            multicore.SetFloatPrecision(floatPrecision);
+            const Multicore::Result result = multicore.Run(cycles);
+            for( uint32_t n = 0 ; n < multicore.GetSize() ; n++ )
+            {
+                const MiniCPU& core = multicore.GetCore(n);
+                std::cout << "Core " << n << " PC = 0x" << std::hex << core.GetPC() << std::dec << " Cycles = " << core.GetCycleCount();
+                if( multicore.GetError(n).size() )
+                {
+                    std::cout << " stopped: " << multicore.GetError(n);
+                }
+                std::cout << std::endl;
+            }
+            std::cout << result.Cores << " cores ran " << result.Instructions << " instructions in " << result.Seconds << "s, " << result.InstructionsPerSecond / 1e6 << " MIPS" << std::endl;
+            return 0;
+        }
+
+        if( lanes > 0 )
+        {
+            GuestMemory memory;
+            image.LoadInto(memory);
+            WideCPU wide(lanes);
+            wide.LoadImage(memory,image.GetEntry());
+            wide.SetRandomSeed(randomSeed);
+            wide.SetFloatPrecision(floatPrecision);
+
+            const auto wideStart = std::chrono::steady_clock::now();
+            try
+            {
+                wide.Run(cycles);
+            }
+            catch(const std::exception& e)
+            {
+                std::cerr << "Lanes stopped: " << e.what() << std::endl;
+            }
+            const double wideSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wideStart).count();
+
+            // The same lanes again one at a time, each the way a Multicore core would start, to check the lanes got the
+            // same answers and to see what running them together gained.
+            bool match = true;
+            double scalarSeconds = 0.0;
+            for( uint32_t n = 0 ; n < wide.GetSize() ; n++ )
+            {
+                MiniCPU lane;
+                lane.LoadImage(memory,image.GetEntry());
+                lane.SetRandomSeed(randomSeed,n);
+                lane.SetFloatPrecision(floatPrecision);
+                lane.SetRegister(REG_0,n);
+                lane.SetRegister(REG_1,wide.GetSize());
+
+                const auto start = std::chrono::steady_clock::now();
+                try
+                {
+                    lane.Run(cycles);
+                }
+                catch(const std::exception&)
+                {
+                }
+                scalarSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                const std::string diff = wide.GetLane(n).CompareState(lane);
+                if( diff.size() )
+                {
+                    std::cout << "Lane " << n << " is not the same run on its own: " << diff << std::endl;
+                    match = false;
+                }
+            }
+
+            const WideCPU::Stats& stats = wide.GetStats();
+            std::cout << wide.GetSize() << " lanes, " << stats.WideInstructions << " wide instructions, " << stats.MaskedInstructions << " masked, "
+                      << stats.ScalarInstructions << " done per lane" << (stats.Split ? ", split to run on their own" : "") << std::endl;
+            std::cout << "Together " << wideSeconds << "s, one at a time " << scalarSeconds << "s, " << (wideSeconds > 0.0 ? scalarSeconds / wideSeconds : 0.0) << "x" << std::endl;
+            return match ? 0 : 1;
+        }
+
+        {
+            GuestMemory memory;
+            image.LoadInto(memory);
+            cpu->LoadImage(memory,image.GetEntry());
+        }
+        cpu->SetRandomSeed(randomSeed);
+
+        if( recordFilename.size() )
+        {
+            cpu->StartRecording(recording);
+        }
+    }
+
+    // Interupt1 from a timer and Interupt2 from another thread, as a device would.
+    if( timerCycles > 0 )
+    {
+        cpu->GetInterrupts().AddTimer(0,cpu->GetCycleCount() + timerCycles,timerCycles);
+    }
+
+    std::atomic<bool> running(true);
+    std::thread raiser;
+    if( raiseMicroseconds > 0 )
+    {
+        raiser = std::thread([&cpu,&running,raiseMicroseconds]()
+        {
+            while( running )
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(raiseMicroseconds));
+                cpu->GetInterrupts().Raise(1);
+            }
+        });
+    }
+
+    try
+    {
+        cpu->EnableJIT(useJIT);
+        cpu->EnableProfiler(profile);
+        cpu->Run(cycles);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "CPU stopped: " << e.what() << std::endl;
+    }
+
+    running = false;
+    if( raiser.joinable() )
+    {
+        raiser.join();
+    }
+
+    if( recording.GetMode() == Recording::MODE_RECORDING )
+    {
+        cpu->StopRecording();
+        recording.Save(recordFilename);
+        std::cout << "Recorded " << recording.GetEventCount() << " events, " << recording.GetEventBytes() << " bytes, to " << recordFilename << std::endl;
+    }
+    else if( recording.GetMode() == Recording::MODE_REPLAYING )
+    {
+        const std::string difference = cpu->StopReplay();
+        std::cout << (difference.size() ? difference : "Replay ended in the same state as the recording") << std::endl;
+    }
+
+    for( int r = REG_0 ; r < REG_15 ; r++ )
+    {
+        std::cout << "R" << r << " = 0x" << std::hex << cpu->GetRegister(r).u64 << std::dec << std::endl;
+    }
+    std::cout << "PC = 0x" << std::hex << cpu->GetPC() << " SP = 0x" << cpu->GetSP() << " Flags = 0x" << cpu->GetFlags() << std::dec << std::endl;
+    std::cout << "Cycles = " << cpu->GetCycleCount() << std::endl;
+    const FusionStats& fusion = cpu->GetFusionStats();
+    for( uint32_t type = 0 ; type < NUMBER_FUSION_TYPES ; type++ )
+    {
+        if( fusion.Decoded[type] )
+        {
+            std::cout << "Fused " << MiniCPU::GetFusionName(type) << " decoded = " << fusion.Decoded[type] << " executed = " << fusion.Executed[type] << std::endl;
+        }
+    }
+    std::cout << "Dispatches saved by fusion = " << fusion.DispatchesSaved << std::endl;
+
+    const InterruptController::Stats& interrupts = cpu->GetInterrupts().GetStats();
+    uint64_t taken = 0;
+    for( uint32_t line = 0 ; line < InterruptController::NUMBER_LINES ; line++ )
+    {
+        if( interrupts.Raised[line] || interrupts.Fired[line] || interrupts.Taken[line] )
+        {
+            std::cout << "Interrupt " << line + 1 << " raised = " << interrupts.Raised[line] << " fired = " << interrupts.Fired[line] << " taken = " << interrupts.Taken[line] << std::endl;
+        }
+        taken += interrupts.Taken[line];
+    }
+
+    if( taken )
+    {
+        std::cout << "Interrupt latency cycles mean = " << interrupts.LatencyCycles / taken << " max = " << interrupts.MaxLatencyCycles << std::endl;
+    }
+
+    if( interrupts.HostTaken )
+    {
+        std::cout << "Interrupt latency from Raise mean = " << (interrupts.LatencyNanoseconds / interrupts.HostTaken) / 1000.0 << "us max = " << interrupts.MaxLatencyNanoseconds / 1000.0 << "us" << std::endl;
+    }
 
-    MachineCodeAssembler assembler;
+    if( cpu->GetJIT() )
+    {
+        const JIT::Stats& stats = cpu->GetJIT()->GetStats();
+        std::cout << "JIT blocks = " << stats.BlocksCompiled << " instructions compiled = " << stats.InstructionsCompiled << " flushes = " << stats.Flushes << std::endl;
+        std::cout << "JIT native = " << stats.NativeInstructions << " interpreted = " << stats.InterpretedInstructions << std::endl;
+    }
 
-    const std::vector<Instruction> machineCode = assembler.Compile(code);
+    if( cpu->GetProfiler() )
+    {
+        cpu->GetProfiler()->Report(*cpu,std::cout,source.size() ? &sourceMap : nullptr,&symbols);
+    }
 
 // And quit
     return 0;
@@ -2,6 +2,17 @@
 #define __MINI_CPU__
 
 #include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "GuestMemory.h"
+#include "Random.h"
+#include "InterruptController.h"
 
 enum Registers
 {
@@ -38,6 +49,9 @@ union Register
     uint32_t u32;
     uint64_t u64;
 
+    float f32;
+    double f64;
+
     int8_t  *ps8;
     int16_t *ps16;
     int32_t *ps32;
@@ -83,8 +97,8 @@ union Register
     /* data sinstrutions */ \
     MAKE_OPCODE("MOVE",OP_MOVE)       \
     /* Copies from the source register to the dest register. Number bytes copied is the data type * the unsigned constant data. */  \
-    MAKE_OPCODE("MEMSET",OP_MEMSET)      /* MEMSET U32,R0,&R1,0x10 /* Copy 16 32 bit values, 128 bytes, to address. */             \
-    MAKE_OPCODE("MEMCPY",OP_MEMCPY)      /* MEMCPY U32,&R0,&R1,0x10 /* Copy 16 32 bit values, 128 bytes, to address.  */           \
+    MAKE_OPCODE("MEMSET",OP_MEMSET)      /* MEMSET U32,R0,&R1,0x10  Copy 16 32 bit values, 128 bytes, to address. */             \
+    MAKE_OPCODE("MEMCPY",OP_MEMCPY)      /* MEMCPY U32,&R0,&R1,0x10  Copy 16 32 bit values, 128 bytes, to address.  */           \
     /* Stack operations. */                                                                                                         \
     MAKE_OPCODE("POP",OP_POP)       /* POP -,-,R0,-    Move 32 bit value from stack into register, decrement SP */\
     MAKE_OPCODE("PUSH",OP_PUSH)      /* PUSH -,R0,-,-   Move 32Bit value from register into stack. */\
@@ -122,7 +136,7 @@ union Register
     /* dest = remainder of dest / source. 7 = 107 / 10 */\
     /* Any integer division by zero returns zero. */\
     MAKE_OPCODE("DIVR",OP_DIVR)    \
-    MAKE_OPCODE("RAND",OP_RAND)      /* RAND U32,-,&R1,0x10 /* Make random 32 bit value and write to address.  */           \
+    MAKE_OPCODE("RAND",OP_RAND)      /* RAND U32,-,&R1,0x10  Make random 32 bit value and write to address.  */           \
     /* Linear interpolation from source to dest based on constant. Constant treated as 16 unsigned 0 -> 1 value. dest = source + ((dest-source) * constant) */\
     MAKE_OPCODE("LERP",OP_LERP)     /* LERP U32,R1,R2,0x0100 */\
     MAKE_OPCODE("MAX",OP_MAX)         /* MAX S32,R1,R2,- */\
@@ -132,7 +146,7 @@ union Register
     MAKE_OPCODE("FMUL",OP_FMUL)    \
     MAKE_OPCODE("FDIV",OP_FDIV)    \
     MAKE_OPCODE("FRAC",OP_FRAC)    /* Fractional part of a float or double. */\
-    MAKE_OPCODE("FRAND",OP_FRAND)      /* RAND FLOAT,-,&R1,0x10 /* Make random float 0.0 -> 1.0 value and write to address.  */           \
+    MAKE_OPCODE("FRAND",OP_FRAND)      /* RAND FLOAT,-,&R1,0x10  Make random float 0.0 -> 1.0 value and write to address.  */           \
     /* Linear interpolation from source to dest based on constant. Constant treated as 16 unsigned 0 -> 1 value. dest = source + ((dest-source) * constant) */\
     MAKE_OPCODE("FLERP",OP_FLERP)     /* LERP FLOAT,R1,R2,0x0100 */\
     MAKE_OPCODE("FMAX",OP_FMAX)    \
@@ -195,7 +209,10 @@ enum ConditionFlags
     ConFlag_Negative = 0,
     ConFlag_Zero = 1,
     ConFlag_Carry = 2,
-    ConFlag_Overflow = 3
+    ConFlag_Overflow = 3,
+    ConFlag_Signed = 4,     // Not a real flag, set when the last operation that set the flags used a signed data type. Lets LT, GT etc do the right thing for unsigned compares.
+
+    NUMBER_CONDITION_FLAGS
 };
 
 enum ConditionCodes
@@ -213,6 +230,102 @@ enum ConditionCodes
     ConCode_GE,     // Greater than or equal
 };
 
+/**
+ * @brief Tests the condition code against the flags set by the last operation that changed them.
+ * LT, GT, LE and GE are signed or unsigned compares depending on the data type of that operation.
+ */
+inline bool TestCondition(uint32_t a_Flags,uint32_t a_Condition)
+{
+    const bool negative = (a_Flags&(1<<ConFlag_Negative)) != 0;
+    const bool zero = (a_Flags&(1<<ConFlag_Zero)) != 0;
+    const bool carry = (a_Flags&(1<<ConFlag_Carry)) != 0;
+    const bool overflow = (a_Flags&(1<<ConFlag_Overflow)) != 0;
+    const bool lessThan = (a_Flags&(1<<ConFlag_Signed)) ? (negative != overflow) : carry;
+
+    switch( a_Condition )
+    {
+    case ConCode_FALSE: return false;
+    case ConCode_TRUE:  return true;
+    case ConCode_NEQ:   return negative;
+    case ConCode_POS:   return !negative;
+    case ConCode_NZ:    return !zero;
+    case ConCode_EQ:    return zero;
+    case ConCode_NE:    return !zero;
+    case ConCode_LT:    return lessThan;
+    case ConCode_GT:    return !zero && !lessThan;
+    case ConCode_LE:    return zero || lessThan;
+    case ConCode_GE:    return !lessThan;
+    }
+    return false;
+}
+
+enum FlagsOperation
+{
+    FLAGS_VALUE,    // Result is the flags themselves, after SGET, a reset or the JIT.
+    FLAGS_RESULT,   // Logic, shifts, MUL, DIV and the rest. Negative and zero come from the result, carry and overflow are clear.
+    FLAGS_ADD,
+    FLAGS_SUB,      // SUB and CMP, carry is the borrow.
+};
+
+/**
+ * @brief The flags are not worked out when an operation sets them, as nearly all of them are never read. Instead the
+ * operation, its data type, operands and result are kept and the flags made from them by Get when a JUMP needs them.
+ * The operands and result are zero extended from the width of the data type.
+ */
+struct LazyFlags
+{
+    uint64_t Result;
+    uint64_t A;
+    uint64_t B;
+    uint32_t Operation;
+    uint32_t DataType;
+
+    uint32_t Get()const
+    {
+        if( Operation == FLAGS_VALUE )
+        {
+            return static_cast<uint32_t>(Result);
+        }
+
+        const uint64_t signBit = 1ull << ((8 << (DataType&3)) - 1);
+        uint32_t flags = DataType >= DataType_SIGNED_INT_8 ? (1<<ConFlag_Signed) : 0;
+        if( Result & signBit )
+        {
+            flags |= (1<<ConFlag_Negative);
+        }
+
+        if( Result == 0 )
+        {
+            flags |= (1<<ConFlag_Zero);
+        }
+
+        if( Operation == FLAGS_ADD )
+        {
+            flags |= (Result < A ? (1<<ConFlag_Carry) : 0) | (((A ^ Result) & (B ^ Result) & signBit) ? (1<<ConFlag_Overflow) : 0);
+        }
+        else if( Operation == FLAGS_SUB )
+        {
+            flags |= (A < B ? (1<<ConFlag_Carry) : 0) | (((A ^ B) & (A ^ Result) & signBit) ? (1<<ConFlag_Overflow) : 0);
+        }
+        return flags;
+    }
+
+    /**
+     * @brief Turns the state into FLAGS_VALUE, for code that wants the flags in one place, like the JIT.
+     */
+    void Resolve()
+    {
+        Result = Get();
+        Operation = FLAGS_VALUE;
+    }
+
+    void Set(uint32_t a_Flags)
+    {
+        Result = a_Flags;
+        Operation = FLAGS_VALUE;
+    }
+};
+
 /**
  * @brief Basic instruction type that most instructions fall into. There are two exceptions, LOAD and JUMP.
  * The reason the first bit is used to differentiate between the special load instuction and the rest of the instuction set
@@ -260,6 +373,7 @@ struct __attribute__ ((packed)) LoadInstruction
  * If a register other than the constant register is used then the constant data is added to the value in the register.
  * If PCRelative is false then the jump is zero base, that is an absolute address.
  * If PCRelative is true then the jump is +- the PC.
+ * In the assembler the constant can be a label, see MachineCodeAssembler for how a JUMP to one is made.
  */
 struct __attribute__ ((packed)) JumpInstruction
 {
@@ -295,18 +409,393 @@ struct AddressSpace
     uint8_t BootCode2[0x000000000000ffff];
 };
 
+class MiniCPU;
+class JIT;
+class Profiler;
+class Snapshot;
+struct SnapshotState;
+class Recording;
+class Multicore;
+struct MicroOp;
+typedef void (*MicroOpHandler)(MiniCPU& a_CPU,const MicroOp& a_Op);
+
+/**
+ * @brief An instruction that has been decoded once, ready to be executed many times.
+ * All the bitfield work is done up front. Registers are resolved to pointers, R15 as a source points at the
+ * immediate value and the address modes are built into which handler is used.
+ * One per cache line.
+ */
+struct alignas(64) MicroOp
+{
+    MicroOpHandler Handler;     // May run more than one instruction when fused with the instructions that follow it.
+    MicroOpHandler Single;      // Runs just this instruction, the same as Handler when not fused.
+    Register* Source;
+    Register* Dest;
+    Register Immediate;     // What R15 reads as, converted to the data type of the instruction.
+    Register Constant;      // The constant data. Sign extended for JUMP, shifted into place for LOAD. Target address for a JUMP using R15.
+    uint64_t Offset;        // Added to the address of both operands when they are addresses. The address of the instruction for JUMP.
+    uint32_t Bytes;         // The instruction this was decoded from.
+    mutable uint32_t Count; // Times run, only kept when profiling and moved into the Profiler before it can wrap.
+};
+
+/**
+ * @brief How FSIN, FCOS, FTAN and FATAN are worked out.
+ */
+enum FloatPrecision
+{
+    FLOAT_PRECISION_EXACT,      // The host libm.
+    FLOAT_PRECISION_FAST        // The inline polynomials of MathKernels, a couple of ULP out at worst.
+};
+
+/**
+ * @brief Common instruction sequences the decoder fuses into one micro op.
+ */
+enum FusionType
+{
+    FUSE_ADD_JUMP,      // ADD to a register then a JUMP using R15, count up and branch.
+    FUSE_SUB_JUMP,      // SUB from a register then a JUMP using R15, count down and branch.
+    FUSE_CMP_JUMP,      // CMP registers then a JUMP using R15, compare and branch.
+    FUSE_LOAD_48,       // LOAD then LOAD with OrWithDest to the same register.
+    FUSE_LOAD_64,       // LOAD then two LOAD with OrWithDest to the same register, a full 64bit immediate.
+
+    NUMBER_FUSION_TYPES
+};
+
+struct FusionStats
+{
+    uint64_t Decoded[NUMBER_FUSION_TYPES];     // Times the decoder made one.
+    uint64_t Executed[NUMBER_FUSION_TYPES];
+    uint64_t DispatchesSaved;                  // Instructions run without going through the dispatch in Run.
+};
+
+/**
+ * @brief The emulated CPU.
+ * Instructions are decoded into a MicroOp the first time they are executed and kept in a cache, one page of micro ops
+ * per CODE_PAGE_SIZE bytes of memory that has had code run from it. Executing is then a lookup and a call through the handler pointer.
+ * Writing to memory that has been decoded puts those micro ops back to the decode handler, so self modifying code
+ * (including MEMCPY and MEMSET over code) works.
+ * The decoder also fuses common sequences, like a count down and branch, into one micro op. See FusionType.
+ * 
+ * Operand rules for the standard instructions:-
+ *   R15 as a source reads as the constant data of the instruction. &R15 is an absolute address, the constant.
+ *   R15 as a register destination is a scratch register.
+ *   &Rn is the address in Rn plus the constant data, unless the instruction uses the constant for something else (shifts, counts etc).
+ *   Writing to a register sign or zero extends the value, depending on the data type, to the full 64 bits.
+ *   Memory is a sparse 64bit address space, see GuestMemory.
+ * The flags are set from dest - source by CMP, ADD, SUB and from the result for the other integer math and bit wise operations.
+ * The stack grows up, PUSH writes the full 64bit register and then increments SP by 8.
+ */
 class MiniCPU
 {
 public:
+    static const uint64_t PAGE_SHIFT = GuestMemory::PAGE_SHIFT;
+    static const uint64_t PAGE_SIZE = GuestMemory::PAGE_SIZE;
+    static const uint64_t CODE_PAGE_SHIFT = 8;
+    static const uint64_t CODE_PAGE_SIZE = 1<<CODE_PAGE_SHIFT;
+    static const uint64_t MICRO_OPS_PER_PAGE = CODE_PAGE_SIZE / sizeof(Instruction);
+    static const uint64_t MAX_FUSED_LENGTH = 3;
+    static const uint64_t MAX_CODE_PAGES = 4096;   // 16MiB of micro ops.
+    static const uint64_t TLB_SIZE = 64;
+    static const uint64_t PROFILE_COLLECT_CYCLES = 0xffffffff;    // No micro op count can wrap in this many.
+    static const uint64_t INTERRUPT_POLL_CYCLES = 16384;         // Most Run goes without looking at the interrupt mailbox.
+
     MiniCPU();
     ~MiniCPU();
 
     void Reset();
 
+    /**
+     * @brief Seeds the numbers RAND and FRAND make, Reset goes back to the start of them. Instances that run together
+     * should have a different a_Stream each, the same seed and stream always give the same numbers.
+     */
+    void SetRandomSeed(uint64_t a_Seed,uint64_t a_Stream = 0);
+
+    /**
+     * @brief Copies the program into memory at the address passed and sets the PC to the start of it.
+     */
+    void LoadProgram(const std::vector<Instruction>& a_Program,uint64_t a_Address = 0);
+
+    /**
+     * @brief Replaces all of memory with the pages of the image, shared copy on write, and sets the PC.
+     * This is how many instances running the same program share one copy of it.
+     */
+    void LoadImage(const GuestMemory& a_Image,uint64_t a_PC = 0);
+
+    /**
+     * @brief Executes the instruction at PC, just the one even if it has been fused with the ones after it.
+     * Will throw an exception if the instruction is illegal.
+     */
+    void Step();
+
+    /**
+     * @brief Executes a_MaxCycles instructions. Returns the number of instructions executed.
+     * Fused instructions are used while there are enough cycles left for them.
+     * Interrupts are taken between slices of the run, see InterruptController.
+     * Returns early, after the PAUSE, if a PAUSE parks the CPU.
+     */
+    uint64_t Run(uint64_t a_MaxCycles);
+
+    /**
+     * @brief When set a PAUSE does not sleep the host thread, it parks the CPU. Run returns straight after it and
+     * whoever is running the CPU waits GetParkedMicroseconds() before calling Run again, see CpuPool.
+     * Recording or replaying PAUSE always sleeps, the recording has to have how long it really took.
+     */
+    void SetParkOnPause(bool a_Park){mParkOnPause = a_Park;}
+    bool IsParked()const{return mParked;}
+    uint64_t GetParkedMicroseconds()const{return mParkedMicroseconds;}
+
+    /**
+     * @brief Timers and Raise for Interupt1 to Interupt3. Raise can be called from any thread while Run is running.
+     */
+    InterruptController& GetInterrupts(){return mInterrupts;}
+    const InterruptController& GetInterrupts()const{return mInterrupts;}
+
+    /**
+     * @brief Exact libm or the fast kernels for the float functions, see MathKernels. Kept over Reset and by Fork.
+     * Changing it clears the code cache, the choice is made when an instruction is decoded.
+     * A replay has to be run with the precision the recording was made with.
+     */
+    void SetFloatPrecision(FloatPrecision a_Precision);
+    FloatPrecision GetFloatPrecision()const{return mFloatPrecision;}
+
+    /**
+     * @brief Turns the x86-64 JIT on or off, when on Run uses it. Throws if the JIT is not supported on this host.
+     */
+    void EnableJIT(bool a_Enable);
+    const JIT* GetJIT()const{return mJIT.get();}
+
+    /**
+     * @brief Turns counting of every instruction Run executes on or off, see Profiler. While it is on Run does not use the JIT.
+     * Throws if this was not built with MINICPU_PROFILER, without it Run has no profiling code at all.
+     */
+    void EnableProfiler(bool a_Enable);
+    const Profiler* GetProfiler()const{return mProfiler.get();}
+
+    /**
+     * @brief Saves the state and memory into r_Snapshot, memory is shared copy on write. From now on the pages written
+     * are tracked so that restoring this snapshot only has to put those pages back.
+     */
+    void TakeSnapshot(Snapshot& r_Snapshot);
+
+    /**
+     * @brief Puts the state and memory back to what they were in a_Snapshot. Restoring the snapshot this CPU last
+     * took or restored only puts back the pages written since, else all of memory is shared and the code cache cleared.
+     */
+    void Restore(const Snapshot& a_Snapshot);
+
+    /**
+     * @brief A new CPU in the same state, sharing memory copy on write. The JIT is on in it if it is on in this one.
+     */
+    std::unique_ptr<MiniCPU> Fork();
+
+    /**
+     * @brief Takes a snapshot into r_Recording then logs the events that could be different in another run until
+     * StopRecording, see Recording. r_Recording has to stay alive until then.
+     */
+    void StartRecording(Recording& r_Recording);
+    void StopRecording();
+
+    /**
+     * @brief Restores the snapshot the recording started with and from then on PAUSE and the rest take their results
+     * from it, Run throws if the program does something the recording did not.
+     * Run for GetEndCycle() - GetStartCycle() cycles, then StopReplay returns a description of how the state is
+     * different to the end of the recording, empty if it is not.
+     */
+    void StartReplay(Recording& a_Recording);
+    std::string StopReplay();
+
+    /**
+     * @brief Returns a description of the first difference in registers, flags, counters or memory, empty if there is none.
+     */
+    std::string CompareState(const MiniCPU& a_Other)const;
+
+    const Register& GetRegister(uint32_t a_Register)const{return mRegisters[a_Register&0x0f];}
+    void SetRegister(uint32_t a_Register,uint64_t a_Value){mRegisters[a_Register&0x0f].u64 = a_Value;}
+    uint64_t GetPC()const{return mPC;}
+    uint64_t GetSP()const{return mSP;}
+    uint32_t GetFlags()const{return mFlags.Get();}
+    bool GetFlag(ConditionFlags a_Flag)const{return (mFlags.Get()&(1<<a_Flag))?true:false;}
+    uint32_t GetInterruptMask()const{return mInterruptMask;}
+    uint64_t GetCycleCount()const{return mCycleCount;}
+    const FusionStats& GetFusionStats()const{return mFusionStats;}
+    static const char* GetFusionName(uint32_t a_Type);
+    /**
+     * @brief On a core of a Multicore this is the memory shared by all of them.
+     */
+    const GuestMemory& GetMemory()const;
+
+    /**
+     * @brief Host memory used by the decoded micro ops.
+     */
+    size_t GetCodeCacheSize()const{return mCodePages.size() * sizeof(MicroOp) * MICRO_OPS_PER_PAGE;}
+
+    template <typename T> T ReadMemory(uint64_t a_Address)const;
+    template <typename T> void WriteMemory(uint64_t a_Address,T a_Value);
+
 private:
-    uint8_t mRam[1024*1024];
-    Register mRegisters[NUMBER_REGISTERS];
+    friend struct ExecutionUnit;
+    friend class JIT;
+    friend class Multicore;
+    friend class WideCPU;
+
+    struct CodePageDeleter
+    {
+        void operator()(MicroOp* a_Page)const{free(a_Page);}
+    };
+    typedef std::unique_ptr<MicroOp[],CodePageDeleter> CodePage;
+
+    // Guest page number to host memory. Read entries can point at shared or zero pages, write entries
+    // are only made for private pages that have no code, so a write that hits never has to check for code.
+    struct TLBEntry
+    {
+        uint64_t Page;
+        uint8_t* Data;
+    };
 
+    struct CodeTLBEntry
+    {
+        uint64_t Page;
+        MicroOp* Ops;
+    };
+
+    static const uint64_t TLB_EMPTY = ~0ull;
+
+    Register mRegisters[NUMBER_REGISTERS];
+    uint64_t mPC;
+    uint64_t mSP;
+    LazyFlags mFlags;
+    uint32_t mInterruptMask;
+    uint64_t mCycleCount;
+    uint64_t mRandomSeed = Random::DEFAULT_SEED;
+    uint64_t mRandomStream = 0;
+    Random mRandom;
+    InterruptController mInterrupts;
+    FusionStats mFusionStats;
+
+    GuestMemory mMemory;
+    mutable TLBEntry mReadTLB[TLB_SIZE];
+    TLBEntry mWriteTLB[TLB_SIZE];
+    CodeTLBEntry mCodeTLB[TLB_SIZE];
+
+    std::unordered_map<uint64_t,CodePage> mCodePages;   // Keyed by address >> CODE_PAGE_SHIFT.
+    std::unordered_set<uint64_t> mPagesWithCode;        // Memory pages that have decoded or compiled code, writes to them are checked.
+    std::unique_ptr<JIT> mJIT;
+    std::unique_ptr<Profiler> mProfiler;
+    uint64_t mProfiledCycles = 0;      // Since the micro op counts were last collected.
+
+    uint64_t mSliceEnd = 0;            // The cycle RunSlice stops on, a PAUSE that parks brings it in to now.
+    bool mParkOnPause = false;
+    FloatPrecision mFloatPrecision = FLOAT_PRECISION_EXACT;
+    bool mParked = false;
+    uint64_t mParkedMicroseconds = 0;
+
+    uint64_t mSnapshotID = 0;                      // The snapshot memory was last the same as, zero for none.
+    std::unordered_set<uint64_t> mDirtyPages;      // Pages written since then.
+    Recording* mRecording = nullptr;               // Recording or replaying when set.
+    Multicore* mMulticore = nullptr;               // Set on the cores of a Multicore, memory is then its memory and mMemory is not used.
+    mutable std::unordered_map<uint64_t,uint8_t*> mCorePages;  // Shared pages this core has found, they never move so only the first find locks.
+
+    void ReadMemorySlow(uint64_t a_Address,void* r_Data,uint64_t a_Size)const;
+    void WriteMemorySlow(uint64_t a_Address,const void* a_Data,uint64_t a_Size);
+
+    /**
+     * @brief Pointers into host memory for bulk work, a_Address to the end of its page is contiguous.
+     * Writes through the pointer must be followed by a call to Written.
+     */
+    const uint8_t* GetReadPointer(uint64_t a_Address)const;
+    uint8_t* GetWritePointer(uint64_t a_Address);
+    void Written(uint64_t a_Address,uint64_t a_Size);
+
+    /**
+     * @brief Where the TLBs get pages from, mMemory or the shared memory of a Multicore.
+     */
+    const uint8_t* GetReadablePage(uint64_t a_Page)const;
+    uint8_t* GetWritablePage(uint64_t a_Page);
+    uint8_t* GetCorePage(uint64_t a_Page)const;
+
+    /**
+     * @brief Throws if this is a core of a Multicore, for what needs memory of its own.
+     */
+    void CheckNotCore(const char* a_What)const;
+
+    void FlushTLBs();
+    void FlushWriteTLB();
+    void MarkCode(uint64_t a_Page);
+
+    const MicroOp& GetMicroOp(uint64_t a_PC);
+    void Dispatch();
+    MicroOp* FindCodePage(uint64_t a_CodePage);
+    MicroOp* AllocateCodePage(uint64_t a_CodePage);
+    void InvalidateCode(uint64_t a_Address,uint64_t a_Size);
+    void ClearCodePages();
+    void CollectProfile();
+    void RunSlice(uint64_t a_Cycles);
+
+    /**
+     * @brief Takes the interrupts that are waiting and enabled, or when replaying the ones logged for this cycle.
+     */
+    void CheckInterrupts();
+    uint64_t GetInterruptDeadline()const;
+    void TakeInterrupt(uint32_t a_Line);
+
+    void GetState(SnapshotState& r_State)const;
+    void SetState(const SnapshotState& a_State);
+    uint64_t HashState()const;
 };
 
+template <typename T> T MiniCPU::ReadMemory(uint64_t a_Address)const
+{
+    const uint64_t page = a_Address >> PAGE_SHIFT;
+    const uint64_t offset = a_Address & (PAGE_SIZE-1);
+    const TLBEntry& entry = mReadTLB[page & (TLB_SIZE-1)];
+    if( entry.Page == page && offset <= PAGE_SIZE - sizeof(T) )
+    {
+        T value;
+        memcpy(&value,entry.Data + offset,sizeof(T));
+        return value;
+    }
+
+    T value;
+    ReadMemorySlow(a_Address,&value,sizeof(T));
+    return value;
+}
+
+template <typename T> void MiniCPU::WriteMemory(uint64_t a_Address,T a_Value)
+{
+    const uint64_t page = a_Address >> PAGE_SHIFT;
+    const uint64_t offset = a_Address & (PAGE_SIZE-1);
+    const TLBEntry& entry = mWriteTLB[page & (TLB_SIZE-1)];
+    if( entry.Page == page && offset <= PAGE_SIZE - sizeof(T) )
+    {
+        memcpy(entry.Data + offset,&a_Value,sizeof(T));
+        return;
+    }
+    WriteMemorySlow(a_Address,&a_Value,sizeof(T));
+}
+
+inline const MicroOp& MiniCPU::GetMicroOp(uint64_t a_PC)
+{
+    const uint64_t page = a_PC >> CODE_PAGE_SHIFT;
+    const CodeTLBEntry& entry = mCodeTLB[page & (TLB_SIZE-1)];
+    MicroOp* ops = entry.Page == page ? entry.Ops : FindCodePage(page);
+    return ops[(a_PC & (CODE_PAGE_SIZE-1)) / sizeof(Instruction)];
+}
+
+inline void MiniCPU::Step()
+{
+    const MicroOp& op = GetMicroOp(mPC);
+    mPC += sizeof(Instruction);
+    mCycleCount++;
+    op.Single(*this,op);
+}
+
+// Fused handlers move the PC and cycle count on past the other instructions they run.
+inline void MiniCPU::Dispatch()
+{
+    const MicroOp& op = GetMicroOp(mPC);
+    mPC += sizeof(Instruction);
+    mCycleCount++;
+    op.Handler(*this,op);
+}
+
 #endif //__MINI_CPU__
@@ -0,0 +1,148 @@
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Multicore.h"
+
+Multicore::Multicore(uint32_t a_Cores)
+{
+    const uint32_t cores = a_Cores ? a_Cores : std::max(1u,std::thread::hardware_concurrency());
+    for( uint32_t n = 0 ; n < cores ; n++ )
+    {
+        mCores.emplace_back(new MiniCPU());
+        mCores.back()->mMulticore = this;
+    }
+    mErrors.resize(cores);
+    SetRandomSeed(Random::DEFAULT_SEED);
+}
+
+Multicore::~Multicore()
+{
+
+}
+
+void Multicore::LoadImage(const GuestMemory& a_Image,uint64_t a_PC)
+{
+    mMemory.Share(a_Image);
+    for( uint32_t n = 0 ; n < mCores.size() ; n++ )
+    {
+        MiniCPU& core = *mCores[n];
+        core.Reset();
+        core.mPC = a_PC;
+        core.mSP += n * STACK_SIZE;
+        core.mRegisters[REG_0].u64 = n;
+        core.mRegisters[REG_1].u64 = mCores.size();
+        mErrors[n].clear();
+    }
+}
+
+void Multicore::SetRandomSeed(uint64_t a_Seed)
+{
+    for( uint32_t n = 0 ; n < mCores.size() ; n++ )
+    {
+        mCores[n]->SetRandomSeed(a_Seed,n);
+    }
+}
+
+void Multicore::EnableJIT(bool a_Enable)
+{
+    for( auto& core : mCores )
+    {
+        core->EnableJIT(a_Enable);
+    }
+}
+
+void Multicore::SetFloatPrecision(FloatPrecision a_Precision)
+{
+    for( auto& core : mCores )
+    {
+        core->SetFloatPrecision(a_Precision);
+    }
+}
+
+Multicore::Result Multicore::Run(uint64_t a_Cycles)
+{
+    std::vector<uint64_t> instructions(mCores.size(),0);
+    auto worker = [this,a_Cycles,&instructions](uint32_t a_Index)
+    {
+        MiniCPU& core = *mCores[a_Index];
+        const uint64_t before = core.GetCycleCount();
+        try
+        {
+            core.Run(a_Cycles);
+        }
+        catch(const std::exception& e)
+        {
+            mErrors[a_Index] = e.what();
+        }
+        instructions[a_Index] = core.GetCycleCount() - before;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for( uint32_t n = 1 ; n < mCores.size() ; n++ )
+    {
+        threads.emplace_back(worker,n);
+    }
+    worker(0);
+
+    for( auto& t : threads )
+    {
+        t.join();
+    }
+
+    Result result;
+    result.Cores = GetSize();
+    result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for( auto i : instructions )
+    {
+        result.Instructions += i;
+    }
+    result.InstructionsPerSecond = result.Seconds > 0.0 ? result.Instructions / result.Seconds : 0.0;
+    return result;
+}
+
+uint8_t* Multicore::GetPage(uint64_t a_Page)
+{
+    std::lock_guard<std::mutex> lock(mPageLock);
+    return mMemory.GetWritable(a_Page);
+}
+
+/******************************************************************************
+ * MiniCPU
+ ******************************************************************************/
+const GuestMemory& MiniCPU::GetMemory()const
+{
+    return mMulticore ? mMulticore->mMemory : mMemory;
+}
+
+// In shared memory there is no zero page to read, another core could write the page and this one would not see it.
+const uint8_t* MiniCPU::GetReadablePage(uint64_t a_Page)const
+{
+    return mMulticore ? GetCorePage(a_Page) : mMemory.GetReadable(a_Page);
+}
+
+uint8_t* MiniCPU::GetWritablePage(uint64_t a_Page)
+{
+    return mMulticore ? GetCorePage(a_Page) : mMemory.GetWritable(a_Page);
+}
+
+// Pages with code never get a write TLB entry so every store to them comes here, the lock is only taken the first time.
+uint8_t* MiniCPU::GetCorePage(uint64_t a_Page)const
+{
+    uint8_t*& data = mCorePages[a_Page];
+    if( data == nullptr )
+    {
+        data = mMulticore->GetPage(a_Page);
+    }
+    return data;
+}
+
+void MiniCPU::CheckNotCore(const char* a_What)const
+{
+    if( mMulticore )
+    {
+        throw std::runtime_error(std::string(a_What) + " can not be used on a core of a Multicore");
+    }
+}
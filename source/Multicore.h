@@ -0,0 +1,96 @@
+#ifndef __MULTICORE_H__
+#define __MULTICORE_H__
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <string>
+
+#include "MiniCPU.h"
+
+/**
+ * @brief Several MiniCPU cores, each run on its own thread, that share one guest address space.
+ * Unlike CpuPool the cores are one machine, what one core writes the others read. SWAP with one side in memory is a
+ * host atomic exchange so guest code can build locks and semaphores out of it.
+ *
+ * Each core keeps its own TLBs, loads and stores that hit them never lock. A page in shared memory is allocated the
+ * first time any core touches it, even to read, and is never moved or copied after, so each core also keeps every page
+ * it has found and only takes the lock the first time it touches one. Stores to pages with code, which never get a
+ * write TLB entry, are then lock free too. A pointer one core has stays good however the others use that page.
+ * Plain loads and stores have the ordering of the host, SWAP is sequentially consistent.
+ *
+ * Every core starts at the same PC with R0 its index and R1 the number of cores. Each has its own STACK_SIZE of
+ * stack, the first core's starting where a single MiniCPU's would.
+ * Code is decoded per core. A core sees its own writes to code but not those of other cores, so code should not be
+ * changed while the cores run. The cores can not take snapshots, fork or record.
+ */
+class Multicore
+{
+public:
+    static const uint64_t STACK_SIZE = 0x10000;
+
+    struct Result
+    {
+        uint32_t Cores = 0;
+        uint64_t Instructions = 0;
+        double Seconds = 0.0;
+        double InstructionsPerSecond = 0.0;
+    };
+
+    /**
+     * @brief a_Cores of zero uses one per host core.
+     */
+    Multicore(uint32_t a_Cores = 0);
+    ~Multicore();
+
+    Multicore(const Multicore&) = delete;
+    Multicore& operator=(const Multicore&) = delete;
+
+    /**
+     * @brief Replaces the shared memory with the pages of the image, shared copy on write with it, and resets all the cores.
+     */
+    void LoadImage(const GuestMemory& a_Image,uint64_t a_PC = 0);
+
+    /**
+     * @brief Core n gets stream n of the seed, so each makes different numbers.
+     */
+    void SetRandomSeed(uint64_t a_Seed);
+    void EnableJIT(bool a_Enable);
+    void SetFloatPrecision(FloatPrecision a_Precision);
+
+    /**
+     * @brief Runs every core for a_Cycles instructions, or until it throws, and waits for all of them.
+     */
+    Result Run(uint64_t a_Cycles);
+
+    uint32_t GetSize()const{return static_cast<uint32_t>(mCores.size());}
+    const MiniCPU& GetCore(uint32_t a_Index)const{return *mCores[a_Index];}
+
+    /**
+     * @brief The exception that stopped the core, empty if it ran all its cycles.
+     */
+    const std::string& GetError(uint32_t a_Index)const{return mErrors[a_Index];}
+
+    /**
+     * @brief Only safe to look at when Run is not running.
+     */
+    const GuestMemory& GetMemory()const{return mMemory;}
+
+private:
+    friend class MiniCPU;
+    friend struct ExecutionUnit;
+
+    std::vector<std::unique_ptr<MiniCPU>> mCores;
+    std::vector<std::string> mErrors;
+    GuestMemory mMemory;
+    std::mutex mPageLock;   // Taken by a core the first time it touches a page.
+    std::mutex mSwapLock;   // Taken by SWAPs that can not be one host atomic.
+
+    /**
+     * @brief The page for reading or writing, allocating it or taking a private copy of it the first time.
+     */
+    uint8_t* GetPage(uint64_t a_Page);
+};
+
+#endif //__MULTICORE_H__
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <iomanip>
+#include <string>
+#include <sstream>
+
+#include "Profiler.h"
+
+static const char* sOpCodeNames[NUMBER_OPERATIONS] =
+{
+#define MAKE_OPCODE(__OP_NAME__,__OP_CODE__)  __OP_NAME__,
+    OPERATION_CODES
+#undef MAKE_OPCODE
+};
+
+static const char* sIntegerTypeNames[8] = {"U8","U16","U32","U64","S8","S16","S32","S64"};
+static const char* sFloatTypeNames[8] = {"FLOAT","DOUBLE","FLOAT?","FLOAT?","FLOAT?","FLOAT?","FLOAT?","FLOAT?"};
+
+// Rows of a histogram, hottest first.
+struct HistogramRow
+{
+    std::string Name;
+    uint64_t Count;
+};
+
+static void WriteHistogram(std::ostream& a_Report,const char* a_Title,std::vector<HistogramRow> a_Rows,uint64_t a_Total)
+{
+    std::sort(a_Rows.begin(),a_Rows.end(),[](const HistogramRow& a,const HistogramRow& b){return a.Count > b.Count;});
+
+    a_Report << std::endl << a_Title << std::endl;
+    a_Report << "      %          count  name" << std::endl;
+    for( const auto& row : a_Rows )
+    {
+        if( row.Count )
+        {
+            a_Report << std::setw(7) << (100.0 * row.Count / a_Total) << std::setw(15) << row.Count << "  " << row.Name << std::endl;
+        }
+    }
+}
+
+Profiler::Profiler()
+{
+
+}
+
+Profiler::~Profiler()
+{
+
+}
+
+void Profiler::Add(uint64_t a_PC,uint64_t a_Count)
+{
+    std::unique_ptr<uint64_t[]>& page = mPages[a_PC >> PAGE_SHIFT];
+    if( !page )
+    {
+        page.reset(new uint64_t[COUNTS_PER_PAGE]());
+    }
+    page[(a_PC & (PAGE_SIZE-1)) / sizeof(Instruction)] += a_Count;
+}
+
+void Profiler::Clear()
+{
+    mPages.clear();
+}
+
+uint64_t Profiler::GetCount(uint64_t a_PC)const
+{
+    auto found = mPages.find(a_PC >> PAGE_SHIFT);
+    return found == mPages.end() ? 0 : found->second[(a_PC & (PAGE_SIZE-1)) / sizeof(Instruction)];
+}
+
+uint64_t Profiler::GetTotal()const
+{
+    uint64_t total = 0;
+    for( const auto& page : mPages )
+    {
+        for( uint64_t n = 0 ; n < COUNTS_PER_PAGE ; n++ )
+        {
+            total += page.second[n];
+        }
+    }
+    return total;
+}
+
+std::vector<Profiler::Entry> Profiler::GetCounts()const
+{
+    std::vector<Entry> counts;
+    for( const auto& page : mPages )
+    {
+        for( uint64_t n = 0 ; n < COUNTS_PER_PAGE ; n++ )
+        {
+            if( page.second[n] )
+            {
+                counts.push_back({(page.first << PAGE_SHIFT) + (n * sizeof(Instruction)),page.second[n]});
+            }
+        }
+    }
+    std::sort(counts.begin(),counts.end(),[](const Entry& a,const Entry& b){return a.PC < b.PC;});
+    return counts;
+}
+
+void Profiler::Report(const MiniCPU& a_CPU,std::ostream& a_Report,const SourceMap* a_Source,const std::vector<ProgramImage::Symbol>* a_Symbols,size_t a_MaxRows)const
+{
+    const std::vector<Entry> counts = GetCounts();
+    uint64_t total = 0;
+    for( const auto& entry : counts )
+    {
+        total += entry.Count;
+    }
+
+    if( total == 0 )
+    {
+        a_Report << "Flat profile, nothing executed" << std::endl;
+        return;
+    }
+
+    // The source split into lines once, for looking up the text of each instruction.
+    std::vector<std::string_view> lines;
+    if( a_Source )
+    {
+        std::string_view source = a_Source->Source;
+        while( source.size() )
+        {
+            const size_t end = source.find('\n');
+            lines.push_back(source.substr(0,end));
+            source.remove_prefix(end == std::string_view::npos ? source.size() : end + 1);
+        }
+    }
+
+    auto getLine = [a_Source](uint64_t a_PC) -> uint32_t
+    {
+        if( a_Source == nullptr || a_PC < a_Source->Address )
+        {
+            return 0;
+        }
+        const uint64_t index = (a_PC - a_Source->Address) / sizeof(Instruction);
+        return index < a_Source->Lines.size() ? a_Source->Lines[index] : 0;
+    };
+
+    auto writeSource = [&](uint64_t a_PC)
+    {
+        const uint32_t line = getLine(a_PC);
+        if( line )
+        {
+            a_Report << std::setw(8) << line << "  " << (line <= lines.size() ? lines[line-1] : std::string_view());
+        }
+    };
+
+    // The symbols in address order, each address is named after the last one at or before it.
+    std::vector<ProgramImage::Symbol> symbols;
+    if( a_Symbols )
+    {
+        symbols = *a_Symbols;
+        std::stable_sort(symbols.begin(),symbols.end(),[](const ProgramImage::Symbol& a,const ProgramImage::Symbol& b){return a.Address < b.Address;});
+    }
+
+    auto writeSymbol = [&](uint64_t a_PC)
+    {
+        if( symbols.empty() )
+        {
+            return;
+        }
+
+        std::string name;
+        auto after = std::upper_bound(symbols.begin(),symbols.end(),a_PC,[](uint64_t a_Value,const ProgramImage::Symbol& a_Symbol){return a_Value < a_Symbol.Address;});
+        if( after != symbols.begin() )
+        {
+            const ProgramImage::Symbol& symbol = *(after - 1);
+            std::ostringstream offset;
+            offset << std::hex << (a_PC - symbol.Address);
+            name = symbol.Name + (a_PC == symbol.Address ? "" : "+0x" + offset.str());
+        }
+        a_Report << "  " << std::left << std::setw(SYMBOL_WIDTH) << name << std::right;
+    };
+
+    const std::ios::fmtflags oldFlags = a_Report.flags();
+    const std::streamsize oldPrecision = a_Report.precision();
+    a_Report << std::fixed << std::setprecision(2);
+
+    // Flat profile, hottest instructions first.
+    std::vector<Entry> hottest = counts;
+    std::sort(hottest.begin(),hottest.end(),[](const Entry& a,const Entry& b){return a.Count > b.Count || (a.Count == b.Count && a.PC < b.PC);});
+
+    a_Report << "Flat profile, " << total << " instructions executed at " << counts.size() << " addresses" << std::endl;
+    a_Report << "      %  cumulative          count             address";
+    if( symbols.size() )
+    {
+        a_Report << "  " << std::left << std::setw(SYMBOL_WIDTH) << "symbol" << std::right;
+    }
+    a_Report << "    line  source" << std::endl;
+    uint64_t cumulative = 0;
+    for( size_t n = 0 ; n < hottest.size() && n < a_MaxRows ; n++ )
+    {
+        cumulative += hottest[n].Count;
+        a_Report << std::setw(7) << (100.0 * hottest[n].Count / total)
+                 << std::setw(12) << (100.0 * cumulative / total)
+                 << std::setw(15) << hottest[n].Count
+                 << "  0x" << std::hex << std::setfill('0') << std::setw(16) << hottest[n].PC << std::dec << std::setfill(' ');
+        writeSymbol(hottest[n].PC);
+        writeSource(hottest[n].PC);
+        a_Report << std::endl;
+    }
+
+    // The histograms come from the instructions in memory now.
+    std::vector<HistogramRow> opCodes(NUMBER_OPERATIONS + 1);
+    std::vector<HistogramRow> dataTypes(16);
+    for( uint32_t n = 0 ; n < NUMBER_OPERATIONS ; n++ )
+    {
+        opCodes[n].Name = sOpCodeNames[n] ? sOpCodeNames[n] : "RESERVED_" + std::to_string(n);
+    }
+    opCodes[NUMBER_OPERATIONS].Name = "LOAD";
+    for( uint32_t n = 0 ; n < 8 ; n++ )
+    {
+        dataTypes[n].Name = sIntegerTypeNames[n];
+        dataTypes[n + 8].Name = sFloatTypeNames[n];
+    }
+
+    for( const auto& entry : counts )
+    {
+        Instruction ins;
+        ins.Bytes = a_CPU.ReadMemory<uint32_t>(entry.PC);
+        if( ins.Standard.IsLoad )
+        {
+            opCodes[NUMBER_OPERATIONS].Count += entry.Count;
+            continue;
+        }
+
+        opCodes[ins.Standard.OpCode].Count += entry.Count;
+        if( ins.Standard.OpCode != OP_JUMP )
+        {
+            const bool isFloat = ins.Standard.OpCode >= OP_FADD && ins.Standard.OpCode <= OP_FATAN;
+            dataTypes[ins.Standard.DataType + (isFloat ? 8 : 0)].Count += entry.Count;
+        }
+    }
+    WriteHistogram(a_Report,"Opcodes",opCodes,total);
+    WriteHistogram(a_Report,"Data types, not counting LOAD and JUMP",dataTypes,total);
+
+    // Basic blocks. A block ends at a JUMP that can be taken or a gap in the code that ran, and where the count
+    // changes, as that means something jumped into or out of the middle of it.
+    struct Block
+    {
+        uint64_t Start;
+        uint64_t End;
+        uint64_t Executions;
+        uint64_t Instructions;
+    };
+    std::vector<Block> blocks;
+    for( size_t n = 0 ; n < counts.size() ; n++ )
+    {
+        Instruction previous;
+        previous.Bytes = n > 0 ? a_CPU.ReadMemory<uint32_t>(counts[n-1].PC) : 0;
+        const bool previousJumps = !previous.Standard.IsLoad && previous.Standard.OpCode == OP_JUMP && previous.Jump.Condition != ConCode_FALSE; // JUMP FALSE is the NOP.
+        if( n == 0 || previousJumps || counts[n].PC != counts[n-1].PC + sizeof(Instruction) || counts[n].Count != counts[n-1].Count )
+        {
+            blocks.push_back({counts[n].PC,counts[n].PC,counts[n].Count,0});
+        }
+        blocks.back().End = counts[n].PC;
+        blocks.back().Instructions += counts[n].Count;
+    }
+    std::sort(blocks.begin(),blocks.end(),[](const Block& a,const Block& b){return a.Instructions > b.Instructions || (a.Instructions == b.Instructions && a.Start < b.Start);});
+
+    a_Report << std::endl << "Basic blocks, " << blocks.size() << " in total" << std::endl;
+    a_Report << "      %   instructions     executions               start                 end";
+    if( symbols.size() )
+    {
+        a_Report << "  " << std::left << std::setw(SYMBOL_WIDTH) << "symbol" << std::right;
+    }
+    a_Report << "   lines" << std::endl;
+    for( size_t n = 0 ; n < blocks.size() && n < a_MaxRows ; n++ )
+    {
+        a_Report << std::setw(7) << (100.0 * blocks[n].Instructions / total)
+                 << std::setw(15) << blocks[n].Instructions
+                 << std::setw(15) << blocks[n].Executions
+                 << std::hex << std::setfill('0')
+                 << "  0x" << std::setw(16) << blocks[n].Start
+                 << "  0x" << std::setw(16) << blocks[n].End
+                 << std::dec << std::setfill(' ');
+        writeSymbol(blocks[n].Start);
+        const uint32_t first = getLine(blocks[n].Start);
+        const uint32_t last = getLine(blocks[n].End);
+        if( first && last )
+        {
+            a_Report << "  " << first << "-" << last;
+        }
+        a_Report << std::endl;
+    }
+
+    a_Report.flags(oldFlags);
+    a_Report.precision(oldPrecision);
+}
@@ -0,0 +1,77 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <ostream>
+
+#include "MiniCPU.h"
+#include "ProgramImage.h"
+
+/**
+ * @brief Counts how many times each instruction is executed, only built when MINICPU_PROFILER is defined.
+ * While running each micro op counts itself, in the cache line Run has already loaded, fused micro ops count the
+ * ones after them too. Run moves those counts in here, into a flat array per PAGE_SIZE of code, before they can wrap
+ * and when the code cache is cleared. The JIT is not used while profiling.
+ * Everything else, the opcode and data type histograms and the basic blocks, is worked out from the counts and the
+ * instructions in memory when the report is made, so it costs nothing while the program runs.
+ * If the program modifies its own code the histograms are for what is in memory at the end.
+ */
+class Profiler
+{
+public:
+    static const uint64_t PAGE_SHIFT = 12;
+    static const uint64_t PAGE_SIZE = 1<<PAGE_SHIFT;
+    static const uint64_t COUNTS_PER_PAGE = PAGE_SIZE / sizeof(Instruction);
+    static const int SYMBOL_WIDTH = 24;     // Of the symbol column, longer names push the rest along.
+
+    /**
+     * @brief Where each instruction came from in the source, made by MachineCodeAssembler::Compile.
+     * Lines[n] is the line of the instruction at Address + (n * sizeof(Instruction)), counted from one.
+     */
+    struct SourceMap
+    {
+        uint64_t Address = 0;
+        std::vector<uint32_t> Lines;
+        std::string_view Source;
+    };
+
+    struct Entry
+    {
+        uint64_t PC;
+        uint64_t Count;
+    };
+
+    Profiler();
+    ~Profiler();
+
+    /**
+     * @brief Adds a_Count executions of the instruction at a_PC.
+     */
+    void Add(uint64_t a_PC,uint64_t a_Count);
+
+    void Clear();
+
+    uint64_t GetCount(uint64_t a_PC)const;
+    uint64_t GetTotal()const;
+
+    /**
+     * @brief Every PC that has been executed and its count, in address order.
+     */
+    std::vector<Entry> GetCounts()const;
+
+    /**
+     * @brief Writes the flat profile, the a_MaxRows hottest instructions, then the opcode and data type histograms and
+     * the hottest basic blocks. a_Source, if not null, adds the line and text of the source for each instruction.
+     * a_Symbols, if not null, names each address after the symbol at or before it, as loop+0x8.
+     */
+    void Report(const MiniCPU& a_CPU,std::ostream& a_Report,const SourceMap* a_Source = nullptr,const std::vector<ProgramImage::Symbol>* a_Symbols = nullptr,size_t a_MaxRows = 20)const;
+
+private:
+    std::unordered_map<uint64_t,std::unique_ptr<uint64_t[]>> mPages;
+};
+
+#endif //__PROFILER_H__
@@ -0,0 +1,316 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ProgramImage.h"
+
+static uint64_t RoundUpToPage(uint64_t a_Value)
+{
+    return (a_Value + ProgramImage::PAGE_SIZE - 1) & ~(ProgramImage::PAGE_SIZE - 1);
+}
+
+// True if a_Offset + a_Size is inside a_Limit, without overflowing.
+static bool InBounds(uint64_t a_Offset,uint64_t a_Size,uint64_t a_Limit)
+{
+    return a_Offset <= a_Limit && a_Size <= a_Limit - a_Offset;
+}
+
+// The tables follow the header, the string table is left empty.
+static ProgramImage::ImageHeader MakeHeader(uint64_t a_Entry,size_t a_Sections,size_t a_Symbols)
+{
+    ProgramImage::ImageHeader header = {};
+    header.Magic = ProgramImage::MAGIC;
+    header.Version = ProgramImage::VERSION;
+    header.HeaderSize = sizeof(ProgramImage::ImageHeader);
+    header.Entry = a_Entry;
+    header.SectionCount = static_cast<uint32_t>(a_Sections);
+    header.SymbolCount = static_cast<uint32_t>(a_Symbols);
+    header.SectionTableOffset = sizeof(ProgramImage::ImageHeader);
+    header.SymbolTableOffset = header.SectionTableOffset + (a_Sections * sizeof(ProgramImage::ImageSection));
+    header.StringTableOffset = header.SymbolTableOffset + (a_Symbols * sizeof(ProgramImage::ImageSymbol));
+    return header;
+}
+
+// The symbol table and the names that go in the string table.
+static void MakeSymbolTable(const std::vector<ProgramImage::Symbol>& a_Symbols,std::vector<ProgramImage::ImageSymbol>& r_Symbols,std::string& r_Names)
+{
+    for( const auto& symbol : a_Symbols )
+    {
+        r_Symbols.push_back({symbol.Address,static_cast<uint32_t>(r_Names.size()),static_cast<uint32_t>(symbol.Name.size())});
+        r_Names += symbol.Name;
+    }
+}
+
+ProgramImage::ProgramImage():
+    mEntry(0),
+    mMappingSize(0)
+{
+
+}
+
+ProgramImage::~ProgramImage()
+{
+
+}
+
+void ProgramImage::AddSection(SectionType a_Type,uint64_t a_Address,const void* a_Data,uint64_t a_Size)
+{
+    std::unique_ptr<uint8_t[]> data(new uint8_t[a_Size]);
+    memcpy(data.get(),a_Data,a_Size);
+    mSections.push_back({a_Type,a_Address,a_Size,data.get()});
+    mOwned.push_back(std::move(data));
+}
+
+void ProgramImage::AddSymbol(const std::string& a_Name,uint64_t a_Address)
+{
+    mSymbols.push_back({a_Name,a_Address});
+}
+
+void ProgramImage::Save(const std::string& a_Filename)const
+{
+    ImageHeader header = MakeHeader(mEntry,mSections.size(),mSymbols.size());
+
+    std::string names;
+    std::vector<ImageSymbol> symbols;
+    MakeSymbolTable(mSymbols,symbols,names);
+    header.StringTableSize = names.size();
+
+    std::vector<ImageSection> sections;
+    uint64_t offset = RoundUpToPage(header.StringTableOffset + header.StringTableSize);
+    for( const auto& section : mSections )
+    {
+        sections.push_back({static_cast<uint32_t>(section.Type),0,section.Address,offset,section.Size});
+        offset += RoundUpToPage(section.Size);
+    }
+
+    std::ofstream out(a_Filename,std::ios::binary|std::ios::trunc);
+    if( !out )
+    {
+        throw std::runtime_error("Failed to create program image " + a_Filename);
+    }
+
+    out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    out.write(reinterpret_cast<const char*>(sections.data()),sections.size() * sizeof(ImageSection));
+    out.write(reinterpret_cast<const char*>(symbols.data()),symbols.size() * sizeof(ImageSymbol));
+    out.write(names.data(),names.size());
+
+    // Padding is zeros, the end of the last page of a section is what the guest reads after it.
+    const std::vector<char> zeros(PAGE_SIZE,0);
+    uint64_t written = header.StringTableOffset + header.StringTableSize;
+    for( size_t n = 0 ; n < mSections.size() ; n++ )
+    {
+        out.write(zeros.data(),sections[n].FileOffset - written);
+        out.write(reinterpret_cast<const char*>(mSections[n].Data),mSections[n].Size);
+        written = sections[n].FileOffset + mSections[n].Size;
+    }
+    out.write(zeros.data(),RoundUpToPage(written) - written);
+
+    if( !out )
+    {
+        throw std::runtime_error("Failed to write program image " + a_Filename);
+    }
+}
+
+void ProgramImage::Load(const std::string& a_Filename)
+{
+    const int file = open(a_Filename.c_str(),O_RDONLY);
+    if( file < 0 )
+    {
+        throw std::runtime_error("Failed to open program image " + a_Filename);
+    }
+
+    struct stat info;
+    if( fstat(file,&info) != 0 || static_cast<uint64_t>(info.st_size) < sizeof(ImageHeader) )
+    {
+        close(file);
+        throw std::runtime_error("Program image " + a_Filename + " is too small");
+    }
+
+    const uint64_t fileSize = static_cast<uint64_t>(info.st_size);
+    void* base = mmap(nullptr,fileSize,PROT_READ,MAP_PRIVATE,file,0);
+    close(file);
+    if( base == MAP_FAILED )
+    {
+        throw std::runtime_error("Failed to map program image " + a_Filename);
+    }
+
+    std::shared_ptr<const void> mapping(base,[fileSize](const void* a_Base){munmap(const_cast<void*>(a_Base),fileSize);});
+    const uint8_t* bytes = static_cast<const uint8_t*>(base);
+
+    ImageHeader header;
+    memcpy(&header,bytes,sizeof(header));
+    if( header.Magic != MAGIC )
+    {
+        throw std::runtime_error(a_Filename + " is not a program image");
+    }
+
+    if( header.Version != VERSION || header.HeaderSize != sizeof(ImageHeader) )
+    {
+        throw std::runtime_error("Program image " + a_Filename + " is version " + std::to_string(header.Version) + ", expected " + std::to_string(VERSION));
+    }
+
+    if( !InBounds(header.SectionTableOffset,static_cast<uint64_t>(header.SectionCount) * sizeof(ImageSection),fileSize) ||
+        !InBounds(header.SymbolTableOffset,static_cast<uint64_t>(header.SymbolCount) * sizeof(ImageSymbol),fileSize) ||
+        !InBounds(header.StringTableOffset,header.StringTableSize,fileSize) )
+    {
+        throw std::runtime_error("Program image " + a_Filename + " is truncated");
+    }
+
+    std::vector<Section> sections;
+    for( uint32_t n = 0 ; n < header.SectionCount ; n++ )
+    {
+        ImageSection section;
+        memcpy(&section,bytes + header.SectionTableOffset + (n * sizeof(ImageSection)),sizeof(section));
+        if( section.Type > SECTION_DATA || (section.FileOffset & (PAGE_SIZE-1)) || !InBounds(section.FileOffset,section.Size,fileSize) )
+        {
+            throw std::runtime_error("Program image " + a_Filename + " has a bad section " + std::to_string(n));
+        }
+        sections.push_back({static_cast<SectionType>(section.Type),section.Address,section.Size,bytes + section.FileOffset});
+    }
+
+    std::vector<Symbol> symbols;
+    const char* names = reinterpret_cast<const char*>(bytes + header.StringTableOffset);
+    for( uint32_t n = 0 ; n < header.SymbolCount ; n++ )
+    {
+        ImageSymbol symbol;
+        memcpy(&symbol,bytes + header.SymbolTableOffset + (n * sizeof(ImageSymbol)),sizeof(symbol));
+        if( !InBounds(symbol.NameOffset,symbol.NameLength,header.StringTableSize) )
+        {
+            throw std::runtime_error("Program image " + a_Filename + " has a bad symbol " + std::to_string(n));
+        }
+        symbols.push_back({std::string(names + symbol.NameOffset,symbol.NameLength),symbol.Address});
+    }
+
+    mEntry = header.Entry;
+    mSections = std::move(sections);
+    mSymbols = std::move(symbols);
+    mOwned.clear();
+    mMapping = mapping;
+    mMappingSize = fileSize;
+}
+
+void ProgramImage::LoadInto(GuestMemory& r_Memory)const
+{
+    const uint8_t* file = static_cast<const uint8_t*>(mMapping.get());
+    for( const auto& section : mSections )
+    {
+        // Only whole pages of the file can be given to the guest, the padding after the data reads as zero.
+        const bool aligned = mMapping && (section.Address & (PAGE_SIZE-1)) == 0;
+        for( uint64_t done = 0 ; done < section.Size ; done += PAGE_SIZE )
+        {
+            const uint64_t bytes = section.Size - done < PAGE_SIZE ? section.Size - done : PAGE_SIZE;
+            const uint64_t address = section.Address + done;
+            const bool mappable = aligned && InBounds(static_cast<uint64_t>(section.Data + done - file),PAGE_SIZE,mMappingSize);
+            if( !mappable || !r_Memory.Map(address / PAGE_SIZE,section.Data + done,mMapping) )
+            {
+                r_Memory.Write(address,section.Data + done,bytes);
+            }
+        }
+    }
+}
+
+std::vector<Instruction> ProgramImage::GetCode()const
+{
+    for( const auto& section : mSections )
+    {
+        if( section.Type == SECTION_CODE && mEntry >= section.Address && mEntry - section.Address < section.Size )
+        {
+            std::vector<Instruction> code((section.Size - (mEntry - section.Address)) / sizeof(Instruction));
+            memcpy(code.data(),section.Data + (mEntry - section.Address),code.size() * sizeof(Instruction));
+            return code;
+        }
+    }
+    throw std::runtime_error("Program image has no code at the entry point");
+}
+
+bool ProgramImage::IsImage(const std::string& a_Filename)
+{
+    std::ifstream in(a_Filename,std::ios::binary);
+    uint32_t magic = 0;
+    in.read(reinterpret_cast<char*>(&magic),sizeof(magic));
+    return in && magic == MAGIC;
+}
+
+ImageStreamWriter::ImageStreamWriter(const std::string& a_Filename):
+    mFilename(a_Filename),
+    mOut(a_Filename,std::ios::binary|std::ios::trunc),
+    mSize(0),
+    mFinished(false),
+    mStringTableSize(0)
+{
+    if( !mOut )
+    {
+        throw std::runtime_error("Failed to create program image " + a_Filename);
+    }
+
+    // The header with no size for now, then zeros up to the page the code starts on.
+    WriteHeader();
+    const uint64_t written = sizeof(ProgramImage::ImageHeader) + sizeof(ProgramImage::ImageSection);
+    const std::vector<char> zeros(ProgramImage::PAGE_SIZE - written,0);
+    mOut.write(zeros.data(),zeros.size());
+}
+
+ImageStreamWriter::~ImageStreamWriter()
+{
+    if( !mFinished )
+    {
+        mOut.close();
+        std::remove(mFilename.c_str());
+    }
+}
+
+void ImageStreamWriter::Write(const Instruction* a_Code,size_t a_Count)
+{
+    mOut.write(reinterpret_cast<const char*>(a_Code),a_Count * sizeof(Instruction));
+    mSize += a_Count * sizeof(Instruction);
+}
+
+void ImageStreamWriter::AddSymbol(const std::string& a_Name,uint64_t a_Address)
+{
+    mSymbols.push_back({a_Name,a_Address});
+}
+
+void ImageStreamWriter::Finish()
+{
+    const std::vector<char> zeros(RoundUpToPage(mSize) - mSize,0);
+    mOut.write(zeros.data(),zeros.size());
+
+    std::string names;
+    std::vector<ProgramImage::ImageSymbol> symbols;
+    MakeSymbolTable(mSymbols,symbols,names);
+    mOut.write(reinterpret_cast<const char*>(symbols.data()),symbols.size() * sizeof(ProgramImage::ImageSymbol));
+    mOut.write(names.data(),names.size());
+    mStringTableSize = names.size();
+
+    mOut.seekp(0);
+    WriteHeader();
+    mOut.flush();
+    if( !mOut )
+    {
+        throw std::runtime_error("Failed to write program image " + mFilename);
+    }
+    mFinished = true;
+}
+
+void ImageStreamWriter::WriteHeader()
+{
+    static_assert(sizeof(ProgramImage::ImageHeader) + sizeof(ProgramImage::ImageSection) <= ProgramImage::PAGE_SIZE,"The header has to fit before the code");
+
+    ProgramImage::ImageHeader header = MakeHeader(0,1,mSymbols.size());
+    if( mSymbols.size() )
+    {// After the code, only Finish writes them.
+        header.SymbolTableOffset = ProgramImage::PAGE_SIZE + RoundUpToPage(mSize);
+        header.StringTableOffset = header.SymbolTableOffset + (mSymbols.size() * sizeof(ProgramImage::ImageSymbol));
+        header.StringTableSize = mStringTableSize;
+    }
+    const ProgramImage::ImageSection section = {ProgramImage::SECTION_CODE,0,0,ProgramImage::PAGE_SIZE,mSize};
+    mOut.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    mOut.write(reinterpret_cast<const char*>(&section),sizeof(section));
+}
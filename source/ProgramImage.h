@@ -0,0 +1,182 @@
+#ifndef __PROGRAM_IMAGE_H__
+#define __PROGRAM_IMAGE_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+
+#include "MiniCPU.h"
+
+/**
+ * @brief A program ready to run, saved so it does not have to be assembled again.
+ * The file is a header, a table of sections, a symbol table and the names of the symbols followed by the data of
+ * each section. The data of each section starts on a page boundary in the file so when it is loaded the file is
+ * mapped into memory and the pages are given to the guest as they are, nothing is copied or parsed.
+ *
+ * File layout, all little endian:-
+ *   ImageHeader
+ *   ImageSection[SectionCount]
+ *   ImageSymbol[SymbolCount]
+ *   Names, StringTableSize bytes, not null terminated.
+ *   Padding to PAGE_SIZE then the data of each section, each padded to PAGE_SIZE.
+ * ImageStreamWriter only knows the symbols once the code is written, so it puts the symbol table and the names after
+ * the data, the header says where they are either way.
+ */
+class ProgramImage
+{
+public:
+    static const uint32_t MAGIC = 0x5550434d; // "MCPU"
+    static const uint16_t VERSION = 1;
+    static const uint64_t PAGE_SIZE = GuestMemory::PAGE_SIZE;
+
+    enum SectionType
+    {
+        SECTION_CODE,
+        SECTION_DATA
+    };
+
+    struct ImageHeader
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t HeaderSize;        // sizeof(ImageHeader), so a reader can check it was built the same way.
+        uint64_t Entry;             // Where the PC starts.
+        uint32_t SectionCount;
+        uint32_t SymbolCount;
+        uint64_t SectionTableOffset;
+        uint64_t SymbolTableOffset;
+        uint64_t StringTableOffset;
+        uint64_t StringTableSize;
+    };
+
+    struct ImageSection
+    {
+        uint32_t Type;
+        uint32_t Flags;
+        uint64_t Address;           // Guest address the section is loaded at.
+        uint64_t FileOffset;        // Always a multiple of PAGE_SIZE.
+        uint64_t Size;
+    };
+
+    struct ImageSymbol
+    {
+        uint64_t Address;
+        uint32_t NameOffset;        // Into the string table.
+        uint32_t NameLength;
+    };
+
+    struct Section
+    {
+        SectionType Type;
+        uint64_t Address;
+        uint64_t Size;
+        const uint8_t* Data;
+    };
+
+    struct Symbol
+    {
+        std::string Name;
+        uint64_t Address;
+    };
+
+    ProgramImage();
+    ~ProgramImage();
+
+    ProgramImage(const ProgramImage&) = delete;
+    ProgramImage& operator=(const ProgramImage&) = delete;
+    ProgramImage(ProgramImage&&) = default;
+    ProgramImage& operator=(ProgramImage&&) = default;
+
+    /**
+     * @brief Building an image, the data is copied.
+     */
+    void SetEntry(uint64_t a_Entry){mEntry = a_Entry;}
+    void AddSection(SectionType a_Type,uint64_t a_Address,const void* a_Data,uint64_t a_Size);
+    void AddSymbol(const std::string& a_Name,uint64_t a_Address);
+
+    /**
+     * @brief Writes the image to the file. Throws if it can not.
+     */
+    void Save(const std::string& a_Filename)const;
+
+    /**
+     * @brief Maps the file into memory and checks it, the sections then point into the mapping.
+     * Throws if the file can not be read or is not a valid image of this version.
+     */
+    void Load(const std::string& a_Filename);
+
+    /**
+     * @brief Puts the sections into guest memory. Sections that start on a page boundary of a loaded image are
+     * mapped, the guest reads the file directly. Anything else is copied.
+     */
+    void LoadInto(GuestMemory& r_Memory)const;
+
+    /**
+     * @brief The code as instructions, for the things that still want a program rather than memory.
+     */
+    std::vector<Instruction> GetCode()const;
+
+    uint64_t GetEntry()const{return mEntry;}
+    const std::vector<Section>& GetSections()const{return mSections;}
+    const std::vector<Symbol>& GetSymbols()const{return mSymbols;}
+
+    /**
+     * @brief True if the file starts with the magic number of an image.
+     */
+    static bool IsImage(const std::string& a_Filename);
+
+private:
+    uint64_t mEntry;
+    std::vector<Section> mSections;
+    std::vector<Symbol> mSymbols;
+    std::vector<std::unique_ptr<uint8_t[]>> mOwned;    // Data of sections added when building.
+    std::shared_ptr<const void> mMapping;              // The mapped file when loaded, the guest pages keep it alive.
+    uint64_t mMappingSize;
+};
+
+/**
+ * @brief Writes an image of one code section at address zero, the entry point, as the code is made, the sink for
+ * MachineCodeAssembler::CompileStream. None of the code is kept, the size in the section table is put in by Finish.
+ * Symbols are kept until Finish writes them after the code.
+ */
+class ImageStreamWriter
+{
+public:
+    /**
+     * @brief Throws if the file can not be created.
+     */
+    ImageStreamWriter(const std::string& a_Filename);
+
+    /**
+     * @brief If Finish was not called, say the assembler threw, the file is removed so there is no half written image.
+     */
+    ~ImageStreamWriter();
+
+    ImageStreamWriter(const ImageStreamWriter&) = delete;
+    ImageStreamWriter& operator=(const ImageStreamWriter&) = delete;
+
+    void Write(const Instruction* a_Code,size_t a_Count);
+    void AddSymbol(const std::string& a_Name,uint64_t a_Address);
+
+    /**
+     * @brief Pads out the last page, writes the symbols and then the header again with the size and where the symbols
+     * are. Throws if any of the writing failed.
+     */
+    void Finish();
+
+    uint64_t GetSize()const{return mSize;}
+
+private:
+    const std::string mFilename;
+    std::ofstream mOut;
+    uint64_t mSize;
+    bool mFinished;
+    std::vector<ProgramImage::Symbol> mSymbols;
+    uint64_t mStringTableSize;
+
+    void WriteHeader();
+};
+
+#endif //__PROGRAM_IMAGE_H__
@@ -0,0 +1,128 @@
+#include <cstring>
+
+#include "Random.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RANDOM_X86
+#endif
+
+typedef void (*GenerateFunction)(uint64_t (*a_State)[Random::LANES],uint64_t* r_Values,size_t a_Steps);
+
+static inline uint64_t RotateLeft(uint64_t a_Value,int a_Bits)
+{
+    return (a_Value << a_Bits) | (a_Value >> (64 - a_Bits));
+}
+
+static uint64_t SplitMix64(uint64_t& r_State)
+{
+    uint64_t z = (r_State += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// The state is copied into locals so it stays in registers, and is inlined into each version so it is compiled for
+// that instruction set.
+__attribute__((always_inline)) static inline void GenerateLanes(uint64_t (*a_State)[Random::LANES],uint64_t* r_Values,size_t a_Steps)
+{
+    const uint32_t LANES = Random::LANES;
+    uint64_t s0[LANES],s1[LANES],s2[LANES],s3[LANES];
+    memcpy(s0,a_State[0],sizeof(s0));
+    memcpy(s1,a_State[1],sizeof(s1));
+    memcpy(s2,a_State[2],sizeof(s2));
+    memcpy(s3,a_State[3],sizeof(s3));
+
+    for( size_t step = 0 ; step < a_Steps ; step++ )
+    {
+        for( uint32_t lane = 0 ; lane < LANES ; lane++ )
+        {
+            r_Values[(step*LANES) + lane] = RotateLeft(s1[lane] * 5,7) * 9;
+
+            const uint64_t t = s1[lane] << 17;
+            s2[lane] ^= s0[lane];
+            s3[lane] ^= s1[lane];
+            s1[lane] ^= s2[lane];
+            s0[lane] ^= s3[lane];
+            s2[lane] ^= t;
+            s3[lane] = RotateLeft(s3[lane],45);
+        }
+    }
+
+    memcpy(a_State[0],s0,sizeof(s0));
+    memcpy(a_State[1],s1,sizeof(s1));
+    memcpy(a_State[2],s2,sizeof(s2));
+    memcpy(a_State[3],s3,sizeof(s3));
+}
+
+// SSE2 on x86-64, as that is the base line.
+static void GenerateDefault(uint64_t (*a_State)[Random::LANES],uint64_t* r_Values,size_t a_Steps)
+{
+    GenerateLanes(a_State,r_Values,a_Steps);
+}
+
+#ifdef RANDOM_X86
+__attribute__((target("avx2")))
+static void GenerateAVX2(uint64_t (*a_State)[Random::LANES],uint64_t* r_Values,size_t a_Steps)
+{
+    GenerateLanes(a_State,r_Values,a_Steps);
+}
+#endif
+
+static GenerateFunction PickGenerate()
+{
+#ifdef RANDOM_X86
+    if( __builtin_cpu_supports("avx2") )
+    {
+        return GenerateAVX2;
+    }
+#endif
+    return GenerateDefault;
+}
+
+Random::Random(uint64_t a_Seed,uint64_t a_Stream)
+{
+    Seed(a_Seed,a_Stream);
+}
+
+void Random::Seed(uint64_t a_Seed,uint64_t a_Stream)
+{
+    uint64_t splitMix = a_Seed + (a_Stream * 4 * LANES * 0x9e3779b97f4a7c15ull);
+    for( auto& word : mState )
+    {
+        for( auto& lane : word )
+        {
+            lane = SplitMix64(splitMix);
+        }
+    }
+    mNext = LANES;
+}
+
+void Random::Fill(uint64_t* r_Values,size_t a_Count)
+{
+    // What is left from the last step first, then whole steps straight into the output.
+    while( a_Count > 0 && mNext < LANES )
+    {
+        *r_Values++ = mBuffer[mNext++];
+        a_Count--;
+    }
+
+    const size_t steps = a_Count / LANES;
+    if( steps > 0 )
+    {
+        Generate(r_Values,steps);
+        r_Values += steps * LANES;
+        a_Count -= steps * LANES;
+    }
+
+    while( a_Count > 0 )
+    {
+        *r_Values++ = Next();
+        a_Count--;
+    }
+}
+
+void Random::Generate(uint64_t* r_Values,size_t a_Steps)
+{
+    static const GenerateFunction generate = PickGenerate();
+    generate(mState,r_Values,a_Steps);
+}
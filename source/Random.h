@@ -0,0 +1,60 @@
+#ifndef __RANDOM_H__
+#define __RANDOM_H__
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief The random numbers behind RAND and FRAND, xoshiro256** run as LANES independent generators side by side.
+ * Each step makes one value from every lane, lane order, so filling a buffer is a loop over the lanes the compiler
+ * turns into vector code. The AVX2 version is used when the host has it, both give the same values.
+ * Everything is in the instance, no locks and nothing global, so every MiniCPU has its own stream and the same seed
+ * and stream always give the same numbers, however they are asked for.
+ */
+class Random
+{
+public:
+    static const uint32_t LANES = 4;
+    static const uint64_t DEFAULT_SEED = 0x9e3779b97f4a7c15ull;
+
+    Random(uint64_t a_Seed = DEFAULT_SEED,uint64_t a_Stream = 0);
+
+    /**
+     * @brief The state is made from a_Seed with splitmix64. Each stream starts further along the splitmix64 sequence
+     * than all the words of the one before, so streams of the same seed never start with the same state.
+     */
+    void Seed(uint64_t a_Seed,uint64_t a_Stream = 0);
+
+    uint64_t Next()
+    {
+        if( mNext == LANES )
+        {
+            Generate(mBuffer,1);
+            mNext = 0;
+        }
+        return mBuffer[mNext++];
+    }
+
+    /**
+     * @brief Writes the next a_Count values, the same ones a_Count calls to Next would give.
+     */
+    void Fill(uint64_t* r_Values,size_t a_Count);
+
+    /**
+     * @brief 0.0 to 1.0, not including 1.0, from the top bits of a value.
+     */
+    static float ToFloat(uint64_t a_Value){return static_cast<float>(a_Value >> 40) * (1.0f / (1ull << 24));}
+    static double ToDouble(uint64_t a_Value){return static_cast<double>(a_Value >> 11) * (1.0 / (1ull << 53));}
+
+private:
+    alignas(32) uint64_t mState[4][LANES];  // Word of the xoshiro256** state then lane, so each word is one vector.
+    uint64_t mBuffer[LANES];
+    uint32_t mNext;
+
+    /**
+     * @brief Runs a_Steps steps, writing a_Steps * LANES values.
+     */
+    void Generate(uint64_t* r_Values,size_t a_Steps);
+};
+
+#endif //__RANDOM_H__
@@ -0,0 +1,338 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+
+#include "Recording.h"
+#include "InterruptController.h"
+
+static const char* sEventNames[Recording::NUMBER_EVENT_TYPES] = {"END","PAUSE","INTERRUPT"};
+
+static void WriteLEB128(std::vector<uint8_t>& r_Bytes,uint64_t a_Value)
+{
+    while( a_Value >= 0x80 )
+    {
+        r_Bytes.push_back(static_cast<uint8_t>(a_Value | 0x80));
+        a_Value >>= 7;
+    }
+    r_Bytes.push_back(static_cast<uint8_t>(a_Value));
+}
+
+static bool ReadLEB128(const std::vector<uint8_t>& a_Bytes,size_t& r_Position,uint64_t& r_Value)
+{
+    r_Value = 0;
+    for( uint32_t shift = 0 ; shift < 64 && r_Position < a_Bytes.size() ; shift += 7 )
+    {
+        const uint8_t byte = a_Bytes[r_Position++];
+        r_Value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if( (byte & 0x80) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Recording::Recording():
+    mMode(MODE_IDLE),
+    mEventCount(0),
+    mReadPosition(0),
+    mLastCycle(0),
+    mEndCycle(0),
+    mSkipPauses(false),
+    mNextInterruptKnown(false),
+    mNextInterruptCycle(0)
+{
+
+}
+
+Recording::~Recording()
+{
+
+}
+
+void Recording::Save(const std::string& a_Filename)const
+{
+    if( mMode != MODE_FINISHED )
+    {
+        throw std::runtime_error("Can not save recording " + a_Filename + ", it has not finished");
+    }
+
+    RecordingHeader header = {};
+    header.Magic = MAGIC;
+    header.Version = VERSION;
+    header.HeaderSize = sizeof(RecordingHeader);
+    header.EventBytes = mEvents.size();
+
+    std::ofstream out(a_Filename,std::ios::binary|std::ios::trunc);
+    if( !out )
+    {
+        throw std::runtime_error("Failed to create recording " + a_Filename);
+    }
+
+    out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    mStart.Write(out,a_Filename);
+    out.write(reinterpret_cast<const char*>(mEvents.data()),mEvents.size());
+    if( !out )
+    {
+        throw std::runtime_error("Failed to write recording " + a_Filename);
+    }
+}
+
+void Recording::Load(const std::string& a_Filename)
+{
+    std::ifstream in(a_Filename,std::ios::binary);
+    if( !in )
+    {
+        throw std::runtime_error("Failed to open recording " + a_Filename);
+    }
+
+    RecordingHeader header = {};
+    if( !in.read(reinterpret_cast<char*>(&header),sizeof(header)) || header.Magic != MAGIC )
+    {
+        throw std::runtime_error(a_Filename + " is not a recording");
+    }
+
+    if( header.Version != VERSION || header.HeaderSize != sizeof(RecordingHeader) )
+    {
+        throw std::runtime_error("Recording " + a_Filename + " is version " + std::to_string(header.Version) + ", expected " + std::to_string(VERSION));
+    }
+
+    mStart.Read(in,a_Filename);
+    mEvents.resize(header.EventBytes);
+    if( !in.read(reinterpret_cast<char*>(mEvents.data()),mEvents.size()) )
+    {
+        throw std::runtime_error("Recording " + a_Filename + " is truncated");
+    }
+
+    // Walk the events for the count and the end, which also checks they can be read.
+    size_t position = 0;
+    uint64_t cycle = GetStartCycle();
+    mEventCount = 0;
+    mEndCycle = 0;
+    while( position < mEvents.size() )
+    {
+        uint64_t cycles,value;
+        if( !ReadLEB128(mEvents,position,cycles) || !ReadLEB128(mEvents,position,value) || position >= mEvents.size() || mEvents[position] >= NUMBER_EVENT_TYPES )
+        {
+            throw std::runtime_error("Recording " + a_Filename + " has a bad event " + std::to_string(mEventCount));
+        }
+        cycle += cycles;
+        mEventCount++;
+        if( mEvents[position++] == EVENT_END )
+        {
+            mEndCycle = cycle;
+            break;
+        }
+    }
+
+    if( position != mEvents.size() || mEndCycle == 0 )
+    {
+        throw std::runtime_error("Recording " + a_Filename + " does not end with an END event");
+    }
+    mMode = MODE_FINISHED;
+}
+
+void Recording::Pause(uint64_t a_Cycle,uint64_t a_Microseconds)
+{
+    if( mMode == MODE_REPLAYING )
+    {
+        const uint64_t slept = Next(EVENT_PAUSE,a_Cycle);
+        if( slept > 0 && !mSkipPauses )
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(slept));
+        }
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if( a_Microseconds > 0 )
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(a_Microseconds));
+    }
+    Add(EVENT_PAUSE,a_Cycle,std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void Recording::Interrupt(uint64_t a_Cycle,uint32_t a_Line)
+{
+    if( mMode == MODE_RECORDING )
+    {
+        Add(EVENT_INTERRUPT,a_Cycle,a_Line);
+    }
+}
+
+// Looks past any other events, so a PAUSE before it does not hide it. Kept until the interrupt is taken.
+uint64_t Recording::GetNextInterruptCycle()
+{
+    if( !mNextInterruptKnown )
+    {
+        mNextInterruptCycle = InterruptController::NO_DEADLINE;
+        size_t position = mReadPosition;
+        uint64_t cycle = mLastCycle;
+        while( position < mEvents.size() )
+        {
+            uint64_t cycles,value;
+            ReadLEB128(mEvents,position,cycles);
+            ReadLEB128(mEvents,position,value);
+            cycle += cycles;
+            if( mEvents[position++] == EVENT_INTERRUPT )
+            {
+                mNextInterruptCycle = cycle;
+                break;
+            }
+        }
+        mNextInterruptKnown = true;
+    }
+    return mNextInterruptCycle;
+}
+
+bool Recording::NextInterrupt(uint64_t a_Cycle,uint32_t& r_Line)
+{
+    if( mMode != MODE_REPLAYING || GetNextInterruptCycle() != a_Cycle )
+    {
+        return false;
+    }
+    const uint64_t line = Next(EVENT_INTERRUPT,a_Cycle);
+    if( line >= InterruptController::NUMBER_LINES )
+    {
+        throw std::runtime_error("Recording has an interrupt on line " + std::to_string(line) + " which does not exist");
+    }
+    r_Line = static_cast<uint32_t>(line);
+    mNextInterruptKnown = false;
+    return true;
+}
+
+void Recording::Begin(Mode a_Mode)
+{
+    mMode = a_Mode;
+    mReadPosition = 0;
+    mNextInterruptKnown = false;
+    mLastCycle = GetStartCycle();
+    if( a_Mode == MODE_RECORDING )
+    {
+        mEvents.clear();
+        mEventCount = 0;
+        mEndCycle = 0;
+    }
+}
+
+void Recording::Add(EventType a_Type,uint64_t a_Cycle,uint64_t a_Value)
+{
+    WriteLEB128(mEvents,a_Cycle - mLastCycle);
+    WriteLEB128(mEvents,a_Value);
+    mEvents.push_back(static_cast<uint8_t>(a_Type));
+    mLastCycle = a_Cycle;
+    mEventCount++;
+}
+
+uint64_t Recording::Next(EventType a_Type,uint64_t a_Cycle)
+{
+    // Load checked the events, so they can be read.
+    uint64_t cycles,value;
+    size_t position = mReadPosition;
+    ReadLEB128(mEvents,position,cycles);
+    ReadLEB128(mEvents,position,value);
+    const uint32_t type = mEvents[position++];
+    if( type != static_cast<uint32_t>(a_Type) || mLastCycle + cycles != a_Cycle )
+    {
+        std::ostringstream error;
+        error << "Replay went a different way to the recording, " << sEventNames[a_Type] << " at cycle " << a_Cycle << " but the recording has " << sEventNames[type] << " at cycle " << mLastCycle + cycles;
+        throw std::runtime_error(error.str());
+    }
+
+    mReadPosition = position;
+    mLastCycle = a_Cycle;
+    return value;
+}
+
+/******************************************************************************
+ * MiniCPU
+ ******************************************************************************/
+void MiniCPU::StartRecording(Recording& r_Recording)
+{
+    if( mRecording )
+    {
+        throw std::runtime_error("Already recording or replaying");
+    }
+    TakeSnapshot(r_Recording.mStart);
+    r_Recording.Begin(Recording::MODE_RECORDING);
+    mRecording = &r_Recording;
+}
+
+void MiniCPU::StopRecording()
+{
+    if( mRecording == nullptr || mRecording->mMode != Recording::MODE_RECORDING )
+    {
+        throw std::runtime_error("Not recording");
+    }
+    mRecording->Add(Recording::EVENT_END,mCycleCount,HashState());
+    mRecording->mEndCycle = mCycleCount;
+    mRecording->mMode = Recording::MODE_FINISHED;
+    mRecording = nullptr;
+}
+
+void MiniCPU::StartReplay(Recording& a_Recording)
+{
+    if( mRecording )
+    {
+        throw std::runtime_error("Already recording or replaying");
+    }
+
+    if( a_Recording.mMode != Recording::MODE_FINISHED )
+    {
+        throw std::runtime_error("Can only replay a recording that has finished");
+    }
+    Restore(a_Recording.mStart);
+    a_Recording.Begin(Recording::MODE_REPLAYING);
+    mRecording = &a_Recording;
+}
+
+std::string MiniCPU::StopReplay()
+{
+    if( mRecording == nullptr || mRecording->mMode != Recording::MODE_REPLAYING )
+    {
+        throw std::runtime_error("Not replaying");
+    }
+
+    Recording& recording = *mRecording;
+    recording.mMode = Recording::MODE_FINISHED;
+    mRecording = nullptr;
+
+    std::string difference;
+    try
+    {
+        if( recording.Next(Recording::EVENT_END,mCycleCount) != HashState() )
+        {
+            difference = "Replay ended in a different state to the recording at cycle " + std::to_string(mCycleCount);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        difference = e.what();
+    }
+    return difference;
+}
+
+// FNV-1a of what the guest can see apart from memory.
+uint64_t MiniCPU::HashState()const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&hash](uint64_t a_Value)
+    {
+        for( int n = 0 ; n < 8 ; n++ )
+        {
+            hash = (hash ^ ((a_Value >> (n*8)) & 0xff)) * 0x100000001b3ull;
+        }
+    };
+
+    for( const auto& r : mRegisters )
+    {
+        add(r.u64);
+    }
+    add(mPC);
+    add(mSP);
+    add(GetFlags());
+    add(mInterruptMask);
+    return hash;
+}
@@ -0,0 +1,132 @@
+#ifndef __RECORDING_H__
+#define __RECORDING_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Snapshot.h"
+
+/**
+ * @brief Record and replay of a run, see MiniCPU::StartRecording and StartReplay.
+ * A recording is a snapshot of the CPU when it started and then only the inputs that can be different from one run
+ * to the next, each with the cycle it happened on. Everything else the CPU does follows from those. RAND and FRAND
+ * are not logged, the state of their generator is in the snapshot and they always make the same numbers from it.
+ * So nothing is done per instruction while recording, only when one of the events happens, and it can be left on.
+ *
+ * Interrupts are logged as they are taken, a replay takes them on the same cycles from the log and not from the
+ * timers or Raise.
+ *
+ * Events are a byte stream, for each the cycles since the last event and the value as LEB128 then the type.
+ * The last event is always EVENT_END, its value is a hash of the registers, PC, SP and flags so a replay that went
+ * a different way is caught.
+ *
+ * File layout, all little endian, only for loading into the same build:-
+ *   RecordingHeader
+ *   The snapshot, see Snapshot.
+ *   EventBytes of events.
+ */
+class Recording
+{
+public:
+    static const uint32_t MAGIC = 0x5252434d; // "MCRR"
+    static const uint16_t VERSION = 1;
+
+    enum EventType
+    {
+        EVENT_END,
+        EVENT_PAUSE,    // Value is how long the PAUSE really slept, in microseconds.
+        EVENT_INTERRUPT,// Value is the line taken.
+
+        NUMBER_EVENT_TYPES
+    };
+
+    enum Mode
+    {
+        MODE_IDLE,
+        MODE_RECORDING,
+        MODE_REPLAYING,
+        MODE_FINISHED
+    };
+
+    struct RecordingHeader
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t HeaderSize;
+        uint64_t EventBytes;
+    };
+
+    Recording();
+    ~Recording();
+
+    Recording(const Recording&) = delete;
+    Recording& operator=(const Recording&) = delete;
+
+    /**
+     * @brief Writes the recording to the file, it must have finished. Throws if it can not.
+     */
+    void Save(const std::string& a_Filename)const;
+
+    /**
+     * @brief Replaces this with the recording in the file. Throws if the file can not be read or was not saved by this build.
+     */
+    void Load(const std::string& a_Filename);
+
+    /**
+     * @brief When set, replaying a PAUSE does not sleep. For getting to the interesting part quickly.
+     */
+    void SetSkipPauses(bool a_Skip){mSkipPauses = a_Skip;}
+
+    Mode GetMode()const{return mMode;}
+    const Snapshot& GetStart()const{return mStart;}
+    uint64_t GetStartCycle()const{return mStart.GetState().CycleCount;}
+    uint64_t GetEndCycle()const{return mEndCycle;}
+    size_t GetEventCount()const{return mEventCount;}
+    size_t GetEventBytes()const{return mEvents.size();}
+
+    /**
+     * @brief Called by PAUSE. Recording it sleeps and logs how long it slept, replaying it sleeps for the same time.
+     */
+    void Pause(uint64_t a_Cycle,uint64_t a_Microseconds);
+
+    /**
+     * @brief Logs an interrupt taken while recording.
+     */
+    void Interrupt(uint64_t a_Cycle,uint32_t a_Line);
+
+    /**
+     * @brief Replaying, the cycle of the next interrupt in the log, InterruptController::NO_DEADLINE if there are no more.
+     */
+    uint64_t GetNextInterruptCycle();
+
+    /**
+     * @brief Replaying, true with the line if the next event is an interrupt on a_Cycle.
+     */
+    bool NextInterrupt(uint64_t a_Cycle,uint32_t& r_Line);
+
+private:
+    friend class MiniCPU;
+
+    Mode mMode;
+    Snapshot mStart;
+    std::vector<uint8_t> mEvents;
+    size_t mEventCount;
+    size_t mReadPosition;
+    uint64_t mLastCycle;
+    uint64_t mEndCycle;
+    bool mSkipPauses;
+    bool mNextInterruptKnown;
+    uint64_t mNextInterruptCycle;
+
+    void Begin(Mode a_Mode);
+    void Add(EventType a_Type,uint64_t a_Cycle,uint64_t a_Value);
+
+    /**
+     * @brief The value of the next event, which has to be a_Type on a_Cycle. Throws if it is not, the replay has
+     * gone a different way to the recording.
+     */
+    uint64_t Next(EventType a_Type,uint64_t a_Cycle);
+};
+
+#endif //__RECORDING_H__
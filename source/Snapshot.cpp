@@ -0,0 +1,221 @@
+#include <fstream>
+#include <vector>
+#include <stdexcept>
+
+#include "Snapshot.h"
+
+std::atomic<uint64_t> Snapshot::sNextID(1);
+
+Snapshot::Snapshot():mID(0),mState()
+{
+
+}
+
+Snapshot::~Snapshot()
+{
+
+}
+
+void Snapshot::Save(const std::string& a_Filename,const Snapshot* a_Base)const
+{
+    std::ofstream out(a_Filename,std::ios::binary|std::ios::trunc);
+    if( !out )
+    {
+        throw std::runtime_error("Failed to create snapshot " + a_Filename);
+    }
+    Write(out,a_Filename,a_Base);
+}
+
+void Snapshot::Load(const std::string& a_Filename,const Snapshot* a_Base)
+{
+    std::ifstream in(a_Filename,std::ios::binary);
+    if( !in )
+    {
+        throw std::runtime_error("Failed to open snapshot " + a_Filename);
+    }
+    Read(in,a_Filename,a_Base);
+}
+
+void Snapshot::Write(std::ostream& a_Out,const std::string& a_Name,const Snapshot* a_Base)const
+{
+    if( mID == 0 )
+    {
+        throw std::runtime_error("Can not save an empty snapshot to " + a_Name);
+    }
+
+    // A page the base has and this does not is saved as zeros, as that is what this reads for it.
+    std::vector<uint64_t> pages;
+    for( uint64_t page : mMemory.GetPages() )
+    {
+        if( a_Base == nullptr || !mMemory.IsSharedWith(page,a_Base->mMemory) )
+        {
+            pages.push_back(page);
+        }
+    }
+
+    if( a_Base )
+    {
+        for( uint64_t page : a_Base->mMemory.GetPages() )
+        {
+            if( !mMemory.HasPage(page) )
+            {
+                pages.push_back(page);
+            }
+        }
+    }
+
+    SnapshotHeader header = {};
+    header.Magic = MAGIC;
+    header.Version = VERSION;
+    header.HeaderSize = sizeof(SnapshotHeader);
+    header.StateSize = sizeof(SnapshotState);
+    header.PageCount = pages.size();
+
+    a_Out.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    a_Out.write(reinterpret_cast<const char*>(&mState),sizeof(mState));
+    for( uint64_t page : pages )
+    {
+        a_Out.write(reinterpret_cast<const char*>(&page),sizeof(page));
+        a_Out.write(reinterpret_cast<const char*>(mMemory.GetReadable(page)),GuestMemory::PAGE_SIZE);
+    }
+
+    if( !a_Out )
+    {
+        throw std::runtime_error("Failed to write snapshot " + a_Name);
+    }
+}
+
+void Snapshot::Read(std::istream& a_In,const std::string& a_Name,const Snapshot* a_Base)
+{
+    SnapshotHeader header = {};
+    if( !a_In.read(reinterpret_cast<char*>(&header),sizeof(header)) || header.Magic != MAGIC )
+    {
+        throw std::runtime_error(a_Name + " is not a snapshot");
+    }
+
+    if( header.Version != VERSION || header.HeaderSize != sizeof(SnapshotHeader) || header.StateSize != sizeof(SnapshotState) )
+    {
+        throw std::runtime_error("Snapshot " + a_Name + " was saved by a different build, version " + std::to_string(header.Version) + ", expected " + std::to_string(VERSION));
+    }
+
+    SnapshotState state;
+    if( !a_In.read(reinterpret_cast<char*>(&state),sizeof(state)) )
+    {
+        throw std::runtime_error("Snapshot " + a_Name + " is truncated");
+    }
+
+    // Read into a new memory so a bad file leaves this as it was.
+    GuestMemory memory;
+    if( a_Base )
+    {
+        memory.Share(a_Base->mMemory);
+    }
+
+    for( uint64_t n = 0 ; n < header.PageCount ; n++ )
+    {
+        uint64_t page;
+        if( !a_In.read(reinterpret_cast<char*>(&page),sizeof(page)) ||
+            !a_In.read(reinterpret_cast<char*>(memory.GetWritable(page)),GuestMemory::PAGE_SIZE) )
+        {
+            throw std::runtime_error("Snapshot " + a_Name + " is truncated");
+        }
+    }
+
+    mMemory.Share(memory);
+    mState = state;
+    mID = sNextID++;
+}
+
+void MiniCPU::TakeSnapshot(Snapshot& r_Snapshot)
+{
+    CheckNotCore("TakeSnapshot");
+    // The pages are about to be shared, writes that hit the TLB would change the snapshot too.
+    FlushWriteTLB();
+    r_Snapshot.mMemory.Share(mMemory);
+    GetState(r_Snapshot.mState);
+    r_Snapshot.mID = Snapshot::sNextID++;
+
+    mSnapshotID = r_Snapshot.mID;
+    mDirtyPages.clear();
+}
+
+void MiniCPU::Restore(const Snapshot& a_Snapshot)
+{
+    CheckNotCore("Restore");
+    if( a_Snapshot.mID == 0 )
+    {
+        throw std::runtime_error("Can not restore an empty snapshot");
+    }
+
+    if( a_Snapshot.mID == mSnapshotID )
+    {// Only the pages written since are different. The write TLB only has pages that were written, the read TLB
+     // and any code have to go for those pages.
+        for( uint64_t page : mDirtyPages )
+        {
+            mMemory.SharePage(page,a_Snapshot.mMemory);
+            TLBEntry& read = mReadTLB[page & (TLB_SIZE-1)];
+            if( read.Page == page )
+            {
+                read.Page = TLB_EMPTY;
+                read.Data = nullptr;
+            }
+
+            if( mPagesWithCode.count(page) )
+            {
+                InvalidateCode(page << PAGE_SHIFT,PAGE_SIZE);
+            }
+        }
+        FlushWriteTLB();
+    }
+    else
+    {
+        mMemory.Share(a_Snapshot.mMemory);
+        FlushTLBs();
+        ClearCodePages();
+        mSnapshotID = a_Snapshot.mID;
+    }
+    mDirtyPages.clear();
+    SetState(a_Snapshot.mState);
+}
+
+std::unique_ptr<MiniCPU> MiniCPU::Fork()
+{
+    CheckNotCore("Fork");
+    // As for a snapshot, the pages are about to be shared.
+    FlushWriteTLB();
+
+    std::unique_ptr<MiniCPU> fork(new MiniCPU());
+    fork->mMemory.Share(mMemory);
+    SnapshotState state;
+    GetState(state);
+    fork->SetState(state);
+    fork->SetFloatPrecision(mFloatPrecision);
+    fork->EnableJIT(mJIT != nullptr);
+    return fork;
+}
+
+void MiniCPU::GetState(SnapshotState& r_State)const
+{
+    memcpy(r_State.Registers,mRegisters,sizeof(mRegisters));
+    r_State.PC = mPC;
+    r_State.SP = mSP;
+    r_State.Flags = mFlags;
+    r_State.InterruptMask = mInterruptMask;
+    r_State.CycleCount = mCycleCount;
+    r_State.RandomSeed = mRandomSeed;
+    r_State.RandomStream = mRandomStream;
+    r_State.RandomState = mRandom;
+}
+
+void MiniCPU::SetState(const SnapshotState& a_State)
+{
+    memcpy(mRegisters,a_State.Registers,sizeof(mRegisters));
+    mPC = a_State.PC;
+    mSP = a_State.SP;
+    mFlags = a_State.Flags;
+    mInterruptMask = a_State.InterruptMask;
+    mCycleCount = a_State.CycleCount;
+    mRandomSeed = a_State.RandomSeed;
+    mRandomStream = a_State.RandomStream;
+    mRandom = a_State.RandomState;
+}
@@ -0,0 +1,94 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <istream>
+#include <ostream>
+
+#include "MiniCPU.h"
+
+/**
+ * @brief Everything a MiniCPU needs to carry on from where it was, see MiniCPU::TakeSnapshot, Restore and Fork.
+ * The state is the registers, PC, SP, flags, interrupt mask, cycle count and the generator behind RAND, along with
+ * all of guest memory. Memory is shared copy on write with the CPU it was taken from, so taking one costs a reference
+ * per page and nothing is copied until one side writes to a page.
+ * What SSET pushes, R0 to R14, the flags and the interrupt mask, is all in here too and the flags are kept the way
+ * the CPU had them, so SGET after a restore pops the same values it would have without it.
+ *
+ * File layout, all little endian, only for loading into the same build:-
+ *   SnapshotHeader
+ *   SnapshotState
+ *   PageCount of, uint64_t page number then PAGE_SIZE bytes.
+ * Saved with a base snapshot only the pages that are different from the base are written, it then has to be loaded
+ * with the same base.
+ */
+struct SnapshotState
+{
+    Register Registers[NUMBER_REGISTERS];
+    uint64_t PC;
+    uint64_t SP;
+    LazyFlags Flags;
+    uint32_t InterruptMask;
+    uint64_t CycleCount;
+    uint64_t RandomSeed;
+    uint64_t RandomStream;
+    Random RandomState;
+};
+
+class Snapshot
+{
+public:
+    static const uint32_t MAGIC = 0x5353434d; // "MCSS"
+    static const uint16_t VERSION = 1;
+
+    struct SnapshotHeader
+    {
+        uint32_t Magic;
+        uint16_t Version;
+        uint16_t HeaderSize;        // sizeof(SnapshotHeader), so a reader can check it was built the same way.
+        uint32_t StateSize;         // sizeof(SnapshotState), the same.
+        uint32_t Reserved;
+        uint64_t PageCount;
+    };
+
+    Snapshot();
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    /**
+     * @brief Writes the snapshot to the file, all of memory or with a_Base just the pages that are different from it.
+     * Throws if it can not.
+     */
+    void Save(const std::string& a_Filename,const Snapshot* a_Base = nullptr)const;
+
+    /**
+     * @brief Replaces this with the snapshot in the file, pages not in the file come from a_Base if there is one.
+     * Throws if the file can not be read or was not saved by this build.
+     */
+    void Load(const std::string& a_Filename,const Snapshot* a_Base = nullptr);
+
+    /**
+     * @brief The same as a file, for when a snapshot is part of something else. a_Name is used in the exceptions.
+     */
+    void Write(std::ostream& a_Out,const std::string& a_Name,const Snapshot* a_Base = nullptr)const;
+    void Read(std::istream& a_In,const std::string& a_Name,const Snapshot* a_Base = nullptr);
+
+    const SnapshotState& GetState()const{return mState;}
+    const GuestMemory& GetMemory()const{return mMemory;}
+    bool IsEmpty()const{return mID == 0;}
+
+private:
+    friend class MiniCPU;
+
+    uint64_t mID;           // Unique to each snapshot taken or loaded, zero when there is nothing in it.
+    SnapshotState mState;
+    GuestMemory mMemory;
+
+    static std::atomic<uint64_t> sNextID;
+};
+
+#endif //__SNAPSHOT_H__
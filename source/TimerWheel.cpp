@@ -0,0 +1,67 @@
+#include <stdexcept>
+
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(uint64_t a_TickMicroseconds):
+    mTick(a_TickMicroseconds),
+    mCurrent(0),
+    mSize(0)
+{
+    if( mTick == 0 )
+    {
+        throw std::runtime_error("Timer wheel tick must be at least one microsecond");
+    }
+}
+
+TimerWheel::~TimerWheel()
+{
+
+}
+
+void TimerWheel::Add(size_t a_Item,uint64_t a_Deadline)
+{
+    const uint64_t tick = a_Deadline / mTick;
+    mSlots[(tick > mCurrent ? tick : mCurrent) % SLOTS].push_back({a_Item,a_Deadline});
+    mSize++;
+}
+
+void TimerWheel::Expire(uint64_t a_Now,std::vector<size_t>& r_Items)
+{
+    const uint64_t now = a_Now / mTick;
+    if( mSize == 0 || now < mCurrent )
+    {
+        mCurrent = now > mCurrent ? now : mCurrent;
+        return;
+    }
+
+    // One turn of the wheel looks at every slot, however long it has been.
+    const uint64_t last = now - mCurrent >= SLOTS ? mCurrent + SLOTS - 1 : now;
+    for( uint64_t tick = mCurrent ; tick <= last && mSize > 0 ; tick++ )
+    {
+        std::vector<Entry>& slot = mSlots[tick % SLOTS];
+        size_t kept = 0;
+        for( size_t n = 0 ; n < slot.size() ; n++ )
+        {
+            if( slot[n].Deadline <= a_Now )
+            {
+                r_Items.push_back(slot[n].Item);
+                mSize--;
+            }
+            else
+            {
+                slot[kept++] = slot[n];
+            }
+        }
+        slot.resize(kept);
+    }
+    mCurrent = now;
+}
+
+void TimerWheel::Clear()
+{
+    for( auto& slot : mSlots )
+    {
+        slot.clear();
+    }
+    mSize = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Items waiting for a time, in microseconds from whatever start the caller likes.
+ * A hashed wheel of SLOTS slots, each a tick long. An item goes in the slot of its deadline and stays there for as
+ * many turns of the wheel as it needs, so adding is constant time and expiring only looks at the slots time has moved
+ * past, however many items are waiting.
+ * Not thread safe, CpuPool has a lock round it.
+ */
+class TimerWheel
+{
+public:
+    static const uint32_t SLOTS = 256;
+
+    TimerWheel(uint64_t a_TickMicroseconds = 100);
+    ~TimerWheel();
+
+    /**
+     * @brief A deadline that has passed is due at the next Expire.
+     */
+    void Add(size_t a_Item,uint64_t a_Deadline);
+
+    /**
+     * @brief Adds the items that are due at a_Now to r_Items and takes them out of the wheel.
+     */
+    void Expire(uint64_t a_Now,std::vector<size_t>& r_Items);
+
+    void Clear();
+
+    size_t GetSize()const{return mSize;}
+    uint64_t GetTickMicroseconds()const{return mTick;}
+
+private:
+    struct Entry
+    {
+        size_t Item;
+        uint64_t Deadline;
+    };
+
+    const uint64_t mTick;
+    uint64_t mCurrent;      // The tick expired up to, its slot can still have items for later turns.
+    size_t mSize;
+    std::vector<Entry> mSlots[SLOTS];
+};
+
+#endif //__TIMER_WHEEL_H__
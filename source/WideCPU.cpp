@@ -0,0 +1,996 @@
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#include "WideCPU.h"
+#include "MathKernels.h"
+
+static_assert(sizeof(WideOp::Immediate) / sizeof(uint64_t) == WideCPU::MAX_LANES,"WideOp has to have a value for every lane");
+
+// What a register holds as the type and back, the same as GetRegisterValue and SetRegisterValue in the ExecutionUnit.
+template <typename T> inline T FromBits(uint64_t a_Bits)
+{
+    return static_cast<T>(a_Bits);
+}
+
+template <> inline float FromBits<float>(uint64_t a_Bits)
+{
+    const uint32_t low = static_cast<uint32_t>(a_Bits);
+    float value;
+    memcpy(&value,&low,sizeof(value));
+    return value;
+}
+
+template <> inline double FromBits<double>(uint64_t a_Bits)
+{
+    double value;
+    memcpy(&value,&a_Bits,sizeof(value));
+    return value;
+}
+
+template <typename T> inline uint64_t ToBits(T a_Value)
+{
+    return static_cast<uint64_t>(a_Value);
+}
+
+template <> inline uint64_t ToBits<float>(float a_Value)
+{
+    uint32_t bits;
+    memcpy(&bits,&a_Value,sizeof(bits));
+    return bits;
+}
+
+template <> inline uint64_t ToBits<double>(double a_Value)
+{
+    uint64_t bits;
+    memcpy(&bits,&a_Value,sizeof(bits));
+    return bits;
+}
+
+inline uint64_t Blend(uint64_t a_Mask,uint64_t a_New,uint64_t a_Old)
+{
+    return (a_New & a_Mask) | (a_Old & ~a_Mask);
+}
+
+/**
+ * @brief The handlers, each a loop over LANES lanes, and the tables the decoder picks them from.
+ * Lanes that are masked off keep their registers and flags. Only register operands, the decoder sends anything with
+ * an address to OpScalar.
+ */
+struct WideUnit
+{
+    static const uint32_t NUMBER_DATA_TYPES = 8;
+    static const uint32_t NUMBER_OPCODES = 64;
+    static const uint32_t NUMBER_WIDTHS = 3;         // 4, 8 and 16 lanes.
+    static const uint32_t NO_FLAGS = ~0u;
+
+    static WideOpHandler sHandlers[NUMBER_WIDTHS][NUMBER_OPCODES][NUMBER_DATA_TYPES];
+    static WideOpHandler sFastHandlers[NUMBER_WIDTHS][NUMBER_OPCODES][NUMBER_DATA_TYPES];    // FLOAT_PRECISION_FAST only.
+    static WideOpHandler sLoadSet[NUMBER_WIDTHS];
+    static WideOpHandler sLoadOr[NUMBER_WIDTHS];
+    static WideOpHandler sJumpTo[NUMBER_WIDTHS][16];
+    static WideOpHandler sJumpRelative[NUMBER_WIDTHS][16];
+    static WideOpHandler sJumpAbsolute[NUMBER_WIDTHS][16];
+    static bool sFloat[NUMBER_OPCODES];                // R15 reads as the constant converted to FLOAT or DOUBLE.
+    static bool sConstantIsOperand[NUMBER_OPCODES];    // Shifts, the constant is not added to anything.
+
+    static uint32_t WidthIndex(uint32_t a_Lanes)
+    {
+        return a_Lanes == 4 ? 0 : a_Lanes == 8 ? 1 : 2;
+    }
+
+    template <typename T> static constexpr uint32_t DataTypeOf()
+    {
+        return (sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3) | (std::is_signed<T>::value ? DataType_SIGNED_INT_8 : 0);
+    }
+
+/******************************************************************************
+ * Lanes
+ ******************************************************************************/
+    // dest = function(dest,source) for every lane, recording the flags the same as RecordFlags does, less A and B for
+    // FLAGS_RESULT as nothing reads them then.
+    // The operands are copied out first, source and dest can be the same row.
+    template <typename T,uint32_t LANES,uint32_t FLAGS,bool WRITE,typename FUNCTION> static void Apply(WideCPU& a_CPU,const WideOp& a_Op,FUNCTION a_Function)
+    {
+        T a[LANES],b[LANES],result[LANES];
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            a[n] = FromBits<T>(a_Op.Dest[n]);
+            b[n] = FromBits<T>(a_Op.Source[n]);
+        }
+
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            result[n] = a_Function(a[n],b[n]);
+        }
+
+        // Most of the time every lane is running, nothing to keep from the masked ones.
+        if( a_CPU.mAllActive )
+        {
+            if( WRITE )
+            {
+                for( uint32_t n = 0 ; n < LANES ; n++ )
+                {
+                    a_Op.Dest[n] = ToBits<T>(result[n]);
+                }
+            }
+            if constexpr( FLAGS != NO_FLAGS )
+            {
+                typedef typename std::make_unsigned<T>::type U;
+                for( uint32_t n = 0 ; n < LANES ; n++ )
+                {
+                    a_CPU.mFlagResult[n] = static_cast<U>(result[n]);
+                    a_CPU.mFlagOperation[n] = FLAGS;
+                    a_CPU.mFlagDataType[n] = DataTypeOf<T>();
+                }
+                if( FLAGS != FLAGS_RESULT )
+                {
+                    for( uint32_t n = 0 ; n < LANES ; n++ )
+                    {
+                        a_CPU.mFlagA[n] = static_cast<U>(a[n]);
+                        a_CPU.mFlagB[n] = static_cast<U>(b[n]);
+                    }
+                }
+            }
+            return;
+        }
+
+        const uint64_t* active = a_CPU.mActive;
+        if( WRITE )
+        {
+            for( uint32_t n = 0 ; n < LANES ; n++ )
+            {
+                a_Op.Dest[n] = Blend(active[n],ToBits<T>(result[n]),a_Op.Dest[n]);
+            }
+        }
+
+        if constexpr( FLAGS != NO_FLAGS )
+        {
+            typedef typename std::make_unsigned<T>::type U;
+            for( uint32_t n = 0 ; n < LANES ; n++ )
+            {
+                a_CPU.mFlagResult[n] = Blend(active[n],static_cast<U>(result[n]),a_CPU.mFlagResult[n]);
+                a_CPU.mFlagOperation[n] = Blend(active[n],FLAGS,a_CPU.mFlagOperation[n]);
+                a_CPU.mFlagDataType[n] = Blend(active[n],DataTypeOf<T>(),a_CPU.mFlagDataType[n]);
+            }
+            if( FLAGS != FLAGS_RESULT )
+            {
+                for( uint32_t n = 0 ; n < LANES ; n++ )
+                {
+                    a_CPU.mFlagA[n] = Blend(active[n],static_cast<U>(a[n]),a_CPU.mFlagA[n]);
+                    a_CPU.mFlagB[n] = Blend(active[n],static_cast<U>(b[n]),a_CPU.mFlagB[n]);
+                }
+            }
+        }
+    }
+
+    // The same as TestFlags, zero and not zero without making the flags.
+    template <uint32_t COND> static bool TestLane(const WideCPU& a_CPU,uint32_t a_Lane)
+    {
+        if( (COND == ConCode_EQ || COND == ConCode_NE || COND == ConCode_NZ) && a_CPU.mFlagOperation[a_Lane] != FLAGS_VALUE )
+        {
+            return (a_CPU.mFlagResult[a_Lane] == 0) == (COND == ConCode_EQ);
+        }
+
+        LazyFlags flags;
+        flags.Result = a_CPU.mFlagResult[a_Lane];
+        flags.A = a_CPU.mFlagA[a_Lane];
+        flags.B = a_CPU.mFlagB[a_Lane];
+        flags.Operation = static_cast<uint32_t>(a_CPU.mFlagOperation[a_Lane]);
+        flags.DataType = static_cast<uint32_t>(a_CPU.mFlagDataType[a_Lane]);
+        return TestCondition(flags.Get(),COND);
+    }
+
+/******************************************************************************
+ * Program control
+ ******************************************************************************/
+    static void OpNop(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+    }
+
+    template <uint32_t LANES> static void OpLoadSet(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            a_Op.Dest[n] = Blend(a_CPU.mActive[n],a_Op.Constant.u64,a_Op.Dest[n]);
+        }
+    }
+
+    template <uint32_t LANES> static void OpLoadOr(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            a_Op.Dest[n] |= a_Op.Constant.u64 & a_CPU.mActive[n];
+        }
+    }
+
+    template <uint32_t LANES,uint32_t COND> static void OpJumpTo(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            if( a_CPU.mActive[n] && TestLane<COND>(a_CPU,n) )
+            {
+                a_CPU.mPC[n] = a_Op.Constant.u64;
+            }
+        }
+    }
+
+    template <uint32_t LANES,uint32_t COND> static void OpJumpRelative(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            if( a_CPU.mActive[n] && TestLane<COND>(a_CPU,n) )
+            {
+                a_CPU.mPC[n] = a_Op.Offset + ((a_Op.Constant.s64 + static_cast<int64_t>(a_Op.Source[n])) * sizeof(Instruction));
+            }
+        }
+    }
+
+    template <uint32_t LANES,uint32_t COND> static void OpJumpAbsolute(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            if( a_CPU.mActive[n] && TestLane<COND>(a_CPU,n) )
+            {
+                a_CPU.mPC[n] = (a_Op.Constant.s64 + static_cast<int64_t>(a_Op.Source[n])) * sizeof(Instruction);
+            }
+        }
+    }
+
+    // Each active lane runs the instruction on its own MiniCPU. The PC and cycle count of the lanes are already past
+    // it, so they go back one for Step.
+    static void OpScalar(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        for( uint32_t n = 0 ; n < a_CPU.mLaneCount ; n++ )
+        {
+            if( a_CPU.mActive[n] == 0 )
+            {
+                continue;
+            }
+
+            a_CPU.mPC[n] -= sizeof(Instruction);
+            a_CPU.mCycleCount[n]--;
+            a_CPU.StoreLane(n);
+            try
+            {
+                a_CPU.mLanes[n]->Step();
+            }
+            catch(const std::exception& e)
+            {// The lanes after this one have not run it.
+                a_CPU.LoadLane(n);
+                for( uint32_t m = n + 1 ; m < a_CPU.mLaneCount ; m++ )
+                {
+                    if( a_CPU.mActive[m] )
+                    {
+                        a_CPU.mPC[m] -= sizeof(Instruction);
+                        a_CPU.mCycleCount[m]--;
+                    }
+                }
+                throw std::runtime_error("Lane " + std::to_string(n) + ": " + e.what());
+            }
+            a_CPU.LoadLane(n);
+            a_CPU.mStats.ScalarInstructions++;
+
+            if( !a_CPU.HasSameCode(n) )
+            {
+                a_CPU.mCodeChanged = true;
+            }
+        }
+    }
+
+/******************************************************************************
+ * Math, dest = dest op source
+ ******************************************************************************/
+    template <typename T,uint32_t LANES> static void OpMove(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpCmp(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        Apply<T,LANES,FLAGS_SUB,false>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(static_cast<U>(a_Dest) - static_cast<U>(a_Source));});
+    }
+
+    template <typename T,uint32_t LANES> static void OpOr(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(a_Dest | a_Source);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpXor(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(a_Dest ^ a_Source);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpAnd(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(a_Dest & a_Source);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpNot(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T,T a_Source){return static_cast<T>(~a_Source);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpLSL(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t shift = a_Op.Constant.u64;
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[shift](T,T a_Source){return static_cast<T>(shift < sizeof(T)*8 ? static_cast<U>(static_cast<U>(a_Source) << shift) : 0);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpLSR(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        const uint64_t shift = a_Op.Constant.u64;
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[shift](T,T a_Source){return static_cast<T>(shift < sizeof(T)*8 ? static_cast<U>(static_cast<U>(a_Source) >> shift) : 0);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpAdd(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        Apply<T,LANES,FLAGS_ADD,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(static_cast<U>(a_Dest) + static_cast<U>(a_Source));});
+    }
+
+    template <typename T,uint32_t LANES> static void OpSub(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        Apply<T,LANES,FLAGS_SUB,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(static_cast<U>(a_Dest) - static_cast<U>(a_Source));});
+    }
+
+    template <typename T,uint32_t LANES> static void OpMul(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        typedef typename std::make_unsigned<T>::type U;
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return static_cast<T>(static_cast<U>(static_cast<U>(a_Dest) * static_cast<U>(a_Source)));});
+    }
+
+    template <typename T,uint32_t LANES> static void OpMax(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return a_Dest > a_Source ? a_Dest : a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpMin(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,FLAGS_RESULT,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return a_Dest < a_Source ? a_Dest : a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFAdd(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return a_Dest + a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFSub(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return a_Dest - a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFMul(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return a_Dest * a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFDiv(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return a_Dest / a_Source;});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFMax(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return std::fmax(a_Dest,a_Source);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFMin(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T a_Dest,T a_Source){return std::fmin(a_Dest,a_Source);});
+    }
+
+    template <typename T,uint32_t LANES> static void OpFSqrt(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return std::sqrt(a_Source);});
+    }
+
+    // FLOAT_PRECISION_FAST, libm is done per lane. When every lane is in range sin, cos and tan have no branches and
+    // the loop over the lanes is vector code.
+    template <typename T,uint32_t LANES> static bool InTrigRange(const WideOp& a_Op)
+    {
+        bool inRange = true;
+        for( uint32_t n = 0 ; n < LANES ; n++ )
+        {
+            inRange = inRange & MathKernels::InRange(FromBits<T>(a_Op.Source[n]));
+        }
+        return inRange;
+    }
+
+    template <typename T,uint32_t LANES> static void OpFSinFast(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        if( InTrigRange<T,LANES>(a_Op) )
+        {
+            Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::SinInRange(a_Source);});
+        }
+        else
+        {
+            Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::Sin(a_Source);});
+        }
+    }
+
+    template <typename T,uint32_t LANES> static void OpFCosFast(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        if( InTrigRange<T,LANES>(a_Op) )
+        {
+            Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::CosInRange(a_Source);});
+        }
+        else
+        {
+            Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::Cos(a_Source);});
+        }
+    }
+
+    template <typename T,uint32_t LANES> static void OpFTanFast(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        if( InTrigRange<T,LANES>(a_Op) )
+        {
+            Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::TanInRange(a_Source);});
+        }
+        else
+        {
+            Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::Tan(a_Source);});
+        }
+    }
+
+    template <typename T,uint32_t LANES> static void OpFATanFast(WideCPU& a_CPU,const WideOp& a_Op)
+    {
+        Apply<T,LANES,NO_FLAGS,true>(a_CPU,a_Op,[](T,T a_Source){return MathKernels::ATan(a_Source);});
+    }
+
+/******************************************************************************
+ * Building the handler tables.
+ ******************************************************************************/
+    template <template <typename,uint32_t> class OP,typename T> static void SetWidths(uint32_t a_OpCode,uint32_t a_DataType,WideOpHandler r_Table[NUMBER_WIDTHS][NUMBER_OPCODES][NUMBER_DATA_TYPES] = sHandlers)
+    {
+        r_Table[0][a_OpCode][a_DataType] = OP<T,4>::Execute;
+        r_Table[1][a_OpCode][a_DataType] = OP<T,8>::Execute;
+        r_Table[2][a_OpCode][a_DataType] = OP<T,16>::Execute;
+    }
+
+    template <template <typename,uint32_t> class OP> static void SetIntegerHandlers(uint32_t a_OpCode,bool a_ConstantIsOperand = false)
+    {
+        SetWidths<OP,uint8_t>(a_OpCode,DataType_UNSIGNED_INT_8);
+        SetWidths<OP,uint16_t>(a_OpCode,DataType_UNSIGNED_INT_16);
+        SetWidths<OP,uint32_t>(a_OpCode,DataType_UNSIGNED_INT_32);
+        SetWidths<OP,uint64_t>(a_OpCode,DataType_UNSIGNED_INT_64);
+        SetWidths<OP,int8_t>(a_OpCode,DataType_SIGNED_INT_8);
+        SetWidths<OP,int16_t>(a_OpCode,DataType_SIGNED_INT_16);
+        SetWidths<OP,int32_t>(a_OpCode,DataType_SIGNED_INT_32);
+        SetWidths<OP,int64_t>(a_OpCode,DataType_SIGNED_INT_64);
+        sConstantIsOperand[a_OpCode] = a_ConstantIsOperand;
+    }
+
+    template <template <typename,uint32_t> class OP> static void SetFloatHandlers(uint32_t a_OpCode)
+    {
+        SetWidths<OP,float>(a_OpCode,DataType_FLOAT);
+        SetWidths<OP,double>(a_OpCode,DataType_DOUBLE);
+        sFloat[a_OpCode] = true;
+    }
+
+    template <template <typename,uint32_t> class OP> static void SetFastFloatHandlers(uint32_t a_OpCode)
+    {
+        SetWidths<OP,float>(a_OpCode,DataType_FLOAT,sFastHandlers);
+        SetWidths<OP,double>(a_OpCode,DataType_DOUBLE,sFastHandlers);
+        sFloat[a_OpCode] = true;
+    }
+
+    template <uint32_t WIDTH,uint32_t LANES,size_t... CONDS> static void SetJumpHandlers(std::index_sequence<CONDS...>)
+    {
+        const WideOpHandler to[] = {OpJumpTo<LANES,CONDS>...};
+        const WideOpHandler relative[] = {OpJumpRelative<LANES,CONDS>...};
+        const WideOpHandler absolute[] = {OpJumpAbsolute<LANES,CONDS>...};
+        for( uint32_t cond = 0 ; cond < sizeof...(CONDS) ; cond++ )
+        {
+            sJumpTo[WIDTH][cond] = to[cond];
+            sJumpRelative[WIDTH][cond] = relative[cond];
+            sJumpAbsolute[WIDTH][cond] = absolute[cond];
+        }
+        sLoadSet[WIDTH] = OpLoadSet<LANES>;
+        sLoadOr[WIDTH] = OpLoadOr<LANES>;
+    }
+
+    static bool BuildHandlerTables();
+};
+
+WideOpHandler WideUnit::sHandlers[NUMBER_WIDTHS][NUMBER_OPCODES][NUMBER_DATA_TYPES];
+WideOpHandler WideUnit::sFastHandlers[NUMBER_WIDTHS][NUMBER_OPCODES][NUMBER_DATA_TYPES];
+WideOpHandler WideUnit::sLoadSet[NUMBER_WIDTHS];
+WideOpHandler WideUnit::sLoadOr[NUMBER_WIDTHS];
+WideOpHandler WideUnit::sJumpTo[NUMBER_WIDTHS][16];
+WideOpHandler WideUnit::sJumpRelative[NUMBER_WIDTHS][16];
+WideOpHandler WideUnit::sJumpAbsolute[NUMBER_WIDTHS][16];
+bool WideUnit::sFloat[NUMBER_OPCODES];
+bool WideUnit::sConstantIsOperand[NUMBER_OPCODES];
+
+#define DEF_WIDE_HANDLER(__name__,__function__)    template <typename T,uint32_t LANES> struct __name__ {static void Execute(WideCPU& a_CPU,const WideOp& a_Op){WideUnit::__function__<T,LANES>(a_CPU,a_Op);}};
+namespace WideHandler
+{
+    DEF_WIDE_HANDLER(Move,OpMove)
+    DEF_WIDE_HANDLER(Cmp,OpCmp)
+    DEF_WIDE_HANDLER(Or,OpOr)
+    DEF_WIDE_HANDLER(Xor,OpXor)
+    DEF_WIDE_HANDLER(And,OpAnd)
+    DEF_WIDE_HANDLER(Not,OpNot)
+    DEF_WIDE_HANDLER(LSL,OpLSL)
+    DEF_WIDE_HANDLER(LSR,OpLSR)
+    DEF_WIDE_HANDLER(Add,OpAdd)
+    DEF_WIDE_HANDLER(Sub,OpSub)
+    DEF_WIDE_HANDLER(Mul,OpMul)
+    DEF_WIDE_HANDLER(Max,OpMax)
+    DEF_WIDE_HANDLER(Min,OpMin)
+    DEF_WIDE_HANDLER(FAdd,OpFAdd)
+    DEF_WIDE_HANDLER(FSub,OpFSub)
+    DEF_WIDE_HANDLER(FMul,OpFMul)
+    DEF_WIDE_HANDLER(FDiv,OpFDiv)
+    DEF_WIDE_HANDLER(FMax,OpFMax)
+    DEF_WIDE_HANDLER(FMin,OpFMin)
+    DEF_WIDE_HANDLER(FSqrt,OpFSqrt)
+    DEF_WIDE_HANDLER(FSinFast,OpFSinFast)
+    DEF_WIDE_HANDLER(FCosFast,OpFCosFast)
+    DEF_WIDE_HANDLER(FTanFast,OpFTanFast)
+    DEF_WIDE_HANDLER(FATanFast,OpFATanFast)
+}
+#undef DEF_WIDE_HANDLER
+
+bool WideUnit::BuildHandlerTables()
+{
+    // Everything not set here is done per lane.
+    SetJumpHandlers<0,4>(std::make_index_sequence<16>());
+    SetJumpHandlers<1,8>(std::make_index_sequence<16>());
+    SetJumpHandlers<2,16>(std::make_index_sequence<16>());
+
+    SetIntegerHandlers<WideHandler::Move>(OP_MOVE);
+    SetIntegerHandlers<WideHandler::Cmp>(OP_CMP);
+    SetIntegerHandlers<WideHandler::Or>(OP_OR);
+    SetIntegerHandlers<WideHandler::Xor>(OP_XOR);
+    SetIntegerHandlers<WideHandler::And>(OP_AND);
+    SetIntegerHandlers<WideHandler::Not>(OP_NOT);
+    SetIntegerHandlers<WideHandler::LSL>(OP_LSL,true);
+    SetIntegerHandlers<WideHandler::LSR>(OP_LSR,true);
+    SetIntegerHandlers<WideHandler::Add>(OP_ADD);
+    SetIntegerHandlers<WideHandler::Sub>(OP_SUB);
+    SetIntegerHandlers<WideHandler::Mul>(OP_MUL);
+    SetIntegerHandlers<WideHandler::Max>(OP_MAX);
+    SetIntegerHandlers<WideHandler::Min>(OP_MIN);
+
+    SetFloatHandlers<WideHandler::FAdd>(OP_FADD);
+    SetFloatHandlers<WideHandler::FSub>(OP_FSUB);
+    SetFloatHandlers<WideHandler::FMul>(OP_FMUL);
+    SetFloatHandlers<WideHandler::FDiv>(OP_FDIV);
+    SetFloatHandlers<WideHandler::FMax>(OP_FMAX);
+    SetFloatHandlers<WideHandler::FMin>(OP_FMIN);
+    SetFloatHandlers<WideHandler::FSqrt>(OP_FSQRT);
+
+    SetFastFloatHandlers<WideHandler::FSinFast>(OP_FSIN);
+    SetFastFloatHandlers<WideHandler::FCosFast>(OP_FCOS);
+    SetFastFloatHandlers<WideHandler::FTanFast>(OP_FTAN);
+    SetFastFloatHandlers<WideHandler::FATanFast>(OP_FATAN);
+    return true;
+}
+
+static const bool sWideTablesBuilt = WideUnit::BuildHandlerTables();
+
+/******************************************************************************
+ * WideCPU
+ ******************************************************************************/
+WideCPU::WideCPU(uint32_t a_Lanes):mLaneCount(a_Lanes)
+{
+    if( a_Lanes != 4 && a_Lanes != 8 && a_Lanes != 16 )
+    {
+        throw std::runtime_error("A WideCPU has 4, 8 or 16 lanes, not " + std::to_string(a_Lanes));
+    }
+
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        mLanes.emplace_back(new MiniCPU());
+    }
+    memset(mRegisters,0,sizeof(mRegisters));
+    memset(mActive,0,sizeof(mActive));
+    memset(mFlagResult,0,sizeof(mFlagResult));
+    memset(mFlagA,0,sizeof(mFlagA));
+    memset(mFlagB,0,sizeof(mFlagB));
+    memset(mFlagOperation,0,sizeof(mFlagOperation));
+    memset(mFlagDataType,0,sizeof(mFlagDataType));
+    memset(mPC,0,sizeof(mPC));
+    memset(mCycleCount,0,sizeof(mCycleCount));
+    SetRandomSeed(Random::DEFAULT_SEED);
+}
+
+WideCPU::~WideCPU()
+{
+
+}
+
+void WideCPU::LoadImage(const GuestMemory& a_Image,uint64_t a_PC)
+{
+    mImage.Share(a_Image);
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        MiniCPU& lane = *mLanes[n];
+        lane.Reset();
+        lane.LoadImage(mImage,a_PC);
+        lane.SetRegister(REG_0,n);
+        lane.SetRegister(REG_1,mLaneCount);
+    }
+    ClearCode();
+    mSplit = false;
+    mStats = Stats();
+}
+
+void WideCPU::SetFloatPrecision(FloatPrecision a_Precision)
+{
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        mLanes[n]->SetFloatPrecision(a_Precision);
+    }
+    mFloatPrecision = a_Precision;
+    ClearCode();
+}
+
+void WideCPU::SetRandomSeed(uint64_t a_Seed)
+{
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        mLanes[n]->SetRandomSeed(a_Seed,n);
+    }
+}
+
+uint64_t WideCPU::Run(uint64_t a_MaxCycles)
+{
+    uint64_t instructions = 0;
+    if( mSplit )
+    {
+        for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+        {
+            instructions += mLanes[n]->Run(a_MaxCycles);
+        }
+        return instructions;
+    }
+
+    // Memory of a lane may have been written since the code was decoded.
+    uint64_t end[MAX_LANES];
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        LoadLane(n);
+        end[n] = mCycleCount[n] + a_MaxCycles;
+        mCodeChanged = mCodeChanged || !HasSameCode(n);
+    }
+
+    uint64_t window = 0;
+    uint64_t apart = 0;
+    try
+    {
+        while( true )
+        {
+            if( mCodeChanged )
+            {
+                ClearCode();
+            }
+
+            // The lanes at the lowest PC go next, the others wait for them to catch up.
+            uint64_t pc = ~0ull;
+            uint32_t running = 0;
+            for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+            {
+                if( mCycleCount[n] != end[n] )
+                {
+                    running++;
+                    pc = mPC[n] < pc ? mPC[n] : pc;
+                }
+            }
+
+            if( running == 0 )
+            {
+                break;
+            }
+
+            uint32_t active = 0;
+            uint32_t first = 0;
+            uint64_t steps = ~0ull;
+            uint64_t stop = ~0ull;
+            for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+            {
+                const bool left = mCycleCount[n] != end[n];
+                mActive[n] = left && mPC[n] == pc ? ~0ull : 0;
+                if( mActive[n] )
+                {
+                    first = active == 0 ? n : first;
+                    active++;
+                    steps = end[n] - mCycleCount[n] < steps ? end[n] - mCycleCount[n] : steps;
+                }
+                else if( left )
+                {
+                    stop = mPC[n] < stop ? mPC[n] : stop;
+                }
+            }
+
+            mAllActive = active == mLaneCount;
+            mFirstActive = first;
+
+            // No more than the rest of the window, so going apart is seen.
+            steps = SPLIT_WINDOW - window < steps ? SPLIT_WINDOW - window : steps;
+            const uint64_t scalar = mStats.ScalarInstructions;
+            const uint64_t done = RunTogether(pc,steps,stop);
+            window += done;
+            if( active != running )
+            {
+                mStats.MaskedInstructions += done;
+                apart += done;
+            }
+            apart += (mStats.ScalarInstructions - scalar) / active;
+
+            if( window >= SPLIT_WINDOW )
+            {
+                if( apart * 2 > window )
+                {// Not worth keeping them together, the rest of the run is each lane on its own.
+                    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+                    {
+                        StoreLane(n);
+                        instructions += mCycleCount[n] + a_MaxCycles - end[n];
+                    }
+                    mSplit = true;
+                    mStats.Split = true;
+                    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+                    {
+                        instructions += mLanes[n]->Run(end[n] - mCycleCount[n]);
+                    }
+                    return instructions;
+                }
+                window = 0;
+                apart = 0;
+            }
+        }
+    }
+    catch(...)
+    {
+        for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+        {
+            StoreLane(n);
+        }
+        throw;
+    }
+
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        StoreLane(n);
+        instructions += mCycleCount[n] + a_MaxCycles - end[n];
+    }
+    return instructions;
+}
+
+const WideOp& WideCPU::GetOp(uint64_t a_PC)
+{
+    const uint64_t page = a_PC >> MiniCPU::CODE_PAGE_SHIFT;
+    if( page != mLastCodePage )
+    {
+        auto found = mCode.find(page);
+        mLastOps = found != mCode.end() ? found->second.get() : DecodePage(page);
+        mLastCodePage = page;
+    }
+    return mLastOps[(a_PC & (MiniCPU::CODE_PAGE_SIZE-1)) / sizeof(Instruction)];
+}
+
+uint64_t WideCPU::RunTogether(uint64_t a_PC,uint64_t a_Steps,uint64_t a_Stop)
+{
+    // The PC and cycle count of the lanes are only brought up to date when a handler needs them, and at the end.
+    uint64_t pc = a_PC;
+    uint64_t done = 0;
+    uint64_t pending = 0;
+    while( done < a_Steps && pc < a_Stop )
+    {
+        const WideOp& op = GetOp(pc);
+        pc += sizeof(Instruction);
+        done++;
+        pending++;
+        if( (op.Flags & WideOp::WIDE_CHANGES_PC) == 0 )
+        {
+            op.Handler(*this,op);
+            continue;
+        }
+
+        Flush(pc,pending);
+        pending = 0;
+        op.Handler(*this,op);
+
+        // Still together? Each active lane against the first one.
+        pc = mPC[mFirstActive];
+        uint64_t apart = mCodeChanged ? 1 : 0;
+        for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+        {
+            apart |= (mPC[n] ^ pc) & mActive[n];
+        }
+        const bool together = apart == 0;
+
+        if( !together )
+        {
+            mStats.WideInstructions += done;
+            return done;
+        }
+    }
+
+    Flush(pc,pending);
+    mStats.WideInstructions += done;
+    return done;
+}
+
+void WideCPU::Flush(uint64_t a_PC,uint64_t a_Pending)
+{
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        mPC[n] = Blend(mActive[n],a_PC,mPC[n]);
+        mCycleCount[n] += a_Pending & mActive[n];
+    }
+}
+
+WideOp* WideCPU::DecodePage(uint64_t a_CodePage)
+{
+    std::unique_ptr<WideOp[]> ops(new WideOp[MiniCPU::MICRO_OPS_PER_PAGE]);
+    const uint64_t address = a_CodePage << MiniCPU::CODE_PAGE_SHIFT;
+    const uint64_t page = address >> GuestMemory::PAGE_SHIFT;
+
+    // Only a page every lane still has from the image is the same code in every lane.
+    bool same = true;
+    for( uint32_t n = 0 ; n < mLaneCount ; n++ )
+    {
+        same = same && mLanes[n]->GetMemory().IsSharedWith(page,mImage);
+    }
+
+    for( uint64_t n = 0 ; n < MiniCPU::MICRO_OPS_PER_PAGE ; n++ )
+    {
+        WideOp& op = ops[n];
+        op.Handler = WideUnit::OpScalar;
+        op.Flags = WideOp::WIDE_CHANGES_PC | WideOp::WIDE_SCALAR;
+        if( same )
+        {
+            Decode(address + (n * sizeof(Instruction)),op);
+        }
+    }
+
+    if( same )
+    {
+        mCodeMemoryPages.insert(page);
+    }
+
+    WideOp* decoded = ops.get();
+    mCode[a_CodePage] = std::move(ops);
+    return decoded;
+}
+
+void WideCPU::Decode(uint64_t a_PC,WideOp& r_Op)
+{
+    const uint8_t* data = mImage.GetReadable(a_PC >> GuestMemory::PAGE_SHIFT);
+    Instruction ins;
+    memcpy(&ins.Bytes,data + (a_PC & (GuestMemory::PAGE_SIZE-1)),sizeof(ins.Bytes));
+
+    const uint32_t width = WideUnit::WidthIndex(mLaneCount);
+    r_Op.Source = r_Op.Immediate;
+    r_Op.Dest = mRegisters[REG_15];
+    r_Op.Constant.u64 = 0;
+    r_Op.Offset = a_PC;
+    r_Op.Condition = 0;
+
+    if( ins.Load.IsLoad )
+    {
+        const uint32_t shift = ins.Load.Shift * 24;
+        r_Op.Constant.u64 = shift < 64 ? (static_cast<uint64_t>(ins.Load.ConstantData) << shift) : 0;
+        r_Op.Dest = mRegisters[ins.Load.Dest];
+        r_Op.Handler = ins.Load.OrWithDest ? WideUnit::sLoadOr[width] : WideUnit::sLoadSet[width];
+        r_Op.Flags = 0;
+        return;
+    }
+
+    if( ins.Standard.OpCode == OP_JUMP && ins.Jump.Condition == ConCode_FALSE )
+    {// Never taken, which includes the NOP, so the lanes do not need their PC for it.
+        r_Op.Handler = WideUnit::OpNop;
+        r_Op.Flags = 0;
+        return;
+    }
+
+    if( ins.Standard.OpCode == OP_JUMP )
+    {
+        r_Op.Condition = ins.Jump.Condition;
+        r_Op.Flags = WideOp::WIDE_CHANGES_PC;
+        if( ins.Jump.OffsetRegister == REG_15 )
+        {
+            const int64_t offset = ins.Jump.ConstantData;
+            r_Op.Constant.u64 = (ins.Jump.PCRelative ? a_PC : 0) + (offset * sizeof(Instruction));
+            r_Op.Handler = WideUnit::sJumpTo[width][ins.Jump.Condition];
+        }
+        else
+        {
+            r_Op.Source = mRegisters[ins.Jump.OffsetRegister];
+            r_Op.Constant.s64 = ins.Jump.ConstantData;
+            r_Op.Handler = ins.Jump.PCRelative ? WideUnit::sJumpRelative[width][ins.Jump.Condition] : WideUnit::sJumpAbsolute[width][ins.Jump.Condition];
+        }
+        return;
+    }
+
+    const uint32_t opCode = ins.Standard.OpCode;
+    const WideOpHandler fast = WideUnit::sFastHandlers[width][opCode][ins.Standard.DataType];
+    const WideOpHandler handler = (mFloatPrecision == FLOAT_PRECISION_FAST && fast) ? fast : WideUnit::sHandlers[width][opCode][ins.Standard.DataType];
+    if( handler == nullptr || ins.Standard.SourceIsAddress || ins.Standard.DestIsAddress )
+    {
+        return;
+    }
+
+    // R15 as a source is the constant, converted for the float ops, and as a dest the scratch register.
+    const uint64_t constant = ins.Standard.ConstantData;
+    uint64_t immediate = constant;
+    if( WideUnit::sFloat[opCode] )
+    {
+        immediate = ins.Standard.DataType == DataType_DOUBLE ? ToBits<double>(static_cast<double>(constant)) : ToBits<float>(static_cast<float>(constant));
+    }
+
+    for( auto& value : r_Op.Immediate )
+    {
+        value = immediate;
+    }
+
+    r_Op.Constant.u64 = WideUnit::sConstantIsOperand[opCode] ? constant : 0;
+    r_Op.Source = ins.Standard.Source == REG_15 ? r_Op.Immediate : mRegisters[ins.Standard.Source];
+    r_Op.Dest = mRegisters[ins.Standard.Dest];
+    r_Op.Handler = handler;
+    r_Op.Flags = 0;
+}
+
+void WideCPU::ClearCode()
+{
+    mCode.clear();
+    mCodeMemoryPages.clear();
+    mLastCodePage = ~0ull;
+    mLastOps = nullptr;
+    mCodeChanged = false;
+}
+
+void WideCPU::LoadLane(uint32_t a_Lane)
+{
+    const MiniCPU& lane = *mLanes[a_Lane];
+    for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+    {
+        mRegisters[r][a_Lane] = lane.mRegisters[r].u64;
+    }
+    mFlagResult[a_Lane] = lane.mFlags.Result;
+    mFlagA[a_Lane] = lane.mFlags.A;
+    mFlagB[a_Lane] = lane.mFlags.B;
+    mFlagOperation[a_Lane] = lane.mFlags.Operation;
+    mFlagDataType[a_Lane] = lane.mFlags.DataType;
+    mPC[a_Lane] = lane.mPC;
+    mCycleCount[a_Lane] = lane.mCycleCount;
+}
+
+void WideCPU::StoreLane(uint32_t a_Lane)
+{
+    MiniCPU& lane = *mLanes[a_Lane];
+    for( uint32_t r = 0 ; r < NUMBER_REGISTERS ; r++ )
+    {
+        lane.mRegisters[r].u64 = mRegisters[r][a_Lane];
+    }
+    lane.mFlags.Result = mFlagResult[a_Lane];
+    lane.mFlags.A = mFlagA[a_Lane];
+    lane.mFlags.B = mFlagB[a_Lane];
+    lane.mFlags.Operation = static_cast<uint32_t>(mFlagOperation[a_Lane]);
+    lane.mFlags.DataType = static_cast<uint32_t>(mFlagDataType[a_Lane]);
+    lane.mPC = mPC[a_Lane];
+    lane.mCycleCount = mCycleCount[a_Lane];
+}
+
+bool WideCPU::HasSameCode(uint32_t a_Lane)const
+{
+    const GuestMemory& memory = mLanes[a_Lane]->GetMemory();
+    for( const uint64_t page : mCodeMemoryPages )
+    {
+        if( !memory.IsSharedWith(page,mImage) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,170 @@
+#ifndef __WIDE_CPU_H__
+#define __WIDE_CPU_H__
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "MiniCPU.h"
+
+class WideCPU;
+struct WideOp;
+typedef void (*WideOpHandler)(WideCPU& a_CPU,const WideOp& a_Op);
+
+/**
+ * @brief An instruction decoded once for all the lanes.
+ * Source and Dest point at a row of lane registers, or for R15 as a source at Immediate, the constant in every lane.
+ */
+struct alignas(64) WideOp
+{
+    enum Flags
+    {
+        WIDE_CHANGES_PC = 1,    // The handler moves the PC of each lane itself, JUMP and anything done per lane.
+        WIDE_SCALAR = 2         // Not done wide, each active lane runs it on its own MiniCPU.
+    };
+
+    WideOpHandler Handler;
+    const uint64_t* Source;
+    uint64_t* Dest;
+    Register Constant;      // Shifts and the LOAD value. The target for a JUMP using R15, else its signed offset.
+    uint64_t Offset;        // Address of the instruction, for a PC relative JUMP off a register.
+    uint32_t Flags;
+    uint32_t Condition;
+    uint64_t Immediate[16];
+};
+
+/**
+ * @brief Runs one program over many data sets at once, each in a lane with its own registers, flags, PC and memory.
+ * Lane n starts with R0 = n and R1 = the number of lanes, the same as the cores of a Multicore, so it can find its data.
+ *
+ * The registers are kept structure of arrays, a row of lanes per register, so ADD, MUL, FMUL, FSQRT and the rest of
+ * the register to register integer and float math are one loop over the lanes that the compiler turns into host SIMD.
+ * One dispatch does the instruction for every lane.
+ *
+ * While the lanes are at the same PC they run together. When a JUMP sends them different ways the lanes at the lowest
+ * PC run, the rest masked off, until they catch up with the others, which is where an if or a loop comes back together.
+ * Anything else, memory operands, the stack, PAUSE and so on, is done by each active lane on a MiniCPU of its own, which
+ * is also what holds the memory of the lane. If in a window of SPLIT_WINDOW instructions more than half were masked or
+ * done per lane, the lanes stop running together and from then on each is a MiniCPU run on its own.
+ *
+ * Interrupts are not checked while the lanes run together and code is decoded from the image given to LoadImage. Once a
+ * lane writes to a page that has code decoded, the code is decoded again and that page is done per lane.
+ */
+class WideCPU
+{
+public:
+    static const uint32_t MAX_LANES = 16;
+    static const uint64_t SPLIT_WINDOW = 4096;
+
+    struct Stats
+    {
+        uint64_t WideInstructions = 0;      // Dispatches that ran an instruction for all the active lanes at once.
+        uint64_t MaskedInstructions = 0;    // Of those, ones with some lanes masked off.
+        uint64_t ScalarInstructions = 0;    // Lane instructions done on the MiniCPU of a lane, while together.
+        bool Split = false;                 // The lanes went their own way and are each run on their own.
+    };
+
+    /**
+     * @brief a_Lanes is 4, 8 or 16.
+     */
+    WideCPU(uint32_t a_Lanes = 8);
+    ~WideCPU();
+
+    WideCPU(const WideCPU&) = delete;
+    WideCPU& operator=(const WideCPU&) = delete;
+
+    /**
+     * @brief Resets every lane, shares the pages of the image with them and sets the PC, R0 and R1.
+     */
+    void LoadImage(const GuestMemory& a_Image,uint64_t a_PC = 0);
+
+    /**
+     * @brief Lane n gets stream n of a_Seed.
+     */
+    void SetRandomSeed(uint64_t a_Seed);
+
+    /**
+     * @brief Sets it on every lane. With FLOAT_PRECISION_FAST FSIN, FCOS, FTAN and FATAN are done wide as well.
+     */
+    void SetFloatPrecision(FloatPrecision a_Precision);
+
+    /**
+     * @brief Runs every lane for a_MaxCycles instructions. Returns the instructions run over all the lanes.
+     * Throws if a lane does, the message says which.
+     */
+    uint64_t Run(uint64_t a_MaxCycles);
+
+    uint32_t GetSize()const{return mLaneCount;}
+
+    /**
+     * @brief The state of a lane, up to date between calls to Run. Registers set in it before Run are used.
+     */
+    MiniCPU& GetLane(uint32_t a_Lane){return *mLanes[a_Lane];}
+    const MiniCPU& GetLane(uint32_t a_Lane)const{return *mLanes[a_Lane];}
+
+    const Stats& GetStats()const{return mStats;}
+
+private:
+    friend struct WideUnit;
+
+    alignas(64) uint64_t mRegisters[NUMBER_REGISTERS][MAX_LANES];
+    alignas(64) uint64_t mActive[MAX_LANES];   // All ones for a lane that is running the instruction, else zero.
+
+    // LazyFlags, split into lanes.
+    alignas(64) uint64_t mFlagResult[MAX_LANES];
+    alignas(64) uint64_t mFlagA[MAX_LANES];
+    alignas(64) uint64_t mFlagB[MAX_LANES];
+    alignas(64) uint64_t mFlagOperation[MAX_LANES];
+    alignas(64) uint64_t mFlagDataType[MAX_LANES];
+
+    bool mAllActive = false;                    // Every lane is in mActive, the handlers need not keep any lane as it was.
+
+    uint32_t mFirstActive = 0;
+    uint64_t mPC[MAX_LANES];
+    uint64_t mCycleCount[MAX_LANES];
+
+    const uint32_t mLaneCount;
+    std::vector<std::unique_ptr<MiniCPU>> mLanes;
+    GuestMemory mImage;
+
+    std::unordered_map<uint64_t,std::unique_ptr<WideOp[]>> mCode;  // Keyed by address >> MiniCPU::CODE_PAGE_SHIFT.
+    std::unordered_set<uint64_t> mCodeMemoryPages;                  // Pages decoded wide, every lane had the page of the image.
+    uint64_t mLastCodePage = ~0ull;
+    WideOp* mLastOps = nullptr;
+    bool mCodeChanged = false;
+
+    FloatPrecision mFloatPrecision = FLOAT_PRECISION_EXACT;
+    bool mSplit = false;
+    Stats mStats;
+
+    inline const WideOp& GetOp(uint64_t a_PC);
+    WideOp* DecodePage(uint64_t a_CodePage);
+    void Decode(uint64_t a_PC,WideOp& r_Op);
+    void ClearCode();
+
+    /**
+     * @brief Runs the active lanes, all at a_PC, together until they part, they reach a_Stop or a_Steps have run.
+     * Returns the number run.
+     */
+    uint64_t RunTogether(uint64_t a_PC,uint64_t a_Steps,uint64_t a_Stop);
+
+    /**
+     * @brief Brings the PC and cycle count of the active lanes up to date.
+     */
+    void Flush(uint64_t a_PC,uint64_t a_Pending);
+
+    /**
+     * @brief Moving the state of a lane between its MiniCPU and the rows.
+     */
+    void LoadLane(uint32_t a_Lane);
+    void StoreLane(uint32_t a_Lane);
+
+    /**
+     * @brief False if the lane has written to a page that was decoded wide.
+     */
+    bool HasSameCode(uint32_t a_Lane)const;
+};
+
+#endif //__WIDE_CPU_H__